@@ -0,0 +1,96 @@
+use criterion::{black_box, criterion_group, criterion_main, Criterion, Throughput};
+
+use samaku::media::{dsp, AudioProperties};
+
+const SECONDS: usize = 10;
+
+fn properties(channels: u32, sample_rate: u32) -> AudioProperties {
+    AudioProperties {
+        is_float: false,
+        bytes_per_sample: 2,
+        bits_per_sample: 16,
+        sample_rate,
+        channels,
+        channel_layout: dsp::default_layout(channels.try_into().unwrap()),
+        num_samples: (SECONDS * sample_rate as usize) as i64,
+        start_time: 0.0,
+    }
+}
+
+/// Packed 16-bit noise, like BestSource would return it.
+fn source_audio(properties: &AudioProperties) -> Vec<u8> {
+    let mut state: u32 = 0x1234_5678;
+    (0..properties.num_samples as usize * properties.channels as usize)
+        .flat_map(|_| {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            (state as i16 / 4).to_ne_bytes()
+        })
+        .collect()
+}
+
+fn convert(converter: &mut dsp::Converter, audio: &[u8], output: &mut Vec<f32>) -> usize {
+    converter.seek(0);
+    output.clear();
+    for chunk in audio.chunks(2048 * converter.input_frame_size()) {
+        converter.process(chunk, output);
+    }
+    output.len()
+}
+
+fn dsp_benchmark(c: &mut Criterion) {
+    let mut group = c.benchmark_group("convert 10 s of audio");
+    group.sample_size(20);
+    group.throughput(Throughput::Elements(SECONDS as u64));
+
+    let cases = [
+        ("stereo 48 kHz passthrough", properties(2, 48000), 2, 48000),
+        ("stereo 44.1 → 48 kHz", properties(2, 44100), 2, 48000),
+        ("5.1 48 kHz → stereo", properties(6, 48000), 2, 48000),
+        ("5.1 44.1 → stereo 48 kHz", properties(6, 44100), 2, 48000),
+    ];
+
+    for (name, properties, channels, rate) in cases {
+        let audio = source_audio(&properties);
+        let mut converter = dsp::Converter::new(&properties, channels, rate).unwrap();
+        let mut output = Vec::with_capacity(SECONDS * rate as usize * usize::from(channels) * 2);
+        group.bench_function(name, |b| {
+            b.iter(|| convert(&mut converter, black_box(&audio), &mut output))
+        });
+    }
+
+    group.finish();
+}
+
+fn stretch_benchmark(c: &mut Criterion) {
+    let rate = 48000;
+    let properties = properties(2, rate);
+    let mut converter = dsp::Converter::new(&properties, 2, rate).unwrap();
+    let mut audio = vec![];
+    convert(&mut converter, &source_audio(&properties), &mut audio);
+
+    let mut group = c.benchmark_group("time stretch 10 s of stereo audio");
+    group.sample_size(10);
+    group.throughput(Throughput::Elements(SECONDS as u64));
+
+    for speed in [250, 500, 750, 1500, 2000] {
+        let mut stretcher = dsp::Stretcher::new(2, rate);
+        let mut output = Vec::with_capacity(audio.len() * 1000 / speed as usize + 4096);
+        group.bench_function(format!("{}%", speed / 10), |b| {
+            b.iter(|| {
+                stretcher.reset(speed);
+                output.clear();
+                for chunk in black_box(&audio).chunks(4096) {
+                    stretcher.process(chunk, &mut output);
+                }
+                output.len()
+            })
+        });
+    }
+
+    group.finish();
+}
+
+criterion_group!(dsp, dsp_benchmark, stretch_benchmark);
+criterion_main!(dsp);
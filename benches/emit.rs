@@ -0,0 +1,188 @@
+use std::borrow::Cow;
+
+use criterion::{black_box, criterion_group, criterion_main, Criterion};
+
+use smol::io::AsyncBufReadExt;
+
+use samaku::{media, nde, subtitle};
+
+const EVENT_COUNT: usize = 100_000;
+const SIGN_COUNT: usize = 300;
+const CONTEXT: subtitle::compile::Context = subtitle::compile::Context {
+    frame_rate: media::FrameRate {
+        numerator: 24000,
+        denominator: 1001,
+    },
+};
+
+fn large_file() -> subtitle::File {
+    let events = (0..EVENT_COUNT)
+        .map(|i| {
+            let i = i64::try_from(i).unwrap();
+            subtitle::Event {
+                start: subtitle::StartTime(i * 1000),
+                duration: subtitle::Duration(2500),
+                text: Cow::Owned(format!(
+                    r"{{\i1}}Sphinx of black quartz, judge my vow.\N{{\i0}}Line number {i}"
+                )),
+                actor: Cow::Borrowed("Sphinx"),
+                ..Default::default()
+            }
+        })
+        .collect();
+
+    subtitle::File {
+        events: subtitle::EventTrack::from_vec(events),
+        ..Default::default()
+    }
+}
+
+fn emit_benchmark(c: &mut Criterion) {
+    let file = large_file();
+    let path = std::env::temp_dir().join("samaku_emit_benchmark.ass");
+
+    let mut group = c.benchmark_group("emit 100k events");
+    group.sample_size(20);
+
+    // Formats all events on one thread, as a baseline for the parallel chunks
+    group.bench_function("into string", |b| {
+        b.iter(|| {
+            let mut data = String::new();
+            subtitle::emit(&mut data, black_box(&file), None).unwrap();
+            data
+        })
+    });
+    group.bench_function("chunks", |b| {
+        b.iter(|| subtitle::emit_chunks(black_box(&file), None).unwrap())
+    });
+    group.bench_function("save to disk", |b| {
+        b.iter(|| {
+            let chunks = subtitle::emit_chunks(black_box(&file), None).unwrap();
+            subtitle::write_atomically(&path, &chunks).unwrap();
+        })
+    });
+
+    group.finish();
+    std::fs::remove_file(&path).unwrap();
+}
+
+/// A file in which every event has its own copy of the same NDE filter, like when a typesetting
+/// filter has been pasted onto many signs.
+fn sign_heavy_file() -> String {
+    let mut extradata = subtitle::Extradata::new();
+    let events = (0..SIGN_COUNT)
+        .map(|i| {
+            let i = i64::try_from(i).unwrap();
+            let filter = nde::Filter {
+                name: "Sign".to_owned(),
+                graph: nde::Graph::from_single_intermediate(Box::new(nde::node::Italic)),
+            };
+            subtitle::Event {
+                start: subtitle::StartTime(i * 1000),
+                duration: subtitle::Duration(2500),
+                text: Cow::Borrowed("Sign text"),
+                extradata_ids: vec![extradata.push_filter(filter)],
+                ..Default::default()
+            }
+        })
+        .collect();
+
+    let file = subtitle::File {
+        events: subtitle::EventTrack::from_vec(events),
+        extradata,
+        ..Default::default()
+    };
+
+    let mut data = String::new();
+    subtitle::emit(&mut data, &file, None).unwrap();
+    data
+}
+
+fn parse(data: &str) -> subtitle::File {
+    smol::block_on(async {
+        subtitle::File::parse(smol::io::BufReader::new(data.as_bytes()).lines()).await
+    })
+    .unwrap()
+    .0
+}
+
+fn sign_heavy_benchmark(c: &mut Criterion) {
+    let data = sign_heavy_file();
+    let file = parse(&data);
+    let stats = file.extradata.filter_stats();
+    println!(
+        "Sign-heavy file: {} bytes, {} filter entries, {} unique",
+        data.len(),
+        stats.entries,
+        stats.unique
+    );
+
+    let mut group = c.benchmark_group("sign-heavy file");
+    group.bench_function("load", |b| b.iter(|| parse(black_box(&data))));
+    group.bench_function("load and compile", |b| {
+        b.iter(|| {
+            let file = parse(black_box(&data));
+            file.events
+                .compile(&file.extradata, &CONTEXT, 0, None)
+                .len()
+        })
+    });
+    group.bench_function("save", |b| {
+        b.iter(|| subtitle::emit_chunks(black_box(&file), None).unwrap())
+    });
+    group.finish();
+}
+
+fn cache_benchmark(c: &mut Criterion) {
+    let mut data = String::new();
+    subtitle::emit(&mut data, &large_file(), None).unwrap();
+    let file = parse(&data);
+    let source_hash = subtitle::cache::source_hash(data.as_bytes());
+    let compiled = file.events.compile(&file.extradata, &CONTEXT, 0, None);
+
+    let directory = std::env::temp_dir().join("samaku_cache_benchmark");
+    std::fs::create_dir_all(&directory).unwrap();
+    let path = directory.join("benchmark.ass");
+    let cache_data = subtitle::cache::build(source_hash, &file.events, Some((&compiled, &CONTEXT)));
+    subtitle::cache::write(&path, &cache_data).unwrap();
+
+    let mut group = c.benchmark_group("open 100k events");
+    group.sample_size(20);
+
+    group.bench_function("parse and compile", |b| {
+        b.iter(|| {
+            let file = parse(black_box(&data));
+            file.events
+                .compile(&file.extradata, &CONTEXT, 0, None)
+                .len()
+        })
+    });
+    group.bench_function("compiled events from cache", |b| {
+        b.iter(|| {
+            let hash = subtitle::cache::source_hash(black_box(data.as_bytes()));
+            let cache = subtitle::cache::Cache::open(&path, hash).unwrap();
+            cache.compiled(&CONTEXT).unwrap().len()
+        })
+    });
+    group.bench_function("source events from cache", |b| {
+        b.iter(|| {
+            let cache = subtitle::cache::Cache::open(&path, source_hash).unwrap();
+            cache.events().unwrap().len()
+        })
+    });
+    group.bench_function("build cache", |b| {
+        b.iter(|| {
+            subtitle::cache::build(
+                source_hash,
+                black_box(&file.events),
+                Some((&compiled, &CONTEXT)),
+            )
+        })
+    });
+
+    group.finish();
+    std::fs::remove_dir_all(&directory).unwrap();
+}
+
+criterion_group!(emit, emit_benchmark, sign_heavy_benchmark, cache_benchmark);
+criterion_main!(emit);
@@ -0,0 +1,63 @@
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+
+use samaku::media::motion::{Model, Point, Region, TrackResult, Tracker};
+use samaku::media::Video;
+use samaku::model::FrameNumber;
+
+const VIDEO_FILE: &str = concat!(env!("CARGO_MANIFEST_DIR"), "/test_files/cube_av1.mkv");
+
+const FRAMES: i32 = 30;
+
+/// Markers around the one tracked in the `motion_track` test, which all follow the cube's motion.
+fn markers(count: usize) -> Vec<Region> {
+    (0..count)
+        .map(|index| {
+            let offset = (index % 4) as f64 * 3.0 - 4.5;
+            Region::from_center_and_radius(
+                Point {
+                    x: 272.0 + offset,
+                    y: 81.0 - offset,
+                },
+                10.0,
+            )
+        })
+        .collect()
+}
+
+fn track(video: &Video, initial_markers: Vec<Region>) -> TrackResult {
+    let mut tracker = Tracker::new(
+        video,
+        Video::get_libmv_patch,
+        initial_markers,
+        60.0,
+        FrameNumber(0),
+        FrameNumber(FRAMES),
+    );
+
+    let mut last_result = TrackResult::Success;
+    while last_result == TrackResult::Success {
+        last_result = tracker.update(Model::Translation);
+    }
+    last_result
+}
+
+fn motion_benchmark(c: &mut Criterion) {
+    let video = Video::load(VIDEO_FILE).unwrap();
+
+    let mut group = c.benchmark_group("track markers");
+    group.sample_size(10);
+
+    for count in [1, 2, 4, 8, 16] {
+        group.throughput(Throughput::Elements(count as u64 * FRAMES as u64));
+        group.bench_with_input(BenchmarkId::from_parameter(count), &count, |b, &count| {
+            b.iter(|| {
+                assert_eq!(track(&video, markers(count)), TrackResult::Termination);
+            })
+        });
+    }
+
+    group.finish();
+}
+
+criterion_group!(motion, motion_benchmark);
+criterion_main!(motion);
@@ -0,0 +1,74 @@
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+
+use samaku::media::{proxy, Video, VideoCoreBudget};
+use samaku::model::FrameNumber;
+
+const VIDEO_FILE: &str = concat!(env!("CARGO_MANIFEST_DIR"), "/test_files/cube_h264.mkv");
+
+const SEEKS: usize = 30;
+
+/// Frame numbers in a fixed pseudo-random order, like when scrubbing back and forth.
+fn random_frames(num_frames: u32) -> Vec<FrameNumber> {
+    let mut state: u32 = 0x1234_5678;
+    (0..SEEKS)
+        .map(|_| {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            FrameNumber((state % num_frames) as i32)
+        })
+        .collect()
+}
+
+fn seek_benchmark(c: &mut Criterion) {
+    let mut video = Video::load(VIDEO_FILE).unwrap();
+
+    // The test video is too small to get a proxy by default, so make one at half its size
+    let dimensions = proxy::Dimensions {
+        width: (video.metadata.width / 2) as u32 & !1,
+        height: (video.metadata.height / 2) as u32 & !1,
+        num_frames: video.metadata.num_frames as u32,
+    };
+    let proxy_path =
+        std::env::temp_dir().join(format!("samaku-bench-proxy-{}.proxy", std::process::id()));
+    let _ = std::fs::remove_file(&proxy_path);
+
+    video.prepare_proxy(dimensions).unwrap();
+    let mut writer = proxy::Writer::open(&proxy_path, dimensions).unwrap();
+    while let Some(frame) = writer.next_missing(FrameNumber(0)) {
+        writer
+            .add_frame(frame, &video.get_proxy_rgb(frame))
+            .unwrap();
+    }
+    let mut reader = proxy::Reader::open(&proxy_path).unwrap();
+
+    // Keep the core from caching frames across iterations, so every seek decodes
+    video.set_core_budget(VideoCoreBudget::for_system(0, &video.metadata));
+    let frames = random_frames(dimensions.num_frames);
+
+    let mut group = c.benchmark_group("random seek");
+    group.sample_size(10);
+    group.throughput(Throughput::Elements(SEEKS as u64));
+
+    group.bench_function(BenchmarkId::from_parameter("source"), |b| {
+        b.iter(|| {
+            for frame in &frames {
+                criterion::black_box(video.get_iced_frame(*frame));
+            }
+        });
+    });
+
+    group.bench_function(BenchmarkId::from_parameter("proxy"), |b| {
+        b.iter(|| {
+            for frame in &frames {
+                criterion::black_box(reader.read_iced_frame(*frame).unwrap().unwrap());
+            }
+        });
+    });
+
+    group.finish();
+    let _ = std::fs::remove_file(&proxy_path);
+}
+
+criterion_group!(proxy_seek, seek_benchmark);
+criterion_main!(proxy_seek);
@@ -0,0 +1,41 @@
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+
+use samaku::media::{scene_change, Video};
+
+const VIDEO_FILE: &str = concat!(env!("CARGO_MANIFEST_DIR"), "/test_files/cube_h264.mkv");
+
+fn scene_change_benchmark(c: &mut Criterion) {
+    let video = Video::load(VIDEO_FILE).unwrap();
+    let num_frames = video.metadata.num_frames;
+    let available = std::thread::available_parallelism().map_or(1, usize::from);
+    let cancelled = std::sync::atomic::AtomicBool::new(false);
+
+    let mut group = c.benchmark_group("detect keyframes");
+    group.sample_size(10);
+    group.throughput(Throughput::Elements(num_frames as u64));
+
+    // Frames stay in the core's cache across iterations, so this mostly measures thumbnailing and
+    // comparison, not decoding
+    for threads in [1, available] {
+        group.bench_with_input(
+            BenchmarkId::from_parameter(format!("{threads} threads")),
+            &threads,
+            |b, threads| {
+                b.iter(|| {
+                    scene_change::detect(
+                        &video,
+                        Video::get_luma_thumbnail,
+                        0..num_frames,
+                        *threads,
+                        &cancelled,
+                    )
+                });
+            },
+        );
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, scene_change_benchmark);
+criterion_main!(benches);
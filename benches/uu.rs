@@ -0,0 +1,67 @@
+use criterion::{black_box, criterion_group, criterion_main, Criterion, Throughput};
+
+use smol::io::AsyncBufReadExt;
+
+use samaku::subtitle;
+
+const FONT_SIZE: usize = 20 * 1024 * 1024;
+
+/// Pseudorandom data standing in for a large font, which compresses about as badly.
+fn font_data() -> Vec<u8> {
+    let mut state: u64 = 0x9e37_79b9_7f4a_7c15;
+    (0..FONT_SIZE)
+        .map(|_| {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            state.to_le_bytes()[0]
+        })
+        .collect()
+}
+
+/// A subtitle file with the given data attached as a font, split into lines like Aegisub does.
+fn file_with_font(encoded: &str) -> String {
+    let mut data = "[Script Info]\nScriptType: v4.00+\n\n[Fonts]\nfontname: big_0.ttf\n".to_owned();
+    for line in encoded.as_bytes().chunks(80) {
+        data.push_str(std::str::from_utf8(line).unwrap());
+        data.push('\n');
+    }
+    data.push('\n');
+    data
+}
+
+fn uu_benchmark(c: &mut Criterion) {
+    let font = font_data();
+    let encoded = subtitle::uu::encode(&font);
+
+    let file = smol::block_on(async {
+        let data = file_with_font(&encoded);
+        subtitle::File::parse(smol::io::BufReader::new(data.as_bytes()).lines()).await
+    })
+    .unwrap()
+    .0;
+    let attachment = &file.attachments[0];
+
+    let mut group = c.benchmark_group("uu 20 MB font");
+    group.sample_size(20);
+    group.throughput(Throughput::Bytes(FONT_SIZE as u64));
+
+    group.bench_function("encode", |b| {
+        b.iter(|| subtitle::uu::encode(black_box(&font)))
+    });
+    group.bench_function("decode", |b| {
+        b.iter(|| subtitle::uu::decode(black_box(&encoded)).unwrap())
+    });
+    group.bench_function("decode attachment into reused buffer", |b| {
+        let mut buffer = Vec::with_capacity(FONT_SIZE);
+        b.iter(|| {
+            black_box(attachment).decode_into(&mut buffer).unwrap();
+            buffer.len()
+        })
+    });
+
+    group.finish();
+}
+
+criterion_group!(uu, uu_benchmark);
+criterion_main!(uu);
@@ -0,0 +1,37 @@
+use criterion::{criterion_group, criterion_main, BatchSize, Criterion};
+
+use samaku::media::{IndexCache, Video};
+
+const VIDEO_FILE: &str = concat!(env!("CARGO_MANIFEST_DIR"), "/test_files/cube_h264.mkv");
+
+fn load_benchmark(c: &mut Criterion) {
+    let cache_dir =
+        std::env::temp_dir().join(format!("samaku-bench-index-cache-{}", std::process::id()));
+    let cache = IndexCache::new(cache_dir.clone(), IndexCache::DEFAULT_MAX_BYTES);
+
+    let mut group = c.benchmark_group("load video");
+    group.sample_size(10);
+
+    // Every load has to index the file first
+    group.bench_function("cold", |b| {
+        b.iter_batched(
+            || {
+                let _ = std::fs::remove_dir_all(&cache_dir);
+            },
+            |()| Video::load_with_index_cache(VIDEO_FILE, &cache).unwrap(),
+            BatchSize::PerIteration,
+        );
+    });
+
+    // The index from the previous load is reused
+    Video::load_with_index_cache(VIDEO_FILE, &cache).unwrap();
+    group.bench_function("warm", |b| {
+        b.iter(|| Video::load_with_index_cache(VIDEO_FILE, &cache).unwrap());
+    });
+
+    group.finish();
+    let _ = std::fs::remove_dir_all(&cache_dir);
+}
+
+criterion_group!(video_load, load_benchmark);
+criterion_main!(video_load);
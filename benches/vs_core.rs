@@ -0,0 +1,81 @@
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+
+use samaku::media::{Video, VideoCoreBudget};
+use samaku::model::FrameNumber;
+
+const VIDEO_FILE: &str = concat!(env!("CARGO_MANIFEST_DIR"), "/test_files/cube_h264.mkv");
+
+const FRAMES: i32 = 60;
+
+/// Frame numbers in a fixed pseudo-random order, like when jumping around the timeline.
+fn random_frames() -> Vec<FrameNumber> {
+    let mut state: u32 = 0x1234_5678;
+    (0..FRAMES)
+        .map(|_| {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            FrameNumber((state % FRAMES as u32) as i32)
+        })
+        .collect()
+}
+
+fn fetch(video: &Video, frames: &[FrameNumber]) {
+    for frame in frames {
+        criterion::black_box(video.get_iced_frame(*frame));
+    }
+}
+
+fn core_benchmark(c: &mut Criterion) {
+    let video = Video::load(VIDEO_FILE).unwrap();
+
+    let sequential: Vec<FrameNumber> = (0..FRAMES).map(FrameNumber).collect();
+    let random = random_frames();
+
+    let available = std::thread::available_parallelism().map_or(1, usize::from);
+    let policy = VideoCoreBudget::for_system(VideoCoreBudget::PLAYBACK_MEMORY, &video.metadata);
+    let minimal_cache = VideoCoreBudget::for_system(0, &video.metadata);
+    let single_thread = |budget| VideoCoreBudget {
+        threads: 1,
+        ..budget
+    };
+
+    // Frames stay cached across iterations, so with a large enough cache, repeated fetches only
+    // measure the cache lookup and the conversion to iced's format
+    let settings = [
+        ("1 thread, minimal cache", single_thread(minimal_cache)),
+        ("1 thread", single_thread(policy)),
+        ("policy, minimal cache", minimal_cache),
+        ("policy", policy),
+        (
+            "all threads",
+            VideoCoreBudget {
+                threads: available as i32,
+                ..policy
+            },
+        ),
+    ];
+
+    for (name, frames) in [("sequential fetch", &sequential), ("random fetch", &random)] {
+        let mut group = c.benchmark_group(name);
+        group.sample_size(10);
+        group.throughput(Throughput::Elements(FRAMES as u64));
+
+        for (setting, budget) in settings {
+            let info = video.set_core_budget(budget);
+            let id = format!(
+                "{setting} ({} threads, {} MiB)",
+                info.num_threads,
+                info.max_framebuffer_size >> 20
+            );
+            group.bench_function(BenchmarkId::from_parameter(id), |b| {
+                b.iter(|| fetch(&video, frames))
+            });
+        }
+
+        group.finish();
+    }
+}
+
+criterion_group!(vs_core, core_benchmark);
+criterion_main!(vs_core);
@@ -29,6 +29,10 @@ pub(crate) fn handle_key_press(modifiers: Modifiers, key_code: KeyCode) -> Optio
         KeyCode::Left => Some(Message::PlaybackAdvanceSeconds(-1.0)),
         KeyCode::Right => Some(Message::PlaybackAdvanceSeconds(1.0)),
         KeyCode::Space => Some(Message::TogglePlayback),
+        KeyCode::P => Some(Message::PlaySelection),
+        KeyCode::L => Some(Message::LoopSelection),
+        KeyCode::LBracket => Some(Message::StepPlaybackSpeed(-1)),
+        KeyCode::RBracket => Some(Message::StepPlaybackSpeed(1)),
         KeyCode::Plus => Some(Message::AddEvent),
         _ => None,
     }
@@ -142,7 +142,7 @@ pub fn run() -> iced::Result {
         },
         default_text_size: 16.0,
         antialiasing: false,
-        exit_on_close_request: true,
+        exit_on_close_request: false,
     })
 }
 
@@ -172,10 +172,33 @@ pub struct Samaku {
     /// Metadata of the currently loaded video, if and only if any is loaded.
     pub video_metadata: Option<media::VideoMetadata>,
 
+    /// Stage of loading a video, if one is currently being loaded.
+    pub video_load_stage: Option<media::VideoLoadStage>,
+
+    /// First frame of the video that is being loaded, if it could be decoded before indexing.
+    pub video_preview: Option<iced::widget::image::Handle>,
+
+    /// Path of the currently loaded video, if any.
+    pub video_path: Option<std::path::PathBuf>,
+
+    /// Keyframes of the currently loaded video, which timing can snap to. Empty if no video is
+    /// loaded.
+    pub keyframes: model::keyframes::Keyframes,
+
     /// Currently loaded subtitles. Will contain some useful defaults if nothing has been loaded
     /// yet.
     pub subtitles: subtitle::File,
 
+    /// Path the subtitles were loaded from or last saved to, if any.
+    pub subtitle_path: Option<std::path::PathBuf>,
+
+    /// Journal of edits made since the subtitles were last saved, if they have a path.
+    pub journal: Option<subtitle::journal::Journal>,
+
+    /// Binary cache of the subtitle file as it was opened. Its compiled events are used for
+    /// rendering until the subtitles are first modified.
+    pub project_cache: Option<subtitle::cache::Cache>,
+
     /// Indices of currently selected events. May be any length, or empty if no event is currently
     /// selected.
     pub selected_event_indices: HashSet<subtitle::EventIndex>,
@@ -291,7 +314,14 @@ impl Application for Samaku {
             workers: workers::Workers::spawn_all(&shared_state),
             actual_frame: None,
             video_metadata: None,
+            video_load_stage: None,
+            video_preview: None,
+            video_path: None,
+            keyframes: model::keyframes::Keyframes::default(),
             subtitles: subtitle::File::default(),
+            subtitle_path: None,
+            journal: None,
+            project_cache: None,
             selected_event_indices: HashSet::new(),
             shared: shared_state,
             view: RefCell::new(ViewState {
@@ -418,6 +448,9 @@ impl Application for Samaku {
                     modifiers,
                     key_code,
                 }) => keyboard::handle_key_press(modifiers, key_code),
+                Event::Window(iced::window::Event::CloseRequested) => {
+                    Some(message::Message::CloseRequested)
+                }
                 _ => None,
             }
         });
@@ -438,7 +471,17 @@ impl Application for Samaku {
             },
         );
 
-        Subscription::batch(vec![events, worker_messages])
+        let mut subscriptions = vec![events, worker_messages];
+
+        // While an edit journal is open, periodically make sure its records get synced to disk
+        if self.journal.is_some() {
+            subscriptions.push(
+                iced::time::every(subtitle::journal::SYNC_INTERVAL)
+                    .map(|_| message::Message::SyncJournal),
+            );
+        }
+
+        Subscription::batch(subscriptions)
     }
 }
 
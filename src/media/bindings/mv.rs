@@ -195,6 +195,31 @@ impl Region {
             center: self.center.offset(x_offset, y_offset),
         }
     }
+
+    /// Multiplies the coordinates of all points by the given factor.
+    #[must_use]
+    pub fn scale(&self, factor: f64) -> Self {
+        let (x, y) = self.as_float_slices();
+        Self::from_float_slices(&x.map(|x| x * factor), &y.map(|y| y * factor))
+    }
+
+    /// The largest distance of any corner from the center, along either axis.
+    #[must_use]
+    pub fn extent(&self) -> f64 {
+        [
+            self.top_left,
+            self.top_right,
+            self.bottom_right,
+            self.bottom_left,
+        ]
+        .iter()
+        .map(|corner| {
+            (corner.x - self.center.x)
+                .abs()
+                .max((corner.y - self.center.y).abs())
+        })
+        .fold(0.0, f64::max)
+    }
 }
 
 /// Tracks the region defined by `region1` on `image1` onto `image2`.
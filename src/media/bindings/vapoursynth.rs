@@ -145,6 +145,43 @@ impl Core {
         }
     }
 
+    /// Sets the number of threads the core uses to process frames. Zero selects the number of
+    /// logical cores. Returns the number of threads actually in use afterwards.
+    pub fn set_thread_count(&mut self, threads: i32) -> i32 {
+        self.check_null();
+        let api = get_api();
+        unsafe { (*api).setThreadCount.unwrap()(threads, self.core) }
+    }
+
+    /// Sets the maximum number of bytes the core keeps in its frame caches. Returns the new
+    /// maximum, which may differ from the requested one if it was out of range.
+    pub fn set_max_cache_size(&mut self, bytes: i64) -> i64 {
+        self.check_null();
+        let api = get_api();
+        unsafe { (*api).setMaxCacheSize.unwrap()(bytes, self.core) }
+    }
+
+    pub fn get_info(&self) -> CoreInfo {
+        self.check_null();
+        let api = get_api();
+        let mut info = std::mem::MaybeUninit::<vs::VSCoreInfo>::uninit();
+        let info = unsafe {
+            (*api).getCoreInfo.unwrap()(self.core, info.as_mut_ptr());
+            info.assume_init()
+        };
+
+        CoreInfo {
+            version: unsafe { CStr::from_ptr(info.versionString) }
+                .to_string_lossy()
+                .into_owned(),
+            core_version: info.core,
+            api_version: info.api,
+            num_threads: info.numThreads,
+            max_framebuffer_size: info.maxFramebufferSize,
+            used_framebuffer_size: info.usedFramebufferSize,
+        }
+    }
+
     pub fn free(&mut self) {
         let api = get_api();
         unsafe {
@@ -158,6 +195,16 @@ impl Core {
     }
 }
 
+#[derive(Debug, Clone)]
+pub struct CoreInfo {
+    pub version: String,
+    pub core_version: i32,
+    pub api_version: i32,
+    pub num_threads: i32,
+    pub max_framebuffer_size: i64,
+    pub used_framebuffer_size: i64,
+}
+
 pub struct Script {
     script: *mut vs::VSScript,
 }
@@ -561,6 +608,17 @@ impl VideoInfo<'_> {
         }
     }
 
+    /// If the video is YUV or greyscale with integer samples of at most 16 bits, returns the
+    /// number of bits per sample of its first (luma) plane.
+    pub fn integer_luma_bits(&self) -> Option<i32> {
+        let format = unsafe { *self.vi }.format;
+        let has_luma = format.colorFamily == vs::VSColorFamily::cfYUV as i32
+            || format.colorFamily == vs::VSColorFamily::cfGray as i32;
+        (has_luma && format.sampleType == vs::VSSampleType::stInteger as i32)
+            .then_some(format.bitsPerSample)
+            .filter(|bits| (8..=16).contains(bits))
+    }
+
     pub fn get_width(&self) -> i32 {
         unsafe { *self.vi }.width
     }
@@ -569,6 +627,10 @@ impl VideoInfo<'_> {
         unsafe { *self.vi }.height
     }
 
+    pub fn get_num_frames(&self) -> i32 {
+        unsafe { *self.vi }.numFrames
+    }
+
     fn get_color_family(&self) -> i32 {
         unsafe { *self.vi }.format.colorFamily
     }
@@ -807,6 +869,14 @@ pub fn color_matrix_description(vi: &VideoInfo, props: &ConstMap) -> String {
     ret
 }
 
+/// Whether the frame properties indicate full range (“PC”) samples. Unlike limited range, this
+/// needs to be specified explicitly.
+pub fn is_full_range(props: &ConstMap) -> bool {
+    props
+        .get_int(CString::new("_ColorRange").unwrap().as_c_str(), 0)
+        .is_ok_and(|range| range == vs::VSColorRange::VSC_RANGE_FULL as i64)
+}
+
 pub fn init_resize(vi: &VideoInfo, args: &mut MutMap, props: &ConstMap) {
     args.append_int(
         CString::new("format").unwrap().as_c_str(),
@@ -864,7 +934,13 @@ pub fn init_resize(vi: &VideoInfo, args: &mut MutMap, props: &ConstMap) {
 
 const PRELUDE: &str = include_str!("../default_scripts/prelude.py");
 
-pub fn open_script<P: AsRef<Path>>(script_code: &str, filename: P) -> Option<Script> {
+/// Evaluates the given script for the given file. Scripts that index the file should store the
+/// index in `index_file`, and other cache files next to it.
+pub fn open_script<P: AsRef<Path>, Q: AsRef<Path>>(
+    script_code: &str,
+    filename: P,
+    index_file: Q,
+) -> Option<Script> {
     let mut core = Core::create_core(0).unwrap();
     let Some(mut script) = core.create_script() else {
         // This matches how it's done in aegi, where a core is only ever specifically freed
@@ -880,10 +956,12 @@ pub fn open_script<P: AsRef<Path>>(script_code: &str, filename: P) -> Option<Scr
     let mut map_owned = OwnedMap::create_map().unwrap();
     let map = map_owned.as_mut();
     map.set_path(c_string("filename").as_c_str(), filename);
+    let index_file = index_file.as_ref();
     map.set_path(
         c_string("__aegi_vscache").as_c_str(),
-        Path::new("./vscache/"),
+        index_file.parent().unwrap_or(Path::new(".")),
     );
+    map.set_path(c_string("__samaku_lwi_cachefile").as_c_str(), index_file);
     map.set_utf8(
         c_string("__aegi_vsplugins").as_c_str(),
         c_string("").as_c_str(),
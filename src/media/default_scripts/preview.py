@@ -0,0 +1,11 @@
+# This script opens an MP4 or MOV file using LibavSMASHSource, which reads the container's own
+# sample table instead of indexing the file, so that a frame can be shown while it is indexed.
+# It requires the `lsmas` plugin.
+
+import vapoursynth as vs
+import aegisub_vs as a
+a.set_paths(locals())
+
+a.ensure_plugin("lsmas", "libvslsmashsource", "To preview videos, the `lsmas` plugin for VapourSynth must be installed")
+clip = vs.core.lsmas.LibavSMASHSource(source=filename)
+clip.set_output()
@@ -7,7 +7,7 @@ import time
 import aegisub_vs as a
 a.set_paths(locals())
 
-clip, videoinfo = a.wrap_lwlibavsource(filename)
+clip, videoinfo = a.wrap_lwlibavsource(filename, cachefile=__samaku_lwi_cachefile)
 clip.set_output()
 __aegi_timecodes = videoinfo["timecodes"]
 __aegi_keyframes = videoinfo["keyframes"]
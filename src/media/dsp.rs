@@ -0,0 +1,875 @@
+//! Conversion of decoded audio into the format the audio device expects: sample format
+//! conversion to `f32`, channel up/down-mixing, and sample rate conversion using a polyphase
+//! windowed-sinc filter. Also contains a time stretcher for playback at different speeds.
+//!
+//! The inner loops work on fixed-size chunks of 8 samples with independent accumulators, which
+//! the compiler can turn into SIMD instructions on any target without us having to write
+//! architecture-specific code.
+
+use std::f64::consts::PI;
+use std::mem::size_of;
+
+use super::AudioProperties;
+
+/// Number of filter taps per resampler phase. Needs to be a multiple of [`LANES`].
+const TAPS: usize = 32;
+
+/// Maximum number of precomputed filter phases. Conversions between rates whose ratio needs
+/// more phases than this use the nearest precomputed phase instead.
+const MAX_PHASES: u64 = 256;
+
+/// Fraction of the lower of the two Nyquist frequencies that is let through by the resampling
+/// filter. Leaves room for the transition band, so that little aliasing occurs.
+const PASSBAND: f64 = 0.9;
+
+/// Chunk size for the vectorisable loops.
+const LANES: usize = 8;
+
+/// Length of the segments the time stretcher splices together.
+const STRETCH_WINDOW_MILLIS: u32 = 20;
+
+/// Speeds are given in thousandths.
+pub const UNITY_SPEED: u32 = 1000;
+
+/// Channel position bits, as used in FFmpeg's (and therefore BestSource's) channel layouts.
+/// Interleaved samples are ordered by ascending bit.
+pub mod channel {
+    pub const FRONT_LEFT: u64 = 0x1;
+    pub const FRONT_RIGHT: u64 = 0x2;
+    pub const FRONT_CENTER: u64 = 0x4;
+    pub const LOW_FREQUENCY: u64 = 0x8;
+    pub const BACK_LEFT: u64 = 0x10;
+    pub const BACK_RIGHT: u64 = 0x20;
+    pub const FRONT_LEFT_OF_CENTER: u64 = 0x40;
+    pub const FRONT_RIGHT_OF_CENTER: u64 = 0x80;
+    pub const BACK_CENTER: u64 = 0x100;
+    pub const SIDE_LEFT: u64 = 0x200;
+    pub const SIDE_RIGHT: u64 = 0x400;
+}
+
+/// Returns the channel layout that is assumed for a source or device that has the given number
+/// of channels but does not specify a layout. These match the WAVE channel orders, which most
+/// audio backends use.
+#[must_use]
+pub fn default_layout(channels: u16) -> u64 {
+    use channel::{
+        BACK_CENTER, BACK_LEFT, BACK_RIGHT, FRONT_CENTER, FRONT_LEFT, FRONT_RIGHT, LOW_FREQUENCY,
+        SIDE_LEFT, SIDE_RIGHT,
+    };
+    match channels {
+        1 => FRONT_CENTER,
+        2 => FRONT_LEFT | FRONT_RIGHT,
+        3 => FRONT_LEFT | FRONT_RIGHT | FRONT_CENTER,
+        4 => FRONT_LEFT | FRONT_RIGHT | BACK_LEFT | BACK_RIGHT,
+        5 => FRONT_LEFT | FRONT_RIGHT | FRONT_CENTER | BACK_LEFT | BACK_RIGHT,
+        6 => FRONT_LEFT | FRONT_RIGHT | FRONT_CENTER | LOW_FREQUENCY | BACK_LEFT | BACK_RIGHT,
+        7 => {
+            FRONT_LEFT
+                | FRONT_RIGHT
+                | FRONT_CENTER
+                | LOW_FREQUENCY
+                | BACK_CENTER
+                | SIDE_LEFT
+                | SIDE_RIGHT
+        }
+        8 => {
+            FRONT_LEFT
+                | FRONT_RIGHT
+                | FRONT_CENTER
+                | LOW_FREQUENCY
+                | BACK_LEFT
+                | BACK_RIGHT
+                | SIDE_LEFT
+                | SIDE_RIGHT
+        }
+        other => u64::MAX >> (64 - u32::from(other.clamp(1, 64))),
+    }
+}
+
+/// Sample formats BestSource can output.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum SampleFormat {
+    U8,
+    I16,
+    I32,
+    F32,
+    F64,
+}
+
+impl SampleFormat {
+    #[must_use]
+    pub fn from_properties(properties: &AudioProperties) -> Option<Self> {
+        const U8_SIZE: usize = size_of::<u8>();
+        const I16_SIZE: usize = size_of::<i16>();
+        const I32_SIZE: usize = size_of::<i32>();
+        const F32_SIZE: usize = size_of::<f32>();
+        const F64_SIZE: usize = size_of::<f64>();
+
+        match (properties.is_float, properties.bytes_per_sample) {
+            (false, U8_SIZE) => Some(Self::U8),
+            (false, I16_SIZE) => Some(Self::I16),
+            (false, I32_SIZE) => Some(Self::I32),
+            (true, F32_SIZE) => Some(Self::F32),
+            (true, F64_SIZE) => Some(Self::F64),
+            _ => None,
+        }
+    }
+
+    #[must_use]
+    pub const fn bytes_per_sample(self) -> usize {
+        match self {
+            Self::U8 => size_of::<u8>(),
+            Self::I16 => size_of::<i16>(),
+            Self::I32 => size_of::<i32>(),
+            Self::F32 => size_of::<f32>(),
+            Self::F64 => size_of::<f64>(),
+        }
+    }
+}
+
+/// Converts the given raw, native-endian samples to `f32` in the range [-1, 1] and appends them
+/// to `output`. Integer samples with fewer significant bits than their container are expected to
+/// be stored in the upper bits, as FFmpeg does.
+#[allow(clippy::cast_precision_loss, clippy::cast_possible_truncation)]
+pub fn convert_to_f32(format: SampleFormat, bytes: &[u8], output: &mut Vec<f32>) {
+    output.reserve(bytes.len() / format.bytes_per_sample());
+    match format {
+        SampleFormat::U8 => output.extend(
+            bytes
+                .iter()
+                .map(|&sample| (f32::from(sample) - 128.0) * (1.0 / 128.0)),
+        ),
+        SampleFormat::I16 => output.extend(bytes.chunks_exact(size_of::<i16>()).map(|sample| {
+            f32::from(i16::from_ne_bytes(sample.try_into().unwrap())) * (1.0 / 32768.0)
+        })),
+        SampleFormat::I32 => output.extend(bytes.chunks_exact(size_of::<i32>()).map(|sample| {
+            i32::from_ne_bytes(sample.try_into().unwrap()) as f32 * (1.0 / 2_147_483_648.0)
+        })),
+        SampleFormat::F32 => output.extend(
+            bytes
+                .chunks_exact(size_of::<f32>())
+                .map(|sample| f32::from_ne_bytes(sample.try_into().unwrap())),
+        ),
+        SampleFormat::F64 => output.extend(
+            bytes
+                .chunks_exact(size_of::<f64>())
+                .map(|sample| f64::from_ne_bytes(sample.try_into().unwrap()) as f32),
+        ),
+    }
+}
+
+/// Dot product of two slices whose length is a multiple of [`LANES`].
+fn dot(left: &[f32], right: &[f32]) -> f32 {
+    let mut accumulators = [0.0_f32; LANES];
+    for (left, right) in left.chunks_exact(LANES).zip(right.chunks_exact(LANES)) {
+        let left: &[f32; LANES] = left.try_into().unwrap();
+        let right: &[f32; LANES] = right.try_into().unwrap();
+        for (accumulator, (left, right)) in accumulators.iter_mut().zip(left.iter().zip(right)) {
+            *accumulator += left * right;
+        }
+    }
+    accumulators.iter().sum()
+}
+
+/// Mixes interleaved audio from one channel layout into another, using a fixed gain matrix.
+#[derive(Debug, Clone)]
+pub struct Mixer {
+    input_channels: usize,
+    output_channels: usize,
+
+    /// `output_channels` rows of `input_channels` gains each.
+    matrix: Vec<f32>,
+
+    identity: bool,
+}
+
+impl Mixer {
+    /// Creates a mixer between the given channel layouts. Channels present in both layouts are
+    /// passed through; others are folded into the nearest available channels using the usual
+    /// −3 dB downmix coefficients. The low-frequency channel is dropped if the output does not
+    /// have one. The result is normalised so that no output channel can clip.
+    #[must_use]
+    pub fn new(input_layout: u64, output_layout: u64) -> Self {
+        let input_positions = positions(input_layout);
+        let output_positions = positions(output_layout);
+        let input_channels = input_positions.len();
+        let output_channels = output_positions.len();
+
+        let mut matrix = vec![0.0; input_channels * output_channels];
+        for (input_index, &input_position) in input_positions.iter().enumerate() {
+            for &(output_position, gain) in route(input_position, output_layout) {
+                let output_index = output_positions
+                    .iter()
+                    .position(|&position| position == output_position)
+                    .expect("route should only return positions in the output layout");
+                #[allow(clippy::cast_possible_truncation)]
+                {
+                    matrix[output_index * input_channels + input_index] += gain as f32;
+                }
+            }
+        }
+
+        let max_gain = matrix
+            .chunks_exact(input_channels.max(1))
+            .map(|row| row.iter().sum::<f32>())
+            .fold(0.0_f32, f32::max);
+        if max_gain > 1.0 {
+            for gain in &mut matrix {
+                *gain /= max_gain;
+            }
+        }
+
+        Self {
+            input_channels,
+            output_channels,
+            matrix,
+            identity: input_layout == output_layout,
+        }
+    }
+
+    #[must_use]
+    pub fn output_channels(&self) -> usize {
+        self.output_channels
+    }
+
+    /// Mixes the interleaved `input` and appends the result to `output`.
+    pub fn mix(&self, input: &[f32], output: &mut Vec<f32>) {
+        if self.identity {
+            output.extend_from_slice(input);
+            return;
+        }
+
+        output.reserve(input.len() / self.input_channels * self.output_channels);
+        for frame in input.chunks_exact(self.input_channels) {
+            for row in self.matrix.chunks_exact(self.input_channels) {
+                output.push(
+                    row.iter()
+                        .zip(frame)
+                        .map(|(gain, sample)| gain * sample)
+                        .sum(),
+                );
+            }
+        }
+    }
+}
+
+/// Returns the individual channel position bits in the given layout, in interleaving order.
+fn positions(layout: u64) -> Vec<u64> {
+    (0..64)
+        .map(|bit| 1 << bit)
+        .filter(|position| layout & position != 0)
+        .collect()
+}
+
+/// Determines where a channel at `position` should go in the `output_layout`, as a list of
+/// output positions and gains.
+fn route(position: u64, output_layout: u64) -> &'static [(u64, f64)] {
+    use channel::{
+        BACK_CENTER, BACK_LEFT, BACK_RIGHT, FRONT_CENTER, FRONT_LEFT, FRONT_LEFT_OF_CENTER,
+        FRONT_RIGHT, FRONT_RIGHT_OF_CENTER, LOW_FREQUENCY, SIDE_LEFT, SIDE_RIGHT,
+    };
+    const HALF_POWER: f64 = std::f64::consts::FRAC_1_SQRT_2;
+
+    // Alternatives in order of preference. The first one whose positions all exist in the
+    // output layout is used.
+    let alternatives: &[&[(u64, f64)]] = match position {
+        FRONT_LEFT => &[&[(FRONT_LEFT, 1.0)], &[(FRONT_CENTER, HALF_POWER)]],
+        FRONT_RIGHT => &[&[(FRONT_RIGHT, 1.0)], &[(FRONT_CENTER, HALF_POWER)]],
+        FRONT_CENTER => &[
+            &[(FRONT_CENTER, 1.0)],
+            &[(FRONT_LEFT, HALF_POWER), (FRONT_RIGHT, HALF_POWER)],
+        ],
+        LOW_FREQUENCY => &[&[(LOW_FREQUENCY, 1.0)]],
+        BACK_LEFT => &[
+            &[(BACK_LEFT, 1.0)],
+            &[(SIDE_LEFT, 1.0)],
+            &[(FRONT_LEFT, HALF_POWER)],
+            &[(FRONT_CENTER, 0.5)],
+        ],
+        BACK_RIGHT => &[
+            &[(BACK_RIGHT, 1.0)],
+            &[(SIDE_RIGHT, 1.0)],
+            &[(FRONT_RIGHT, HALF_POWER)],
+            &[(FRONT_CENTER, 0.5)],
+        ],
+        SIDE_LEFT => &[
+            &[(SIDE_LEFT, 1.0)],
+            &[(BACK_LEFT, 1.0)],
+            &[(FRONT_LEFT, HALF_POWER)],
+            &[(FRONT_CENTER, 0.5)],
+        ],
+        SIDE_RIGHT => &[
+            &[(SIDE_RIGHT, 1.0)],
+            &[(BACK_RIGHT, 1.0)],
+            &[(FRONT_RIGHT, HALF_POWER)],
+            &[(FRONT_CENTER, 0.5)],
+        ],
+        FRONT_LEFT_OF_CENTER => &[
+            &[(FRONT_LEFT_OF_CENTER, 1.0)],
+            &[(FRONT_LEFT, 1.0)],
+            &[(FRONT_CENTER, HALF_POWER)],
+        ],
+        FRONT_RIGHT_OF_CENTER => &[
+            &[(FRONT_RIGHT_OF_CENTER, 1.0)],
+            &[(FRONT_RIGHT, 1.0)],
+            &[(FRONT_CENTER, HALF_POWER)],
+        ],
+        BACK_CENTER => &[
+            &[(BACK_CENTER, 1.0)],
+            &[(BACK_LEFT, HALF_POWER), (BACK_RIGHT, HALF_POWER)],
+            &[(SIDE_LEFT, HALF_POWER), (SIDE_RIGHT, HALF_POWER)],
+            &[(FRONT_LEFT, 0.5), (FRONT_RIGHT, 0.5)],
+            &[(FRONT_CENTER, 0.5)],
+        ],
+        _ => &[],
+    };
+
+    alternatives
+        .iter()
+        .find(|alternative| {
+            alternative
+                .iter()
+                .all(|(output_position, _)| output_layout & output_position != 0)
+        })
+        .copied()
+        .unwrap_or(&[])
+}
+
+/// Converts interleaved audio from one sample rate to another, using a bank of windowed-sinc
+/// filters, one for each fractional position an output sample can fall on between two input
+/// samples. Conversion ratios are handled exactly as the ratio of two integers.
+#[derive(Debug, Clone)]
+pub struct Resampler {
+    channels: usize,
+
+    /// Output samples are spaced `decimation / interpolation` input samples apart.
+    interpolation: u64,
+    decimation: u64,
+
+    phases: u64,
+
+    /// `phases` filters of `TAPS` coefficients each.
+    coefficients: Vec<f32>,
+
+    /// Input samples that still need to be used, one buffer per channel.
+    history: Vec<Vec<f32>>,
+
+    /// Fractional position of the next output sample after the first sample in `history`, in
+    /// units of `1 / interpolation` input samples.
+    fraction: u64,
+
+    /// Number of input samples to drop before the next one is used. Only non-zero if output
+    /// samples are spaced further apart than the filter is long.
+    skip: usize,
+}
+
+impl Resampler {
+    #[must_use]
+    pub fn new(channels: usize, input_rate: u32, output_rate: u32) -> Self {
+        let divisor = gcd(u64::from(input_rate), u64::from(output_rate)).max(1);
+        let interpolation = (u64::from(output_rate) / divisor).max(1);
+        let decimation = (u64::from(input_rate) / divisor).max(1);
+        let phases = interpolation.min(MAX_PHASES);
+
+        #[allow(clippy::cast_precision_loss)]
+        let cutoff = PASSBAND * (interpolation as f64 / decimation as f64).min(1.0);
+        let coefficients = (0..phases)
+            .flat_map(|phase| {
+                #[allow(clippy::cast_precision_loss)]
+                filter(cutoff, phase as f64 / phases as f64)
+            })
+            .collect();
+
+        let mut resampler = Self {
+            channels,
+            interpolation,
+            decimation,
+            phases,
+            coefficients,
+            history: vec![vec![]; channels],
+            fraction: 0,
+            skip: 0,
+        };
+        resampler.seek(0);
+        resampler
+    }
+
+    /// Whether input and output rates are the same, so that samples are passed through as-is.
+    #[must_use]
+    pub fn is_passthrough(&self) -> bool {
+        self.interpolation == self.decimation
+    }
+
+    /// Discards all buffered input and prepares for output sample number `output_position`.
+    /// Returns the number of the input sample that should be passed in next.
+    pub fn seek(&mut self, output_position: u64) -> u64 {
+        let input_position = u128::from(output_position) * u128::from(self.decimation);
+        let interpolation = u128::from(self.interpolation);
+        #[allow(clippy::cast_possible_truncation)]
+        {
+            self.fraction = (input_position % interpolation) as u64;
+        }
+        self.skip = 0;
+
+        // Prime the filter with silence, so that the centre of the first filter falls on the
+        // first sample passed in
+        for history in &mut self.history {
+            history.clear();
+            history.resize(TAPS / 2 - 1, 0.0);
+        }
+
+        u64::try_from(input_position / interpolation).unwrap_or(u64::MAX)
+    }
+
+    /// Resamples the interleaved `input` and appends as many output samples as can be computed
+    /// from it to `output`. The remaining input is kept for the next call.
+    pub fn process(&mut self, input: &[f32], output: &mut Vec<f32>) {
+        if self.is_passthrough() {
+            output.extend_from_slice(input);
+            return;
+        }
+
+        let skip = self.skip.min(input.len() / self.channels);
+        self.skip -= skip;
+        for (channel, history) in self.history.iter_mut().enumerate() {
+            history.extend(
+                input
+                    .iter()
+                    .skip(skip * self.channels + channel)
+                    .step_by(self.channels),
+            );
+        }
+
+        let available = self.history.first().map_or(0, Vec::len);
+        let mut offset = 0;
+        while offset + TAPS <= available {
+            #[allow(clippy::cast_possible_truncation)]
+            let phase = (self.fraction * self.phases / self.interpolation) as usize;
+            let filter = &self.coefficients[phase * TAPS..(phase + 1) * TAPS];
+            for history in &self.history {
+                output.push(dot(&history[offset..offset + TAPS], filter));
+            }
+
+            self.fraction += self.decimation;
+            #[allow(clippy::cast_possible_truncation)]
+            {
+                offset += (self.fraction / self.interpolation) as usize;
+            }
+            self.fraction %= self.interpolation;
+        }
+
+        let consumed = offset.min(available);
+        for history in &mut self.history {
+            history.drain(..consumed);
+        }
+        self.skip = offset - consumed;
+    }
+}
+
+/// Computes the filter for an output sample `fraction` input samples after tap `TAPS / 2 - 1`,
+/// normalised to unity gain.
+#[allow(clippy::cast_possible_truncation, clippy::cast_precision_loss)]
+fn filter(cutoff: f64, fraction: f64) -> Vec<f32> {
+    let half_width = (TAPS / 2) as f64;
+    let taps: Vec<f64> = (0..TAPS)
+        .map(|tap| {
+            let distance = tap as f64 - (half_width - 1.0) - fraction;
+            let sinc = if distance == 0.0 {
+                1.0
+            } else {
+                (PI * cutoff * distance).sin() / (PI * cutoff * distance)
+            };
+            let window_position = distance / half_width;
+            let window = if window_position.abs() > 1.0 {
+                0.0
+            } else {
+                0.42 + 0.5 * (PI * window_position).cos()
+                    + 0.08 * (2.0 * PI * window_position).cos()
+            };
+            sinc * window
+        })
+        .collect();
+
+    let sum: f64 = taps.iter().sum();
+    taps.iter().map(|tap| (tap / sum) as f32).collect()
+}
+
+fn gcd(mut left: u64, mut right: u64) -> u64 {
+    while right != 0 {
+        (left, right) = (right, left % right);
+    }
+    left
+}
+
+/// Changes the speed of audio without changing its pitch, using waveform similarity overlap-add
+/// (WSOLA): the output is assembled from overlapping, windowed segments of the input, spaced
+/// according to the speed. Each segment is shifted by up to a quarter window length so that it
+/// continues the previous one as smoothly as possible, which avoids the phasing artifacts of plain
+/// overlap-add.
+#[derive(Debug, Clone)]
+pub struct Stretcher {
+    channels: usize,
+
+    /// Speed in thousandths, see [`UNITY_SPEED`].
+    speed: u32,
+
+    /// Hann window, twice as long as `hop`, so that consecutive windows sum to one.
+    window: Vec<f32>,
+
+    /// Distance between output segments.
+    hop: usize,
+
+    /// How far a segment may be shifted from its nominal position.
+    tolerance: usize,
+
+    /// Buffered interleaved input, and its downmix used for the similarity search.
+    input: Vec<f32>,
+    mono: Vec<f32>,
+
+    /// Absolute frame number of the first buffered input frame.
+    input_start: u64,
+
+    /// Nominal absolute input position of the next segment, in thousandths of a frame.
+    nominal: u64,
+
+    /// Absolute input position of the previous segment, if any.
+    previous: Option<u64>,
+
+    /// Second half of the previous windowed segment, to be added to the next one.
+    overlap: Vec<f32>,
+}
+
+impl Stretcher {
+    #[must_use]
+    pub fn new(channels: usize, rate: u32) -> Self {
+        // Keep all lengths multiples of the vector width
+        let step = u32::try_from(2 * LANES).unwrap_or(1);
+        let window_len = (rate * STRETCH_WINDOW_MILLIS / 1000 / step).max(1) * step;
+        let window_len = usize::try_from(window_len).unwrap_or(2 * LANES);
+        let hop = window_len / 2;
+
+        #[allow(clippy::cast_precision_loss, clippy::cast_possible_truncation)]
+        let window = (0..window_len)
+            .map(|index| (0.5 - 0.5 * (2.0 * PI * index as f64 / window_len as f64).cos()) as f32)
+            .collect();
+
+        Self {
+            channels,
+            speed: UNITY_SPEED,
+            window,
+            hop,
+            tolerance: hop / 2,
+            input: vec![],
+            mono: vec![],
+            input_start: 0,
+            nominal: 0,
+            previous: None,
+            overlap: vec![0.0; hop * channels],
+        }
+    }
+
+    /// Discards all buffered input and sets the speed at which the input following after this
+    /// call will be played.
+    pub fn reset(&mut self, speed: u32) {
+        self.speed = speed.max(1);
+        self.input.clear();
+        self.mono.clear();
+        self.input_start = 0;
+        self.nominal = 0;
+        self.previous = None;
+        self.overlap.fill(0.0);
+    }
+
+    /// Stretches the interleaved `input` and appends as much output as can be computed from it to
+    /// `output`. At unity speed, the input is passed through as-is.
+    pub fn process(&mut self, input: &[f32], output: &mut Vec<f32>) {
+        if self.speed == UNITY_SPEED {
+            output.extend_from_slice(input);
+            return;
+        }
+
+        self.input.extend_from_slice(input);
+        #[allow(clippy::cast_precision_loss)]
+        let scale = 1.0 / self.channels as f32;
+        self.mono.extend(
+            input
+                .chunks_exact(self.channels)
+                .map(|frame| frame.iter().sum::<f32>() * scale),
+        );
+
+        loop {
+            let nominal = usize::try_from(self.nominal / 1000 - self.input_start).unwrap_or(0);
+            let search_start = nominal.saturating_sub(self.tolerance);
+            let search_end = nominal + self.tolerance;
+            if search_end + 2 * self.hop > self.mono.len() {
+                break;
+            }
+
+            let position = match self.previous {
+                None => nominal,
+                Some(previous) => {
+                    let target =
+                        usize::try_from(previous - self.input_start).unwrap_or(0) + self.hop;
+                    self.most_similar(target, search_start, search_end)
+                }
+            };
+            self.emit_segment(position, output);
+
+            self.previous = Some(self.input_start + position as u64);
+            self.nominal += self.hop as u64 * u64::from(self.speed);
+        }
+
+        // Drop input that can no longer be used, once enough has accumulated to make the move
+        // worth it
+        let needed_from = (self.nominal / 1000)
+            .saturating_sub(self.tolerance as u64)
+            .min(self.previous.unwrap_or(u64::MAX))
+            .saturating_sub(self.input_start);
+        let unused = usize::try_from(needed_from)
+            .unwrap_or(0)
+            .min(self.mono.len());
+        if unused >= 4 * self.window.len() {
+            self.mono.drain(..unused);
+            self.input.drain(..unused * self.channels);
+            self.input_start += unused as u64;
+        }
+    }
+
+    /// Finds the segment start within `search_start..=search_end` whose first half is most similar
+    /// to the `hop` frames starting at `target`, by normalised cross-correlation.
+    fn most_similar(&self, target: usize, search_start: usize, search_end: usize) -> usize {
+        let target = &self.mono[target..target + self.hop];
+        let mut best = (search_start, f32::NEG_INFINITY);
+        for candidate in search_start..=search_end {
+            let segment = &self.mono[candidate..candidate + self.hop];
+            let energy = dot(segment, segment);
+            let score = dot(segment, target) / energy.max(f32::MIN_POSITIVE).sqrt();
+            if score > best.1 {
+                best = (candidate, score);
+            }
+        }
+        best.0
+    }
+
+    /// Windows the segment starting at `position`, adds its first half to the overlap from the
+    /// previous segment and outputs it, and keeps the second half as the new overlap.
+    fn emit_segment(&mut self, position: usize, output: &mut Vec<f32>) {
+        let channels = self.channels;
+        let len = self.hop * channels;
+        let first = &self.input[position * channels..][..len];
+        let second = &self.input[(position + self.hop) * channels..][..len];
+        let (rising, falling) = self.window.split_at(self.hop);
+
+        output.reserve(len);
+        for (frame_index, (frame, overlap)) in first
+            .chunks_exact(channels)
+            .zip(self.overlap.chunks_exact(channels))
+            .enumerate()
+        {
+            let gain = rising[frame_index];
+            output.extend(
+                frame
+                    .iter()
+                    .zip(overlap)
+                    .map(|(sample, overlap)| sample.mul_add(gain, *overlap)),
+            );
+        }
+
+        for (frame_index, (frame, overlap)) in second
+            .chunks_exact(channels)
+            .zip(self.overlap.chunks_exact_mut(channels))
+            .enumerate()
+        {
+            let gain = falling[frame_index];
+            for (sample, overlap) in frame.iter().zip(overlap) {
+                *overlap = sample * gain;
+            }
+        }
+    }
+}
+
+/// The complete conversion from audio as decoded by BestSource to interleaved `f32` samples in
+/// the channel layout and sample rate of the output device.
+#[derive(Debug, Clone)]
+pub struct Converter {
+    format: SampleFormat,
+    input_channels: usize,
+    mixer: Mixer,
+    resampler: Resampler,
+
+    samples: Vec<f32>,
+    mixed: Vec<f32>,
+}
+
+impl Converter {
+    /// Returns `None` if the source's sample format is not supported.
+    #[must_use]
+    pub fn new(
+        properties: &AudioProperties,
+        output_channels: u16,
+        output_rate: u32,
+    ) -> Option<Self> {
+        let format = SampleFormat::from_properties(properties)?;
+        let input_channels = u16::try_from(properties.channels).ok()?;
+        let input_layout = if properties.channel_layout.count_ones() == properties.channels {
+            properties.channel_layout
+        } else {
+            default_layout(input_channels)
+        };
+
+        let mixer = Mixer::new(input_layout, default_layout(output_channels));
+        let resampler =
+            Resampler::new(mixer.output_channels(), properties.sample_rate, output_rate);
+
+        Some(Self {
+            format,
+            input_channels: usize::from(input_channels),
+            mixer,
+            resampler,
+            samples: vec![],
+            mixed: vec![],
+        })
+    }
+
+    /// Number of bytes a single frame of input occupies.
+    #[must_use]
+    pub fn input_frame_size(&self) -> usize {
+        self.format.bytes_per_sample() * self.input_channels
+    }
+
+    /// Prepares for producing output starting at frame `output_position`, discarding any
+    /// buffered state. Returns the source frame that should be converted next.
+    pub fn seek(&mut self, output_position: u64) -> u64 {
+        self.resampler.seek(output_position)
+    }
+
+    /// Converts raw packed audio, as returned by BestSource, and appends the result to `output`.
+    pub fn process(&mut self, bytes: &[u8], output: &mut Vec<f32>) {
+        self.samples.clear();
+        convert_to_f32(self.format, bytes, &mut self.samples);
+        self.mixed.clear();
+        self.mixer.mix(&self.samples, &mut self.mixed);
+        self.resampler.process(&self.mixed, output);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sine(rate: u32, frequency: f64, len: usize) -> Vec<f32> {
+        #[allow(clippy::cast_possible_truncation, clippy::cast_precision_loss)]
+        (0..len)
+            .map(|index| (2.0 * PI * frequency * index as f64 / f64::from(rate)).sin() as f32)
+            .collect()
+    }
+
+    #[test]
+    fn resample() {
+        let mut resampler = Resampler::new(1, 44100, 48000);
+        let input = sine(44100, 1000.0, 44100);
+
+        let mut output = vec![];
+        for chunk in input.chunks(1000) {
+            resampler.process(chunk, &mut output);
+        }
+
+        // Everything but the end of the input, which is still held back by the filter, has been
+        // converted
+        assert!((47970..=48000).contains(&output.len()));
+
+        // The result is the same sine wave, at the new rate
+        let expected = sine(48000, 1000.0, output.len());
+        let max_error = output
+            .iter()
+            .zip(&expected)
+            .skip(TAPS)
+            .map(|(actual, expected)| (actual - expected).abs())
+            .fold(0.0_f32, f32::max);
+        assert!(max_error < 0.01, "maximum error {max_error}");
+
+        // Seeking computes the matching input position
+        assert_eq!(resampler.seek(48000), 44100);
+        assert_eq!(resampler.seek(160), 147);
+        assert_eq!(resampler.seek(1), 0);
+    }
+
+    #[test]
+    fn mix() {
+        let surround = default_layout(6);
+        let stereo = default_layout(2);
+
+        let mixer = Mixer::new(surround, stereo);
+        let mut output = vec![];
+        mixer.mix(&[1.0, 0.0, 0.0, 0.0, 0.0, 0.0], &mut output);
+        mixer.mix(&[0.0, 0.0, 1.0, 0.0, 0.0, 0.0], &mut output);
+        mixer.mix(&[0.0, 0.0, 0.0, 1.0, 0.0, 0.0], &mut output);
+        assert!(output[0] > 0.0 && output[1] == 0.0);
+        assert!(output[2] > 0.0 && (output[2] - output[3]).abs() < f32::EPSILON);
+        assert_eq!(&output[4..6], &[0.0, 0.0]);
+
+        // Full-scale input on every channel does not clip
+        output.clear();
+        mixer.mix(&[1.0; 6], &mut output);
+        assert!(output.iter().all(|&sample| sample <= 1.000_001));
+
+        output.clear();
+        Mixer::new(stereo, channel::FRONT_CENTER).mix(&[1.0, 1.0], &mut output);
+        assert!((output[0] - 1.0).abs() < 1e-6);
+
+        output.clear();
+        Mixer::new(stereo, stereo).mix(&[0.25, -0.5], &mut output);
+        assert_eq!(output, [0.25, -0.5]);
+    }
+
+    #[test]
+    fn stretch() {
+        let rate = 48000;
+        let input = sine(rate, 440.0, 48000);
+
+        for speed in [250, 500, 1500, 2000] {
+            let mut stretcher = Stretcher::new(1, rate);
+            stretcher.reset(speed);
+            let mut output = vec![];
+            for chunk in input.chunks(1000) {
+                stretcher.process(chunk, &mut output);
+            }
+
+            // The duration changes according to the speed, except for the last window, which is
+            // held back
+            let expected_len = 48000 * 1000 / speed as usize;
+            assert!(
+                output.len() <= expected_len
+                    && output.len() + 2000 * 1000 / speed as usize >= expected_len,
+                "speed {speed}: {} samples",
+                output.len()
+            );
+
+            // The pitch does not
+            let middle = &output[output.len() / 4..output.len() * 3 / 4];
+            let crossings = middle
+                .windows(2)
+                .filter(|pair| (pair[0] < 0.0) != (pair[1] < 0.0))
+                .count();
+            #[allow(clippy::cast_precision_loss)]
+            let frequency = crossings as f64 / 2.0 / (middle.len() as f64 / f64::from(rate));
+            assert!(
+                (frequency - 440.0).abs() < 10.0,
+                "speed {speed}: frequency {frequency}"
+            );
+        }
+    }
+
+    #[test]
+    fn sample_formats() {
+        let mut output = vec![];
+        convert_to_f32(SampleFormat::U8, &[0, 128, 255], &mut output);
+        convert_to_f32(
+            SampleFormat::I16,
+            &[i16::MIN.to_ne_bytes(), 16384_i16.to_ne_bytes()].concat(),
+            &mut output,
+        );
+        convert_to_f32(SampleFormat::F64, &0.5_f64.to_ne_bytes(), &mut output);
+        assert_eq!(output, [-1.0, 0.0, 127.0 / 128.0, -1.0, 0.5, 0.5]);
+    }
+}
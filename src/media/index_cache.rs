@@ -0,0 +1,314 @@
+//! Per-user cache of the `.lwi` index files LWLibavSource writes when it opens a video. Indexing a
+//! large file takes a long time, so the index is kept around and reused the next time the same
+//! file is opened, no matter from which directory samaku was started.
+//!
+//! Index files are named after the source file and a hash of its canonical path, size and
+//! modification time, so that a modified or replaced source gets a fresh index. The cache is kept
+//! below a size limit by deleting the least recently used index files, where use is tracked by the
+//! modification time of the index file.
+
+use std::ffi::OsStr;
+use std::fs;
+use std::io::{self, Read, Seek, SeekFrom};
+use std::path::{Path, PathBuf};
+use std::time::SystemTime;
+
+/// Extension of index files, as written by LWLibavSource.
+const EXTENSION: &str = "lwi";
+
+/// Every index file starts with this tag.
+const HEADER_TAG: &[u8] = b"<LSMASHWorksIndexVersion=";
+
+/// LWLibavSource writes this tag last, so an index file without it was not written completely.
+const END_TAG: &[u8] = b"</LibavReaderIndexFile>";
+
+/// Number of bytes at the end of an index file in which the end tag is searched.
+const TAIL_LEN: u64 = 64;
+
+/// Number of bytes at the start of an index file in which the header is checked.
+const HEAD_LEN: u64 = 4096;
+
+/// Length of the source file name prefix kept in index file names, in characters.
+const NAME_PREFIX_LEN: usize = 64;
+
+#[derive(Debug, Clone)]
+pub struct IndexCache {
+    dir: PathBuf,
+    max_bytes: u64,
+}
+
+impl IndexCache {
+    /// Default size limit of the cache. Indices of long remuxes can take up tens of megabytes.
+    pub const DEFAULT_MAX_BYTES: u64 = 1 << 30;
+
+    #[must_use]
+    pub fn new(dir: PathBuf, max_bytes: u64) -> Self {
+        Self { dir, max_bytes }
+    }
+
+    /// The cache in the current user's cache directory, with the default size limit.
+    #[must_use]
+    pub fn for_user() -> Self {
+        Self::new(
+            user_cache_dir().join("samaku").join("lwi"),
+            Self::DEFAULT_MAX_BYTES,
+        )
+    }
+
+    /// Returns the path of the index file for the given source file, which LWLibavSource should
+    /// read the index from, or write it to if it does not exist yet. An existing index file that
+    /// is incomplete or belongs to a different source is deleted, so that it is rebuilt. A valid
+    /// one is marked as recently used.
+    ///
+    /// # Errors
+    /// Returns an error if the source file cannot be accessed, or if the cache directory cannot be
+    /// created.
+    pub fn prepare(&self, source: &Path) -> io::Result<PathBuf> {
+        fs::create_dir_all(&self.dir)?;
+        let index_path = self.dir.join(source_file_name(source, EXTENSION)?);
+
+        match is_valid_index(&index_path, source) {
+            Ok(true) => touch(&index_path)?,
+            Ok(false) => {
+                println!("Discarding invalid index file {}", index_path.display());
+                fs::remove_file(&index_path)?;
+            }
+            Err(err) if err.kind() == io::ErrorKind::NotFound => {}
+            Err(err) => return Err(err),
+        }
+
+        Ok(index_path)
+    }
+
+    /// Deletes the least recently used index files until the cache fits within its size limit,
+    /// except for the given one, which is in use.
+    ///
+    /// # Errors
+    /// Returns an error if the cache directory cannot be read.
+    pub fn evict(&self, in_use: &Path) -> io::Result<()> {
+        evict_least_recently_used(&self.dir, EXTENSION, self.max_bytes, in_use)
+    }
+}
+
+/// Deletes the least recently used files with the given extension in `dir`, until their total size
+/// is at most `max_bytes`. The file `in_use` is never deleted.
+pub(super) fn evict_least_recently_used(
+    dir: &Path,
+    extension: &str,
+    max_bytes: u64,
+    in_use: &Path,
+) -> io::Result<()> {
+    let mut entries: Vec<(SystemTime, u64, PathBuf)> = vec![];
+    let mut total_bytes = 0;
+
+    for entry in fs::read_dir(dir)? {
+        let entry = entry?;
+        let path = entry.path();
+        if path.extension() != Some(OsStr::new(extension)) {
+            continue;
+        }
+
+        let metadata = entry.metadata()?;
+        total_bytes += metadata.len();
+        if path != in_use {
+            entries.push((metadata.modified()?, metadata.len(), path));
+        }
+    }
+
+    entries.sort_unstable();
+    for (_, len, path) in entries {
+        if total_bytes <= max_bytes {
+            break;
+        }
+
+        // Another samaku instance may have deleted the file in the meantime
+        match fs::remove_file(&path) {
+            Ok(()) => println!("Evicted cache file {}", path.display()),
+            Err(err) if err.kind() == io::ErrorKind::NotFound => {}
+            Err(err) => return Err(err),
+        }
+        total_bytes -= len;
+    }
+
+    Ok(())
+}
+
+/// Name of a cache file with the given extension for the given source, which must exist.
+pub(super) fn source_file_name(source: &Path, extension: &str) -> io::Result<String> {
+    let canonical = fs::canonicalize(source)?;
+    let metadata = fs::metadata(&canonical)?;
+    let modified = metadata
+        .modified()?
+        .duration_since(SystemTime::UNIX_EPOCH)
+        .unwrap_or_default();
+
+    let mut hash = FNV_OFFSET;
+    hash = fnv1a(hash, canonical.as_os_str().as_encoded_bytes());
+    hash = fnv1a(hash, &metadata.len().to_le_bytes());
+    hash = fnv1a(hash, &modified.as_nanos().to_le_bytes());
+
+    // Keep part of the file name, to make the cache directory easier to inspect
+    let prefix: String = canonical
+        .file_name()
+        .unwrap_or_default()
+        .to_string_lossy()
+        .chars()
+        .take(NAME_PREFIX_LEN)
+        .map(|char| if char.is_alphanumeric() { char } else { '_' })
+        .collect();
+
+    Ok(format!("{prefix}-{hash:016x}.{extension}"))
+}
+
+/// Checks whether the index file was written completely, and, if it records the path of its
+/// source, whether that is the given one.
+fn is_valid_index(index_path: &Path, source: &Path) -> io::Result<bool> {
+    let mut file = fs::File::open(index_path)?;
+    let len = file.metadata()?.len();
+
+    let mut head = vec![];
+    (&mut file).take(HEAD_LEN).read_to_end(&mut head)?;
+    if !head.starts_with(HEADER_TAG) {
+        return Ok(false);
+    }
+
+    if let Some(recorded_source) = tag_contents(&head, b"<InputFilePath>", b"</InputFilePath>") {
+        let source = fs::canonicalize(source)?;
+        if recorded_source != source.as_os_str().as_encoded_bytes() {
+            return Ok(false);
+        }
+    }
+
+    let mut tail = vec![];
+    file.seek(SeekFrom::Start(len.saturating_sub(TAIL_LEN)))?;
+    file.read_to_end(&mut tail)?;
+    Ok(memchr::memmem::find(&tail, END_TAG).is_some())
+}
+
+fn tag_contents<'a>(data: &'a [u8], open: &[u8], close: &[u8]) -> Option<&'a [u8]> {
+    let start = memchr::memmem::find(data, open)? + open.len();
+    let len = memchr::memmem::find(&data[start..], close)?;
+    Some(&data[start..start + len])
+}
+
+pub(super) fn touch(path: &Path) -> io::Result<()> {
+    fs::File::options()
+        .write(true)
+        .open(path)?
+        .set_modified(SystemTime::now())
+}
+
+/// The platform's directory for per-user cache files.
+pub(super) fn user_cache_dir() -> PathBuf {
+    let from_env = |key: &str| {
+        std::env::var_os(key)
+            .map(PathBuf::from)
+            .filter(|path| path.is_absolute())
+    };
+
+    let dir = if cfg!(windows) {
+        from_env("LOCALAPPDATA")
+    } else if cfg!(target_os = "macos") {
+        from_env("HOME").map(|home| home.join("Library").join("Caches"))
+    } else {
+        from_env("XDG_CACHE_HOME").or_else(|| from_env("HOME").map(|home| home.join(".cache")))
+    };
+
+    dir.unwrap_or_else(std::env::temp_dir)
+}
+
+const FNV_OFFSET: u64 = 0xcbf2_9ce4_8422_2325;
+
+fn fnv1a(mut hash: u64, data: &[u8]) -> u64 {
+    for byte in data {
+        hash ^= u64::from(*byte);
+        hash = hash.wrapping_mul(0x0100_0000_01b3);
+    }
+    hash
+}
+
+#[cfg(test)]
+mod tests {
+    use std::time::Duration;
+
+    use super::*;
+
+    fn temp_dir(name: &str) -> PathBuf {
+        let dir =
+            std::env::temp_dir().join(format!("samaku-index-cache-{name}-{}", std::process::id()));
+        let _ = fs::remove_dir_all(&dir);
+        fs::create_dir_all(&dir).unwrap();
+        dir
+    }
+
+    fn write_index(path: &Path, source: &Path, complete: bool) {
+        let mut contents = format!(
+            "<LSMASHWorksIndexVersion=0.0.3.0>\n<InputFilePath>{}</InputFilePath>\n",
+            fs::canonicalize(source).unwrap().display()
+        );
+        contents.push_str(&"<Index>\n".repeat(100));
+        if complete {
+            contents.push_str("</LibavReaderIndexFile>\n");
+        }
+        fs::write(path, contents).unwrap();
+    }
+
+    #[test]
+    fn validation() {
+        let dir = temp_dir("validation");
+        let source = dir.join("source.mkv");
+        fs::write(&source, "video").unwrap();
+        let cache = IndexCache::new(dir.join("cache"), IndexCache::DEFAULT_MAX_BYTES);
+
+        let index_path = cache.prepare(&source).unwrap();
+        assert!(!index_path.exists());
+
+        write_index(&index_path, &source, true);
+        assert_eq!(cache.prepare(&source).unwrap(), index_path);
+        assert!(index_path.exists());
+
+        // Interrupted indexing
+        write_index(&index_path, &source, false);
+        cache.prepare(&source).unwrap();
+        assert!(!index_path.exists());
+
+        // Different source
+        write_index(&index_path, &dir, true);
+        cache.prepare(&source).unwrap();
+        assert!(!index_path.exists());
+
+        // Modifying the source changes the index file
+        fs::write(&source, "longer video").unwrap();
+        assert_ne!(cache.prepare(&source).unwrap(), index_path);
+
+        fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn eviction() {
+        let dir = temp_dir("eviction");
+        let cache = IndexCache::new(dir.clone(), 250);
+
+        let now = SystemTime::now();
+        let paths: Vec<PathBuf> = (0..4)
+            .map(|index| {
+                let path = dir.join(format!("{index}.lwi"));
+                fs::write(&path, [0; 100]).unwrap();
+                fs::File::options()
+                    .write(true)
+                    .open(&path)
+                    .unwrap()
+                    .set_modified(now - Duration::from_secs(100 - index))
+                    .unwrap();
+                path
+            })
+            .collect();
+
+        // The oldest file is in use, so the next two oldest ones have to go
+        cache.evict(&paths[0]).unwrap();
+        let remaining: Vec<bool> = paths.iter().map(|path| path.exists()).collect();
+        assert_eq!(remaining, [true, false, false, true]);
+
+        fs::remove_dir_all(&dir).unwrap();
+    }
+}
@@ -1,11 +1,19 @@
 pub use audio::Audio;
 pub use audio::Properties as AudioProperties;
+pub use index_cache::IndexCache;
+pub use video::CoreBudget as VideoCoreBudget;
 pub use video::FrameRate;
+pub use video::LoadError as VideoLoadError;
+pub use video::LoadStage as VideoLoadStage;
 pub use video::Metadata as VideoMetadata;
 pub use video::Video;
 
 mod audio;
 mod bindings;
+pub mod dsp;
+mod index_cache;
 pub mod motion;
+pub mod proxy;
+pub mod scene_change;
 pub mod subtitle;
 mod video;
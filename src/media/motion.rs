@@ -2,6 +2,8 @@ pub use mv::MotionModel as Model;
 pub use mv::Point;
 pub use mv::Region;
 
+use rayon::prelude::*;
+
 use crate::model;
 
 use super::bindings::mv;
@@ -23,43 +25,207 @@ pub struct PatchResponse {
     pub height: u32,
 }
 
+impl PatchRequest {
+    fn around(center: Point, radius: f64) -> Self {
+        Self {
+            left: center.x - radius,
+            top: center.y - radius,
+            width: 2.0 * radius,
+            height: 2.0 * radius,
+        }
+    }
+
+    /// The smallest request whose area contains the areas of all given requests.
+    fn enclosing<I: IntoIterator<Item = Self>>(requests: I) -> Self {
+        let (left, top, right, bottom) = requests.into_iter().fold(
+            (
+                f64::INFINITY,
+                f64::INFINITY,
+                f64::NEG_INFINITY,
+                f64::NEG_INFINITY,
+            ),
+            |(left, top, right, bottom), request| {
+                (
+                    left.min(request.left),
+                    top.min(request.top),
+                    right.max(request.left + request.width),
+                    bottom.max(request.top + request.height),
+                )
+            },
+        );
+
+        Self {
+            left,
+            top,
+            width: right - left,
+            height: bottom - top,
+        }
+    }
+
+    /// Whether the area of this request lies entirely within the area of `other`. Patch providers
+    /// clamp requests to the frame bounds, so the response to `other` then also contains every
+    /// pixel the response to this request would contain.
+    fn is_within(&self, other: &Self) -> bool {
+        self.left >= other.left
+            && self.top >= other.top
+            && self.left + self.width <= other.left + other.width
+            && self.top + self.height <= other.top + other.height
+    }
+}
+
+impl PatchResponse {
+    /// Copies the part of this patch that lies within the area of the given request, rounded
+    /// outwards to whole pixels.
+    #[allow(clippy::cast_sign_loss)] // we clamp to >0.0 it will never be negative
+    #[allow(clippy::cast_possible_truncation)]
+    fn crop(&self, request: &PatchRequest) -> Self {
+        let right_edge = self.left + self.width;
+        let bottom_edge = self.top + self.height;
+
+        let left = (request.left.floor().max(0.0) as u32).clamp(self.left, right_edge);
+        let top = (request.top.floor().max(0.0) as u32).clamp(self.top, bottom_edge);
+        let right = ((request.left + request.width).ceil().max(0.0) as u32).clamp(left, right_edge);
+        let bottom =
+            ((request.top + request.height).ceil().max(0.0) as u32).clamp(top, bottom_edge);
+
+        let width = right - left;
+        let height = bottom - top;
+        let mut data = Vec::with_capacity(width as usize * height as usize);
+        for row in top..bottom {
+            let row_start =
+                (row - self.top) as usize * self.width as usize + (left - self.left) as usize;
+            data.extend_from_slice(&self.data[row_start..(row_start + width as usize)]);
+        }
+
+        Self {
+            data,
+            left,
+            top,
+            width,
+            height,
+        }
+    }
+
+    /// Averages blocks of `factor` × `factor` pixels. The result's origin is in the coordinates of
+    /// the downsampled frame, so pixels at the edges that do not make up a full block are dropped.
+    fn downsample(&self, factor: u32) -> Self {
+        let left = self.left.div_ceil(factor);
+        let top = self.top.div_ceil(factor);
+        let width = ((self.left + self.width) / factor).saturating_sub(left);
+        let height = ((self.top + self.height) / factor).saturating_sub(top);
+
+        let factor_usize = factor as usize;
+        #[allow(clippy::cast_precision_loss)]
+        let normalization = 1.0 / (factor * factor) as f32;
+        let mut data = Vec::with_capacity(width as usize * height as usize);
+        for row in 0..height as usize {
+            let source_top = (top as usize + row) * factor_usize - self.top as usize;
+            let source_left = left as usize * factor_usize - self.left as usize;
+            for col in 0..width as usize {
+                let block_left = source_left + col * factor_usize;
+                let sum: f32 = (source_top..(source_top + factor_usize))
+                    .map(|source_row| {
+                        let row_start = source_row * self.width as usize + block_left;
+                        self.data[row_start..(row_start + factor_usize)]
+                            .iter()
+                            .sum::<f32>()
+                    })
+                    .sum();
+                data.push(sum * normalization);
+            }
+        }
+
+        Self {
+            data,
+            left,
+            top,
+            width,
+            height,
+        }
+    }
+}
+
+/// How much larger than the search area the fetched patches are, relative to the search radius.
+/// The patch fetched for the next frame in one tracking step is reused for the current frame in
+/// the following step, as long as the markers have moved by less than this margin.
+const PATCH_MARGIN: f64 = 0.25;
+
+/// Tracks one or more markers at once. Every frame is only fetched once for all markers, as a
+/// single patch enclosing all of their search areas; the markers are then tracked in parallel on
+/// the current rayon thread pool, whose threads are reused across steps.
 pub struct Tracker<'a, V> {
     video: &'a V,
     patch_provider: fn(&V, model::FrameNumber, PatchRequest) -> PatchResponse,
     search_radius: f64,
-    track: Vec<Region>,
+    tracks: Vec<Vec<Region>>,
     last_frame: model::FrameNumber,
     end_frame: model::FrameNumber,
+    step: model::FrameDelta,
+
+    /// The patch fetched for `last_frame` in the previous step, together with the request it
+    /// answers.
+    last_patch: Option<(PatchRequest, PatchResponse)>,
+    patches_fetched: u64,
 }
 
 impl<'a, V> Tracker<'a, V> {
     /// Create a new `MotionTracker`.
-    /// The `initial_marker` should be an axis-aligned rectangle.
-    /// `search_radius` is defined around the center of the `initial_marker`.
-    /// `start_frame`: the frame at which the `initial_marker` is at the correct position.
-    /// `end_frame`: the last frame onto which the `initial_marker` will be tracked.
-    /// `track` will be of size `end_frame - start_frame + 1`, if all goes well.
+    /// The `initial_markers` should be axis-aligned rectangles. There must be at least one.
+    /// `search_radius` is defined around the center of each marker.
+    /// `start_frame`: the frame at which the `initial_markers` are at the correct position.
+    /// `end_frame`: the last frame onto which the `initial_markers` will be tracked. If it is
+    /// before `start_frame`, the markers are tracked backwards.
+    /// Each track will be of size `|end_frame - start_frame| + 1`, if all goes well.
+    ///
+    /// # Panics
+    /// Panics if `initial_markers` is empty.
     pub fn new(
         video: &'a V,
         patch_provider: fn(&V, model::FrameNumber, PatchRequest) -> PatchResponse,
-        initial_marker: Region,
+        initial_markers: Vec<Region>,
         search_radius: f64,
         start_frame: model::FrameNumber,
         end_frame: model::FrameNumber,
     ) -> Self {
+        assert!(
+            !initial_markers.is_empty(),
+            "there should be at least one marker to track"
+        );
+
         Self {
             video,
             patch_provider,
             search_radius,
-            track: vec![initial_marker],
+            tracks: initial_markers
+                .into_iter()
+                .map(|marker| vec![marker])
+                .collect(),
             last_frame: start_frame,
             end_frame,
+            step: model::FrameDelta(if end_frame.0 < start_frame.0 { -1 } else { 1 }),
+            last_patch: None,
+            patches_fetched: 0,
         }
     }
 
+    /// The track of each marker, in the order the markers were passed to [`Tracker::new`].
     #[must_use]
-    pub fn track(&self) -> &Vec<Region> {
-        &self.track
+    pub fn tracks(&self) -> &[Vec<Region>] {
+        &self.tracks
+    }
+
+    /// The position of each marker in the last tracked frame.
+    #[allow(clippy::missing_panics_doc)] // the expectation should always be met
+    #[must_use]
+    pub fn last_regions(&self) -> Vec<Region> {
+        self.tracks
+            .iter()
+            .map(|track| {
+                *track
+                    .last()
+                    .expect("there should be at least one region in each track")
+            })
+            .collect()
     }
 
     #[must_use]
@@ -67,55 +233,66 @@ impl<'a, V> Tracker<'a, V> {
         self.last_frame
     }
 
-    #[allow(clippy::missing_panics_doc)] // the expectation should always be met
+    /// How many patches have been requested from the patch provider so far. Every fetched patch
+    /// corresponds to one decoded frame.
+    #[must_use]
+    pub fn patches_fetched(&self) -> u64 {
+        self.patches_fetched
+    }
+
+    fn fetch_patch(&mut self, frame: model::FrameNumber, request: PatchRequest) -> PatchResponse {
+        self.patches_fetched += 1;
+        (self.patch_provider)(self.video, frame, request)
+    }
+
+    /// Tracks all markers onto the next frame, or the previous one when tracking backwards. If any
+    /// of them fails to track, the result is a failure and no marker is advanced.
+    #[allow(clippy::missing_panics_doc)] // the expectations should always be met
     pub fn update(&mut self, motion_model: Model) -> TrackResult {
         if self.last_frame == self.end_frame {
             return TrackResult::Termination;
         }
 
-        let last_region = self
-            .track
-            .last()
-            .expect("there should be at least one region in the track");
+        let last_regions = self.last_regions();
 
-        let patch_request = PatchRequest {
-            left: last_region.center.x - self.search_radius,
-            top: last_region.center.y - self.search_radius,
-            width: 2.0 * self.search_radius,
-            height: 2.0 * self.search_radius,
-        };
+        // The patches always cover the largest search area, both around the last position of each
+        // marker and around where it is predicted to be, as the actual one is only decided when
+        // tracking each marker
+        let search_radius = self.search_radius;
+        let window_radius = search_radius * (1.0 + PATCH_MARGIN);
 
-        let patch_response_1 = (self.patch_provider)(self.video, self.last_frame, patch_request);
-        let patch_response_2 = (self.patch_provider)(
-            self.video,
-            self.last_frame + model::FrameDelta(1),
-            patch_request,
-        );
-
-        let image1 = mv::MonochromeImage::new(
-            patch_response_1.data.as_slice(),
-            patch_response_1.width.try_into().unwrap(),
-            patch_response_1.height.try_into().unwrap(),
-        );
-        let image2 = mv::MonochromeImage::new(
-            patch_response_2.data.as_slice(),
-            patch_response_2.width.try_into().unwrap(),
-            patch_response_2.height.try_into().unwrap(),
-        );
+        let patch_request = PatchRequest::enclosing(self.tracks.iter().flat_map(|track| {
+            let last_center = track
+                .last()
+                .expect("there should be at least one region in each track")
+                .center;
+            let predicted_center = predict(track).map_or(last_center, |(region, _)| region.center);
+            [
+                PatchRequest::around(last_center, window_radius),
+                PatchRequest::around(predicted_center, window_radius),
+            ]
+        }));
 
-        // In theory, the two different patch responses might have different origin points,
-        // because the frames might be of a different size.
-        let region1 = last_region.offset(
-            -f64::from(patch_response_1.left),
-            -f64::from(patch_response_1.top),
-        );
-        let predicted_region2 = last_region.offset(
-            -f64::from(patch_response_2.left),
-            -f64::from(patch_response_2.top),
-        );
+        // The patch for the current frame was usually already fetched as the second patch of the
+        // previous step. It can be reused as long as it still covers all search areas.
+        let patch_response_1 = match self.last_patch.take() {
+            Some((last_request, last_response))
+                if last_regions.iter().all(|region| {
+                    PatchRequest::around(region.center, search_radius).is_within(&last_request)
+                }) =>
+            {
+                last_response
+            }
+            _ => self.fetch_patch(self.last_frame, patch_request),
+        };
+        let patch_response_2 = self.fetch_patch(self.last_frame + self.step, patch_request);
 
         let options = mv::TrackRegionOptions {
-            direction: mv::TrackRegionDirection::Forward,
+            direction: if self.step.0 < 0 {
+                mv::TrackRegionDirection::Backward
+            } else {
+                mv::TrackRegionDirection::Forward
+            },
             motion_model,
             num_iterations: 50,
             use_brute: true,
@@ -125,20 +302,431 @@ impl<'a, V> Tracker<'a, V> {
             image1_mask: None,
         };
 
-        let result = mv::track_region(&options, &image1, &image2, &region1, &predicted_region2);
+        let track = |track: &Vec<Region>| {
+            track_marker(
+                &options,
+                &patch_response_1,
+                &patch_response_2,
+                track,
+                search_radius,
+            )
+        };
+
+        let results: Vec<Option<Region>> = self.tracks.par_iter().map(track).collect();
 
-        match result {
-            Some(refined_region2) => {
-                self.track.push(refined_region2.offset(
-                    f64::from(patch_response_2.left),
-                    f64::from(patch_response_2.top),
-                ));
-                self.last_frame += model::FrameDelta(1);
-                TrackResult::Success
+        if results.iter().any(Option::is_none) {
+            return TrackResult::Failure;
+        }
+
+        for (track, result) in self.tracks.iter_mut().zip(results) {
+            track.push(result.expect("all markers were tracked successfully"));
+        }
+        self.last_frame += self.step;
+        self.last_patch = Some((patch_request, patch_response_2));
+        TrackResult::Success
+    }
+}
+
+/// Tracks markers that have been placed at one or more keyframes. Each keyframe starts two
+/// segments: one tracking forward up to the next keyframe, and one tracking backward down to the
+/// previous one. All segments are tracked concurrently, on the same thread pool as the markers
+/// within each segment.
+///
+/// Between two keyframes, the forward segment of the earlier one and the backward segment of the
+/// later one overlap. There, their results are blended, weighted by the distance to each
+/// segment's keyframe, so that drift accumulated by either segment fades out towards the other
+/// keyframe.
+pub struct SegmentTracker<'a, V> {
+    keyframes: Vec<(model::FrameNumber, Vec<Region>)>,
+    segments: Vec<Segment<'a, V>>,
+}
+
+struct Segment<'a, V> {
+    tracker: Tracker<'a, V>,
+    keyframe: model::FrameNumber,
+    finished: bool,
+}
+
+impl<V> Segment<'_, V> {
+    /// The tracked positions of all markers at the given frame, if the segment has reached it.
+    fn regions_at(&self, frame: model::FrameNumber) -> Option<Vec<Region>> {
+        let index = usize::try_from((frame.0 - self.keyframe.0).abs()).ok()?;
+        self.tracker
+            .tracks()
+            .iter()
+            .map(|track| track.get(index).copied())
+            .collect()
+    }
+
+    fn covers(&self, frame: model::FrameNumber) -> bool {
+        let (low, high) = if self.tracker.step.0 < 0 {
+            (self.tracker.end_frame, self.keyframe)
+        } else {
+            (self.keyframe, self.tracker.end_frame)
+        };
+        (low.0..=high.0).contains(&frame.0)
+    }
+}
+
+impl<'a, V: Sync> SegmentTracker<'a, V> {
+    /// Create a new `SegmentTracker` for the frames from `start_frame` to `end_frame`, inclusive.
+    /// Each keyframe gives the positions of all markers at its frame, and all keyframes must have
+    /// the same number of markers. Keyframes outside the range are ignored.
+    ///
+    /// # Panics
+    /// Panics if the keyframes have different numbers of markers, or none at all.
+    pub fn new(
+        video: &'a V,
+        patch_provider: fn(&V, model::FrameNumber, PatchRequest) -> PatchResponse,
+        mut keyframes: Vec<(model::FrameNumber, Vec<Region>)>,
+        search_radius: f64,
+        start_frame: model::FrameNumber,
+        end_frame: model::FrameNumber,
+    ) -> Self {
+        keyframes.retain(|(frame, _)| (start_frame.0..=end_frame.0).contains(&frame.0));
+        keyframes.sort_by_key(|(frame, _)| frame.0);
+        keyframes.dedup_by_key(|(frame, _)| frame.0);
+        if let Some((_, first_markers)) = keyframes.first() {
+            assert!(
+                keyframes
+                    .iter()
+                    .all(|(_, markers)| markers.len() == first_markers.len()),
+                "all keyframes should have the same number of markers"
+            );
+        }
+
+        let mut segments = vec![];
+        for (index, (frame, markers)) in keyframes.iter().enumerate() {
+            let backward_end = index.checked_sub(1).map_or(start_frame, |previous| {
+                keyframes[previous].0 + model::FrameDelta(1)
+            });
+            let forward_end = keyframes
+                .get(index + 1)
+                .map_or(end_frame, |(next, _)| *next - model::FrameDelta(1));
+
+            for segment_end in [backward_end, forward_end] {
+                if segment_end != *frame {
+                    segments.push(Segment {
+                        tracker: Tracker::new(
+                            video,
+                            patch_provider,
+                            markers.clone(),
+                            search_radius,
+                            *frame,
+                            segment_end,
+                        ),
+                        keyframe: *frame,
+                        finished: false,
+                    });
+                }
             }
-            None => TrackResult::Failure,
+        }
+
+        Self {
+            keyframes,
+            segments,
+        }
+    }
+
+    /// Advances every segment that has not finished yet by one frame. Returns the frames whose
+    /// marker positions changed as a result, with their new (blended) positions, or `None` once
+    /// all segments have finished. A segment that fails to track simply ends early; its frames
+    /// are then covered by the other segment overlapping them, if any.
+    pub fn update(
+        &mut self,
+        motion_model: Model,
+    ) -> Option<Vec<(model::FrameNumber, Vec<Region>)>> {
+        if self.segments.iter().all(|segment| segment.finished) {
+            return None;
+        }
+
+        let changed_frames: Vec<model::FrameNumber> = self
+            .segments
+            .par_iter_mut()
+            .filter(|segment| !segment.finished)
+            .filter_map(|segment| {
+                let result = segment.tracker.update(motion_model);
+                segment.finished = result != TrackResult::Success;
+                (!segment.finished).then(|| segment.tracker.last_tracked_frame())
+            })
+            .collect();
+
+        Some(
+            changed_frames
+                .into_iter()
+                .filter_map(|frame| Some((frame, self.regions_at(frame)?)))
+                .collect(),
+        )
+    }
+
+    /// The current marker positions at the given frame, blended from all segments that have
+    /// reached it.
+    #[must_use]
+    pub fn regions_at(&self, frame: model::FrameNumber) -> Option<Vec<Region>> {
+        if let Some((_, markers)) = self
+            .keyframes
+            .iter()
+            .find(|(keyframe, _)| *keyframe == frame)
+        {
+            return Some(markers.clone());
+        }
+
+        // Weight each segment by the distance to the other one's keyframe, so that the closer
+        // keyframe has more influence
+        let mut blended: Option<(Vec<Region>, i32)> = None;
+        for segment in self.segments.iter().filter(|segment| segment.covers(frame)) {
+            let Some(regions) = segment.regions_at(frame) else {
+                continue;
+            };
+            let distance = (frame.0 - segment.keyframe.0).abs();
+
+            blended = Some(match blended {
+                None => (regions, distance),
+                Some((other_regions, other_distance)) => {
+                    let weight = f64::from(other_distance) / f64::from(distance + other_distance);
+                    let mixed = other_regions
+                        .iter()
+                        .zip(&regions)
+                        .map(|(other, region)| mix_regions(other, region, weight))
+                        .collect();
+                    (mixed, distance.min(other_distance))
+                }
+            });
+        }
+
+        blended.map(|(regions, _)| regions)
+    }
+}
+
+/// Linearly interpolates between the corresponding points of two regions, from `a` at a `weight`
+/// of 0 to `b` at 1.
+fn mix_regions(a: &Region, b: &Region, weight: f64) -> Region {
+    let mix = |a: Point, b: Point| Point {
+        x: a.x + (b.x - a.x) * weight,
+        y: a.y + (b.y - a.y) * weight,
+    };
+
+    Region {
+        top_left: mix(a.top_left, b.top_left),
+        top_right: mix(a.top_right, b.top_right),
+        bottom_right: mix(a.bottom_right, b.bottom_right),
+        bottom_left: mix(a.bottom_left, b.bottom_left),
+        center: mix(a.center, b.center),
+    }
+}
+
+/// Predicts where the marker will be in the next frame, assuming it keeps moving the way it did
+/// between the last two frames of its track. Returns the predicted region together with the
+/// distance the marker moved, or `None` if the track is too short to tell.
+fn predict(track: &[Region]) -> Option<(Region, f64)> {
+    let [.., second_to_last_region, last_region] = track else {
+        return None;
+    };
+
+    let velocity_x = last_region.center.x - second_to_last_region.center.x;
+    let velocity_y = last_region.center.y - second_to_last_region.center.y;
+    Some((
+        last_region.offset(velocity_x, velocity_y),
+        velocity_x.hypot(velocity_y),
+    ))
+}
+
+/// Tracks a single marker from the first patch onto the second one, returning its refined position
+/// in frame coordinates.
+///
+/// The search window is centred on the position [`predict`]ed from the recent motion, and only as
+/// large as that motion suggests is necessary, up to `max_search_radius`, because the cost of
+/// brute-force search grows quadratically with its size. As the window moves along with the
+/// marker, even markers moving faster than `max_search_radius` per frame can be tracked. If that
+/// fails, or the motion is not known yet, the whole `max_search_radius` around the last position
+/// is searched.
+fn track_marker(
+    options: &mv::TrackRegionOptions,
+    patch_response_1: &PatchResponse,
+    patch_response_2: &PatchResponse,
+    track: &[Region],
+    max_search_radius: f64,
+) -> Option<Region> {
+    let last_region = track
+        .last()
+        .expect("there should be at least one region in each track");
+
+    if let Some((predicted_region2, speed)) = predict(track) {
+        let adaptive_radius =
+            last_region.extent() + ADAPTIVE_VELOCITY_FACTOR * speed + ADAPTIVE_MARGIN;
+        let result = track_in_window(
+            options,
+            patch_response_1,
+            patch_response_2,
+            last_region,
+            &predicted_region2,
+            adaptive_radius.min(max_search_radius),
+        );
+        if result.is_some() {
+            return result;
         }
     }
+
+    track_in_window(
+        options,
+        patch_response_1,
+        patch_response_2,
+        last_region,
+        last_region,
+        max_search_radius,
+    )
+}
+
+/// How much larger the adaptive search radius is than the distance the marker moved in the last
+/// frame, to allow for acceleration.
+const ADAPTIVE_VELOCITY_FACTOR: f64 = 2.0;
+
+/// Added to the adaptive search radius, so that slow markers still get some room.
+const ADAPTIVE_MARGIN: f64 = 8.0;
+
+/// Search radii above this are first searched at a lower resolution.
+const COARSE_SEARCH_RADIUS: f64 = 24.0;
+
+/// Smallest extent of a marker at a coarse pyramid level. Smaller patterns do not contain enough
+/// detail to be tracked reliably.
+const MIN_COARSE_EXTENT: f64 = 4.0;
+
+const MAX_PYRAMID_LEVELS: u32 = 2;
+
+/// Pixels around the marker that are part of its windows, in addition to its extent. libmv blurs
+/// the images before tracking, which needs some context around the pattern.
+const PATTERN_MARGIN: f64 = 4.0;
+
+/// Tracks `last_region` from the first patch onto the second one, looking for it in a window of the
+/// given radius around `predicted_region2`.
+///
+/// Large windows are searched coarse-to-fine: the marker is first tracked on downsampled copies of
+/// the windows, and the result then refined in a small window at full resolution. Both steps
+/// together are much cheaper than a brute-force search of the whole window at full resolution.
+fn track_in_window(
+    options: &mv::TrackRegionOptions,
+    patch_response_1: &PatchResponse,
+    patch_response_2: &PatchResponse,
+    last_region: &Region,
+    predicted_region2: &Region,
+    search_radius: f64,
+) -> Option<Region> {
+    let extent = last_region.extent();
+    let mut levels = 0;
+    while levels < MAX_PYRAMID_LEVELS
+        && search_radius / f64::from(1_u32 << levels) > COARSE_SEARCH_RADIUS
+        && extent / f64::from(1_u32 << (levels + 1)) >= MIN_COARSE_EXTENT
+    {
+        levels += 1;
+    }
+
+    if levels == 0 {
+        return track_patches(
+            options,
+            &patch_response_1.crop(&PatchRequest::around(
+                last_region.center,
+                extent + PATTERN_MARGIN,
+            )),
+            &patch_response_2.crop(&PatchRequest::around(
+                predicted_region2.center,
+                search_radius,
+            )),
+            last_region,
+            predicted_region2,
+        );
+    }
+
+    let factor = 1_u32 << levels;
+    let coarse_image1 = patch_response_1
+        .crop(&PatchRequest::around(
+            last_region.center,
+            extent + PATTERN_MARGIN * f64::from(factor),
+        ))
+        .downsample(factor);
+    let coarse_image2 = patch_response_2
+        .crop(&PatchRequest::around(
+            predicted_region2.center,
+            search_radius,
+        ))
+        .downsample(factor);
+    let coarse_result = track_patches(
+        options,
+        &coarse_image1,
+        &coarse_image2,
+        &to_coarse(last_region, factor),
+        &to_coarse(predicted_region2, factor),
+    )?;
+    let coarse_region2 = from_coarse(&coarse_result, factor);
+
+    // The coarse result is accurate to about one coarse pixel
+    track_patches(
+        options,
+        &patch_response_1.crop(&PatchRequest::around(
+            last_region.center,
+            extent + PATTERN_MARGIN,
+        )),
+        &patch_response_2.crop(&PatchRequest::around(
+            coarse_region2.center,
+            extent + PATTERN_MARGIN + f64::from(factor),
+        )),
+        last_region,
+        &coarse_region2,
+    )
+}
+
+/// Converts a region in frame coordinates to coordinates of a patch downsampled by `factor`. Each
+/// pixel of that patch covers `factor` × `factor` pixels of the frame, so its centre is offset
+/// from the centres of the pixels it covers.
+fn to_coarse(region: &Region, factor: u32) -> Region {
+    let offset = -f64::from(factor - 1) / 2.0;
+    region.offset(offset, offset).scale(1.0 / f64::from(factor))
+}
+
+/// The inverse of [`to_coarse`].
+fn from_coarse(region: &Region, factor: u32) -> Region {
+    let offset = f64::from(factor - 1) / 2.0;
+    region.scale(f64::from(factor)).offset(offset, offset)
+}
+
+/// Tracks `region1` on the first patch onto the second one. The regions are given and returned in
+/// the coordinate space the patches' origins are in.
+fn track_patches(
+    options: &mv::TrackRegionOptions,
+    patch_response_1: &PatchResponse,
+    patch_response_2: &PatchResponse,
+    region1: &Region,
+    predicted_region2: &Region,
+) -> Option<Region> {
+    let image1 = mv::MonochromeImage::new(
+        patch_response_1.data.as_slice(),
+        patch_response_1.width.try_into().unwrap(),
+        patch_response_1.height.try_into().unwrap(),
+    );
+    let image2 = mv::MonochromeImage::new(
+        patch_response_2.data.as_slice(),
+        patch_response_2.width.try_into().unwrap(),
+        patch_response_2.height.try_into().unwrap(),
+    );
+
+    // In theory, the two different patch responses might have different origin points,
+    // because the frames might be of a different size.
+    let region1 = region1.offset(
+        -f64::from(patch_response_1.left),
+        -f64::from(patch_response_1.top),
+    );
+    let predicted_region2 = predicted_region2.offset(
+        -f64::from(patch_response_2.left),
+        -f64::from(patch_response_2.top),
+    );
+
+    mv::track_region(options, &image1, &image2, &region1, &predicted_region2).map(
+        |refined_region2| {
+            refined_region2.offset(
+                f64::from(patch_response_2.left),
+                f64::from(patch_response_2.top),
+            )
+        },
+    )
 }
 
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
@@ -153,16 +741,15 @@ mod tests {
     use super::super::video;
     use super::*;
 
-    #[test]
-    fn motion_track() {
-        let video =
-            video::Video::load(crate::test_utils::test_file("test_files/cube_av1.mkv")).unwrap();
+    fn load_video() -> video::Video {
+        video::Video::load(crate::test_utils::test_file("test_files/cube_av1.mkv")).unwrap()
+    }
 
-        let initial_marker = Region::from_center_and_radius(Point { x: 272.0, y: 81.0 }, 10.0);
+    fn track_to_end(video: &video::Video, initial_markers: Vec<Region>) -> Tracker<video::Video> {
         let mut tracker = Tracker::new(
-            &video,
+            video,
             video::Video::get_libmv_patch,
-            initial_marker,
+            initial_markers,
             60.0,
             model::FrameNumber(0),
             model::FrameNumber(99),
@@ -172,12 +759,264 @@ mod tests {
         while last_result == TrackResult::Success {
             last_result = tracker.update(Model::Translation);
         }
+        assert_eq!(last_result, TrackResult::Termination);
+
+        // Apart from the very first frame, every frame should only have to be decoded once
+        #[allow(clippy::cast_precision_loss)]
+        let fetches_per_frame = tracker.patches_fetched() as f64 / 99.0;
+        println!("{fetches_per_frame:.3} frames decoded per tracked frame");
+        assert!(fetches_per_frame < 1.1);
+
+        tracker
+    }
+
+    fn assert_near(region: &Region, x: f64, y: f64) {
+        println!("{region:?}");
+        assert!((region.center.x - x).abs() < 2.0);
+        assert!((region.center.y - y).abs() < 2.0);
+    }
+
+    #[test]
+    fn motion_track() {
+        let initial_marker = Region::from_center_and_radius(Point { x: 272.0, y: 81.0 }, 10.0);
+        let video = load_video();
+        let tracker = track_to_end(&video, vec![initial_marker]);
+
+        assert_eq!(tracker.tracks()[0].len(), 100);
+        assert_near(tracker.tracks()[0].last().unwrap(), 45.0, 81.0);
+    }
+
+    #[test]
+    fn motion_track_multiple() {
+        // The same marker twice, and once shifted by a few pixels, which should move the same way
+        let initial_markers = vec![
+            Region::from_center_and_radius(Point { x: 272.0, y: 81.0 }, 10.0),
+            Region::from_center_and_radius(Point { x: 272.0, y: 81.0 }, 10.0),
+            Region::from_center_and_radius(Point { x: 270.0, y: 84.0 }, 10.0),
+        ];
+        let video = load_video();
+        let tracker = track_to_end(&video, initial_markers);
+
+        for track in tracker.tracks() {
+            assert_eq!(track.len(), 100);
+        }
+        let last_regions = tracker.last_regions();
+        assert_near(&last_regions[0], 45.0, 81.0);
+        assert_near(&last_regions[1], 45.0, 81.0);
+        assert_near(&last_regions[2], 43.0, 84.0);
+    }
+
+    /// A video of a textured blob on a plain background that moves horizontally, first slowly, then
+    /// faster than any search radius used for tracking.
+    struct FastMotion;
+
+    impl FastMotion {
+        const WIDTH: u32 = 640;
+        const HEIGHT: u32 = 160;
+        const CENTER_Y: f64 = 80.0;
+
+        fn center_x(frame: model::FrameNumber) -> f64 {
+            match frame.0 {
+                0 => 100.0,
+                frame => 140.0 + 80.0 * f64::from(frame - 1),
+            }
+        }
+
+        fn intensity(x: f64, y: f64) -> f32 {
+            let blob = |center_x: f64, center_y: f64, sigma: f64, amplitude: f64| {
+                let distance_squared = (x - center_x).powi(2) + (y - center_y).powi(2);
+                amplitude * (-distance_squared / (2.0 * sigma * sigma)).exp()
+            };
+
+            #[allow(clippy::cast_possible_truncation)]
+            let value = (0.3
+                + blob(-5.0, -3.0, 3.0, 0.6)
+                + blob(4.0, 2.0, 2.0, 0.5)
+                + blob(1.0, 6.0, 2.5, -0.25)) as f32;
+            value
+        }
+
+        #[allow(clippy::cast_sign_loss, clippy::cast_possible_truncation)]
+        fn get_patch(&self, frame: model::FrameNumber, request: PatchRequest) -> PatchResponse {
+            let left = request.left.clamp(0.0, f64::from(Self::WIDTH)).floor() as u32;
+            let top = request.top.clamp(0.0, f64::from(Self::HEIGHT)).floor() as u32;
+            let width = request
+                .width
+                .clamp(0.0, f64::from(Self::WIDTH - left))
+                .ceil() as u32;
+            let height = request
+                .height
+                .clamp(0.0, f64::from(Self::HEIGHT - top))
+                .ceil() as u32;
 
+            let center_x = Self::center_x(frame);
+            let mut data = Vec::with_capacity(width as usize * height as usize);
+            for row in top..(top + height) {
+                for col in left..(left + width) {
+                    data.push(Self::intensity(
+                        f64::from(col) - center_x,
+                        f64::from(row) - Self::CENTER_Y,
+                    ));
+                }
+            }
+
+            PatchResponse {
+                data,
+                left,
+                top,
+                width,
+                height,
+            }
+        }
+    }
+
+    #[test]
+    fn motion_track_fast() {
+        let mut tracker = Tracker::new(
+            &FastMotion,
+            FastMotion::get_patch,
+            vec![Region::from_center_and_radius(
+                Point {
+                    x: FastMotion::center_x(model::FrameNumber(0)),
+                    y: FastMotion::CENTER_Y,
+                },
+                10.0,
+            )],
+            60.0,
+            model::FrameNumber(0),
+            model::FrameNumber(5),
+        );
+
+        let mut last_result = TrackResult::Success;
+        while last_result == TrackResult::Success {
+            last_result = tracker.update(Model::Translation);
+        }
         assert_eq!(last_result, TrackResult::Termination);
-        assert_eq!(tracker.track().len(), 100);
-        let last_region = tracker.track().last().unwrap();
-        println!("{last_region:?}");
-        assert!((last_region.center.x - 45.0).abs() < 2.0);
-        assert!((last_region.center.y - 81.0).abs() < 2.0);
+
+        // From the second frame on, the blob moves 80 pixels per frame, beyond the search radius
+        for (frame, region) in (0..).zip(&tracker.tracks()[0]) {
+            assert_near(
+                region,
+                FastMotion::center_x(model::FrameNumber(frame)),
+                FastMotion::CENTER_Y,
+            );
+        }
+    }
+
+    #[test]
+    fn motion_track_segments() {
+        let video = load_video();
+
+        // Seed the marker in the middle, and track both ways towards the ends
+        let mut forward = Tracker::new(
+            &video,
+            video::Video::get_libmv_patch,
+            vec![Region::from_center_and_radius(
+                Point { x: 272.0, y: 81.0 },
+                10.0,
+            )],
+            60.0,
+            model::FrameNumber(0),
+            model::FrameNumber(50),
+        );
+        while forward.update(Model::Translation) == TrackResult::Success {}
+        let middle_marker = forward.last_regions();
+
+        let mut tracker = SegmentTracker::new(
+            &video,
+            video::Video::get_libmv_patch,
+            vec![(model::FrameNumber(50), middle_marker)],
+            60.0,
+            model::FrameNumber(0),
+            model::FrameNumber(99),
+        );
+        let mut updated_frames = 0;
+        while let Some(updates) = tracker.update(Model::Translation) {
+            updated_frames += updates.len();
+        }
+
+        // Every frame but the keyframe itself should have been tracked by one of the segments
+        assert_eq!(updated_frames, 99);
+        assert_near(
+            &tracker.regions_at(model::FrameNumber(0)).unwrap()[0],
+            272.0,
+            81.0,
+        );
+        assert_near(
+            &tracker.regions_at(model::FrameNumber(99)).unwrap()[0],
+            45.0,
+            81.0,
+        );
+    }
+
+    #[test]
+    fn motion_track_segments_blend() {
+        fn track_range(
+            video: &video::Video,
+            marker: Region,
+            start_frame: i32,
+            end_frame: i32,
+        ) -> Tracker<video::Video> {
+            let mut tracker = Tracker::new(
+                video,
+                video::Video::get_libmv_patch,
+                vec![marker],
+                60.0,
+                model::FrameNumber(start_frame),
+                model::FrameNumber(end_frame),
+            );
+            while tracker.update(Model::Translation) == TrackResult::Success {}
+            tracker
+        }
+
+        let video = load_video();
+
+        // The marker on the second keyframe is placed a few pixels off from where the first one
+        // ends up, like markers placed by hand would be, so that the segments disagree
+        let first_marker = Region::from_center_and_radius(Point { x: 272.0, y: 81.0 }, 10.0);
+        let tracked = track_range(&video, first_marker, 0, 40).last_regions()[0];
+        let second_marker = Region::from_center_and_radius(tracked.center.offset(-2.0, 3.0), 10.0);
+
+        // What each keyframe's segment tracks on its own, towards the other keyframe
+        let forward = track_range(&video, first_marker, 0, 39);
+        let backward = track_range(&video, second_marker, 40, 1);
+
+        let mut tracker = SegmentTracker::new(
+            &video,
+            video::Video::get_libmv_patch,
+            vec![
+                (model::FrameNumber(0), vec![first_marker]),
+                (model::FrameNumber(40), vec![second_marker]),
+            ],
+            60.0,
+            model::FrameNumber(0),
+            model::FrameNumber(40),
+        );
+        while tracker.update(Model::Translation).is_some() {}
+
+        for frame in [10, 30] {
+            let from_first = forward.tracks()[0][frame].center;
+            let from_second = backward.tracks()[0][40 - frame].center;
+            assert!((from_second.y - from_first.y).abs() > 1.0);
+
+            // Both segments overlap here; the nearer keyframe's one has more weight
+            #[allow(clippy::cast_precision_loss)]
+            let weight = frame as f64 / 40.0;
+            let blended = tracker
+                .regions_at(model::FrameNumber(i32::try_from(frame).unwrap()))
+                .unwrap()[0]
+                .center;
+            println!("frame {frame}: {from_first:?} and {from_second:?} blended to {blended:?}");
+            assert!(
+                (blended.x - (from_first.x + (from_second.x - from_first.x) * weight)).abs() < 0.01
+            );
+            assert!(
+                (blended.y - (from_first.y + (from_second.y - from_first.y) * weight)).abs() < 0.01
+            );
+
+            let nearer = if frame < 20 { from_first } else { from_second };
+            let farther = if frame < 20 { from_second } else { from_first };
+            assert!((blended.y - nearer.y).abs() < (blended.y - farther.y).abs());
+        }
     }
 }
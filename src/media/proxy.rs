@@ -0,0 +1,571 @@
+//! Low-resolution proxies of videos that are too heavy to decode interactively, like 4K HEVC. A
+//! proxy holds every frame of the video downscaled to display size and compressed on its own, as
+//! JPEG, so any frame can be read without seeking in the source or decoding other frames. The
+//! video decoder shows proxy frames during playback and while scrubbing, and switches to the
+//! full-resolution source once the position has settled.
+//!
+//! Proxies are generated in the background and kept in a per-user cache, next to the index cache.
+//! A proxy file consists of a header, a table with one entry per frame giving the offset and length
+//! of its JPEG data, and the JPEG data itself, which is appended in whatever order frames are
+//! generated. A table entry is only written once its data is complete, so a proxy that is still
+//! being generated, or whose generation was interrupted, can be read all the same.
+
+use std::fs;
+use std::io::{self, Read, Seek, SeekFrom, Write};
+use std::path::{Path, PathBuf};
+use std::time::Duration;
+
+use thiserror::Error;
+
+use crate::model;
+
+use super::index_cache;
+
+/// Height proxies are downscaled to, at most.
+pub const MAX_HEIGHT: u32 = 360;
+
+/// Videos at least this tall always get a proxy, as decoding them at full size is too slow for
+/// interactive use whatever their codec.
+const MIN_SOURCE_HEIGHT: u32 = 2160;
+
+/// Smaller videos only get a proxy if decoding one of their frames takes longer than this share of
+/// the time it is shown for, e.g. because of a high bit depth or an expensive codec.
+const MAX_DECODE_SHARE: f64 = 0.5;
+
+const JPEG_QUALITY: u8 = 85;
+
+const EXTENSION: &str = "proxy";
+const MAGIC: &[u8; 8] = b"SMKPROXY";
+const VERSION: u32 = 1;
+
+const HEADER_LEN: usize = 32;
+const ENTRY_LEN: usize = 12;
+
+/// Per-user cache of proxy files, kept below a size limit like [`super::IndexCache`].
+#[derive(Debug, Clone)]
+pub struct Cache {
+    dir: PathBuf,
+    max_bytes: u64,
+}
+
+impl Cache {
+    /// Default size limit of the cache. A proxy of a 24 minute episode takes up around one
+    /// gigabyte.
+    pub const DEFAULT_MAX_BYTES: u64 = 8 << 30;
+
+    #[must_use]
+    pub fn new(dir: PathBuf, max_bytes: u64) -> Self {
+        Self { dir, max_bytes }
+    }
+
+    /// The cache in the current user's cache directory, with the default size limit.
+    #[must_use]
+    pub fn for_user() -> Self {
+        Self::new(
+            index_cache::user_cache_dir().join("samaku").join("proxy"),
+            Self::DEFAULT_MAX_BYTES,
+        )
+    }
+
+    /// Returns the path of the proxy file for the given source file, which may not exist yet. An
+    /// existing one is marked as recently used.
+    ///
+    /// # Errors
+    /// Returns an error if the source file cannot be accessed, or if the cache directory cannot be
+    /// created.
+    pub fn path_for(&self, source: &Path) -> io::Result<PathBuf> {
+        fs::create_dir_all(&self.dir)?;
+        let path = self
+            .dir
+            .join(index_cache::source_file_name(source, EXTENSION)?);
+
+        match index_cache::touch(&path) {
+            Err(err) if err.kind() != io::ErrorKind::NotFound => Err(err),
+            _ => Ok(path),
+        }
+    }
+
+    /// Deletes the least recently used proxy files until the cache fits within its size limit,
+    /// except for the given one, which is in use.
+    ///
+    /// # Errors
+    /// Returns an error if the cache directory cannot be read.
+    pub fn evict(&self, in_use: &Path) -> io::Result<()> {
+        index_cache::evict_least_recently_used(&self.dir, EXTENSION, self.max_bytes, in_use)
+    }
+}
+
+/// Size of the frames in a proxy, and how many there are.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Dimensions {
+    pub width: u32,
+    pub height: u32,
+    pub num_frames: u32,
+}
+
+impl Dimensions {
+    /// The proxy dimensions for a video, keeping its aspect ratio. Returns `None` if the video is
+    /// no taller than a proxy already. Whether the video needs a proxy at all is decided by
+    /// [`needs_proxy`].
+    #[must_use]
+    pub fn for_video(metadata: &super::VideoMetadata) -> Option<Self> {
+        let source_width = u32::try_from(metadata.width).ok()?;
+        let source_height = u32::try_from(metadata.height).ok()?;
+        let num_frames = u32::try_from(metadata.num_frames).ok()?;
+        if source_height <= MAX_HEIGHT || num_frames == 0 {
+            return None;
+        }
+
+        // Even sizes scale more cleanly and are what encoders expect
+        let height = MAX_HEIGHT;
+        let width = u32::try_from(
+            (u64::from(source_width) * u64::from(height) / u64::from(source_height)) & !1,
+        )
+        .ok()?
+        .max(2);
+
+        Some(Self {
+            width,
+            height,
+            num_frames,
+        })
+    }
+
+    fn table_len(self) -> u64 {
+        u64::from(self.num_frames) * ENTRY_LEN as u64
+    }
+
+    fn data_start(self) -> u64 {
+        HEADER_LEN as u64 + self.table_len()
+    }
+
+    fn frame_index(self, frame: model::FrameNumber) -> Option<usize> {
+        u32::try_from(frame.0)
+            .ok()
+            .filter(|index| *index < self.num_frames)
+            .map(|index| index as usize)
+    }
+}
+
+#[derive(Debug, Clone, Copy, Default)]
+struct Entry {
+    offset: u64,
+    len: u32,
+}
+
+impl Entry {
+    fn is_present(self) -> bool {
+        self.len > 0
+    }
+
+    fn to_bytes(self) -> [u8; ENTRY_LEN] {
+        let mut bytes = [0; ENTRY_LEN];
+        bytes[0..8].copy_from_slice(&self.offset.to_le_bytes());
+        bytes[8..12].copy_from_slice(&self.len.to_le_bytes());
+        bytes
+    }
+
+    fn from_bytes(bytes: &[u8]) -> Self {
+        Self {
+            offset: u64::from_le_bytes(bytes[0..8].try_into().unwrap()),
+            len: u32::from_le_bytes(bytes[8..12].try_into().unwrap()),
+        }
+    }
+}
+
+fn entry_position(index: usize) -> u64 {
+    (HEADER_LEN + index * ENTRY_LEN) as u64
+}
+
+fn header_bytes(dimensions: Dimensions) -> [u8; HEADER_LEN] {
+    let mut bytes = [0; HEADER_LEN];
+    bytes[0..8].copy_from_slice(MAGIC);
+    bytes[8..12].copy_from_slice(&VERSION.to_le_bytes());
+    bytes[12..16].copy_from_slice(&dimensions.width.to_le_bytes());
+    bytes[16..20].copy_from_slice(&dimensions.height.to_le_bytes());
+    bytes[20..24].copy_from_slice(&dimensions.num_frames.to_le_bytes());
+    bytes
+}
+
+fn read_header(file: &mut fs::File) -> Result<Dimensions, Error> {
+    let mut bytes = [0; HEADER_LEN];
+    file.seek(SeekFrom::Start(0))?;
+    file.read_exact(&mut bytes)?;
+
+    if &bytes[0..8] != MAGIC {
+        return Err(Error::Corrupted("not a proxy file"));
+    }
+    if u32::from_le_bytes(bytes[8..12].try_into().unwrap()) != VERSION {
+        return Err(Error::Corrupted("unsupported proxy version"));
+    }
+
+    let read_u32 = |start: usize| u32::from_le_bytes(bytes[start..start + 4].try_into().unwrap());
+    let dimensions = Dimensions {
+        width: read_u32(12),
+        height: read_u32(16),
+        num_frames: read_u32(20),
+    };
+
+    if file.metadata()?.len() < dimensions.data_start() {
+        return Err(Error::Corrupted("truncated frame table"));
+    }
+
+    Ok(dimensions)
+}
+
+/// Adds frames to a proxy file.
+pub struct Writer {
+    file: fs::File,
+    dimensions: Dimensions,
+    entries: Vec<Entry>,
+    end: u64,
+}
+
+impl Writer {
+    /// Opens the proxy file at the given path to add the frames that are still missing. If it does
+    /// not exist, or has different dimensions, it is created anew.
+    ///
+    /// # Errors
+    /// Returns an error if the file cannot be read or written.
+    pub fn open(path: &Path, dimensions: Dimensions) -> Result<Self, Error> {
+        let mut file = fs::File::options()
+            .read(true)
+            .write(true)
+            .create(true)
+            .truncate(false)
+            .open(path)?;
+
+        let existing = match read_header(&mut file) {
+            Ok(existing) => Some(existing),
+            Err(Error::Io(err)) if err.kind() != io::ErrorKind::UnexpectedEof => {
+                return Err(Error::Io(err))
+            }
+            Err(_) => None,
+        };
+
+        if existing == Some(dimensions) {
+            let mut table = vec![0; usize::try_from(dimensions.table_len()).unwrap_or(usize::MAX)];
+            file.seek(SeekFrom::Start(HEADER_LEN as u64))?;
+            file.read_exact(&mut table)?;
+
+            // Frames whose data lies beyond the end of the file were cut off, for example by a
+            // full disk, so they are generated again
+            let end = file.metadata()?.len();
+            let entries = table
+                .chunks_exact(ENTRY_LEN)
+                .map(Entry::from_bytes)
+                .map(|entry| {
+                    if entry.offset + u64::from(entry.len) <= end {
+                        entry
+                    } else {
+                        Entry::default()
+                    }
+                })
+                .collect();
+
+            return Ok(Self {
+                file,
+                dimensions,
+                entries,
+                end,
+            });
+        }
+
+        // Write the empty table first, and the header last, so that readers never see a header
+        // without a table
+        file.set_len(0)?;
+        file.set_len(dimensions.data_start())?;
+        file.seek(SeekFrom::Start(0))?;
+        file.write_all(&header_bytes(dimensions))?;
+
+        Ok(Self {
+            file,
+            dimensions,
+            entries: vec![Entry::default(); dimensions.num_frames as usize],
+            end: dimensions.data_start(),
+        })
+    }
+
+    #[must_use]
+    pub fn dimensions(&self) -> Dimensions {
+        self.dimensions
+    }
+
+    /// The first frame at or after `from` that has not been added yet, wrapping around to the
+    /// start of the video. Returns `None` if the proxy is complete.
+    #[must_use]
+    pub fn next_missing(&self, from: model::FrameNumber) -> Option<model::FrameNumber> {
+        let start = self.dimensions.frame_index(from).unwrap_or(0);
+        let (before, after) = self.entries.split_at(start);
+        let position = |entries: &[Entry]| entries.iter().position(|entry| !entry.is_present());
+
+        let index = position(after)
+            .map(|index| start + index)
+            .or_else(|| position(before))?;
+        Some(model::FrameNumber(i32::try_from(index).ok()?))
+    }
+
+    /// Compresses and adds a frame, given as packed 8-bit RGB samples.
+    ///
+    /// # Errors
+    /// Returns an error if the frame is out of range or has the wrong size, or if it cannot be
+    /// compressed or written.
+    pub fn add_frame(&mut self, frame: model::FrameNumber, rgb: &[u8]) -> Result<(), Error> {
+        let index = self
+            .dimensions
+            .frame_index(frame)
+            .ok_or(Error::Corrupted("frame out of range"))?;
+        if rgb.len() != self.dimensions.width as usize * self.dimensions.height as usize * 3 {
+            return Err(Error::Corrupted("frame has the wrong size"));
+        }
+
+        let mut jpeg = vec![];
+        image::codecs::jpeg::JpegEncoder::new_with_quality(&mut jpeg, JPEG_QUALITY).encode(
+            rgb,
+            self.dimensions.width,
+            self.dimensions.height,
+            image::ColorType::Rgb8,
+        )?;
+
+        let entry = Entry {
+            offset: self.end,
+            len: u32::try_from(jpeg.len()).map_err(|_| Error::Corrupted("frame too large"))?,
+        };
+        self.file.seek(SeekFrom::Start(entry.offset))?;
+        self.file.write_all(&jpeg)?;
+        self.file.seek(SeekFrom::Start(entry_position(index)))?;
+        self.file.write_all(&entry.to_bytes())?;
+
+        self.end += jpeg.len() as u64;
+        self.entries[index] = entry;
+        Ok(())
+    }
+}
+
+/// Reads frames from a proxy file, which may still be being generated.
+pub struct Reader {
+    file: fs::File,
+    dimensions: Dimensions,
+}
+
+impl Reader {
+    /// Opens the proxy file at the given path.
+    ///
+    /// # Errors
+    /// Returns an error if the file does not exist or is not a valid proxy file.
+    pub fn open(path: &Path) -> Result<Self, Error> {
+        let mut file = fs::File::open(path)?;
+        let dimensions = read_header(&mut file)?;
+        Ok(Self { file, dimensions })
+    }
+
+    #[must_use]
+    pub fn dimensions(&self) -> Dimensions {
+        self.dimensions
+    }
+
+    /// Reads the given frame as RGBA pixels, as `iced` expects them. Returns `None` if the frame
+    /// has not been generated yet.
+    ///
+    /// # Errors
+    /// Returns an error if the frame cannot be read or decompressed.
+    pub fn read_frame(&mut self, frame: model::FrameNumber) -> Result<Option<Vec<u8>>, Error> {
+        let Some(index) = self.dimensions.frame_index(frame) else {
+            return Ok(None);
+        };
+
+        let mut entry_bytes = [0; ENTRY_LEN];
+        self.file.seek(SeekFrom::Start(entry_position(index)))?;
+        self.file.read_exact(&mut entry_bytes)?;
+        let entry = Entry::from_bytes(&entry_bytes);
+        if !entry.is_present() {
+            return Ok(None);
+        }
+        if entry.offset < self.dimensions.data_start() {
+            return Err(Error::Corrupted("frame data overlaps the table"));
+        }
+
+        let mut jpeg = vec![0; entry.len as usize];
+        self.file.seek(SeekFrom::Start(entry.offset))?;
+        self.file.read_exact(&mut jpeg)?;
+
+        let image = image::load_from_memory_with_format(&jpeg, image::ImageFormat::Jpeg)?;
+        if image.width() != self.dimensions.width || image.height() != self.dimensions.height {
+            return Err(Error::Corrupted("frame has the wrong size"));
+        }
+
+        Ok(Some(image.into_rgba8().into_raw()))
+    }
+
+    /// Like [`Reader::read_frame`], but returns the frame in `iced`'s format.
+    ///
+    /// # Errors
+    /// See [`Reader::read_frame`].
+    pub fn read_iced_frame(
+        &mut self,
+        frame: model::FrameNumber,
+    ) -> Result<Option<iced::widget::image::Handle>, Error> {
+        let dimensions = self.dimensions;
+        Ok(self.read_frame(frame)?.map(|pixels| {
+            iced::widget::image::Handle::from_pixels(dimensions.width, dimensions.height, pixels)
+        }))
+    }
+}
+
+/// Whether a video is expensive enough to decode that it should get a proxy. Videos of at least
+/// [`MIN_SOURCE_HEIGHT`] always do; for smaller ones, `measure_decode_time` is called to find out
+/// how long decoding one frame takes.
+pub fn needs_proxy<F: FnOnce() -> Duration>(
+    metadata: &super::VideoMetadata,
+    measure_decode_time: F,
+) -> bool {
+    if u32::try_from(metadata.height).map_or(false, |height| height >= MIN_SOURCE_HEIGHT) {
+        return true;
+    }
+
+    measure_decode_time().as_secs_f64() * f64::from(metadata.frame_rate) > MAX_DECODE_SHARE
+}
+
+#[derive(Debug, Error)]
+pub enum Error {
+    #[error("I/O error: {0}")]
+    Io(#[from] io::Error),
+
+    #[error("Failed to compress or decompress proxy frame: {0}")]
+    Image(#[from] image::ImageError),
+
+    #[error("Proxy file is corrupted: {0}")]
+    Corrupted(&'static str),
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn temp_path(name: &str) -> PathBuf {
+        std::env::temp_dir().join(format!("samaku-proxy-{name}-{}.proxy", std::process::id()))
+    }
+
+    /// A frame filled with a single colour that depends on the frame number.
+    fn solid_frame(dimensions: Dimensions, frame: i32) -> Vec<u8> {
+        let colour = [
+            u8::try_from(frame * 40).unwrap(),
+            128,
+            255 - u8::try_from(frame * 40).unwrap(),
+        ];
+        colour.repeat(dimensions.width as usize * dimensions.height as usize)
+    }
+
+    #[test]
+    fn dimensions() {
+        let metadata = |width, height| crate::media::VideoMetadata {
+            frame_rate: crate::media::FrameRate {
+                numerator: 24000,
+                denominator: 1001,
+            },
+            width,
+            height,
+            num_frames: 100,
+        };
+
+        assert_eq!(
+            Dimensions::for_video(&metadata(3840, 2160)),
+            Some(Dimensions {
+                width: 640,
+                height: 360,
+                num_frames: 100
+            })
+        );
+        assert_eq!(
+            Dimensions::for_video(&metadata(1440, 1080)).map(|dimensions| dimensions.width),
+            Some(480)
+        );
+        assert_eq!(Dimensions::for_video(&metadata(640, 360)), None);
+    }
+
+    #[test]
+    fn needs_proxy() {
+        let metadata = |height| crate::media::VideoMetadata {
+            frame_rate: crate::media::FrameRate {
+                numerator: 24000,
+                denominator: 1001,
+            },
+            width: height * 16 / 9,
+            height,
+            num_frames: 100,
+        };
+
+        // 4K always needs one, without measuring
+        assert!(super::needs_proxy(&metadata(2160), || unreachable!()));
+
+        // Smaller videos only if they decode too slowly to keep up with playback
+        assert!(!super::needs_proxy(&metadata(1080), || {
+            Duration::from_millis(5)
+        }));
+        assert!(super::needs_proxy(&metadata(1080), || {
+            Duration::from_millis(30)
+        }));
+    }
+
+    #[test]
+    fn write_and_read() {
+        let path = temp_path("write-and-read");
+        let _ = fs::remove_file(&path);
+        let dimensions = Dimensions {
+            width: 32,
+            height: 18,
+            num_frames: 5,
+        };
+
+        let mut writer = Writer::open(&path, dimensions).unwrap();
+        assert_eq!(
+            writer.next_missing(model::FrameNumber(3)),
+            Some(model::FrameNumber(3))
+        );
+        for frame in [3, 4, 0] {
+            writer
+                .add_frame(model::FrameNumber(frame), &solid_frame(dimensions, frame))
+                .unwrap();
+        }
+        assert_eq!(
+            writer.next_missing(model::FrameNumber(3)),
+            Some(model::FrameNumber(1))
+        );
+
+        // Readers see frames while the proxy is still being generated
+        let mut reader = Reader::open(&path).unwrap();
+        assert_eq!(reader.dimensions(), dimensions);
+        assert!(reader.read_frame(model::FrameNumber(1)).unwrap().is_none());
+        assert!(reader.read_frame(model::FrameNumber(5)).unwrap().is_none());
+        let pixels = reader.read_frame(model::FrameNumber(4)).unwrap().unwrap();
+        assert_eq!(pixels.len(), 32 * 18 * 4);
+        for (sample, expected) in pixels[0..4].iter().zip([160, 128, 95, 255]) {
+            assert!(sample.abs_diff(expected) <= 4);
+        }
+
+        // Reopening keeps the frames that are already there
+        drop(writer);
+        let writer = Writer::open(&path, dimensions).unwrap();
+        assert_eq!(
+            writer.next_missing(model::FrameNumber(0)),
+            Some(model::FrameNumber(1))
+        );
+
+        // Different dimensions start over
+        let other = Dimensions {
+            num_frames: 6,
+            ..dimensions
+        };
+        let writer = Writer::open(&path, other).unwrap();
+        assert_eq!(
+            writer.next_missing(model::FrameNumber(4)),
+            Some(model::FrameNumber(4))
+        );
+        assert!(Writer::open(&path, other)
+            .unwrap()
+            .add_frame(model::FrameNumber(0), &[0; 3])
+            .is_err());
+
+        fs::remove_file(&path).unwrap();
+    }
+}
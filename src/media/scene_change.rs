@@ -0,0 +1,325 @@
+//! Scene change detection, to generate keyframes for videos whose codec keyframes do not line up
+//! with scene changes. Frames are compared on small greyscale thumbnails, using the mean absolute
+//! difference between corresponding pixels and the difference between their luma histograms. A
+//! scene change needs both to be large: a large pixel difference alone also occurs with fast
+//! motion, a large histogram difference alone with flashes and fades.
+
+use std::ops::Range;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::thread;
+
+use crate::model::{self, keyframes::Keyframes};
+
+/// Height thumbnails are downscaled to, at most.
+pub const THUMBNAIL_HEIGHT: u32 = 120;
+
+/// Mean absolute difference between pixels, out of 255, above which frames may belong to different
+/// scenes.
+const MEAN_DIFFERENCE_THRESHOLD: f32 = 20.0;
+
+/// Histogram difference, between 0 and 1, above which frames may belong to different scenes.
+const HISTOGRAM_DIFFERENCE_THRESHOLD: f32 = 0.25;
+
+/// Scene changes closer than this to the previous one are ignored.
+const MIN_KEYFRAME_INTERVAL: i32 = 5;
+
+/// Segments are not made shorter than this, so that threads do not spend more time on decoding
+/// frames that are shared between segments than on their own frames.
+const MIN_SEGMENT_FRAMES: usize = 64;
+
+const HISTOGRAM_BINS: usize = 64;
+const HISTOGRAM_SHIFT: u32 = 2;
+
+/// Number of pixels compared at once, so that the compiler can vectorise the comparison.
+const LANES: usize = 32;
+
+/// A downscaled greyscale frame.
+#[derive(Debug, Clone)]
+pub struct Thumbnail {
+    pub width: usize,
+    pub height: usize,
+    pub data: Vec<u8>,
+}
+
+/// How different two consecutive frames are.
+#[derive(Debug, Clone, Copy)]
+pub struct Difference {
+    /// Mean absolute difference between corresponding pixels, out of 255.
+    pub mean: f32,
+
+    /// Half the sum of absolute differences between the normalised histograms, between 0 and 1.
+    pub histogram: f32,
+}
+
+impl Difference {
+    #[must_use]
+    pub fn is_scene_change(self) -> bool {
+        self.mean > MEAN_DIFFERENCE_THRESHOLD && self.histogram > HISTOGRAM_DIFFERENCE_THRESHOLD
+    }
+}
+
+/// A thumbnail together with its histogram, which is needed for the comparisons with both the
+/// previous and the next frame.
+struct AnalysedFrame {
+    thumbnail: Thumbnail,
+    histogram: [u32; HISTOGRAM_BINS],
+}
+
+impl AnalysedFrame {
+    fn new(thumbnail: Thumbnail) -> Self {
+        let histogram = histogram(&thumbnail.data);
+        Self {
+            thumbnail,
+            histogram,
+        }
+    }
+
+    fn difference(&self, next: &Self) -> Difference {
+        let pixels = self
+            .thumbnail
+            .data
+            .len()
+            .min(next.thumbnail.data.len())
+            .max(1);
+
+        #[allow(clippy::cast_precision_loss)]
+        let mean = sum_of_absolute_differences(&self.thumbnail.data, &next.thumbnail.data) as f32
+            / pixels as f32;
+
+        let histogram_sum: u32 = self
+            .histogram
+            .iter()
+            .zip(&next.histogram)
+            .map(|(count, next_count)| count.abs_diff(*next_count))
+            .sum();
+
+        #[allow(clippy::cast_precision_loss)]
+        let histogram = histogram_sum as f32 / (2 * pixels) as f32;
+
+        Difference { mean, histogram }
+    }
+}
+
+/// Detects scene changes within the given range of frames, and returns them as keyframes. The
+/// first frame of the range is always a keyframe.
+///
+/// The range is split into segments that are analysed on `threads` threads in parallel. The
+/// `provider` is called to obtain a thumbnail of at most the given height for a frame.
+///
+/// Every thread stops after its current frame once `cancelled` is set, in which case `None` is
+/// returned.
+pub fn detect<V, F>(
+    video: &V,
+    provider: F,
+    frames: Range<i32>,
+    threads: usize,
+    cancelled: &AtomicBool,
+) -> Option<Keyframes>
+where
+    V: Sync,
+    F: Fn(&V, model::FrameNumber, u32) -> Thumbnail + Sync,
+{
+    if frames.is_empty() {
+        return Some(Keyframes::default());
+    }
+
+    let frame_count = frames.len();
+    let segment_count = threads.min(frame_count / MIN_SEGMENT_FRAMES).max(1);
+    let segment_len = i32::try_from(frame_count.div_ceil(segment_count)).unwrap_or(i32::MAX);
+
+    let provider = &provider;
+    let mut scene_changes: Vec<model::FrameNumber> = thread::scope(|scope| {
+        let handles: Vec<_> = (frames.start..frames.end)
+            .step_by(usize::try_from(segment_len).unwrap_or(1))
+            .map(|segment_start| {
+                let segment =
+                    segment_start..segment_start.saturating_add(segment_len).min(frames.end);
+                let first = frames.start;
+                scope.spawn(move || {
+                    // Each segment also looks at the frame before it, to find out whether its own
+                    // first frame is a scene change
+                    let mut previous = (segment.start > first).then(|| {
+                        AnalysedFrame::new(provider(
+                            video,
+                            model::FrameNumber(segment.start - 1),
+                            THUMBNAIL_HEIGHT,
+                        ))
+                    });
+
+                    let mut segment_changes = vec![];
+                    for frame in segment {
+                        if cancelled.load(Ordering::Relaxed) {
+                            break;
+                        }
+
+                        let frame_number = model::FrameNumber(frame);
+                        let current =
+                            AnalysedFrame::new(provider(video, frame_number, THUMBNAIL_HEIGHT));
+                        if previous
+                            .as_ref()
+                            .is_some_and(|previous| previous.difference(&current).is_scene_change())
+                        {
+                            segment_changes.push(frame_number);
+                        }
+                        previous = Some(current);
+                    }
+                    segment_changes
+                })
+            })
+            .collect();
+
+        handles
+            .into_iter()
+            .flat_map(|handle| handle.join().unwrap())
+            .collect()
+    });
+    if cancelled.load(Ordering::Relaxed) {
+        return None;
+    }
+    scene_changes.sort_unstable();
+
+    // Only now that the segments have been merged can close scene changes be thinned out, as they
+    // might be on both sides of a segment boundary
+    let mut keyframes = vec![model::FrameNumber(frames.start)];
+    for frame in scene_changes {
+        if frame.0 - keyframes[keyframes.len() - 1].0 >= MIN_KEYFRAME_INTERVAL {
+            keyframes.push(frame);
+        }
+    }
+
+    Some(Keyframes::new(keyframes))
+}
+
+fn sum_of_absolute_differences(first: &[u8], second: &[u8]) -> u64 {
+    let mut first_chunks = first.chunks_exact(LANES);
+    let mut second_chunks = second.chunks_exact(LANES);
+
+    // A chunk's sum fits into 16 bits, which lets the compiler use narrow vector lanes (or
+    // dedicated instructions, like `psadbw` on x86)
+    let mut sum: u64 = (&mut first_chunks)
+        .zip(&mut second_chunks)
+        .map(|(first_chunk, second_chunk)| {
+            let chunk_sum: u16 = first_chunk
+                .iter()
+                .zip(second_chunk)
+                .map(|(first_sample, second_sample)| {
+                    u16::from(first_sample.abs_diff(*second_sample))
+                })
+                .sum();
+            u64::from(chunk_sum)
+        })
+        .sum();
+
+    for (first_sample, second_sample) in first_chunks
+        .remainder()
+        .iter()
+        .zip(second_chunks.remainder())
+    {
+        sum += u64::from(first_sample.abs_diff(*second_sample));
+    }
+
+    sum
+}
+
+fn histogram(data: &[u8]) -> [u32; HISTOGRAM_BINS] {
+    // Count into several histograms in turn, so that consecutive samples falling into the same
+    // bin do not have to wait for each other's increment
+    let mut partial = [[0_u32; HISTOGRAM_BINS]; 4];
+    let mut chunks = data.chunks_exact(partial.len());
+    for chunk in &mut chunks {
+        for (histogram, sample) in partial.iter_mut().zip(chunk) {
+            histogram[usize::from(sample >> HISTOGRAM_SHIFT)] += 1;
+        }
+    }
+    for sample in chunks.remainder() {
+        partial[0][usize::from(sample >> HISTOGRAM_SHIFT)] += 1;
+    }
+
+    let mut total = [0_u32; HISTOGRAM_BINS];
+    for histogram in &partial {
+        for (total_count, count) in total.iter_mut().zip(histogram) {
+            *total_count += count;
+        }
+    }
+    total
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// A synthetic video with a scene change every 40 frames. Within a scene, a gradient slowly
+    /// moves to the right.
+    fn synthetic_frame(_video: &(), frame: model::FrameNumber, height: u32) -> Thumbnail {
+        let height = height as usize;
+        let width = height * 16 / 9;
+        let scene = frame.0 / 40;
+        let offset = usize::try_from(frame.0 % 40).unwrap();
+
+        let data = (0..height)
+            .flat_map(|_| {
+                (0..width).map(move |column| {
+                    let value = (column + offset) * 255 / (width + 40);
+                    let value = u8::try_from(value).unwrap();
+                    if scene % 2 == 0 {
+                        value / 2
+                    } else {
+                        255 - value / 2
+                    }
+                })
+            })
+            .collect();
+
+        Thumbnail {
+            width,
+            height,
+            data,
+        }
+    }
+
+    #[test]
+    fn synthetic_scenes() {
+        let expected: Vec<model::FrameNumber> =
+            (0..6).map(|scene| model::FrameNumber(scene * 40)).collect();
+
+        let running = AtomicBool::new(false);
+
+        // With three threads, the segment boundaries coincide with scene changes
+        for threads in [1, 2, 3] {
+            let keyframes = detect(&(), synthetic_frame, 0..240, threads, &running).unwrap();
+            assert_eq!(keyframes.as_slice(), expected.as_slice());
+        }
+
+        // The first frame of a range is always a keyframe
+        let keyframes = detect(&(), synthetic_frame, 50..130, 2, &running).unwrap();
+        assert_eq!(
+            keyframes.as_slice(),
+            [50, 80, 120].map(model::FrameNumber).as_slice()
+        );
+
+        let cancelled = AtomicBool::new(true);
+        assert!(detect(&(), synthetic_frame, 0..240, 2, &cancelled).is_none());
+    }
+
+    #[test]
+    fn sad() {
+        let naive = |first: &[u8], second: &[u8]| -> u64 {
+            first
+                .iter()
+                .zip(second)
+                .map(|(first_sample, second_sample)| {
+                    u64::from(first_sample.abs_diff(*second_sample))
+                })
+                .sum()
+        };
+
+        let first: Vec<u8> = (0..=255).collect();
+        let second: Vec<u8> = (0..=255).rev().collect();
+        for start in [0, 3, 250] {
+            assert_eq!(
+                sum_of_absolute_differences(&first[start..], &second[start..]),
+                naive(&first[start..], &second[start..])
+            );
+        }
+    }
+}
@@ -18,6 +18,33 @@ fn library_init() -> ass::Library {
     library
 }
 
+/// Load all font attachments from the given list into libass, so they can be used by renderers
+/// once their fonts are reloaded using [`Renderer::reload_fonts`]. Returns the number of fonts
+/// that were loaded.
+pub fn add_attached_fonts(attachments: &[subtitle::Attachment]) -> usize {
+    let mut buffer = vec![];
+    let mut count = 0;
+
+    for attachment in attachments {
+        if attachment.attachment_type() != subtitle::AttachmentType::Font {
+            continue;
+        }
+
+        match attachment.decode_into(&mut buffer) {
+            Ok(()) => {
+                LIBRARY.add_font(attachment.filename(), &buffer);
+                count += 1;
+            }
+            Err(error) => println!(
+                "Could not decode attached font {}: {error}",
+                attachment.filename()
+            ),
+        }
+    }
+
+    count
+}
+
 /// Set the global libass message callback. The provided closure will be called on every log message
 /// produced by libass.
 pub fn set_libass_callback<F: FnMut(i32, String) + 'static>(callback: F) {
@@ -136,6 +163,12 @@ impl Renderer {
         Renderer { internal: renderer }
     }
 
+    /// Reinitialise the fonts available to this renderer, picking up fonts added to the library
+    /// since it was created.
+    pub fn reload_fonts(&mut self) {
+        renderer_set_fonts_default(&mut self.internal);
+    }
+
     pub fn render_subtitles_onto_base(
         &mut self,
         subtitles: &OpaqueTrack,
@@ -1,3 +1,4 @@
+use std::fmt::{Display, Formatter};
 use std::path::Path;
 
 use thiserror::Error;
@@ -7,8 +8,13 @@ pub use vapoursynth::FrameRate;
 use crate::model;
 
 use super::bindings::{c_string, vapoursynth};
+use super::index_cache::IndexCache;
 
 const DEFAULT_SCRIPT: &str = include_str!("default_scripts/video.py");
+const PREVIEW_SCRIPT: &str = include_str!("default_scripts/preview.py");
+
+/// Extensions of the containers LibavSMASHSource can open without an index.
+const PREVIEW_EXTENSIONS: [&str; 3] = ["mp4", "m4v", "mov"];
 
 const KF_KEY: &str = "__aegi_keyframes";
 const TC_KEY: &str = "__aegi_timecodes";
@@ -19,14 +25,194 @@ pub struct Metadata {
     pub frame_rate: FrameRate,
     pub width: i32,
     pub height: i32,
+    pub num_frames: i32,
+}
+
+/// How many worker threads and how much frame cache memory the VapourSynth core of a video may use.
+/// VapourSynth's own defaults assume it has the machine to itself, but samaku runs audio playback,
+/// subtitle rendering and motion tracking alongside it.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct CoreBudget {
+    pub threads: i32,
+    pub max_cache_bytes: i64,
+}
+
+impl CoreBudget {
+    /// Memory budget for the frame cache of the video used for playback.
+    pub const PLAYBACK_MEMORY: i64 = 1 << 30;
+
+    /// Threads left to the UI and to audio playback and subtitle rendering.
+    const RESERVED_THREADS: usize = 2;
+
+    /// Frames the cache should ideally hold, which is enough to step back and forth by several
+    /// seconds without decoding again.
+    const TARGET_CACHED_FRAMES: i64 = 120;
+
+    /// Frames per thread the cache holds even if that exceeds the memory budget, as otherwise
+    /// frames that are still needed as references get evicted while threads are working on them.
+    const MIN_CACHED_FRAMES_PER_THREAD: i64 = 4;
+
+    /// Rough number of cached bytes per pixel of a frame: the RGB24 output frame plus the source
+    /// frame it was converted from.
+    const BYTES_PER_PIXEL: i64 = 6;
+
+    /// Splits the given number of available threads and bytes of memory for videos with the given
+    /// dimensions.
+    #[must_use]
+    pub fn new(available_threads: usize, memory_budget: i64, metadata: &Metadata) -> Self {
+        let threads = available_threads
+            .saturating_sub(Self::RESERVED_THREADS)
+            .max(1);
+        let threads = i32::try_from(threads).unwrap_or(i32::MAX);
+
+        let frame_bytes =
+            i64::from(metadata.width) * i64::from(metadata.height) * Self::BYTES_PER_PIXEL;
+        let max_cache_bytes = (frame_bytes * Self::TARGET_CACHED_FRAMES)
+            .min(memory_budget)
+            .max(frame_bytes * Self::MIN_CACHED_FRAMES_PER_THREAD * i64::from(threads));
+
+        Self {
+            threads,
+            max_cache_bytes,
+        }
+    }
+
+    /// Like [`CoreBudget::new`], with the available parallelism of this machine.
+    #[must_use]
+    pub fn for_system(memory_budget: i64, metadata: &Metadata) -> Self {
+        let available_threads = std::thread::available_parallelism().map_or(1, usize::from);
+        Self::new(available_threads, memory_budget, metadata)
+    }
+}
+
+/// Stages of loading a video, in the order in which they happen.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum LoadStage {
+    /// LWLibavSource indexes the file, unless a valid index is cached. This takes by far the
+    /// longest, and cannot be interrupted.
+    Indexing,
+
+    /// The video's format and first frame are read.
+    Probing,
+
+    /// The conversion to RGB is set up, and the first frame is converted for display.
+    Converting,
+}
+
+impl Display for LoadStage {
+    fn fmt(&self, formatter: &mut Formatter<'_>) -> std::fmt::Result {
+        write!(
+            formatter,
+            "{}",
+            match self {
+                LoadStage::Indexing => "Indexing video…",
+                LoadStage::Probing => "Reading video format…",
+                LoadStage::Converting => "Preparing colour conversion…",
+            }
+        )
+    }
 }
 
 pub struct Video {
-    _script: vapoursynth::Script,
+    script: vapoursynth::Script,
     node: vapoursynth::Node,
+    luma: Option<LumaSource>,
+
+    /// The first frame in RGB, which had to be decoded while loading anyway. Kept so that it does
+    /// not need to be decoded again to be displayed.
+    poster: Option<vapoursynth::Frame>,
+
+    /// The video downscaled to proxy size, once [`Video::prepare_proxy`] has been called.
+    proxy: Option<vapoursynth::Node>,
+
+    /// The codec's keyframes, as recorded in the index.
+    pub keyframes: model::keyframes::Keyframes,
+
     pub metadata: Metadata,
 }
 
+// SAFETY: Shared references to a `Video` only ever request frames from its nodes and change the
+// settings of its core, both of which VapourSynth allows from any thread, concurrently.
+unsafe impl Sync for Video {}
+
+/// The video in its native format, if its first plane holds luma samples that motion tracking can
+/// use directly, without going through the conversion to RGB.
+struct LumaSource {
+    node: vapoursynth::Node,
+    format: LumaFormat,
+}
+
+/// How to convert samples of a luma plane to the 0–1 range libmv works with.
+#[derive(Debug, Clone, Copy)]
+struct LumaFormat {
+    bytes_per_sample: usize,
+    black: f32,
+    scale: f32,
+}
+
+impl LumaFormat {
+    #[allow(clippy::cast_possible_truncation)]
+    fn new(bits_per_sample: i32, full_range: bool) -> Self {
+        // Limited range luma goes from 16 to 235, scaled up for higher bit depths
+        let shift = bits_per_sample - 8;
+        let (black, white) = if full_range {
+            (0.0, f64::from((1_i32 << bits_per_sample) - 1))
+        } else {
+            (f64::from(16_i32 << shift), f64::from(235_i32 << shift))
+        };
+
+        Self {
+            bytes_per_sample: if bits_per_sample > 8 { 2 } else { 1 },
+            black: black as f32,
+            scale: (1.0 / (white - black)) as f32,
+        }
+    }
+
+    /// Converts one row of samples, which must contain `out.len()` samples.
+    fn convert_row(self, row: &[u8], out: &mut [f32]) {
+        let convert = |sample: f32| (sample - self.black) * self.scale;
+
+        // Work on fixed-size chunks, so the compiler can vectorise the conversion
+        if self.bytes_per_sample == 1 {
+            let mut out_chunks = out.chunks_exact_mut(LANES);
+            let mut row_chunks = row.chunks_exact(LANES);
+            for (out_chunk, row_chunk) in (&mut out_chunks).zip(&mut row_chunks) {
+                for (out_sample, sample) in out_chunk.iter_mut().zip(row_chunk) {
+                    *out_sample = convert(f32::from(*sample));
+                }
+            }
+            for (out_sample, sample) in out_chunks
+                .into_remainder()
+                .iter_mut()
+                .zip(row_chunks.remainder())
+            {
+                *out_sample = convert(f32::from(*sample));
+            }
+        } else {
+            let mut out_chunks = out.chunks_exact_mut(LANES);
+            let mut row_chunks = row.chunks_exact(LANES * 2);
+            for (out_chunk, row_chunk) in (&mut out_chunks).zip(&mut row_chunks) {
+                for (out_sample, sample) in out_chunk.iter_mut().zip(row_chunk.chunks_exact(2)) {
+                    *out_sample = convert(f32::from(u16::from_ne_bytes([sample[0], sample[1]])));
+                }
+            }
+            for (out_sample, sample) in out_chunks
+                .into_remainder()
+                .iter_mut()
+                .zip(row_chunks.remainder().chunks_exact(2))
+            {
+                *out_sample = convert(f32::from(u16::from_ne_bytes([sample[0], sample[1]])));
+            }
+        }
+    }
+}
+
+/// Number of samples converted at once when extracting luma patches.
+const LANES: usize = 8;
+
+/// The coefficients used by Blender to convert RGB to greyscale, divided by 255.
+const GREYSCALE_COEFFICIENTS: [f32; 3] = [0.000_833_373, 0.002_804_71, 0.000_283_14];
+
 impl Video {
     /// Load the video from the given file using Vapoursynth and LSMASHSource.
     ///
@@ -40,10 +226,62 @@ impl Video {
     ///  6. The Vapoursynth resize plugin is unavailable
     ///  7. The colour space conversion to RGB24 fails
     pub fn load<P: AsRef<Path>>(filename: P) -> Result<Video, LoadError> {
-        let Some(script) = vapoursynth::open_script(DEFAULT_SCRIPT, filename) else {
+        Self::load_with_index_cache(filename, &IndexCache::for_user())
+    }
+
+    /// Like [`Video::load`], but stores the video's index in the given cache.
+    ///
+    /// # Errors
+    /// See [`Video::load`]. Additionally returns an error if the index cache cannot be accessed.
+    pub fn load_with_index_cache<P: AsRef<Path>>(
+        filename: P,
+        index_cache: &IndexCache,
+    ) -> Result<Video, LoadError> {
+        Self::load_with_progress(filename, index_cache, |_| true)
+    }
+
+    /// Like [`Video::load_with_index_cache`], but calls `progress` before each stage of loading.
+    /// If it returns `false`, loading is cancelled.
+    ///
+    /// # Errors
+    /// See [`Video::load_with_index_cache`]. Additionally returns [`LoadError::Cancelled`] if
+    /// loading was cancelled.
+    #[allow(clippy::too_many_lines)]
+    pub fn load_with_progress<P, F>(
+        filename: P,
+        index_cache: &IndexCache,
+        mut progress: F,
+    ) -> Result<Video, LoadError>
+    where
+        P: AsRef<Path>,
+        F: FnMut(LoadStage) -> bool,
+    {
+        if !progress(LoadStage::Indexing) {
+            return Err(LoadError::Cancelled);
+        }
+
+        // LWLibavSource records the path it was given in the index, which is checked against the
+        // canonical path when the index is reused
+        let Ok(filename) = std::fs::canonicalize(filename) else {
+            return Err(LoadError::FailedToOpen);
+        };
+        let index_file = index_cache
+            .prepare(&filename)
+            .map_err(|err| LoadError::IndexCache(err.to_string()))?;
+
+        let Some(script) = vapoursynth::open_script(DEFAULT_SCRIPT, &filename, &index_file) else {
             return Err(LoadError::FailedToOpen);
         };
 
+        // The index has been written now, so it counts towards the cache size
+        if let Err(err) = index_cache.evict(&index_file) {
+            println!("Failed to evict old index files: {err}");
+        }
+
+        if !progress(LoadStage::Probing) {
+            return Err(LoadError::Cancelled);
+        }
+
         let Some(node) = script.get_output_node(0) else {
             return Err(LoadError::FailedToGetNode);
         };
@@ -62,6 +300,25 @@ impl Video {
         let frame_rate = vi.get_frame_rate();
         println!("Frame rate: {frame_rate:?}");
 
+        let metadata = Metadata {
+            frame_rate,
+            width,
+            height,
+            num_frames: vi.get_num_frames(),
+        };
+
+        // Configure the core before the first frame request starts its threads
+        let core_info = Self::apply_core_budget(
+            &script,
+            CoreBudget::for_system(CoreBudget::PLAYBACK_MEMORY, &metadata),
+        );
+        println!(
+            "VapourSynth core R{}: {} threads, {} MiB frame cache",
+            core_info.core_version,
+            core_info.num_threads,
+            core_info.max_framebuffer_size >> 20
+        );
+
         let Some(mut clipinfo_owned) = vapoursynth::OwnedMap::create_map() else {
             return Err(LoadError::VsAllocError);
         };
@@ -84,8 +341,23 @@ impl Video {
             Err(_) => false,
         };
 
-        // TODO: keyframes and timecodes
+        // The keyframes are given as a list if they were read from the index. Otherwise, they
+        // might be the path to a keyframe file, which is not supported yet.
+        // TODO: timecodes
         println!("num_kf: {num_kf}, num_tc: {num_tc}, has_audio: {has_audio}");
+        let keyframes = clipinfo
+            .as_const()
+            .get_int_array(c_string(KF_KEY).as_c_str())
+            .map(|frames| {
+                model::keyframes::Keyframes::new(
+                    frames
+                        .into_iter()
+                        .filter_map(|frame| i32::try_from(frame).ok())
+                        .map(model::FrameNumber)
+                        .collect(),
+                )
+            })
+            .unwrap_or_default();
 
         let frame = match node.get_frame(0) {
             Ok(frame) => frame,
@@ -112,11 +384,24 @@ impl Video {
         let colour_space = vapoursynth::color_matrix_description(&vi, &props);
         println!("Colour space: {colour_space}");
 
-        let out_node = if vi.is_rgb24() {
-            node
+        let luma_format = vi
+            .integer_luma_bits()
+            .map(|bits| LumaFormat::new(bits, vapoursynth::is_full_range(&props)));
+
+        if !progress(LoadStage::Converting) {
+            return Err(LoadError::Cancelled);
+        }
+
+        let (out_node, luma, poster) = if vi.is_rgb24() {
+            // The frame we already have can be displayed as it is
+            (node, None, frame)
         } else {
             match Self::convert_to_rgb24(&script, &node, &vi, &props) {
-                Ok(value) => value,
+                Ok((new_node, new_frame)) => (
+                    new_node,
+                    luma_format.map(|format| LumaSource { node, format }),
+                    new_frame,
+                ),
                 Err(value) => {
                     return Err(value);
                 }
@@ -124,22 +409,73 @@ impl Video {
         };
 
         Ok(Video {
-            _script: script,
+            script,
             node: out_node,
-            metadata: Metadata {
-                frame_rate,
-                width,
-                height,
-            },
+            luma,
+            poster: Some(poster),
+            proxy: None,
+            keyframes,
+            metadata,
         })
     }
 
+    /// Decodes the first frame of an MP4 or MOV file without indexing it, so that it can be shown
+    /// while the file is being loaded. Returns `None` for other containers, or if the frame cannot
+    /// be decoded this way.
+    #[must_use]
+    pub fn preview<P: AsRef<Path>>(filename: P) -> Option<iced::widget::image::Handle> {
+        let extension = filename
+            .as_ref()
+            .extension()?
+            .to_str()?
+            .to_ascii_lowercase();
+        if !PREVIEW_EXTENSIONS.contains(&extension.as_str()) {
+            return None;
+        }
+        let filename = std::fs::canonicalize(filename).ok()?;
+
+        // LibavSMASHSource never writes an index, so this file is not created
+        let index_file = std::env::temp_dir().join("samaku-preview.lwi");
+        let script = vapoursynth::open_script(PREVIEW_SCRIPT, &filename, index_file)?;
+        let node = script.get_output_node(0)?;
+        let vi = node.get_video_info()?;
+        if !vi.is_constant_video_format() {
+            return None;
+        }
+
+        let frame = node.get_frame(0).ok()?;
+        let rgb_frame = if vi.is_rgb24() {
+            frame
+        } else {
+            let props = frame.get_properties_ro()?;
+            Self::convert_to_rgb24(&script, &node, &vi, &props).ok()?.1
+        };
+
+        Some(Self::to_iced(&rgb_frame))
+    }
+
+    /// Changes the number of threads and the cache size of this video's VapourSynth core, and
+    /// returns the resulting core configuration.
+    pub fn set_core_budget(&self, budget: CoreBudget) -> vapoursynth::CoreInfo {
+        Self::apply_core_budget(&self.script, budget)
+    }
+
+    fn apply_core_budget(
+        script: &vapoursynth::Script,
+        budget: CoreBudget,
+    ) -> vapoursynth::CoreInfo {
+        let mut core = script.get_core();
+        core.set_thread_count(budget.threads);
+        core.set_max_cache_size(budget.max_cache_bytes);
+        core.get_info()
+    }
+
     fn convert_to_rgb24(
         script: &vapoursynth::Script,
         node: &vapoursynth::Node,
         vi: &vapoursynth::VideoInfo,
         props: &vapoursynth::ConstMap,
-    ) -> Result<vapoursynth::Node, LoadError> {
+    ) -> Result<(vapoursynth::Node, vapoursynth::Frame), LoadError> {
         let Some(mut resize) = script.get_core().get_resize_plugin() else {
             return Err(LoadError::ResizePluginUnavailable);
         };
@@ -181,7 +517,85 @@ impl Video {
         let new_color_space =
             vapoursynth::color_matrix_description(&new_video_info, &new_properties);
         println!("New color space: {new_color_space}");
-        Ok(new_node)
+        Ok((new_node, new_frame))
+    }
+
+    /// Sets up downscaling of the video to the given proxy dimensions, for
+    /// [`Video::get_proxy_rgb`].
+    ///
+    /// # Errors
+    /// Returns an error if the resize plugin is unavailable or the video cannot be downscaled.
+    pub fn prepare_proxy(&mut self, dimensions: super::proxy::Dimensions) -> Result<(), LoadError> {
+        let Some(mut resize) = self.script.get_core().get_resize_plugin() else {
+            return Err(LoadError::ResizePluginUnavailable);
+        };
+
+        let Some(mut args_owned) = vapoursynth::OwnedMap::create_map() else {
+            return Err(LoadError::VsAllocError);
+        };
+        let args = args_owned.as_mut();
+        args.append_node(c_string("clip").as_c_str(), &self.node);
+        args.append_int(c_string("width").as_c_str(), i64::from(dimensions.width));
+        args.append_int(c_string("height").as_c_str(), i64::from(dimensions.height));
+
+        // The frames are already in RGB, so this only scales them down
+        let mut result_owned = resize.invoke(c_string("Bilinear").as_c_str(), args.as_const());
+        let result = result_owned.as_mut();
+
+        if let Some(err) = result.as_const().get_error() {
+            return Err(LoadError::ColourSpaceConversionFailedDetail(err));
+        }
+
+        match result.as_const().get_node(c_string("clip").as_c_str(), 0) {
+            Ok(node) => {
+                self.proxy = Some(node);
+                Ok(())
+            }
+            Err(error_code) => Err(LoadError::ColourSpaceConversionFailedDetail(format!(
+                "[get_node] error code: {error_code}"
+            ))),
+        }
+    }
+
+    /// Retrieves the `n`th frame downscaled for a proxy, as packed 8-bit RGB samples.
+    ///
+    /// # Panics
+    /// Panics if [`Video::prepare_proxy`] has not been called, or if the frame could not be
+    /// retrieved.
+    #[must_use]
+    pub fn get_proxy_rgb(&self, n: model::FrameNumber) -> Vec<u8> {
+        let vs_frame = self
+            .proxy
+            .as_ref()
+            .expect("proxy should have been prepared")
+            .get_frame(n.0)
+            .unwrap();
+
+        let width: usize = vs_frame
+            .get_width(0)
+            .try_into()
+            .expect("frame width should not be negative");
+        let height: usize = vs_frame
+            .get_height(0)
+            .try_into()
+            .expect("frame height should not be negative");
+
+        let mut out = vec![0; width * height * 3];
+        for (row, out_row) in out.chunks_exact_mut(width * 3).enumerate() {
+            let plane_row = |plane: i32| {
+                let row_start = vs_frame.get_stride(plane) * row;
+                &vs_frame.get_read_ptr(plane)[row_start..row_start + width]
+            };
+
+            for (pixel, ((red, green), blue)) in out_row
+                .chunks_exact_mut(3)
+                .zip(plane_row(0).iter().zip(plane_row(1)).zip(plane_row(2)))
+            {
+                pixel.copy_from_slice(&[*red, *green, *blue]);
+            }
+        }
+
+        out
     }
 
     fn get_frame_internal(&self, n: model::FrameNumber) -> vapoursynth::Frame {
@@ -193,6 +607,12 @@ impl Video {
         vs_frame
     }
 
+    /// Returns the first frame in `iced`'s format, if it has not been taken yet. It was decoded
+    /// while loading the video, so this is much faster than [`Video::get_iced_frame`].
+    pub fn take_poster(&mut self) -> Option<iced::widget::image::Handle> {
+        self.poster.take().map(|vs_frame| Self::to_iced(&vs_frame))
+    }
+
     /// Retrieves the `n`th frame and returns it in `iced`'s format.
     ///
     /// # Panics
@@ -203,6 +623,17 @@ impl Video {
         let vs_frame = self.get_frame_internal(n);
         let elapsed_obtain = instant.elapsed();
 
+        let instant2 = std::time::Instant::now();
+        let handle = Self::to_iced(&vs_frame);
+        let elapsed_copy = instant2.elapsed();
+        println!(
+            "Frame profiling [display]: obtaining frame {n:?} took {elapsed_obtain:.2?}, packing it took {elapsed_copy:.2?}",
+        );
+
+        handle
+    }
+
+    fn to_iced(vs_frame: &vapoursynth::Frame) -> iced::widget::image::Handle {
         let width: u32 = vs_frame
             .get_width(0)
             .try_into()
@@ -216,8 +647,6 @@ impl Video {
         let out_len = pitch * height as usize;
         let mut out = vec![0; out_len];
 
-        let instant2 = std::time::Instant::now();
-
         // Use libp2p, which we are linking to anyway because of BestSource,
         // for high performance (SIMD) packing
         #[allow(clippy::cast_possible_wrap)] // frame stride is guaranteed to fit into an `isize`
@@ -255,16 +684,98 @@ impl Video {
             );
         }
 
-        let elapsed_copy = instant2.elapsed();
-        println!(
-            "Frame profiling [display]: obtaining frame {n:?} took {elapsed_obtain:.2?}, packing it took {elapsed_copy:.2?}",
-        );
-
         iced::widget::image::Handle::from_pixels(width, height, out)
     }
 
+    /// Get frame #`n` in greyscale, downscaled by an integer factor such that it is at most
+    /// `max_height` pixels tall, for scene change detection. Like [`Video::get_libmv_patch`],
+    /// this reads the luma plane directly if the video has one.
+    ///
+    /// # Panics
+    /// Panics if the frame could not be obtained.
+    #[must_use]
+    pub fn get_luma_thumbnail(
+        &self,
+        n: model::FrameNumber,
+        max_height: u32,
+    ) -> super::scene_change::Thumbnail {
+        let vs_frame = match self.luma {
+            Some(ref luma) => luma.node.get_frame(n.0).unwrap(),
+            None => self.get_frame_internal(n),
+        };
+        let frame_width: usize = vs_frame
+            .get_width(0)
+            .try_into()
+            .expect("frame width should not be negative");
+        let frame_height: usize = vs_frame
+            .get_height(0)
+            .try_into()
+            .expect("frame height should not be negative");
+
+        let factor = frame_height.div_ceil(max_height.max(1) as usize).max(1);
+        let width = frame_width / factor;
+        let height = frame_height / factor;
+
+        let mut row = vec![0.0_f32; frame_width];
+        let mut sums = vec![0.0_f32; width];
+        let mut data = Vec::with_capacity(width * height);
+
+        #[allow(clippy::cast_precision_loss)]
+        let scale = 255.0 / (factor * factor) as f32;
+
+        for thumbnail_row in 0..height {
+            sums.fill(0.0);
+            for frame_row in (thumbnail_row * factor)..((thumbnail_row + 1) * factor) {
+                self.read_luma_row(&vs_frame, frame_row, &mut row);
+                for (sum, block) in sums.iter_mut().zip(row.chunks_exact(factor)) {
+                    *sum += block.iter().sum::<f32>();
+                }
+            }
+
+            #[allow(clippy::cast_possible_truncation)]
+            #[allow(clippy::cast_sign_loss)]
+            data.extend(
+                sums.iter()
+                    .map(|sum| (sum * scale).round().clamp(0.0, 255.0) as u8),
+            );
+        }
+
+        super::scene_change::Thumbnail {
+            width,
+            height,
+            data,
+        }
+    }
+
+    /// Converts a full row of the given frame to greyscale between 0 and 1. The frame must come
+    /// from the luma node if there is one, and from the RGB node otherwise.
+    fn read_luma_row(&self, vs_frame: &vapoursynth::Frame, row: usize, out: &mut [f32]) {
+        if let Some(ref luma) = self.luma {
+            let row_len = out.len() * luma.format.bytes_per_sample;
+            let row_start = vs_frame.get_stride(0) * row;
+            luma.format.convert_row(
+                &vs_frame.get_read_ptr(0)[row_start..row_start + row_len],
+                out,
+            );
+        } else {
+            out.fill(0.0);
+            for plane in 0_u8..3_u8 {
+                let row_start = vs_frame.get_stride(i32::from(plane)) * row;
+                let read_ptr =
+                    &vs_frame.get_read_ptr(i32::from(plane))[row_start..row_start + out.len()];
+                let coefficient = GREYSCALE_COEFFICIENTS[plane as usize];
+                for (out_sample, sample) in out.iter_mut().zip(read_ptr) {
+                    *out_sample += coefficient * f32::from(*sample);
+                }
+            }
+        }
+    }
+
     /// Get a patch (monochrome region) of frame #`n` with the bounds given by the `request`.
     ///
+    /// If the video has a luma plane, the patch is read directly from it, converting only the
+    /// requested region. Otherwise, greyscale is computed from the RGB frame.
+    ///
     /// # Panics
     /// Panics if the frame could not be obtained.
     #[must_use]
@@ -273,11 +784,11 @@ impl Video {
         n: model::FrameNumber,
         request: super::motion::PatchRequest,
     ) -> super::motion::PatchResponse {
-        // The conversion coefficients used by Blender, divided by 255
-        const GREYSCALE_COEFFICIENTS: [f32; 3] = [0.000_833_373, 0.002_804_71, 0.000_283_14];
-
         let instant = std::time::Instant::now();
-        let vs_frame = self.get_frame_internal(n);
+        let vs_frame = match self.luma {
+            Some(ref luma) => luma.node.get_frame(n.0).unwrap(),
+            None => self.get_frame_internal(n),
+        };
         let elapsed_obtain = instant.elapsed();
         let frame_width: u32 = vs_frame
             .get_width(0)
@@ -317,25 +828,40 @@ impl Video {
 
         let instant2 = std::time::Instant::now();
 
-        // Assumes all frames are the same size. They should be.
-        for plane in 0_u8..3_u8 {
-            let stride = vs_frame.get_stride(i32::from(plane));
-            let read_ptr = vs_frame.get_read_ptr(i32::from(plane));
-
-            let coefficient = GREYSCALE_COEFFICIENTS[plane as usize];
-
-            for row in 0..(true_height as usize) {
-                let row_start_read =
-                    stride * (top_within_frame as usize + row) + left_within_frame as usize;
-                let row_read_ptr =
-                    &read_ptr[row_start_read..(row_start_read + true_width as usize)];
-
-                let row_start_write = true_width as usize * row;
-                let row_write_ptr =
-                    &mut out[row_start_write..(row_start_write + true_width as usize)];
-
-                for col in 0..(true_width as usize) {
-                    row_write_ptr[col] += coefficient * f32::from(row_read_ptr[col]);
+        if let Some(ref luma) = self.luma {
+            let stride = vs_frame.get_stride(0);
+            let read_ptr = vs_frame.get_read_ptr(0);
+            let bytes_per_sample = luma.format.bytes_per_sample;
+
+            for (row, row_write_ptr) in out.chunks_exact_mut(true_width.max(1) as usize).enumerate()
+            {
+                let row_start_read = stride * (top_within_frame as usize + row)
+                    + left_within_frame as usize * bytes_per_sample;
+                let row_read_ptr = &read_ptr
+                    [row_start_read..(row_start_read + true_width as usize * bytes_per_sample)];
+                luma.format.convert_row(row_read_ptr, row_write_ptr);
+            }
+        } else {
+            // Assumes all frames are the same size. They should be.
+            for plane in 0_u8..3_u8 {
+                let stride = vs_frame.get_stride(i32::from(plane));
+                let read_ptr = vs_frame.get_read_ptr(i32::from(plane));
+
+                let coefficient = GREYSCALE_COEFFICIENTS[plane as usize];
+
+                for row in 0..(true_height as usize) {
+                    let row_start_read =
+                        stride * (top_within_frame as usize + row) + left_within_frame as usize;
+                    let row_read_ptr =
+                        &read_ptr[row_start_read..(row_start_read + true_width as usize)];
+
+                    let row_start_write = true_width as usize * row;
+                    let row_write_ptr =
+                        &mut out[row_start_write..(row_start_write + true_width as usize)];
+
+                    for col in 0..(true_width as usize) {
+                        row_write_ptr[col] += coefficient * f32::from(row_read_ptr[col]);
+                    }
                 }
             }
         }
@@ -360,6 +886,12 @@ pub enum LoadError {
     #[error("Failed to open file (file does not exist, or its format is unsupported)")]
     FailedToOpen,
 
+    #[error("Loading was cancelled")]
+    Cancelled,
+
+    #[error("Failed to access the index cache ({0})")]
+    IndexCache(String),
+
     #[error("Failed to read output node of Vapoursynth script")]
     FailedToGetNode,
 
@@ -387,3 +919,90 @@ pub enum LoadError {
     #[error("Colour space conversion failed")]
     ColourSpaceConversionFailed,
 }
+
+#[cfg(test)]
+mod tests {
+    use assert_matches2::assert_matches;
+
+    use super::*;
+
+    #[test]
+    fn core_budget() {
+        let metadata = |width, height| Metadata {
+            frame_rate: FrameRate {
+                numerator: 24000,
+                denominator: 1001,
+            },
+            width,
+            height,
+            num_frames: 1000,
+        };
+
+        // Small frames: the cache holds the target number of frames, well within the budget
+        let budget = CoreBudget::new(8, CoreBudget::PLAYBACK_MEMORY, &metadata(640, 360));
+        assert_eq!(budget.threads, 6);
+        assert_eq!(budget.max_cache_bytes, 640 * 360 * 6 * 120);
+
+        // Large frames: the budget limits the cache
+        let budget = CoreBudget::new(8, CoreBudget::PLAYBACK_MEMORY, &metadata(3840, 2160));
+        assert_eq!(budget.max_cache_bytes, CoreBudget::PLAYBACK_MEMORY);
+
+        // Tiny budget: every thread still gets a few frames
+        let budget = CoreBudget::new(2, 1 << 20, &metadata(1920, 1080));
+        assert_eq!(budget.threads, 1);
+        assert_eq!(budget.max_cache_bytes, 1920 * 1080 * 6 * 4);
+    }
+
+    #[test]
+    fn load_stages() {
+        let path = crate::test_utils::test_file("test_files/cube_h264.mkv");
+        let cache = IndexCache::new(
+            std::env::temp_dir().join(format!("samaku-load-stages-{}", std::process::id())),
+            IndexCache::DEFAULT_MAX_BYTES,
+        );
+
+        let mut stages = vec![];
+        let mut video = Video::load_with_progress(&path, &cache, |stage| {
+            stages.push(stage);
+            true
+        })
+        .unwrap();
+        assert_eq!(
+            stages,
+            [
+                LoadStage::Indexing,
+                LoadStage::Probing,
+                LoadStage::Converting
+            ]
+        );
+        assert!(video.take_poster().is_some());
+        assert!(video.take_poster().is_none());
+
+        let cancelled =
+            Video::load_with_progress(&path, &cache, |stage| stage != LoadStage::Probing);
+        assert_matches!(cancelled, Err(LoadError::Cancelled));
+
+        // Matroska files cannot be decoded without an index
+        assert!(Video::preview(&path).is_none());
+    }
+
+    #[test]
+    fn luma_conversion() {
+        let mut out = [0.0_f32; 11];
+
+        let limited_8: Vec<u8> = (0..11).map(|index| 16 + index * 20).collect();
+        LumaFormat::new(8, false).convert_row(&limited_8, &mut out);
+        assert!(out[0].abs() < 1e-6);
+        assert!((out[10] - 200.0 / 219.0).abs() < 1e-6);
+
+        let full_10: Vec<u8> = (0..11_u16)
+            .flat_map(|index| (index * 100).to_ne_bytes())
+            .collect();
+        LumaFormat::new(10, true).convert_row(&full_10, &mut out);
+        for (index, sample) in out.iter().enumerate() {
+            #[allow(clippy::cast_precision_loss)]
+            let expected = (index * 100) as f32 / 1023.0;
+            assert!((sample - expected).abs() < 1e-6);
+        }
+    }
+}
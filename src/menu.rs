@@ -24,6 +24,12 @@ pub fn media<'a>() -> MenuTree<'a, message::Message, iced::Renderer> {
         vec![
             view::menu::item("Load video", message::Message::SelectVideoFile),
             view::menu::item("Load audio", message::Message::SelectAudioFile),
+            view::menu::item("Detect keyframes", message::Message::DetectKeyframes),
+            view::menu::item(
+                "Cancel keyframe detection",
+                message::Message::CancelKeyframeDetection,
+            ),
+            view::menu::item("Save keyframes", message::Message::SaveKeyframes),
         ],
     )
 }
@@ -58,12 +58,57 @@ pub enum Message {
     /// Export subtitle file — compiling events and removing extraneous metadata
     ExportSubtitleFile,
 
+    /// The subtitle file has been saved to the given path. Contains the journal's mark from when
+    /// saving was started, if a journal was open at that point.
+    SubtitleFileSaved(std::path::PathBuf, Option<subtitle::journal::SaveMark>),
+
+    /// Saving the subtitle file was cancelled before anything was written.
+    SubtitleSaveCancelled,
+
+    /// Periodic reminder to sync pending edit journal records to disk.
+    SyncJournal,
+
+    /// The user has requested to close the main window.
+    CloseRequested,
+
     /// A video file has been selected and should be loaded.
     VideoFileSelected(std::path::PathBuf),
 
-    /// A video has been loaded; its metadata is now available and frames can now be decode
-    /// from it.
-    VideoLoaded(Box<media::VideoMetadata>),
+    /// The video decoder has started the given stage of loading a video, or, if `None`, has
+    /// stopped loading without a result.
+    VideoLoadProgress(Option<media::VideoLoadStage>),
+
+    /// Stop loading the video that is currently being loaded, if any. The previous video, if any,
+    /// stays loaded.
+    CancelVideoLoad,
+
+    /// A video has been loaded from the given path; its metadata is now available and frames can
+    /// now be decode from it.
+    VideoLoaded(Box<media::VideoMetadata>, std::path::PathBuf),
+
+    /// Keyframes for the loaded video are available, either from its index, from its keyframe
+    /// file, or from scene change detection.
+    KeyframesAvailable(model::keyframes::Keyframes),
+
+    /// Detect scene changes in the loaded video in the background, and use them as keyframes.
+    DetectKeyframes,
+
+    /// Stop the keyframe detection that is currently running, if any.
+    CancelKeyframeDetection,
+
+    /// Ask the user where to save the current keyframes, in Aegisub's keyframe format.
+    SaveKeyframes,
+
+    /// Snap the start and end times of the selected events to nearby keyframes.
+    SnapSelectedEventsToKeyframes,
+
+    /// A low-resolution proxy of the video at the first path is available at the second path, and
+    /// can be used while it is still being generated.
+    ProxyAvailable(std::path::PathBuf, std::path::PathBuf),
+
+    /// The first frame of the video that is being loaded has been decoded before the video was
+    /// indexed, and can be shown until loading has finished.
+    VideoPreviewAvailable(iced::widget::image::Handle),
 
     /// A video frame has been decoded and is available to be displayed.
     VideoFrameAvailable(model::FrameNumber, iced::widget::image::Handle),
@@ -85,6 +130,18 @@ pub enum Message {
     PlaybackAdvanceSeconds(f64),
     TogglePlayback,
 
+    /// Set the playback speed, in thousandths, or change it to the next slower or faster preset.
+    SetPlaybackSpeed(u32),
+    StepPlaybackSpeed(i32),
+
+    /// Play the time span of the selected events once, or repeatedly until toggled off again.
+    PlaySelection,
+    LoopSelection,
+
+    /// Playback has reached the end of a non-repeating playback range; emitted by the playback
+    /// worker.
+    PlaybackRangeEnded,
+
     /// Update the global representation of the playback state; emitted by the playback worker.
     /// Does not cause the playback state itself to change.
     Playing(bool),
@@ -135,12 +192,56 @@ pub enum Message {
     SetReticules(model::reticule::Reticules),
     UpdateReticulePosition(usize, nde::tags::Position),
 
-    /// Tell the video playback worker to start motion tracking and sending the results to the
-    /// node with the given ID.
-    TrackMotionForNode(usize, media::motion::Region),
+    /// Place the given markers on the current frame of the motion track node with the given ID,
+    /// as a keyframe to track from.
+    AddMotionTrackKeyframe(usize, Vec<media::motion::Region>),
+
+    /// Tell the motion tracking worker to start tracking from the given keyframes, within the
+    /// active event, and sending the results to the node with the given ID.
+    TrackMotionForNode(usize, Vec<(model::FrameNumber, Vec<media::motion::Region>)>),
+
+    /// Stop the motion track that is currently running, if any. Results that were already sent
+    /// are kept.
+    CancelMotionTracking,
 }
 
 impl Message {
+    /// Whether handling this message may change the contents of the subtitle file (events, styles,
+    /// or NDE filters). Used to invalidate data derived from the subtitles.
+    #[must_use]
+    pub const fn modifies_subtitles(&self) -> bool {
+        matches!(
+            self,
+            Self::Node(_, _)
+                | Self::SubtitleFileReadForImport(_)
+                | Self::CreateStyle
+                | Self::DeleteStyle(_)
+                | Self::SetStyleBold(_, _)
+                | Self::AddEvent
+                | Self::DeleteSelectedEvents
+                | Self::SetActiveEventText(_)
+                | Self::SetActiveEventActor(_)
+                | Self::SetActiveEventEffect(_)
+                | Self::SetActiveEventStyleIndex(_)
+                | Self::SetActiveEventLayerIndex(_)
+                | Self::SetActiveEventType(_)
+                | Self::SetActiveEventStartTime(_)
+                | Self::SetActiveEventDuration(_)
+                | Self::SnapSelectedEventsToKeyframes
+                | Self::CreateEmptyFilter
+                | Self::AssignFilterToSelectedEvents(_)
+                | Self::UnassignFilterFromSelectedEvents
+                | Self::SetActiveFilterName(_)
+                | Self::DeleteFilter(_)
+                | Self::AddNode(_)
+                | Self::MoveNode(_, _, _)
+                | Self::ConnectNodes(_)
+                | Self::DisconnectNodes(_, _, _)
+                | Self::UpdateReticulePosition(_, _)
+                | Self::AddMotionTrackKeyframe(_, _)
+        )
+    }
+
     /// Returns a function that maps Some(x) to some message, and None to Message::None.
     pub fn map_option<A, F1: FnOnce(A) -> Self>(f1: F1) -> impl FnOnce(Option<A>) -> Self {
         |a_opt| match a_opt {
@@ -178,6 +279,7 @@ pub enum Pane {
     GridSyncHeader(iced::widget::scrollable::AbsoluteOffset),
     GridColumnResizing(usize, f32),
     GridColumnResized,
+    GridScrollToEvent(subtitle::EventIndex),
 
     // Messages for the node editor
     NodeEditorScaleChanged(f32, f32, f32),
@@ -192,8 +294,22 @@ pub enum Pane {
 /// Messages dispatched to nodes.
 #[derive(Debug, Clone)]
 pub enum Node {
-    /// A new marker is available for the currently running motion track.
-    MotionTrackUpdate(model::FrameNumber, media::motion::Region),
+    /// New positions are available for the markers of the currently running motion track, for
+    /// each of the given frames. The positions are in the order the markers were given in when the
+    /// track was started.
+    MotionTrackUpdate(Vec<(model::FrameNumber, Vec<media::motion::Region>)>),
+
+    /// Adds another marker to a motion track node.
+    MotionTrackAddMarker,
+
+    /// Removes the last marker from a motion track node.
+    MotionTrackRemoveMarker,
+
+    /// The markers of a motion track node have been placed on the given frame.
+    MotionTrackKeyframe(model::FrameNumber, Vec<media::motion::Region>),
+
+    /// Removes all keyframes, and the track, from a motion track node.
+    MotionTrackClearKeyframes,
 
     /// The text input in a node has changed, to be used generically by different nodes.
     TextInputChanged(String),
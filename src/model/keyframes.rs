@@ -0,0 +1,166 @@
+//! Keyframes of a video, which subtitle timing can snap to. Stored in Aegisub's keyframe format v1,
+//! which is a header line, a line giving the frame rate (ignored, and usually 0), and then one frame
+//! number per line.
+
+use std::path::{Path, PathBuf};
+
+use thiserror::Error;
+
+use super::{FrameDelta, FrameNumber};
+
+const V1_HEADER: &str = "# keyframe format v1";
+
+/// How far event times may be moved to snap them to a keyframe.
+pub const SNAP_DISTANCE: FrameDelta = FrameDelta(6);
+
+/// Sorted list of keyframes, without duplicates.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct Keyframes(Vec<FrameNumber>);
+
+impl Keyframes {
+    #[must_use]
+    pub fn new(mut frames: Vec<FrameNumber>) -> Self {
+        frames.sort_unstable();
+        frames.dedup();
+        Self(frames)
+    }
+
+    #[must_use]
+    pub fn as_slice(&self) -> &[FrameNumber] {
+        &self.0
+    }
+
+    #[must_use]
+    pub fn len(&self) -> usize {
+        self.0.len()
+    }
+
+    #[must_use]
+    pub fn is_empty(&self) -> bool {
+        self.0.is_empty()
+    }
+
+    /// The last keyframe at or before the given frame.
+    #[must_use]
+    pub fn previous(&self, frame: FrameNumber) -> Option<FrameNumber> {
+        let index = self.0.partition_point(|keyframe| *keyframe <= frame);
+        index.checked_sub(1).map(|index| self.0[index])
+    }
+
+    /// The first keyframe at or after the given frame.
+    #[must_use]
+    pub fn next(&self, frame: FrameNumber) -> Option<FrameNumber> {
+        let index = self.0.partition_point(|keyframe| *keyframe < frame);
+        self.0.get(index).copied()
+    }
+
+    /// Returns the keyframe closest to the given frame, if it is at most `max_distance` frames
+    /// away, or the frame itself otherwise. If two keyframes are equally close, the earlier one is
+    /// chosen.
+    #[must_use]
+    pub fn snap(&self, frame: FrameNumber, max_distance: FrameDelta) -> FrameNumber {
+        let distance = |keyframe: FrameNumber| (keyframe.0 - frame.0).abs();
+        [self.previous(frame), self.next(frame)]
+            .into_iter()
+            .flatten()
+            .filter(|keyframe| distance(*keyframe) <= max_distance.0)
+            .min_by_key(|keyframe| distance(*keyframe))
+            .unwrap_or(frame)
+    }
+
+    /// Parses a keyframe file in Aegisub's keyframe format v1.
+    ///
+    /// # Errors
+    /// Returns an error if the header is missing, or if a line is not a frame number.
+    pub fn parse_v1(text: &str) -> Result<Self, ParseError> {
+        let mut lines = text.lines().map(str::trim);
+        if lines.next() != Some(V1_HEADER) {
+            return Err(ParseError::MissingHeader);
+        }
+
+        let mut frames = vec![];
+        for line in lines {
+            if line.is_empty() || line.starts_with("fps ") {
+                continue;
+            }
+
+            match line.parse() {
+                Ok(frame) => frames.push(FrameNumber(frame)),
+                Err(_) => return Err(ParseError::InvalidLine(line.to_owned())),
+            }
+        }
+
+        Ok(Self::new(frames))
+    }
+
+    /// Writes the keyframes in Aegisub's keyframe format v1.
+    #[must_use]
+    pub fn to_v1(&self) -> String {
+        let mut text = format!("{V1_HEADER}\nfps 0\n");
+        for frame in &self.0 {
+            text.push_str(&frame.0.to_string());
+            text.push('\n');
+        }
+        text
+    }
+}
+
+/// The keyframe file that belongs to the given video, which is where Aegisub looks for one:
+/// `path/to/file.mkv` has its keyframes in `path/to/file_keyframes.txt`.
+#[must_use]
+pub fn path_for(video_path: &Path) -> PathBuf {
+    let mut file_name = video_path.file_stem().unwrap_or_default().to_os_string();
+    file_name.push("_keyframes.txt");
+    video_path.with_file_name(file_name)
+}
+
+#[derive(Debug, Error)]
+pub enum ParseError {
+    #[error("Not a keyframe file in format v1")]
+    MissingHeader,
+
+    #[error("Invalid line in keyframe file: {0}")]
+    InvalidLine(String),
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn snapping() {
+        let keyframes = Keyframes::new(vec![FrameNumber(100), FrameNumber(0), FrameNumber(50)]);
+        assert_eq!(keyframes.previous(FrameNumber(49)), Some(FrameNumber(0)));
+        assert_eq!(keyframes.previous(FrameNumber(50)), Some(FrameNumber(50)));
+        assert_eq!(keyframes.next(FrameNumber(51)), Some(FrameNumber(100)));
+        assert_eq!(keyframes.next(FrameNumber(101)), None);
+
+        assert_eq!(
+            keyframes.snap(FrameNumber(47), FrameDelta(5)),
+            FrameNumber(50)
+        );
+        assert_eq!(
+            keyframes.snap(FrameNumber(75), FrameDelta(25)),
+            FrameNumber(50)
+        );
+        assert_eq!(
+            keyframes.snap(FrameNumber(75), FrameDelta(24)),
+            FrameNumber(75)
+        );
+    }
+
+    #[test]
+    fn format_v1() {
+        let keyframes = Keyframes::new(vec![FrameNumber(0), FrameNumber(24), FrameNumber(90)]);
+        let text = keyframes.to_v1();
+        assert_eq!(text, "# keyframe format v1\nfps 0\n0\n24\n90\n");
+        assert_eq!(Keyframes::parse_v1(&text).unwrap(), keyframes);
+
+        assert!(Keyframes::parse_v1("0\n24\n").is_err());
+        assert_eq!(
+            path_for(Path::new("path/to/file.mkv")),
+            Path::new("path/to/file_keyframes.txt")
+        );
+        assert!(Keyframes::parse_v1("# keyframe format v1\nfps 0\nabc\n").is_err());
+    }
+}
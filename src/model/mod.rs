@@ -1,10 +1,13 @@
 use std::ops::{Add, AddAssign, Deref, DerefMut, Sub, SubAssign};
 
+pub mod keyframes;
 pub mod playback;
 pub mod reticule;
 
 /// Identifies a video frame by number.
-#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, serde::Serialize, serde::Deserialize)]
+#[derive(
+    Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash, serde::Serialize, serde::Deserialize,
+)]
 pub struct FrameNumber(pub i32);
 
 /// A difference in counted video frames.
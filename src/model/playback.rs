@@ -1,49 +1,242 @@
-use std::sync::{
-    atomic::{AtomicU32, AtomicU64, Ordering},
-    Mutex,
-};
+use std::sync::atomic::{AtomicBool, AtomicU32, AtomicU64, Ordering};
+use std::time::{Duration, Instant};
 
 use crate::{media, model};
 
+/// Playback speed limits, in thousandths.
+pub const MIN_SPEED: u32 = 250;
+pub const MAX_SPEED: u32 = 2000;
+
+/// Number of bits of the packed state used for the position. The remaining upper bits hold the
+/// seek epoch.
+const POSITION_BITS: u32 = 48;
+const POSITION_MASK: u64 = (1 << POSITION_BITS) - 1;
+
+/// The playback clock. Can be read and modified from any thread without locking, in particular
+/// from the audio callback.
+///
+/// The position and a seek epoch are packed into a single atomic word, which is updated using
+/// compare-and-swap. Every seek increments the epoch, so that the audio callback can detect when
+/// the position it started filling a buffer from has been changed in the meantime, and the
+/// timestamp of the last callback can be matched to the position it belongs to.
 pub struct Position {
-    // Position in terms of `rate`. Always guaranteed to be correct,
-    // but requires a lock on the mutex to access.
-    pub authoritative_position: Mutex<u64>,
+    /// Seek epoch in the upper 16 bits, position in terms of `rate` in the lower 48 bits.
+    state: AtomicU64,
+
+    /// How many `n`'s per second there are.
+    rate: AtomicU32,
+
+    /// Playback speed in thousandths. Only changed together with a seek, so it is constant within
+    /// a seek epoch.
+    speed: AtomicU32,
+
+    /// When the audio callback last advanced the position, as nanoseconds since `origin` in the
+    /// lower 48 bits, with the epoch at that time in the upper 16 bits. Zero if playback is not
+    /// currently running.
+    callback_time: AtomicU64,
+
+    /// Number of ticks the audio callback advanced the position by the last time it ran.
+    callback_ticks: AtomicU32,
+
+    /// Time between the last audio callback and the moment the audio it provided starts being
+    /// heard, as reported by the audio device, in nanoseconds.
+    latency_nanos: AtomicU64,
+
+    /// The position set by the last seek, packed together with the epoch it started.
+    seek_origin: AtomicU64,
+
+    /// Range playback is restricted to, see [`Range`]. Only changed together with a seek, so it is
+    /// constant within a seek epoch. `range_end` is zero if there is no range.
+    range_start: AtomicU64,
+    range_end: AtomicU64,
+    range_repeat: AtomicBool,
+
+    origin: Instant,
+}
+
+/// A consistent view of the playback position and its seek epoch at some point in time.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Snapshot {
+    pub position: u64,
+    pub epoch: u16,
+}
+
+impl Snapshot {
+    fn pack(self) -> u64 {
+        (u64::from(self.epoch) << POSITION_BITS) | (self.position & POSITION_MASK)
+    }
+
+    #[allow(clippy::cast_possible_truncation)]
+    fn unpack(packed: u64) -> Self {
+        Self {
+            position: packed & POSITION_MASK,
+            epoch: (packed >> POSITION_BITS) as u16,
+        }
+    }
+}
+
+/// Timing information about an invocation of the audio callback.
+#[derive(Debug, Clone, Copy)]
+pub struct CallbackTiming {
+    /// When the callback was invoked.
+    pub time: Instant,
 
-    // Last known position in terns of `rate`.
-    pub position: AtomicU64,
+    /// How long after `time` the audio provided by the callback will start to be heard.
+    pub latency: Duration,
+}
+
+/// A range of positions playback is restricted to, like the time span of the selected events.
+/// Once playback reaches `end` coming from before it, it either wraps around to `start`, exactly at
+/// the sample where `end` is reached, or stops there.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Range {
+    pub start: u64,
+    pub end: u64,
+    pub repeat: bool,
+}
 
-    // How many `n`'s per second there are.
-    pub rate: AtomicU32,
+impl Range {
+    #[must_use]
+    pub fn contains(&self, position: u64) -> bool {
+        (self.start..self.end).contains(&position)
+    }
 }
 
 impl Position {
+    #[must_use]
+    pub fn snapshot(&self) -> Snapshot {
+        Snapshot::unpack(self.state.load(Ordering::Acquire))
+    }
+
+    /// Returns the position as last set by a seek or the audio callback. During playback, this
+    /// is the end of the audio that has been handed to the audio device so far.
     pub fn position(&self) -> u64 {
-        self.position.load(Ordering::Relaxed)
+        self.snapshot().position
     }
 
     pub fn rate(&self) -> u32 {
         self.rate.load(Ordering::Relaxed)
     }
 
-    /// Returns the current non-authoritative position as floating-point seconds.
+    pub fn set_rate(&self, rate: u32) {
+        self.rate.store(rate, Ordering::Relaxed);
+    }
+
+    /// Returns the playback speed in thousandths, see [`media::dsp::UNITY_SPEED`].
+    pub fn speed(&self) -> u32 {
+        self.speed.load(Ordering::Relaxed)
+    }
+
+    /// Changes the playback speed, clamped to between [`MIN_SPEED`] and [`MAX_SPEED`]. Audio that
+    /// has already been prepared for the old speed is discarded, so this counts as a seek.
+    pub fn set_speed(&self, speed: u32) {
+        self.speed
+            .store(speed.clamp(MIN_SPEED, MAX_SPEED), Ordering::Relaxed);
+        self.add_ticks(0);
+    }
+
+    /// Returns the best estimate of the position that is currently being heard.
+    pub fn extrapolated_position(&self) -> u64 {
+        self.extrapolated_position_at(Instant::now())
+    }
+
+    /// Returns the best estimate of the position that is being heard at the given time. During
+    /// playback, this is extrapolated from the time at which the audio callback last ran,
+    /// compensating for the output latency of the audio device, so it can be more precise than
+    /// the size of an audio buffer. Otherwise, it is the same as [`Position::position`].
+    pub fn extrapolated_position_at(&self, time: Instant) -> u64 {
+        let snapshot = self.snapshot();
+        let callback_time = self.callback_time.load(Ordering::Acquire);
+        if callback_time == 0 {
+            return snapshot.position;
+        }
+
+        let Snapshot {
+            position: callback_nanos,
+            epoch: callback_epoch,
+        } = Snapshot::unpack(callback_time);
+        if callback_epoch != snapshot.epoch {
+            // There has been a seek since the callback last ran
+            return snapshot.position;
+        }
+
+        let rate = i128::from(self.rate()) * i128::from(self.speed());
+        let elapsed_nanos =
+            i128::from(self.nanos_at(time).wrapping_sub(callback_nanos) & POSITION_MASK);
+        let latency_nanos = i128::from(self.latency_nanos.load(Ordering::Relaxed));
+        let buffer_ticks = u64::from(self.callback_ticks.load(Ordering::Relaxed));
+
+        // The buffer that was handed to the device in the last callback starts being heard once
+        // the latency has passed after the callback. Until then, earlier audio is still audible.
+        let buffer_start = snapshot.position.saturating_sub(buffer_ticks);
+        let delta_ticks = (elapsed_nanos - latency_nanos) * rate / 1_000_000_000_000;
+        let extrapolated = i128::from(buffer_start) + delta_ticks;
+
+        // Audio from before the last seek may still be heard right after it, but displaying
+        // anything from before the seek target would be confusing.
+        let seek_origin = Snapshot::unpack(self.seek_origin.load(Ordering::Relaxed));
+        let lower_bound = if seek_origin.epoch == snapshot.epoch {
+            seek_origin.position
+        } else {
+            0
+        };
+
+        u64::try_from(extrapolated.max(0))
+            .unwrap_or(u64::MAX)
+            .clamp(lower_bound.min(snapshot.position), snapshot.position)
+    }
+
+    /// Whether the audio callback is currently advancing the position, i.e. whether playback is
+    /// running.
+    pub fn is_running(&self) -> bool {
+        self.callback_time.load(Ordering::Acquire) != 0
+    }
+
+    /// Returns the time until the frame following the one returned by [`current_frame`] starts
+    /// being heard, or `None` if playback is not currently running.
+    ///
+    /// [`current_frame`]: Position::current_frame
+    pub fn duration_until_next_frame(&self, frame_rate: media::FrameRate) -> Option<Duration> {
+        if !self.is_running() || self.rate() == 0 {
+            return None;
+        }
+
+        let rate = u128::from(self.rate());
+        let position = u128::from(self.extrapolated_position());
+        let current_frame = position * u128::from(frame_rate.numerator)
+            / (u128::from(frame_rate.denominator) * rate);
+
+        // First tick of the next frame, rounded up
+        let next_frame_tick = ((current_frame + 1) * u128::from(frame_rate.denominator) * rate)
+            .div_ceil(u128::from(frame_rate.numerator));
+        let remaining_ticks = next_frame_tick.saturating_sub(position);
+
+        // Ticks pass more slowly or quickly than in real time, depending on the speed
+        let ticks_per_second = rate * u128::from(self.speed().max(1));
+        Some(Duration::from_nanos(
+            u64::try_from(remaining_ticks * 1_000_000_000_000 / ticks_per_second)
+                .unwrap_or(u64::MAX),
+        ))
+    }
+
+    /// Returns the current extrapolated position as floating-point seconds.
     /// May be imprecise for very large positions or rates.
     #[allow(clippy::cast_precision_loss)]
     pub fn seconds(&self) -> f64 {
         if self.rate() == 0 {
             return 0.0;
         }
-        self.position() as f64 / f64::from(self.rate())
+        self.extrapolated_position() as f64 / f64::from(self.rate())
     }
 
     /// Converts the playback position into a frame number (rounding down) using the given frame
-    /// rate. Avoids floating point imprecisions where possible.
+    /// rate. Avoids floating point imprecisions where possible. Never blocks.
     ///
     /// # Panics
     /// Panics if the frame number does not fit into a 32-bit signed integer.
     pub fn current_frame(&self, frame_rate: media::FrameRate) -> model::FrameNumber {
-        let numerator = self.position() * frame_rate.numerator;
-        let denominator = frame_rate.denominator * u64::from(self.rate());
+        let numerator = u128::from(self.extrapolated_position()) * u128::from(frame_rate.numerator);
+        let denominator = u128::from(frame_rate.denominator) * u128::from(self.rate());
 
         model::FrameNumber(
             (numerator / denominator)
@@ -52,16 +245,81 @@ impl Position {
         )
     }
 
-    /// Adds the given `delta` number of ticks to the playback state. May be negative.
-    ///
-    /// # Panics
-    /// Panics if the authoritative position lock is poisoned.
+    /// Adds the given `delta` number of ticks to the playback state. May be negative. This counts
+    /// as a seek, so the epoch is incremented.
     pub fn add_ticks(&self, delta: i64) {
-        let mut lock = self.authoritative_position.lock().unwrap();
-        let new_value = lock.saturating_add_signed(delta);
-        *lock = new_value;
-        drop(lock);
-        self.position.store(new_value, Ordering::Relaxed);
+        self.seek_with(|position| position.saturating_add_signed(delta));
+    }
+
+    /// Seeks to the given absolute position.
+    pub fn seek_to(&self, position: u64) {
+        self.seek_with(|_| position);
+    }
+
+    fn seek_with<F: Fn(u64) -> u64>(&self, target: F) {
+        let seek = |previous: Snapshot| Snapshot {
+            position: target(previous.position).min(POSITION_MASK),
+            epoch: previous.epoch.wrapping_add(1),
+        };
+
+        let result = self
+            .state
+            .fetch_update(Ordering::AcqRel, Ordering::Acquire, |packed| {
+                Some(seek(Snapshot::unpack(packed)).pack())
+            });
+
+        if let Ok(previous) = result {
+            let origin = seek(Snapshot::unpack(previous));
+            self.seek_origin.store(origin.pack(), Ordering::Relaxed);
+        }
+    }
+
+    /// Restricts playback to the given range and seeks to its start, or lifts the restriction
+    /// without moving the position if `range` is `None`.
+    pub fn set_range(&self, range: Option<Range>) {
+        // The range needs to be visible to anyone who observes the new epoch
+        if let Some(range) = range {
+            self.range_start.store(range.start, Ordering::Relaxed);
+            self.range_end
+                .store(range.end.max(range.start + 1), Ordering::Relaxed);
+            self.range_repeat.store(range.repeat, Ordering::Relaxed);
+            self.seek_to(range.start);
+        } else {
+            self.range_end.store(0, Ordering::Relaxed);
+            self.add_ticks(0);
+        }
+    }
+
+    /// Returns the range playback is currently restricted to, if any.
+    pub fn range(&self) -> Option<Range> {
+        let end = self.range_end.load(Ordering::Relaxed);
+        (end != 0).then(|| Range {
+            start: self.range_start.load(Ordering::Relaxed),
+            end,
+            repeat: self.range_repeat.load(Ordering::Relaxed),
+        })
+    }
+
+    /// Returns the position after playing `ticks` ticks starting at `position`, taking the
+    /// current range into account.
+    pub fn advanced_position(&self, position: u64, ticks: u64) -> u64 {
+        let advanced = position.saturating_add(ticks).min(POSITION_MASK);
+        match self.range() {
+            Some(range) if position < range.end && advanced >= range.end => {
+                if range.repeat {
+                    range.start + (advanced - range.end) % (range.end - range.start)
+                } else {
+                    range.end
+                }
+            }
+            _ => advanced,
+        }
+    }
+
+    /// Converts a subtitle timestamp in milliseconds to a position.
+    pub fn ticks_from_ms(&self, ms: i64) -> u64 {
+        let ticks = i128::from(ms.max(0)) * i128::from(self.rate()) / 1000;
+        u64::try_from(ticks).unwrap_or(u64::MAX).min(POSITION_MASK)
     }
 
     pub fn add_seconds(&self, delta_seconds: f64) {
@@ -76,14 +334,207 @@ impl Position {
     pub fn add_frames(&self, delta_frames: model::FrameDelta, frame_rate: media::FrameRate) {
         self.add_seconds(f64::from(delta_frames.0) / f64::from(frame_rate));
     }
+
+    /// Called by the audio callback after it has handed `ticks` ticks of audio, starting at the
+    /// position in `start`, to the audio device. Advances the position, wrapping around at the end
+    /// of a repeating range, unless there has been a seek since `start` was taken, in which case
+    /// the seek takes precedence and `false` is returned.
+    pub fn advance(&self, start: Snapshot, ticks: u32, timing: CallbackTiming) -> bool {
+        let advanced = Snapshot {
+            position: self.advanced_position(start.position, u64::from(ticks)),
+            epoch: start.epoch,
+        };
+
+        if self
+            .state
+            .compare_exchange(
+                start.pack(),
+                advanced.pack(),
+                Ordering::AcqRel,
+                Ordering::Acquire,
+            )
+            .is_err()
+        {
+            return false;
+        }
+
+        self.callback_ticks.store(ticks, Ordering::Relaxed);
+        self.latency_nanos.store(
+            u64::try_from(timing.latency.as_nanos()).unwrap_or(u64::MAX),
+            Ordering::Relaxed,
+        );
+        self.callback_time.store(
+            Snapshot {
+                // Never store zero, which means “not playing”
+                position: self.nanos_at(timing.time).max(1),
+                epoch: start.epoch,
+            }
+            .pack(),
+            Ordering::Release,
+        );
+
+        true
+    }
+
+    /// Returns the output latency reported by the audio device during the last callback.
+    pub fn latency(&self) -> Duration {
+        Duration::from_nanos(self.latency_nanos.load(Ordering::Relaxed))
+    }
+
+    /// Called when playback stops, so that the position is no longer extrapolated.
+    pub fn mark_idle(&self) {
+        self.callback_time.store(0, Ordering::Release);
+    }
+
+    #[allow(clippy::cast_possible_truncation)]
+    fn nanos_at(&self, time: Instant) -> u64 {
+        (time.saturating_duration_since(self.origin).as_nanos() as u64) & POSITION_MASK
+    }
 }
 
 impl Default for Position {
     fn default() -> Self {
         Self {
-            authoritative_position: Mutex::new(0),
-            position: 0.into(),
+            state: 0.into(),
             rate: 1000.into(), // if nothing is loaded, use milliseconds for position
+            speed: media::dsp::UNITY_SPEED.into(),
+            callback_time: 0.into(),
+            callback_ticks: 0.into(),
+            latency_nanos: 0.into(),
+            seek_origin: 0.into(),
+            range_start: 0.into(),
+            range_end: 0.into(),
+            range_repeat: false.into(),
+            origin: Instant::now(),
         }
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn timing_at(position: &Position, millis: u64, latency_millis: u64) -> CallbackTiming {
+        CallbackTiming {
+            time: position.origin + Duration::from_millis(millis),
+            latency: Duration::from_millis(latency_millis),
+        }
+    }
+
+    #[test]
+    fn seek_during_callback() {
+        let position = Position::default();
+        position.set_rate(48000);
+
+        let start = position.snapshot();
+        assert!(position.advance(start, 1024, timing_at(&position, 0, 0)));
+        assert_eq!(position.position(), 1024);
+        assert!(position.extrapolated_position() <= 1024);
+
+        // A seek between taking the snapshot and advancing wins over the callback
+        let start = position.snapshot();
+        position.add_ticks(48000);
+        assert!(!position.advance(start, 1024, timing_at(&position, 10, 0)));
+        assert_eq!(position.position(), 49024);
+        assert_eq!(position.extrapolated_position(), 49024);
+
+        position.add_ticks(-100_000);
+        assert_eq!(position.position(), 0);
+
+        position.mark_idle();
+        assert_eq!(position.extrapolated_position(), 0);
+    }
+
+    #[test]
+    fn latency_compensation() {
+        let position = Position::default();
+        position.set_rate(48000);
+        position.add_ticks(96000);
+
+        // Hand 20 ms of audio to a device with 50 ms of latency at t = 1000 ms
+        let start = position.snapshot();
+        assert!(position.advance(start, 960, timing_at(&position, 1000, 50)));
+        assert_eq!(position.position(), 96960);
+
+        // Nothing from after the seek target is heard until the latency has passed
+        let at = |millis| {
+            position.extrapolated_position_at(position.origin + Duration::from_millis(millis))
+        };
+        assert_eq!(at(1000), 96000);
+        assert_eq!(at(1049), 96000);
+        assert_eq!(at(1060), 96480);
+        assert_eq!(at(1070), 96960);
+        assert_eq!(at(2000), 96960);
+
+        // In steady state, the heard position lags behind the buffered one by the latency
+        let start = position.snapshot();
+        assert!(position.advance(start, 960, timing_at(&position, 1020, 50)));
+        let start = position.snapshot();
+        assert!(position.advance(start, 960, timing_at(&position, 1040, 50)));
+        assert_eq!(position.position(), 98880);
+        assert_eq!(at(1040), 96000);
+        assert_eq!(at(1080), 97440);
+        assert_eq!(at(1090), 97920);
+    }
+
+    #[test]
+    fn range() {
+        let position = Position::default();
+        position.set_rate(48000);
+        position.add_ticks(1000);
+
+        position.set_range(Some(Range {
+            start: 48000,
+            end: 50000,
+            repeat: true,
+        }));
+        assert_eq!(position.position(), 48000);
+
+        // Wraps around exactly at the end
+        let start = position.snapshot();
+        assert!(position.advance(start, 1500, timing_at(&position, 0, 0)));
+        assert_eq!(position.position(), 49500);
+        let start = position.snapshot();
+        assert!(position.advance(start, 1024, timing_at(&position, 10, 0)));
+        assert_eq!(position.position(), 48524);
+
+        // Positions after the end are not affected
+        assert_eq!(position.advanced_position(60000, 1024), 61024);
+
+        // Without repeating, playback stops at the end
+        position.set_range(Some(Range {
+            start: 48000,
+            end: 50000,
+            repeat: false,
+        }));
+        let start = position.snapshot();
+        assert!(position.advance(start, 2048, timing_at(&position, 20, 0)));
+        assert_eq!(position.position(), 50000);
+
+        let epoch = position.snapshot().epoch;
+        position.set_range(None);
+        assert_eq!(position.range(), None);
+        assert_eq!(position.position(), 50000);
+        assert_ne!(position.snapshot().epoch, epoch);
+    }
+
+    #[test]
+    fn speed() {
+        let position = Position::default();
+        position.set_rate(48000);
+        position.set_speed(500);
+
+        // At half speed, 20 ms of output cover 10 ms worth of ticks
+        let start = position.snapshot();
+        assert!(position.advance(start, 480, timing_at(&position, 1000, 0)));
+        let at = |millis| {
+            position.extrapolated_position_at(position.origin + Duration::from_millis(millis))
+        };
+        assert_eq!(at(1000), 0);
+        assert_eq!(at(1010), 240);
+        assert_eq!(at(1020), 480);
+
+        position.set_speed(10);
+        assert_eq!(position.speed(), MIN_SPEED);
+    }
+}
@@ -7,9 +7,23 @@ use super::node;
 #[derive(Debug, serde::Serialize, serde::Deserialize)]
 pub struct Graph {
     pub nodes: Vec<VisualNode>,
+
+    #[serde(serialize_with = "serialize_connections_sorted")]
     pub connections: HashMap<NextEndpoint, PreviousEndpoint>,
 }
 
+/// Serialises the connection map in a fixed order, independent of `HashMap` iteration order, so
+/// that equal graphs always serialise to the same bytes. This allows identical filters to be
+/// recognised by their serialised form.
+fn serialize_connections_sorted<S: serde::Serializer>(
+    connections: &HashMap<NextEndpoint, PreviousEndpoint>,
+    serializer: S,
+) -> Result<S::Ok, S::Error> {
+    let mut sorted: Vec<(&NextEndpoint, &PreviousEndpoint)> = connections.iter().collect();
+    sorted.sort_unstable_by_key(|(next, _)| (next.node_index, next.socket_index));
+    serializer.collect_map(sorted)
+}
+
 impl Default for Graph {
     fn default() -> Self {
         Graph {
@@ -4,10 +4,91 @@ use crate::{media, message, model, nde};
 
 use super::{Error, Node, Shell, SocketType, SocketValue};
 
+/// Radius of the search region around each marker.
+const MARKER_RADIUS: f64 = 20.0;
+
+/// Where markers are placed in a new node.
+const DEFAULT_MARKER: nde::tags::Position = nde::tags::Position { x: 100.0, y: 100.0 };
+
+/// Tracks any number of markers through the video, and positions events at the average of their
+/// tracked centres, which is more robust against any single marker drifting off.
+///
+/// The markers are placed by hand on one or more keyframes. Tracking starts from each keyframe,
+/// both forwards and backwards, and the results are blended between keyframes.
 #[derive(Debug, serde::Serialize, serde::Deserialize)]
+#[serde(from = "StoredMotionTrack")]
 pub struct MotionTrack {
-    pub region_center: nde::tags::Position,
-    pub track: HashMap<model::FrameNumber, media::motion::Region>,
+    /// Centres of the markers to place on the next keyframe.
+    pub markers: Vec<nde::tags::Position>,
+
+    /// Frames on which the markers have been placed by hand, with their regions in the same order
+    /// as `markers`.
+    pub keyframes: Vec<(model::FrameNumber, Vec<media::motion::Region>)>,
+
+    /// Tracked regions of all markers, in the same order as `markers`, for each tracked frame.
+    pub track: HashMap<model::FrameNumber, Vec<media::motion::Region>>,
+}
+
+/// The shapes motion track nodes have been saved in, so that projects from before nodes could
+/// track multiple markers can still be opened.
+#[derive(serde::Deserialize)]
+#[serde(untagged)]
+enum StoredMotionTrack {
+    MultipleMarkers {
+        markers: Vec<nde::tags::Position>,
+        #[serde(default)]
+        keyframes: Vec<(model::FrameNumber, Vec<media::motion::Region>)>,
+        track: HashMap<model::FrameNumber, Vec<media::motion::Region>>,
+    },
+    SingleMarker {
+        region_center: nde::tags::Position,
+        track: HashMap<model::FrameNumber, media::motion::Region>,
+    },
+}
+
+impl From<StoredMotionTrack> for MotionTrack {
+    fn from(stored: StoredMotionTrack) -> Self {
+        match stored {
+            StoredMotionTrack::MultipleMarkers {
+                markers,
+                keyframes,
+                track,
+            } => Self {
+                markers,
+                keyframes,
+                track,
+            },
+            // Which frame the marker was placed on was not saved, so there is no keyframe to
+            // track from again, but the tracked regions stay usable
+            StoredMotionTrack::SingleMarker {
+                region_center,
+                track,
+            } => Self {
+                markers: vec![region_center],
+                keyframes: vec![],
+                track: track
+                    .into_iter()
+                    .map(|(frame, region)| (frame, vec![region]))
+                    .collect(),
+            },
+        }
+    }
+}
+
+impl MotionTrack {
+    /// Returns the average centre of the markers tracked for the given frame.
+    #[allow(clippy::cast_precision_loss)]
+    fn center_at(&self, frame: model::FrameNumber) -> Option<nde::tags::Position> {
+        let regions = self
+            .track
+            .get(&frame)
+            .filter(|regions| !regions.is_empty())?;
+        let count = regions.len() as f64;
+        Some(nde::tags::Position {
+            x: regions.iter().map(|region| region.center.x).sum::<f64>() / count,
+            y: regions.iter().map(|region| region.center.y).sum::<f64>() / count,
+        })
+    }
 }
 
 #[typetag::serde]
@@ -36,12 +117,8 @@ impl Node for MotionTrack {
         for event in events {
             let mut cloned = event.clone();
             let frame = frame_rate.ms_to_frame(cloned.start.0);
-            if let Some(region) = self.track.get(&frame) {
-                cloned.global_tags.position =
-                    Some(nde::tags::PositionOrMove::Position(nde::tags::Position {
-                        x: region.center.x,
-                        y: region.center.y,
-                    }));
+            if let Some(center) = self.center_at(frame) {
+                cloned.global_tags.position = Some(nde::tags::PositionOrMove::Position(center));
             }
             new_events.push(cloned);
         }
@@ -53,39 +130,109 @@ impl Node for MotionTrack {
         &self,
         self_index: usize,
     ) -> iced::Element<'a, message::Message, iced::Renderer> {
-        let set_marker_button = iced::widget::button("Set marker").on_press(
+        let set_markers_button = iced::widget::button("Set markers").on_press(
             message::Message::SetReticules(model::reticule::Reticules {
-                list: vec![model::reticule::Reticule {
-                    shape: model::reticule::Shape::Cross,
-                    position: self.region_center,
-                    radius: 10.0,
-                }],
+                list: self
+                    .markers
+                    .iter()
+                    .map(|position| model::reticule::Reticule {
+                        shape: model::reticule::Shape::Cross,
+                        position: *position,
+                        radius: 10.0,
+                    })
+                    .collect(),
                 source_node_index: self_index,
             }),
         );
+        let add_marker_button = iced::widget::button("+").on_press(message::Message::Node(
+            self_index,
+            message::Node::MotionTrackAddMarker,
+        ));
+        let remove_marker_button =
+            iced::widget::button("-").on_press_maybe((self.markers.len() > 1).then_some(
+                message::Message::Node(self_index, message::Node::MotionTrackRemoveMarker),
+            ));
 
-        let initial_point = media::motion::Point {
-            x: self.region_center.x,
-            y: self.region_center.y,
-        };
-        let initial_region = media::motion::Region::from_center_and_radius(initial_point, 20.0);
-        let track_button = iced::widget::button("Track").on_press(
-            message::Message::TrackMotionForNode(self_index, initial_region),
+        let regions = self
+            .markers
+            .iter()
+            .map(|position| {
+                let point = media::motion::Point {
+                    x: position.x,
+                    y: position.y,
+                };
+                media::motion::Region::from_center_and_radius(point, MARKER_RADIUS)
+            })
+            .collect();
+        let keyframe_button = iced::widget::button("Keyframe").on_press(
+            message::Message::AddMotionTrackKeyframe(self_index, regions),
         );
+        let clear_button =
+            iced::widget::button("Clear").on_press_maybe((!self.keyframes.is_empty()).then_some(
+                message::Message::Node(self_index, message::Node::MotionTrackClearKeyframes),
+            ));
+
+        let track_button = iced::widget::button("Track").on_press_maybe(
+            (!self.keyframes.is_empty())
+                .then(|| message::Message::TrackMotionForNode(self_index, self.keyframes.clone())),
+        );
+
+        let cancel_button =
+            iced::widget::button("Cancel").on_press(message::Message::CancelMotionTracking);
 
         let column = iced::widget::column![
             iced::widget::text(self.name()),
-            iced::widget::text(format!("{} frame(s) tracked", self.track.len())),
-            set_marker_button,
-            track_button,
+            iced::widget::text(format!(
+                "{} marker(s), {} keyframe(s), {} frame(s) tracked",
+                self.markers.len(),
+                self.keyframes.len(),
+                self.track.len()
+            )),
+            iced::widget::row![set_markers_button, add_marker_button, remove_marker_button]
+                .spacing(5),
+            iced::widget::row![keyframe_button, clear_button].spacing(5),
+            iced::widget::row![track_button, cancel_button].spacing(5),
         ];
 
         column.align_items(iced::Alignment::Center).into()
     }
 
     fn update(&mut self, message: message::Node) {
-        if let message::Node::MotionTrackUpdate(relative_frame, region) = message {
-            self.track.insert(relative_frame, region);
+        match message {
+            message::Node::MotionTrackUpdate(frames) => self.track.extend(frames),
+            message::Node::MotionTrackAddMarker => {
+                // Place the new marker next to the last one, so that it does not hide it
+                let last = self.markers.last().copied().unwrap_or(DEFAULT_MARKER);
+                self.markers.push(nde::tags::Position {
+                    x: last.x + 2.0 * MARKER_RADIUS,
+                    y: last.y,
+                });
+
+                // The existing keyframes and track no longer cover all markers
+                self.keyframes.clear();
+                self.track.clear();
+            }
+            message::Node::MotionTrackRemoveMarker => {
+                if self.markers.len() > 1 {
+                    self.markers.pop();
+                    self.keyframes.clear();
+                    self.track.clear();
+                }
+            }
+            message::Node::MotionTrackKeyframe(frame, regions) => {
+                if regions.len() != self.markers.len() {
+                    return;
+                }
+
+                self.keyframes.retain(|(keyframe, _)| *keyframe != frame);
+                self.keyframes.push((frame, regions.clone()));
+                self.track.insert(frame, regions);
+            }
+            message::Node::MotionTrackClearKeyframes => {
+                self.keyframes.clear();
+                self.track.clear();
+            }
+            message::Node::TextInputChanged(_) => {}
         }
     }
 
@@ -95,16 +242,18 @@ impl Node for MotionTrack {
         index: usize,
         new_position: nde::tags::Position,
     ) {
-        if index != 0 {
+        let (Some(reticule), Some(marker)) =
+            (reticules.list.get_mut(index), self.markers.get_mut(index))
+        else {
             return;
-        }
+        };
 
-        reticules.list[0].position = new_position;
-        self.region_center = new_position;
+        reticule.position = new_position;
+        *marker = new_position;
     }
 
     fn content_size(&self) -> iced::Size {
-        iced::Size::new(200.0, 150.0)
+        iced::Size::new(250.0, 200.0)
     }
 }
 
@@ -112,11 +261,52 @@ inventory::submit! {
     Shell::new(
         &["Motion track"],
         || Box::new(MotionTrack {
-            region_center: nde::tags::Position {
-                x: 100.0,
-                y: 100.0,
-            },
+            markers: vec![DEFAULT_MARKER],
+            keyframes: vec![],
             track: HashMap::new(),
         })
     )
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn deserialize_single_marker() {
+        #[derive(serde::Serialize)]
+        struct SingleMarker {
+            region_center: nde::tags::Position,
+            track: HashMap<model::FrameNumber, media::motion::Region>,
+        }
+
+        let center = media::motion::Point { x: 12.0, y: 34.0 };
+        let old = SingleMarker {
+            region_center: nde::tags::Position { x: 10.0, y: 30.0 },
+            track: HashMap::from([(
+                model::FrameNumber(5),
+                media::motion::Region::from_center_and_radius(center, MARKER_RADIUS),
+            )]),
+        };
+        let mut data: Vec<u8> = vec![];
+        ciborium::into_writer(&old, &mut data).unwrap();
+
+        let motion_track: MotionTrack = ciborium::from_reader(data.as_slice()).unwrap();
+        assert_eq!(
+            motion_track.markers,
+            vec![nde::tags::Position { x: 10.0, y: 30.0 }]
+        );
+        assert!(motion_track.keyframes.is_empty());
+        assert_eq!(
+            motion_track.center_at(model::FrameNumber(5)),
+            Some(nde::tags::Position { x: 12.0, y: 34.0 })
+        );
+
+        // The current shape survives a round trip
+        let mut data: Vec<u8> = vec![];
+        ciborium::into_writer(&motion_track, &mut data).unwrap();
+        let round_trip: MotionTrack = ciborium::from_reader(data.as_slice()).unwrap();
+        assert_eq!(round_trip.markers, motion_track.markers);
+        assert_eq!(round_trip.track.len(), 1);
+    }
+}
@@ -1,12 +1,30 @@
+use std::cell::RefCell;
+use std::collections::HashMap;
 use std::fmt::{Display, Formatter};
+use std::ops::Range;
 
 use crate::{message, style, subtitle, view};
 
+/// Height of every row in the grid. All rows have the same height, so that the rows within the
+/// viewport can be determined from the scroll offset alone.
+const ROW_HEIGHT: f32 = 24.0;
+
+/// Number of rows above and below the viewport for which widgets are created anyway, so that
+/// scrolling does not reveal empty space before the grid has been rebuilt.
+const OVERSCAN_ROWS: usize = 20;
+
+/// The grid only creates widgets for the rows around the viewport. All other rows are replaced by
+/// two spacers of the same total height, so that the scrollable's content keeps its size.
 #[derive(Debug, Clone)]
 pub struct State {
     header_scrollable_id: iced::widget::scrollable::Id,
     body_scrollable_id: iced::widget::scrollable::Id,
     columns: Vec<Column>,
+    scroll_offset: iced::widget::scrollable::AbsoluteOffset,
+
+    /// Formatted cell contents of the rows that have been shown so far. Emptied whenever the
+    /// subtitles change.
+    row_cache: RefCell<HashMap<subtitle::EventIndex, RowStrings>>,
 }
 
 impl Default for State {
@@ -41,10 +59,91 @@ impl Default for State {
                     resize_offset: None,
                 },
             ],
+            scroll_offset: iced::widget::scrollable::AbsoluteOffset::default(),
+            row_cache: RefCell::new(HashMap::new()),
         }
     }
 }
 
+impl State {
+    /// Must be called whenever the subtitles have been modified, as the cached cell contents may
+    /// no longer match the events.
+    pub fn invalidate_rows(&mut self) {
+        self.row_cache.get_mut().clear();
+    }
+
+    /// Scrolls the grid such that the event with the given index is at the top.
+    pub fn scroll_to(&mut self, index: subtitle::EventIndex) -> iced::Command<message::Message> {
+        #[allow(clippy::cast_precision_loss)]
+        let y = index.0 as f32 * ROW_HEIGHT;
+        self.scroll_offset.y = y;
+        iced::widget::scrollable::scroll_to(self.body_scrollable_id.clone(), self.scroll_offset)
+    }
+
+    /// The range of rows for which widgets should be created, given the height of the viewport.
+    #[allow(clippy::cast_possible_truncation)]
+    #[allow(clippy::cast_sign_loss)]
+    fn visible_rows(&self, viewport_height: f32, row_count: usize) -> Range<usize> {
+        let first_visible = (self.scroll_offset.y.max(0.0) / ROW_HEIGHT) as usize;
+        let visible_count = (viewport_height.max(0.0) / ROW_HEIGHT).ceil() as usize + 1;
+
+        let start = first_visible.saturating_sub(OVERSCAN_ROWS).min(row_count);
+        let end = (first_visible + visible_count + OVERSCAN_ROWS).min(row_count);
+        start..end
+    }
+
+    fn row_strings(&self, global_state: &crate::Samaku, row: &GridRow) -> RowStrings {
+        let GridRow::Event(index, event) = *row else {
+            return RowStrings::default();
+        };
+
+        self.row_cache
+            .borrow_mut()
+            .entry(index)
+            .or_insert_with(|| RowStrings::new(global_state, event))
+            .clone()
+    }
+}
+
+/// Formatted contents of the text cells of a row.
+#[derive(Debug, Clone, Default)]
+struct RowStrings {
+    filter_name: String,
+    start: String,
+    duration: String,
+    text: String,
+}
+
+impl RowStrings {
+    fn new(global_state: &crate::Samaku, event: &subtitle::Event) -> Self {
+        let filter_name = match global_state.subtitles.extradata.nde_filter_for_event(event) {
+            Some(filter) => {
+                let stored_name = &filter.name;
+                if stored_name.is_empty() {
+                    "(unnamed filter)".to_owned()
+                } else {
+                    stored_name.clone()
+                }
+            }
+            None => String::new(),
+        };
+
+        Self {
+            filter_name,
+            start: format!("{}", event.start.0),
+            duration: format!("{}", event.duration.0),
+            text: event.text.to_string(),
+        }
+    }
+}
+
+/// A row passed to the table: either an actual event, or a spacer standing in for the given
+/// number of rows that are not shown.
+enum GridRow<'a> {
+    Event(subtitle::EventIndex, &'a subtitle::Event<'static>),
+    Spacer(usize),
+}
+
 #[derive(Debug, Clone)]
 pub struct Column {
     field: ColumnField,
@@ -107,16 +206,16 @@ impl iced::widget::container::StyleSheet for Comment {
 }
 
 impl<'a, 'b> iced_table::table::Column<'a, 'b, message::Message, iced::Renderer>
-    for (&'a crate::Samaku, &'a Column)
+    for (&'a crate::Samaku, &'a State, &'a Column)
 {
-    type Row = subtitle::Event<'static>;
+    type Row = GridRow<'a>;
 
     fn header(
         &'b self,
         _col_index: usize,
     ) -> iced::advanced::graphics::core::Element<'a, message::Message, iced::Renderer> {
-        iced::widget::container(iced::widget::text(format!("{}", self.1.field)))
-            .height(24)
+        iced::widget::container(iced::widget::text(format!("{}", self.2.field)))
+            .height(ROW_HEIGHT)
             .center_y()
             .into()
     }
@@ -124,15 +223,23 @@ impl<'a, 'b> iced_table::table::Column<'a, 'b, message::Message, iced::Renderer>
     fn cell(
         &'b self,
         _col_index: usize,
-        row_index: usize,
+        _row_index: usize,
         row: &'b Self::Row,
     ) -> iced::advanced::graphics::core::Element<'a, message::Message, iced::Renderer> {
-        let selected = self
-            .0
-            .selected_event_indices
-            .contains(&subtitle::EventIndex(row_index));
+        let (global_state, grid_state, column) = *self;
+
+        let (index, event) = match *row {
+            GridRow::Event(index, event) => (index, event),
+            GridRow::Spacer(rows) => {
+                #[allow(clippy::cast_precision_loss)]
+                let height = rows as f32 * ROW_HEIGHT;
+                return iced::widget::Space::with_height(height).into();
+            }
+        };
+
+        let selected = global_state.selected_event_indices.contains(&index);
 
-        let cell_content: iced::Element<message::Message> = match self.1.field {
+        let cell_content: iced::Element<message::Message> = match column.field {
             ColumnField::SelectButton => {
                 let icon = if selected {
                     iced_aw::Icon::Dot
@@ -141,28 +248,21 @@ impl<'a, 'b> iced_table::table::Column<'a, 'b, message::Message, iced::Renderer>
                 };
 
                 iced::widget::button(view::icon(icon).size(12.0))
-                    .on_press(message::Message::ToggleEventSelection(
-                        subtitle::EventIndex(row_index),
-                    ))
+                    .on_press(message::Message::ToggleEventSelection(index))
                     .into()
             }
             ColumnField::FilterName => {
-                iced::widget::text(match self.0.subtitles.extradata.nde_filter_for_event(row) {
-                    Some(filter) => {
-                        let stored_name = &filter.name;
-                        if stored_name.is_empty() {
-                            "(unnamed filter)"
-                        } else {
-                            stored_name
-                        }
-                    }
-                    None => "",
-                })
-                .into()
+                iced::widget::text(grid_state.row_strings(global_state, row).filter_name).into()
+            }
+            ColumnField::Start => {
+                iced::widget::text(grid_state.row_strings(global_state, row).start).into()
+            }
+            ColumnField::Duration => {
+                iced::widget::text(grid_state.row_strings(global_state, row).duration).into()
+            }
+            ColumnField::Text => {
+                iced::widget::text(grid_state.row_strings(global_state, row).text).into()
             }
-            ColumnField::Start => iced::widget::text(format!("{}", row.start.0)).into(),
-            ColumnField::Duration => iced::widget::text(format!("{}", row.duration.0)).into(),
-            ColumnField::Text => iced::widget::text(row.text.to_string()).into(),
         };
 
         // Highlight the selected event
@@ -170,21 +270,25 @@ impl<'a, 'b> iced_table::table::Column<'a, 'b, message::Message, iced::Renderer>
 
         let styled_container = if selected {
             container.style(iced::theme::Container::Custom(Box::new(Highlighted)))
-        } else if row.is_comment() {
+        } else if event.is_comment() {
             container.style(iced::theme::Container::Custom(Box::new(Comment)))
         } else {
             container
         };
 
-        styled_container.height(24).center_y().into()
+        styled_container
+            .height(ROW_HEIGHT)
+            .padding([0, 4])
+            .center_y()
+            .into()
     }
 
     fn width(&self) -> f32 {
-        self.1.width
+        self.2.width
     }
 
     fn resize_offset(&self) -> Option<f32> {
-        self.1.resize_offset
+        self.2.resize_offset
     }
 }
 
@@ -193,19 +297,39 @@ pub fn view<'a>(
     global_state: &'a crate::Samaku,
     grid_state: &'a State,
 ) -> super::View<'a> {
-    let columns_with_state: Vec<(&'a crate::Samaku, &Column)> = std::iter::repeat(global_state)
-        .zip(&grid_state.columns)
+    let columns_with_state: Vec<(&'a crate::Samaku, &'a State, &Column)> = grid_state
+        .columns
+        .iter()
+        .map(|column| (global_state, grid_state, column))
         .collect();
+    let events = global_state.subtitles.events.as_slice();
 
     let table = iced::widget::responsive(move |size| {
-        iced_table::table(
+        let visible = grid_state.visible_rows(size.height, events.len());
+
+        let mut rows: Vec<GridRow> = Vec::with_capacity(visible.len() + 2);
+        if visible.start > 0 {
+            rows.push(GridRow::Spacer(visible.start));
+        }
+        rows.extend(
+            visible
+                .clone()
+                .map(|index| GridRow::Event(subtitle::EventIndex(index), &events[index])),
+        );
+        if visible.end < events.len() {
+            rows.push(GridRow::Spacer(events.len() - visible.end));
+        }
+
+        let table: iced::Element<message::Message> = iced_table::table(
             grid_state.header_scrollable_id.clone(),
             grid_state.body_scrollable_id.clone(),
             columns_with_state.as_slice(),
-            global_state.subtitles.events.as_slice(),
-            // We have to use `FocusedPane` here (and in `on_column_resize`) because `iced_table`
-            // does not support passing a closure here.
-            // TODO: Make a PR to support this?
+            rows.as_slice(),
+            // `iced_table` only accepts function pointers here (and in `on_column_resize`), which
+            // cannot know which pane they belong to. Their messages are addressed to the focused
+            // pane at first, and then redirected to this one below, as this grid is not
+            // necessarily the focused pane.
+            // TODO: Make a PR to support closures?
             |offset| message::Message::FocusedPane(message::Pane::GridSyncHeader(offset)),
         )
         .on_column_resize(
@@ -214,8 +338,18 @@ pub fn view<'a>(
             },
             message::Message::Pane(self_pane, message::Pane::GridColumnResized),
         )
+        // Row heights are only uniform if the cells have no padding of their own; the cell
+        // containers add horizontal padding instead
+        .cell_padding(0)
         .min_width(size.width)
-        .into()
+        .into();
+
+        table.map(move |table_message| match table_message {
+            message::Message::FocusedPane(pane_message) => {
+                message::Message::Pane(self_pane, pane_message)
+            }
+            other => other,
+        })
     });
 
     let add_button =
@@ -252,6 +386,8 @@ pub fn update(
 ) -> iced::Command<message::Message> {
     match pane_message {
         message::Pane::GridSyncHeader(offset) => {
+            // The body was scrolled, which might have changed which rows are visible
+            grid_state.scroll_offset = offset;
             return iced::widget::scrollable::scroll_to(
                 grid_state.header_scrollable_id.clone(),
                 offset,
@@ -262,6 +398,9 @@ pub fn update(
                 column.resize_offset = Some(offset);
             }
         }
+        message::Pane::GridScrollToEvent(index) => {
+            return grid_state.scroll_to(index);
+        }
         message::Pane::GridColumnResized => {
             grid_state.columns.iter_mut().for_each(|column| {
                 if let Some(offset) = column.resize_offset.take() {
@@ -274,3 +413,25 @@ pub fn update(
 
     iced::Command::none()
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn visible_rows() {
+        let mut state = State::default();
+        assert_eq!(state.visible_rows(240.0, 5), 0..5);
+        assert_eq!(state.visible_rows(240.0, 100_000), 0..(11 + OVERSCAN_ROWS));
+
+        let _ = state.scroll_to(subtitle::EventIndex(50_000));
+        assert_eq!(
+            state.visible_rows(240.0, 100_000),
+            (50_000 - OVERSCAN_ROWS)..(50_011 + OVERSCAN_ROWS)
+        );
+        assert_eq!(
+            state.visible_rows(240.0, 50_005),
+            (50_000 - OVERSCAN_ROWS)..50_005
+        );
+    }
+}
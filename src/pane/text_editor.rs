@@ -132,11 +132,18 @@ pub fn view<'a>(
                 message::Message::SetActiveEventLayerIndex,
             );
 
+            // Only enabled once there are keyframes to snap to
+            let snap_button = iced::widget::button("Snap to keyframes").on_press_maybe(
+                (!global_state.keyframes.is_empty())
+                    .then_some(message::Message::SnapSelectedEventsToKeyframes),
+            );
+
             let second_line = iced::widget::row![
                 "Start time (ms):",
                 start_time_control,
                 "Duration (ms):",
                 duration_control,
+                snap_button,
                 iced::widget::horizontal_space(iced::Length::Fill),
                 "Layer:",
                 layer_control
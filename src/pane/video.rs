@@ -38,12 +38,18 @@ pub fn view<'a>(
                 } else {
                     let instant = std::time::Instant::now();
                     let context = global_state.compile_context();
-                    let compiled = global_state.subtitles.events.compile(
-                        &global_state.subtitles.extradata,
-                        &context,
-                        0,
-                        None,
-                    ); // TODO give actual frame range values here
+                    let compiled = global_state
+                        .project_cache
+                        .as_ref()
+                        .and_then(|cache| cache.compiled(&context))
+                        .unwrap_or_else(|| {
+                            global_state.subtitles.events.compile(
+                                &global_state.subtitles.extradata,
+                                &context,
+                                0,
+                                None,
+                            ) // TODO give actual frame range values here
+                        });
                     let elapsed_compile = instant.elapsed();
 
                     let instant2 = std::time::Instant::now();
@@ -86,14 +92,47 @@ pub fn view<'a>(
                     reticules,
                     storage_size,
                 };
-                iced::widget::scrollable(view::widget::ImageStack::new(stack, program))
+                // The frame may come from a lower-resolution proxy, so always display it at the
+                // size of the video
+                iced::widget::scrollable(view::widget::ImageStack::new(stack, program).base_size(
+                    iced::Size::new(
+                        video_metadata.width.unsigned_abs(),
+                        video_metadata.height.unsigned_abs(),
+                    ),
+                ))
             }
         },
     };
 
+    // While a video is being loaded, show how far it has got above the current video, which stays
+    // visible and playable until the new one is ready, unless the new one can already be previewed
+    let content: iced::Element<message::Message> = match global_state.video_load_stage {
+        Some(stage) => {
+            let status = iced::widget::row![
+                iced::widget::text(stage),
+                iced::widget::button(iced::widget::text("Cancel"))
+                    .on_press(message::Message::CancelVideoLoad),
+            ]
+            .spacing(5)
+            .align_items(iced::Alignment::Center);
+
+            iced::widget::column![
+                iced::widget::container(status).padding(5),
+                view::separator(),
+                match &global_state.video_preview {
+                    Some(handle) => iced::Element::from(iced::widget::image(handle.clone())),
+                    None => scroll.into(),
+                }
+            ]
+            .align_items(iced::Alignment::Center)
+            .into()
+        }
+        None => scroll.into(),
+    };
+
     super::View {
         title: iced::widget::text("Video").into(),
-        content: iced::widget::container(scroll)
+        content: iced::widget::container(content)
             .width(iced::Length::Fill)
             .height(iced::Length::Fill)
             .center_x()
@@ -0,0 +1,563 @@
+//! Optional binary cache of a subtitle file's events, kept in a sidecar file next to the `.ass`
+//! file. Reopening a large project from the cache avoids having to parse every event line, and
+//! the compiled event list stored within it allows the video pane to render subtitles before any
+//! NDE filter has been decoded or run.
+//!
+//! The cache is memory-mapped on open and laid out flat, so that nothing has to be deserialised
+//! up front: a fixed-size header is followed by fixed-size event records, a table of extradata
+//! IDs, and a string table holding the text fields. Records refer to the tables by offset and
+//! length. All integers are little endian.
+//!
+//! A cache is only used if it was written by the same version of samaku, for a source file with
+//! the same content hash. Otherwise it is ignored and rebuilt.
+
+use std::borrow::Cow;
+use std::ffi::OsString;
+use std::io;
+use std::path::{Path, PathBuf};
+
+use smol::io::AsyncBufReadExt;
+use thiserror::Error;
+
+use crate::{media, version};
+
+use super::{
+    compile, emit, Duration, Event, EventTrack, EventType, ExtradataId, Margins, StartTime,
+};
+
+/// Extension appended to the subtitle file name to obtain the cache file name.
+pub const EXTENSION: &str = "samaku-cache";
+
+const MAGIC: &[u8; 8] = b"SMKCACHE";
+const FORMAT_VERSION: u32 = 1;
+
+/// Set in the header flags if the cache contains a compiled event list.
+const FLAG_COMPILED: u32 = 1;
+
+const HEADER_LEN: usize = 72;
+const RECORD_LEN: usize = 72;
+
+/// A parsed and validated cache header.
+#[derive(Debug, Clone, Copy)]
+struct Header {
+    flags: u32,
+    frame_rate: media::FrameRate,
+    event_count: usize,
+    compiled_count: usize,
+    id_count: usize,
+}
+
+impl Header {
+    fn records_start() -> usize {
+        HEADER_LEN
+    }
+
+    fn ids_start(&self) -> usize {
+        HEADER_LEN + (self.event_count + self.compiled_count) * RECORD_LEN
+    }
+
+    fn strings_start(&self) -> usize {
+        self.ids_start() + self.id_count * 4
+    }
+}
+
+#[derive(Error, Debug)]
+pub enum Error {
+    #[error("IO error: {0}")]
+    Io(#[from] io::Error),
+
+    #[error("Cache was written by a different version of samaku")]
+    VersionMismatch,
+
+    #[error("Cache belongs to a different version of the subtitle file")]
+    SourceMismatch,
+
+    #[error("Cache is corrupted: {0}")]
+    Corrupted(&'static str),
+
+    #[error("Could not parse subtitle file: {0}")]
+    Parse(super::parse::Error),
+}
+
+/// Returns the path of the cache file belonging to the subtitle file at the given path.
+#[must_use]
+pub fn path_for(subtitle_path: &Path) -> PathBuf {
+    let mut file_name = subtitle_path
+        .file_name()
+        .map_or_else(OsString::new, std::ffi::OsStr::to_os_string);
+    file_name.push(".");
+    file_name.push(EXTENSION);
+    subtitle_path.with_file_name(file_name)
+}
+
+/// Hashes the contents of a subtitle file, to determine whether a cache belongs to it. Can be fed
+/// the file in multiple consecutive pieces, starting with [`SourceHasher::default`].
+#[derive(Debug, Clone, Copy)]
+pub struct SourceHasher(u64);
+
+impl Default for SourceHasher {
+    fn default() -> Self {
+        Self(FNV_OFFSET)
+    }
+}
+
+impl SourceHasher {
+    pub fn update(&mut self, data: &[u8]) {
+        self.0 = fnv1a(self.0, data);
+    }
+
+    #[must_use]
+    pub fn finish(self) -> u64 {
+        self.0
+    }
+}
+
+/// Hashes the given subtitle file contents in one go.
+#[must_use]
+pub fn source_hash(data: &[u8]) -> u64 {
+    let mut hasher = SourceHasher::default();
+    hasher.update(data);
+    hasher.finish()
+}
+
+/// A memory-mapped, validated cache file.
+pub struct Cache {
+    map: memmap2::Mmap,
+    header: Header,
+}
+
+impl Cache {
+    /// Opens and validates the cache belonging to the subtitle file at the given path, whose
+    /// contents hash to `source_hash`.
+    ///
+    /// # Errors
+    /// Errors if the cache does not exist or cannot be read, if it belongs to a different version
+    /// of samaku or of the subtitle file, or if it is corrupted.
+    pub fn open(subtitle_path: &Path, source_hash: u64) -> Result<Self, Error> {
+        let file = std::fs::File::open(path_for(subtitle_path))?;
+
+        // SAFETY: The mapping is only ever read from. Cache files are replaced atomically by
+        // renaming, so the mapped file itself is never modified by samaku; its checksum is
+        // validated below, which protects against any other modification made before opening.
+        let map = unsafe { memmap2::Mmap::map(&file)? };
+
+        let header = parse_header(&map, source_hash)?;
+        Ok(Self { map, header })
+    }
+
+    /// Converts the cached source events into an event track, in the same form as if they had
+    /// been parsed from the subtitle file.
+    ///
+    /// # Errors
+    /// Errors if an event record is corrupted.
+    pub fn events(&self) -> Result<EventTrack, Error> {
+        let events = (0..self.header.event_count)
+            .map(|index| self.record(index).map(into_owned))
+            .collect::<Result<Vec<_>, _>>()?;
+        Ok(EventTrack::from_vec(events))
+    }
+
+    /// Returns the compiled event list stored in the cache, borrowing its text directly from the
+    /// mapped file. Returns `None` if the cache has no compiled events, or if they were compiled
+    /// for a different frame rate than the one in `context`.
+    #[must_use]
+    pub fn compiled(&self, context: &compile::Context) -> Option<Vec<Event<'_>>> {
+        if self.header.flags & FLAG_COMPILED == 0 || self.header.frame_rate != context.frame_rate {
+            return None;
+        }
+
+        (0..self.header.compiled_count)
+            .map(|index| self.record(self.header.event_count + index))
+            .collect::<Result<Vec<_>, _>>()
+            .map_err(|error| println!("Could not read compiled events from cache: {error}"))
+            .ok()
+    }
+
+    fn record(&self, index: usize) -> Result<Event<'_>, Error> {
+        let start = Header::records_start() + index * RECORD_LEN;
+        let record = &self.map[start..start + RECORD_LEN];
+
+        let ids = self.table(
+            self.header.ids_start(),
+            self.header.strings_start(),
+            read_u32(record, 64),
+            read_u32(record, 68) * 4,
+        )?;
+
+        Ok(Event {
+            start: StartTime(read_i64(record, 0)),
+            duration: Duration(read_i64(record, 8)),
+            layer_index: read_i32(record, 16),
+            style_index: read_u32(record, 20),
+            margins: Margins {
+                left: read_i32(record, 24),
+                right: read_i32(record, 28),
+                vertical: read_i32(record, 32),
+            },
+            event_type: match read_u32(record, 36) {
+                0 => EventType::Dialogue,
+                1 => EventType::Comment,
+                _ => return Err(Error::Corrupted("invalid event type")),
+            },
+            text: self.string(read_u32(record, 40), read_u32(record, 44))?,
+            actor: self.string(read_u32(record, 48), read_u32(record, 52))?,
+            effect: self.string(read_u32(record, 56), read_u32(record, 60))?,
+            extradata_ids: ids
+                .chunks_exact(4)
+                .map(|id| ExtradataId(read_u32_raw(id)))
+                .collect(),
+        })
+    }
+
+    fn string(&self, offset: usize, len: usize) -> Result<Cow<'_, str>, Error> {
+        let bytes = self.table(self.header.strings_start(), self.map.len(), offset, len)?;
+        std::str::from_utf8(bytes)
+            .map(Cow::Borrowed)
+            .map_err(|_| Error::Corrupted("invalid UTF-8 in string table"))
+    }
+
+    fn table(
+        &self,
+        table_start: usize,
+        table_end: usize,
+        offset: usize,
+        len: usize,
+    ) -> Result<&[u8], Error> {
+        let start = table_start + offset;
+        match start.checked_add(len) {
+            Some(end) if end <= table_end => Ok(&self.map[start..end]),
+            _ => Err(Error::Corrupted("table reference out of bounds")),
+        }
+    }
+}
+
+/// Builds the contents of a cache file for the given source events. If `compiled` is given, the
+/// compiled events and the context they were compiled with are stored as well.
+///
+/// # Panics
+/// Panics if the events do not fit into the format, which uses 32-bit offsets.
+#[must_use]
+pub fn build(
+    source_hash: u64,
+    events: &EventTrack,
+    compiled: Option<(&[Event], &compile::Context)>,
+) -> Vec<u8> {
+    let compiled_events = compiled.map_or(&[][..], |(compiled_events, _)| compiled_events);
+    let record_count = events.len() + compiled_events.len();
+
+    let mut records = Vec::with_capacity(record_count * RECORD_LEN);
+    let mut ids: Vec<u8> = vec![];
+    let mut strings: Vec<u8> = vec![];
+
+    for event in events.as_slice().iter().chain(compiled_events) {
+        push_record(&mut records, &mut ids, &mut strings, event);
+    }
+
+    let (flags, frame_rate) = compiled.map_or(
+        (
+            0,
+            media::FrameRate {
+                numerator: 0,
+                denominator: 1,
+            },
+        ),
+        |(_, context)| (FLAG_COMPILED, context.frame_rate),
+    );
+
+    let mut payload = Vec::with_capacity(records.len() + ids.len() + strings.len());
+    payload.extend_from_slice(&records);
+    payload.extend_from_slice(&ids);
+    payload.extend_from_slice(&strings);
+
+    let mut data = Vec::with_capacity(HEADER_LEN + payload.len());
+    data.extend_from_slice(MAGIC);
+    data.extend_from_slice(&FORMAT_VERSION.to_le_bytes());
+    data.extend_from_slice(&flags.to_le_bytes());
+    data.extend_from_slice(&samaku_version_hash().to_le_bytes());
+    data.extend_from_slice(&source_hash.to_le_bytes());
+    data.extend_from_slice(&fnv1a(FNV_OFFSET, &payload).to_le_bytes());
+    data.extend_from_slice(&frame_rate.numerator.to_le_bytes());
+    data.extend_from_slice(&frame_rate.denominator.to_le_bytes());
+    data.extend_from_slice(&to_u32(events.len()).to_le_bytes());
+    data.extend_from_slice(&to_u32(compiled_events.len()).to_le_bytes());
+    data.extend_from_slice(&to_u32(ids.len() / 4).to_le_bytes());
+    data.extend_from_slice(&0_u32.to_le_bytes());
+    debug_assert_eq!(data.len(), HEADER_LEN);
+
+    data.extend_from_slice(&payload);
+    data
+}
+
+/// Atomically writes cache contents built using [`build`] to the cache file belonging to the
+/// subtitle file at the given path.
+///
+/// # Errors
+/// Errors if the cache file could not be written.
+pub fn write(subtitle_path: &Path, data: &[u8]) -> io::Result<()> {
+    emit::write_atomically(&path_for(subtitle_path), &[data])
+}
+
+/// Builds the cache for the subtitle file at the given path from scratch and writes it. The file
+/// is read and parsed anew, and its events are compiled using the given context, if any. As this
+/// takes about as long as loading the file, it should be run on a background thread, without
+/// holding up the UI.
+///
+/// # Errors
+/// Errors if the subtitle file could not be read or parsed, or the cache file could not be
+/// written.
+pub fn rebuild(subtitle_path: &Path, context: Option<&compile::Context>) -> Result<(), Error> {
+    let data = std::fs::read(subtitle_path)?;
+    let lines = smol::io::BufReader::new(data.as_slice()).lines();
+    let (file, _warnings) = smol::block_on(super::File::parse(lines)).map_err(Error::Parse)?;
+
+    let compiled = context.map(|context| file.events.compile(&file.extradata, context, 0, None));
+    let cache_data = build(
+        source_hash(&data),
+        &file.events,
+        compiled.as_deref().zip(context),
+    );
+
+    Ok(write(subtitle_path, &cache_data)?)
+}
+
+fn push_record(records: &mut Vec<u8>, ids: &mut Vec<u8>, strings: &mut Vec<u8>, event: &Event) {
+    let mut push_string = |records: &mut Vec<u8>, string: &str| {
+        records.extend_from_slice(&to_u32(strings.len()).to_le_bytes());
+        records.extend_from_slice(&to_u32(string.len()).to_le_bytes());
+        strings.extend_from_slice(string.as_bytes());
+    };
+
+    records.extend_from_slice(&event.start.0.to_le_bytes());
+    records.extend_from_slice(&event.duration.0.to_le_bytes());
+    records.extend_from_slice(&event.layer_index.to_le_bytes());
+    records.extend_from_slice(&to_u32(event.style_index).to_le_bytes());
+    records.extend_from_slice(&event.margins.left.to_le_bytes());
+    records.extend_from_slice(&event.margins.right.to_le_bytes());
+    records.extend_from_slice(&event.margins.vertical.to_le_bytes());
+    let event_type: u32 = match event.event_type {
+        EventType::Dialogue => 0,
+        EventType::Comment => 1,
+    };
+    records.extend_from_slice(&event_type.to_le_bytes());
+    push_string(records, &event.text);
+    push_string(records, &event.actor);
+    push_string(records, &event.effect);
+
+    records.extend_from_slice(&to_u32(ids.len() / 4).to_le_bytes());
+    records.extend_from_slice(&to_u32(event.extradata_ids.len()).to_le_bytes());
+    for id in &event.extradata_ids {
+        ids.extend_from_slice(&id.0.to_le_bytes());
+    }
+}
+
+fn parse_header(data: &[u8], source_hash: u64) -> Result<Header, Error> {
+    if data.len() < HEADER_LEN || &data[0..8] != MAGIC {
+        return Err(Error::Corrupted("invalid header"));
+    }
+
+    if read_u32_raw(&data[8..12]) != FORMAT_VERSION || read_u64(data, 16) != samaku_version_hash() {
+        return Err(Error::VersionMismatch);
+    }
+
+    if read_u64(data, 24) != source_hash {
+        return Err(Error::SourceMismatch);
+    }
+
+    if read_u64(data, 32) != fnv1a(FNV_OFFSET, &data[HEADER_LEN..]) {
+        return Err(Error::Corrupted("checksum mismatch"));
+    }
+
+    let header = Header {
+        flags: read_u32_raw(&data[12..16]),
+        frame_rate: media::FrameRate {
+            numerator: read_u64(data, 40),
+            denominator: read_u64(data, 48),
+        },
+        event_count: read_u32(data, 56),
+        compiled_count: read_u32(data, 60),
+        id_count: read_u32(data, 64),
+    };
+
+    if header.strings_start() > data.len() {
+        return Err(Error::Corrupted("truncated tables"));
+    }
+
+    Ok(header)
+}
+
+fn into_owned(event: Event<'_>) -> Event<'static> {
+    Event {
+        text: Cow::Owned(event.text.into_owned()),
+        actor: Cow::Owned(event.actor.into_owned()),
+        effect: Cow::Owned(event.effect.into_owned()),
+        ..event
+    }
+}
+
+fn samaku_version_hash() -> u64 {
+    fnv1a(FNV_OFFSET, version::Long.to_string().as_bytes())
+}
+
+const FNV_OFFSET: u64 = 0xcbf2_9ce4_8422_2325;
+
+fn fnv1a(mut hash: u64, data: &[u8]) -> u64 {
+    for byte in data {
+        hash ^= u64::from(*byte);
+        hash = hash.wrapping_mul(0x0100_0000_01b3);
+    }
+    hash
+}
+
+fn to_u32(value: usize) -> u32 {
+    u32::try_from(value).expect("too much data for subtitle cache")
+}
+
+fn read_u32_raw(bytes: &[u8]) -> u32 {
+    u32::from_le_bytes(bytes.try_into().unwrap())
+}
+
+fn read_u32(data: &[u8], offset: usize) -> usize {
+    read_u32_raw(&data[offset..offset + 4]) as usize
+}
+
+fn read_i32(data: &[u8], offset: usize) -> i32 {
+    i32::from_le_bytes(data[offset..offset + 4].try_into().unwrap())
+}
+
+fn read_u64(data: &[u8], offset: usize) -> u64 {
+    u64::from_le_bytes(data[offset..offset + 8].try_into().unwrap())
+}
+
+fn read_i64(data: &[u8], offset: usize) -> i64 {
+    i64::from_le_bytes(data[offset..offset + 8].try_into().unwrap())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn roundtrip() {
+        let events = EventTrack::from_vec(vec![
+            Event {
+                start: StartTime(1000),
+                duration: Duration(2000),
+                layer_index: -3,
+                style_index: 2,
+                margins: Margins {
+                    left: 10,
+                    right: 20,
+                    vertical: 30,
+                },
+                text: Cow::Borrowed(r"{\i1}Sphinx of black quartz"),
+                actor: Cow::Borrowed("Sphinx"),
+                effect: Cow::Borrowed(""),
+                event_type: EventType::Comment,
+                extradata_ids: vec![ExtradataId(1), ExtradataId(5)],
+            },
+            Event {
+                text: Cow::Borrowed("judge my vow ✓"),
+                ..Default::default()
+            },
+        ]);
+        let context = compile::Context {
+            frame_rate: media::FrameRate {
+                numerator: 24000,
+                denominator: 1001,
+            },
+        };
+        let compiled = [Event {
+            text: Cow::Borrowed("compiled"),
+            ..Default::default()
+        }];
+
+        let directory = std::env::temp_dir().join("samaku_cache_test");
+        std::fs::create_dir_all(&directory).unwrap();
+        let subtitle_path = directory.join("test.ass");
+        write(
+            &subtitle_path,
+            &build(1234, &events, Some((&compiled, &context))),
+        )
+        .unwrap();
+
+        assert!(matches!(
+            Cache::open(&subtitle_path, 4321),
+            Err(Error::SourceMismatch)
+        ));
+
+        let cache = Cache::open(&subtitle_path, 1234).unwrap();
+        let cached_track = cache.events().unwrap();
+        let cached_events = cached_track.as_slice();
+        assert_eq!(cached_events.len(), 2);
+        assert_eq!(cached_events[0].start, StartTime(1000));
+        assert_eq!(cached_events[0].layer_index, -3);
+        assert_eq!(cached_events[0].style_index, 2);
+        assert_eq!(cached_events[0].margins.vertical, 30);
+        assert_eq!(cached_events[0].text, r"{\i1}Sphinx of black quartz");
+        assert_eq!(cached_events[0].actor, "Sphinx");
+        assert!(cached_events[0].is_comment());
+        assert_eq!(
+            cached_events[0].extradata_ids,
+            vec![ExtradataId(1), ExtradataId(5)]
+        );
+        assert_eq!(cached_events[1].text, "judge my vow ✓");
+
+        let cached_compiled = cache.compiled(&context).unwrap();
+        assert_eq!(cached_compiled.len(), 1);
+        assert_eq!(cached_compiled[0].text, "compiled");
+        assert!(matches!(cached_compiled[0].text, Cow::Borrowed(_)));
+
+        let other_context = compile::Context {
+            frame_rate: media::FrameRate {
+                numerator: 25,
+                denominator: 1,
+            },
+        };
+        assert!(cache.compiled(&other_context).is_none());
+
+        // Corrupting the payload should be detected by the checksum
+        drop(cache);
+        let cache_path = path_for(&subtitle_path);
+        let mut data = std::fs::read(&cache_path).unwrap();
+        *data.last_mut().unwrap() ^= 0xff;
+        std::fs::write(&cache_path, data).unwrap();
+        assert!(matches!(
+            Cache::open(&subtitle_path, 1234),
+            Err(Error::Corrupted(_))
+        ));
+
+        std::fs::remove_dir_all(&directory).unwrap();
+    }
+
+    #[test]
+    fn rebuild_from_file() {
+        let file = super::super::File {
+            events: EventTrack::from_vec(vec![Event {
+                text: Cow::Borrowed("rebuilt"),
+                ..Default::default()
+            }]),
+            ..Default::default()
+        };
+        let mut data = String::new();
+        emit::emit(&mut data, &file, None).unwrap();
+
+        let directory = std::env::temp_dir().join("samaku_cache_rebuild_test");
+        std::fs::create_dir_all(&directory).unwrap();
+        let subtitle_path = directory.join("test.ass");
+        std::fs::write(&subtitle_path, &data).unwrap();
+
+        let context = compile::Context {
+            frame_rate: media::FrameRate {
+                numerator: 24,
+                denominator: 1,
+            },
+        };
+        rebuild(&subtitle_path, Some(&context)).unwrap();
+
+        let cache = Cache::open(&subtitle_path, source_hash(data.as_bytes())).unwrap();
+        assert_eq!(cache.events().unwrap().as_slice()[0].text, "rebuilt");
+        assert_eq!(cache.compiled(&context).unwrap().len(), 1);
+
+        std::fs::remove_dir_all(&directory).unwrap();
+    }
+}
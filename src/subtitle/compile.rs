@@ -1,4 +1,5 @@
 use std::borrow::Cow;
+use std::collections::VecDeque;
 
 use crate::{media, nde};
 
@@ -38,16 +39,26 @@ pub fn nde<'a, 'b>(
     filter: &'b nde::graph::Graph,
     context: &Context,
 ) -> Result<NdeResult<'a, 'b>, NdeError> {
+    let plan = Plan::new(filter)?;
+    Ok(nde_with_plan(event, filter, &plan, context))
+}
+
+/// Like [`nde`], but using a [`Plan`] that has been made for the `filter` beforehand.
+///
+/// # Panics
+/// Panics if the filter's output node does not provide a [`SocketValue::CompiledEvents`].
+pub fn nde_with_plan<'a, 'b>(
+    event: &'a super::Event<'static>,
+    filter: &'b nde::graph::Graph,
+    plan: &Plan,
+    context: &Context,
+) -> NdeResult<'a, 'b> {
     let mut intermediates: Vec<NodeState> = vec![NodeState::Inactive; filter.nodes.len()];
-    let mut process_queue = match filter.dfs() {
-        nde::graph::DfsResult::ProcessQueue(queue) => queue,
-        nde::graph::DfsResult::CycleFound => return Err(NdeError::CycleInGraph),
-    };
     let source_event_value = nde::node::SocketValue::SourceEvent(event);
     let frame_rate_value = nde::node::SocketValue::FrameRate(context.frame_rate);
 
     // Go through the process queue and process the individual nodes
-    while let Some(node_index) = process_queue.pop_front() {
+    for &node_index in &plan.process_queue {
         let node = &filter.nodes[node_index].node;
         let desired_inputs = node.desired_inputs();
         let mut inputs: Vec<&nde::node::SocketValue> =
@@ -90,19 +101,39 @@ pub fn nde<'a, 'b>(
             let first_output = output_node_outputs.swap_remove(0);
 
             match first_output {
-                nde::node::SocketValue::CompiledEvents(events) => Ok(NdeResult {
+                nde::node::SocketValue::CompiledEvents(events) => NdeResult {
                     events: Some(events),
                     intermediates,
-                }),
+                },
                 _ => {
                     panic!("the output of the output node should be a CompiledEvents socket value")
                 }
             }
         }
-        _ => Ok(NdeResult {
+        _ => NdeResult {
             events: None,
             intermediates,
-        }),
+        },
+    }
+}
+
+/// The order in which the nodes of a filter graph need to be run. It only depends on the graph,
+/// so it can be made once and then reused for every event the filter is applied to.
+#[derive(Debug, Clone)]
+pub struct Plan {
+    process_queue: VecDeque<usize>,
+}
+
+impl Plan {
+    /// Works out the processing order for the given `filter`.
+    ///
+    /// # Errors
+    /// Returns [`NdeError::CycleInGraph`] if the graph contains a cycle.
+    pub fn new(filter: &nde::graph::Graph) -> Result<Self, NdeError> {
+        match filter.dfs() {
+            nde::graph::DfsResult::ProcessQueue(process_queue) => Ok(Self { process_queue }),
+            nde::graph::DfsResult::CycleFound => Err(NdeError::CycleInGraph),
+        }
     }
 }
 
@@ -111,7 +142,7 @@ pub struct NdeResult<'a, 'b> {
     pub intermediates: Vec<NodeState<'b>>,
 }
 
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub enum NdeError {
     CycleInGraph,
 }
@@ -1,6 +1,10 @@
 use std::borrow::Cow;
 use std::collections::HashMap;
+use std::ffi::{OsStr, OsString};
 use std::fmt::{Error, Write};
+use std::io::{self, IoSlice, Write as _};
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicU64, Ordering};
 
 use crate::nde::tags::{Colour, Transparency};
 use crate::{nde, version};
@@ -15,6 +19,13 @@ const STYLE_FORMAT: &str = "Format: Name, Fontname, Fontsize, PrimaryColour, Sec
 const EVENT_FORMAT: &str =
     "Format: Layer, Start, End, Style, Name, MarginL, MarginR, MarginV, Effect, Text";
 
+/// Below this many events, formatting them on a single thread is faster than spawning workers.
+const MIN_EVENTS_PER_CHUNK: usize = 2048;
+
+/// Rough estimate of how many bytes an event line takes up, not counting the text itself. Used to
+/// preallocate the chunk buffers.
+const EVENT_LINE_OVERHEAD: usize = 64;
+
 /// Write the given ASS file data as an .ass file to the given writer.
 ///
 /// Optionally, a compile context can be specified. If this is done, the file will be written as if
@@ -29,9 +40,72 @@ pub fn emit<W: Write>(
     subtitles: &File,
     compile_context: Option<super::compile::Context>,
 ) -> Result<(), Error> {
+    emit_head(writer, subtitles, compile_context.is_none())?;
+
+    if let Some(context) = compile_context {
+        // Compile events
+        let compiled = subtitles
+            .events
+            .compile(&subtitles.extradata, &context, 0, None);
+        emit_events(writer, &compiled, subtitles.styles.as_slice())?;
+    } else {
+        // Export events verbatim
+        emit_events(
+            writer,
+            subtitles.events.as_slice(),
+            subtitles.styles.as_slice(),
+        )?;
+        emit_extradata(writer, &subtitles.extradata)?;
+        emit_other_sections(writer, &subtitles.other_sections)?;
+    }
+
+    Ok(())
+}
+
+/// Like [`emit`], but returns the emitted file as a list of buffers that, concatenated, form the
+/// whole file. The event lines are formatted in parallel, one buffer per worker thread, so this
+/// is considerably faster than [`emit`] for large files. The result can be written to disk using
+/// [`write_atomically`].
+///
+/// # Errors
+/// Errors when there is an unexpected format error.
+pub fn emit_chunks(
+    subtitles: &File,
+    compile_context: Option<super::compile::Context>,
+) -> Result<Vec<String>, Error> {
+    let mut head = String::new();
+    emit_head(&mut head, subtitles, compile_context.is_none())?;
+
+    let mut chunks = vec![head];
+    let mut tail = String::new();
+
+    if let Some(context) = compile_context {
+        // Compile events
+        let compiled = subtitles
+            .events
+            .compile(&subtitles.extradata, &context, 0, None);
+        emit_events_parallel(&mut chunks, &compiled, subtitles.styles.as_slice())?;
+    } else {
+        // Export events verbatim
+        emit_events_parallel(
+            &mut chunks,
+            subtitles.events.as_slice(),
+            subtitles.styles.as_slice(),
+        )?;
+        emit_extradata(&mut tail, &subtitles.extradata)?;
+        emit_other_sections(&mut tail, &subtitles.other_sections)?;
+    }
+
+    chunks.push(tail);
+    Ok(chunks)
+}
+
+/// Emits the sections that come before the events. Samaku- and Aegisub-specific metadata is only
+/// included if the file is exported `verbatim`.
+fn emit_head<W: Write>(writer: &mut W, subtitles: &File, verbatim: bool) -> Result<(), Error> {
     emit_script_info(writer, &subtitles.script_info)?;
 
-    if compile_context.is_none() {
+    if verbatim {
         emit_aegi_metadata(writer, &subtitles.aegi_metadata)?;
     }
 
@@ -49,22 +123,73 @@ pub fn emit<W: Write>(
         "fontname",
         &subtitles.attachments,
         AttachmentType::Font,
-    )?;
+    )
+}
 
-    if let Some(context) = compile_context {
-        // Compile events
-        let compiled = subtitles
-            .events
-            .compile(&subtitles.extradata, &context, 0, None);
-        emit_events(writer, &compiled, subtitles.styles.as_slice())?;
-    } else {
-        // Export events verbatim
-        emit_events(writer, &subtitles.events, subtitles.styles.as_slice())?;
-        emit_extradata(writer, &subtitles.extradata)?;
-        emit_other_sections(writer, &subtitles.other_sections)?;
+/// Writes the given buffers, in order, to a temporary file next to `path`, and then atomically
+/// replaces `path` by it. This way, a crash or a full disk in the middle of saving never leaves
+/// behind a truncated subtitle file.
+///
+/// # Errors
+/// Errors if the temporary file cannot be created, written or synced, or if renaming it fails. In
+/// this case, the file at `path` is left untouched.
+pub fn write_atomically<S: AsRef<[u8]>>(path: &Path, chunks: &[S]) -> io::Result<()> {
+    let temp_path = temp_path_for(path);
+
+    let result =
+        write_synced(&temp_path, path, chunks).and_then(|()| std::fs::rename(&temp_path, path));
+
+    if result.is_err() {
+        // Try not to leave a half-written temporary file behind; if this fails as well, there is
+        // nothing more we can do about it.
+        let _ignored: io::Result<()> = std::fs::remove_file(&temp_path);
     }
 
-    Ok(())
+    result
+}
+
+/// Returns a temporary file name next to `path` that is unique to this save, so that concurrent
+/// saves of the same file, from this process or another one, do not write into the same file.
+fn temp_path_for(path: &Path) -> PathBuf {
+    static SAVE_COUNTER: AtomicU64 = AtomicU64::new(0);
+    let save = SAVE_COUNTER.fetch_add(1, Ordering::Relaxed);
+
+    let mut file_name = OsString::from(".");
+    file_name.push(path.file_name().unwrap_or(OsStr::new("subtitles")));
+    file_name.push(format!(".{}-{save}.samaku-tmp", std::process::id()));
+    path.with_file_name(file_name)
+}
+
+fn write_synced<S: AsRef<[u8]>>(temp_path: &Path, path: &Path, chunks: &[S]) -> io::Result<()> {
+    let mut file = std::fs::OpenOptions::new()
+        .write(true)
+        .create(true)
+        .truncate(true)
+        .open(temp_path)?;
+
+    // Keep the permissions of the file we are replacing
+    if let Ok(metadata) = std::fs::metadata(path) {
+        file.set_permissions(metadata.permissions())?;
+    }
+
+    let mut slices: Vec<IoSlice> = chunks
+        .iter()
+        .map(|chunk| IoSlice::new(chunk.as_ref()))
+        .collect();
+    let mut remaining = slices.as_mut_slice();
+    IoSlice::advance_slices(&mut remaining, 0); // skip leading empty buffers
+
+    while !remaining.is_empty() {
+        match file.write_vectored(remaining) {
+            Ok(0) => return Err(io::ErrorKind::WriteZero.into()),
+            Ok(written) => IoSlice::advance_slices(&mut remaining, written),
+            Err(error) if error.kind() == io::ErrorKind::Interrupted => {}
+            Err(error) => return Err(error),
+        }
+    }
+
+    file.flush()?;
+    file.sync_all()
 }
 
 fn emit_script_info<W: Write>(writer: &mut W, script_info: &ScriptInfo) -> Result<(), Error> {
@@ -240,68 +365,125 @@ fn emit_attachments<W: Write>(
     Ok(())
 }
 
-fn emit_events<'a, 'b, W: Write>(
-    writer: &mut W,
-    events: impl IntoIterator<Item = &'a Event<'b>>,
+fn emit_events<W: Write>(writer: &mut W, events: &[Event], styles: &[Style]) -> Result<(), Error> {
+    if events.is_empty() {
+        return Ok(());
+    }
+
+    write!(writer, "[Events]{NEWLINE}")?;
+    write!(writer, "{EVENT_FORMAT}{NEWLINE}")?;
+    writer.write_str(&emit_event_chunk(events, styles)?)?;
+    write!(writer, "{NEWLINE}")
+}
+
+/// Like [`emit_events`], but formats the event lines on several threads, each into its own buffer.
+fn emit_events_parallel(
+    chunks: &mut Vec<String>,
+    events: &[Event],
     styles: &[Style],
-) -> Result<(), Error>
-where
-    'b: 'a,
-{
-    let mut header_written: bool = false;
+) -> Result<(), Error> {
+    if events.is_empty() {
+        return Ok(());
+    }
 
-    for event in events {
-        if !header_written {
-            write!(writer, "[Events]{NEWLINE}")?;
-            write!(writer, "{EVENT_FORMAT}{NEWLINE}")?;
-            header_written = true;
-        }
+    let mut header = String::new();
+    write!(header, "[Events]{NEWLINE}")?;
+    write!(header, "{EVENT_FORMAT}{NEWLINE}")?;
+    chunks.push(header);
 
-        write!(
-            writer,
-            "{}: {},",
-            event_type_name(event.event_type),
-            event.layer_index,
-        )?;
-        emit_timecode(writer, event.start.0)?;
-        write!(writer, ",")?;
-        emit_timecode(writer, event.end().0)?;
-        write!(writer, ",")?;
-        emit_aegi_inline_string(writer, &styles[event.style_index].name)?;
-        write!(writer, ",")?;
-        emit_aegi_inline_string(writer, &event.actor)?;
-        write!(
-            writer,
-            ",{},{},{},",
-            event.margins.left, event.margins.right, event.margins.vertical
-        )?;
-        emit_aegi_inline_string(writer, &event.effect)?;
-        write!(writer, ",")?;
+    chunks.append(&mut emit_event_chunks(events, styles)?);
 
-        // Write extradata ID block
-        if !event.extradata_ids.is_empty() {
-            write!(writer, "{{")?;
-            for extradata_id in &event.extradata_ids {
-                write!(writer, "={}", extradata_id.0)?;
-            }
-            write!(writer, "}}")?;
-        }
+    chunks.push(NEWLINE.to_owned());
+    Ok(())
+}
 
-        // Skip newlines in event text, should they exist
-        for char in event.text.chars() {
-            match char {
-                '\r' | '\n' => {}
-                other => write!(writer, "{other}")?,
-            }
+/// Formats the given events into one buffer per available thread.
+fn emit_event_chunks(events: &[Event], styles: &[Style]) -> Result<Vec<String>, Error> {
+    let parallelism = std::thread::available_parallelism().map_or(1, std::num::NonZeroUsize::get);
+    let chunk_len = events.len().div_ceil(parallelism).max(MIN_EVENTS_PER_CHUNK);
+
+    if chunk_len >= events.len() {
+        return Ok(vec![emit_event_chunk(events, styles)?]);
+    }
+
+    std::thread::scope(|scope| {
+        let handles: Vec<_> = events
+            .chunks(chunk_len)
+            .map(|chunk| scope.spawn(move || emit_event_chunk(chunk, styles)))
+            .collect();
+
+        handles
+            .into_iter()
+            .map(|handle| handle.join().expect("event formatting thread panicked"))
+            .collect()
+    })
+}
+
+fn emit_event_chunk(events: &[Event], styles: &[Style]) -> Result<String, Error> {
+    let capacity = events
+        .iter()
+        .map(|event| event.text.len() + EVENT_LINE_OVERHEAD)
+        .sum();
+    let mut buffer = String::with_capacity(capacity);
+
+    for event in events {
+        emit_event(&mut buffer, event, styles)?;
+    }
+
+    Ok(buffer)
+}
+
+fn emit_event(buffer: &mut String, event: &Event, styles: &[Style]) -> Result<(), Error> {
+    write!(
+        buffer,
+        "{}: {},",
+        event_type_name(event.event_type),
+        event.layer_index,
+    )?;
+    emit_timecode(buffer, event.start.0)?;
+    buffer.push(',');
+    emit_timecode(buffer, event.end().0)?;
+    buffer.push(',');
+    emit_aegi_inline_string(buffer, &styles[event.style_index].name)?;
+    buffer.push(',');
+    emit_aegi_inline_string(buffer, &event.actor)?;
+    write!(
+        buffer,
+        ",{},{},{},",
+        event.margins.left, event.margins.right, event.margins.vertical
+    )?;
+    emit_aegi_inline_string(buffer, &event.effect)?;
+    buffer.push(',');
+
+    // Write extradata ID block
+    if !event.extradata_ids.is_empty() {
+        buffer.push('{');
+        for extradata_id in &event.extradata_ids {
+            write!(buffer, "={}", extradata_id.0)?;
         }
-        write!(writer, "{NEWLINE}")?;
+        buffer.push('}');
     }
 
-    if header_written {
-        write!(writer, "{NEWLINE}")
-    } else {
-        Ok(())
+    // Skip newlines in event text, should they exist
+    push_without_newlines(buffer, &event.text);
+    buffer.push_str(NEWLINE);
+
+    Ok(())
+}
+
+/// Appends `text` to `buffer`, leaving out any `\r` and `\n` characters. Copies whole runs of text
+/// in between newlines at once, instead of going character by character.
+fn push_without_newlines(buffer: &mut String, text: &str) {
+    let mut run_start = 0;
+
+    for newline_index in memchr::memchr2_iter(b'\r', b'\n', text.as_bytes()) {
+        // Both newline characters are ASCII, so slicing around them always falls on character
+        // boundaries
+        buffer.push_str(&text[run_start..newline_index]);
+        run_start = newline_index + 1;
     }
+
+    buffer.push_str(&text[run_start..]);
 }
 
 fn emit_extradata<W: Write>(writer: &mut W, extradata: &Extradata) -> Result<(), Error> {
@@ -315,17 +497,36 @@ fn emit_extradata<W: Write>(writer: &mut W, extradata: &Extradata) -> Result<(),
         write!(writer, "Data: {},", id.0)?;
 
         match entry {
-            ExtradataEntry::NdeFilter(filter) => {
-                let serialised = match serialise_nde_filter(filter) {
-                    Ok(serialised) => serialised,
-                    Err(err) => {
-                        println!("Error in NDE filter serialisation: {err}");
-                        println!("NDE filter in question: {filter:?}");
-                        return Err(Error);
-                    }
+            ExtradataEntry::NdeFilter(lazy_filter) => {
+                // Filters that were loaded and never modified are written back as they were
+                let serialised = match (lazy_filter.encoded(), lazy_filter.get()) {
+                    (Some(encoded), _) => Cow::Borrowed(encoded),
+                    (None, Some(filter)) => match serialise_nde_filter(filter) {
+                        Ok(serialised) => Cow::Owned(serialised.into_bytes()),
+                        Err(err) => {
+                            println!("Error in NDE filter serialisation: {err}");
+                            println!("NDE filter in question: {filter:?}");
+                            return Err(Error);
+                        }
+                    },
+                    (None, None) => unreachable!("a filter without encoded form must be decoded"),
                 };
 
-                write!(writer, "_samaku_nde_filter,e1{serialised}")?;
+                // Freshly serialised filters are plain base64, but loaded ones might contain
+                // anything, which is then preserved using UU encoding like opaque data.
+                match std::str::from_utf8(&serialised) {
+                    Ok(utf8_str) => {
+                        write!(writer, "_samaku_nde_filter,e1")?;
+                        emit_aegi_inline_string(writer, utf8_str)?;
+                    }
+                    Err(_) => {
+                        let mut value = Vec::with_capacity(serialised.len() + 1);
+                        value.push(b'1');
+                        value.extend_from_slice(&serialised);
+                        let uu_encoded = super::uu::encode(&value);
+                        write!(writer, "_samaku_nde_filter,u{uu_encoded}")?;
+                    }
+                }
             }
             ExtradataEntry::Opaque { key, value } => {
                 emit_aegi_inline_string(writer, key)?;
@@ -384,7 +585,7 @@ fn try_inline_encode(data: &[u8]) -> Option<String> {
 
 const COMPRESSION_LEVEL: u8 = 6;
 
-fn serialise_nde_filter(filter: &nde::Filter) -> Result<String, String> {
+pub(super) fn serialise_nde_filter(filter: &nde::Filter) -> Result<String, String> {
     let mut data: Vec<u8> = vec![];
     ciborium::into_writer(&filter, &mut data).map_err(|err| err.to_string())?;
 
@@ -499,4 +700,53 @@ mod tests {
 
         Ok(())
     }
+
+    #[test]
+    fn strip_newlines() {
+        let mut string = String::new();
+
+        push_without_newlines(&mut string, "\r\nab\ncä\r\r\nd\n");
+        assert_eq!(string, "abcäd");
+    }
+
+    #[test]
+    fn parallel_events() -> Result<(), Error> {
+        let styles = [Style::default()];
+        let events: Vec<Event> = (0..(MIN_EVENTS_PER_CHUNK * 5 + 17))
+            .map(|i| Event {
+                start: crate::subtitle::StartTime(i64::try_from(i).unwrap() * 10),
+                text: Cow::Owned(format!("line {i}\nfoo")),
+                ..Default::default()
+            })
+            .collect();
+
+        let chunks = emit_event_chunks(&events, &styles)?;
+        let sequential = emit_event_chunk(&events, &styles)?;
+        assert_eq!(chunks.concat(), sequential);
+        assert_eq!(sequential.lines().count(), events.len());
+        assert!(sequential.contains("line 17foo"));
+
+        Ok(())
+    }
+
+    #[test]
+    fn atomic_write() -> io::Result<()> {
+        let path = std::env::temp_dir().join("samaku_atomic_write_test.ass");
+        std::fs::write(&path, "old contents")?;
+
+        write_atomically(&path, &["[Script", "", " Info]", "\n"])?;
+        assert_eq!(std::fs::read_to_string(&path)?, "[Script Info]\n");
+
+        // Every save gets its own temporary file, which is gone afterwards
+        assert_ne!(temp_path_for(&path), temp_path_for(&path));
+        let leftover = std::fs::read_dir(std::env::temp_dir())?
+            .filter_map(Result::ok)
+            .any(|entry| {
+                let name = entry.file_name().to_string_lossy().into_owned();
+                name.starts_with(".samaku_atomic_write_test.ass.") && name.ends_with(".samaku-tmp")
+            });
+        assert!(!leftover);
+
+        std::fs::remove_file(&path)
+    }
 }
@@ -0,0 +1,672 @@
+//! Append-only journal of edits made to a subtitle file since it was last saved. The journal is
+//! kept in a sidecar file next to the `.ass` file, so that unsaved edits can be recovered after a
+//! crash, without having to rewrite the entire subtitle file every time something changes.
+//!
+//! The journal starts with a header identifying the version of the subtitle file it applies to,
+//! followed by a sequence of records. Each record consists of its payload length and checksum
+//! (both `u32`, little endian) and the CBOR-serialised [`Op`]. A torn or corrupted record at the
+//! end, as left behind by a crash in the middle of writing, ends replay without failing it.
+
+use std::collections::{BTreeSet, HashSet};
+use std::ffi::OsString;
+use std::io::{self, BufWriter, Read, Seek, Write};
+use std::path::{Path, PathBuf};
+use std::time::{Instant, UNIX_EPOCH};
+
+use thiserror::Error;
+
+use super::{
+    emit, EventIndex, EventTrack, EventType, Extradata, ExtradataEntry, ExtradataId, File,
+    LazyNdeFilter, Style,
+};
+
+/// Extension appended to the subtitle file name to obtain the journal file name.
+pub const EXTENSION: &str = "samaku-journal";
+
+/// Journal records are synced to disk at least this often while edits are being made.
+pub const SYNC_INTERVAL: std::time::Duration = std::time::Duration::from_secs(1);
+
+/// Journal records are synced to disk immediately once this many of them are pending.
+const SYNC_MAX_PENDING: usize = 64;
+
+const MAGIC: &[u8; 8] = b"SMKJRNL1";
+const HEADER_LEN: u64 = 24;
+
+/// Records larger than this are assumed to be corrupted.
+const MAX_RECORD_LEN: u32 = 64 * 1024 * 1024;
+
+/// A single edit operation, as recorded in the journal. Operations refer to events, styles and
+/// extradata entries by their indices or IDs at the time the operation was made.
+#[derive(Debug, Clone, serde::Serialize, serde::Deserialize)]
+pub enum Op {
+    /// Append a new event with default contents to the end of the track.
+    AddEvent,
+
+    /// Delete the events with the given indices.
+    DeleteEvents(Vec<usize>),
+
+    SetEventText(usize, String),
+    SetEventActor(usize, String),
+    SetEventEffect(usize, String),
+    SetEventStart(usize, i64),
+    SetEventDuration(usize, i64),
+    SetEventStyleIndex(usize, usize),
+    SetEventLayerIndex(usize, i32),
+    SetEventType(usize, EventType),
+    SetEventExtradataIds(usize, Vec<ExtradataId>),
+
+    /// Create or replace the NDE filter with the given extradata ID. The filter is stored in the
+    /// same encoded form as in `_samaku_nde_filter` extradata entries.
+    SetFilter(ExtradataId, Vec<u8>),
+
+    /// Delete the NDE filter with the given extradata ID, and unassign it from all events.
+    DeleteFilter(ExtradataId),
+
+    /// Create a new style with the given name and otherwise default properties.
+    CreateStyle(String),
+    DeleteStyle(usize),
+    SetStyleBold(usize, bool),
+}
+
+impl Op {
+    /// Applies this operation to the given subtitle file.
+    ///
+    /// # Errors
+    /// Errors if the operation refers to an event or style that does not exist. In this case, the
+    /// file is left unmodified.
+    pub fn apply(&self, file: &mut File) -> Result<(), Error> {
+        match self {
+            Op::AddEvent => file.events.push(super::Event {
+                start: super::StartTime(0),
+                duration: super::Duration(5000),
+                margins: super::Margins {
+                    left: 50,
+                    right: 50,
+                    vertical: 50,
+                },
+                text: "Sphinx of black quartz, judge my vow".into(),
+                ..Default::default()
+            }),
+            Op::DeleteEvents(indices) => {
+                if let Some(index) = indices.iter().find(|index| **index >= file.events.len()) {
+                    return Err(Error::InvalidEventIndex(*index));
+                }
+                let mut set: HashSet<EventIndex> =
+                    indices.iter().map(|index| EventIndex(*index)).collect();
+                file.events.remove_from_set(&mut set);
+            }
+            Op::SetEventText(index, text) => {
+                event_mut(&mut file.events, *index)?.text = text.clone().into()
+            }
+            Op::SetEventActor(index, actor) => {
+                event_mut(&mut file.events, *index)?.actor = actor.clone().into()
+            }
+            Op::SetEventEffect(index, effect) => {
+                event_mut(&mut file.events, *index)?.effect = effect.clone().into()
+            }
+            Op::SetEventStart(index, start) => {
+                event_mut(&mut file.events, *index)?.start = super::StartTime(*start);
+            }
+            Op::SetEventDuration(index, duration) => {
+                event_mut(&mut file.events, *index)?.duration = super::Duration(*duration);
+            }
+            Op::SetEventStyleIndex(index, style_index) => {
+                event_mut(&mut file.events, *index)?.style_index = *style_index;
+            }
+            Op::SetEventLayerIndex(index, layer_index) => {
+                event_mut(&mut file.events, *index)?.layer_index = *layer_index;
+            }
+            Op::SetEventType(index, event_type) => {
+                event_mut(&mut file.events, *index)?.event_type = *event_type;
+            }
+            Op::SetEventExtradataIds(index, ids) => {
+                // Events must not refer to entries that do not exist, as looking them up panics
+                if let Some(id) = ids.iter().find(|id| !file.extradata.contains(**id)) {
+                    return Err(Error::InvalidExtradataId(*id));
+                }
+                event_mut(&mut file.events, *index)?.extradata_ids = ids.clone();
+            }
+            Op::SetFilter(id, encoded) => file
+                .extradata
+                .insert_filter(*id, LazyNdeFilter::from_encoded(encoded.clone())),
+            Op::DeleteFilter(id) => {
+                for event in &mut file.events {
+                    event.extradata_ids.retain(|event_id| event_id != id);
+                }
+                file.extradata.remove(*id);
+            }
+            Op::CreateStyle(name) => {
+                file.styles.insert(Style {
+                    name: name.clone(),
+                    ..Default::default()
+                });
+            }
+            Op::DeleteStyle(index) => {
+                if *index >= file.styles.len() {
+                    return Err(Error::InvalidStyleIndex(*index));
+                }
+                file.styles.remove(*index);
+
+                // Update style references in events: assign the default style to all events that
+                // had the removed style assigned, and decrement style indices of applicable events
+                // (with existing style indices > the removed index)
+                for event in &mut file.events {
+                    match event.style_index.cmp(index) {
+                        std::cmp::Ordering::Less => {}
+                        std::cmp::Ordering::Equal => event.style_index = 0,
+                        std::cmp::Ordering::Greater => event.style_index -= 1,
+                    }
+                }
+            }
+            Op::SetStyleBold(index, value) => {
+                if *index >= file.styles.len() {
+                    return Err(Error::InvalidStyleIndex(*index));
+                }
+                file.styles[*index].bold = *value;
+            }
+        }
+
+        Ok(())
+    }
+
+    /// Creates an operation that stores the current state of the NDE filter with the given ID.
+    /// Returns `None` if there is no such filter, or it cannot be serialised.
+    #[must_use]
+    pub fn set_filter(extradata: &Extradata, id: ExtradataId) -> Option<Op> {
+        let Some(ExtradataEntry::NdeFilter(lazy_filter)) = extradata.entries.get(&id) else {
+            return None;
+        };
+
+        let encoded = match lazy_filter.encoded() {
+            Some(encoded) => encoded.to_vec(),
+            None => emit::serialise_nde_filter(lazy_filter.get()?)
+                .ok()?
+                .into_bytes(),
+        };
+
+        Some(Op::SetFilter(id, encoded))
+    }
+}
+
+fn event_mut(events: &mut EventTrack, index: usize) -> Result<&mut super::Event<'static>, Error> {
+    if index < events.len() {
+        Ok(&mut events[EventIndex(index)])
+    } else {
+        Err(Error::InvalidEventIndex(index))
+    }
+}
+
+#[derive(Error, Debug)]
+pub enum Error {
+    #[error("I/O error: {0}")]
+    Io(#[from] io::Error),
+
+    #[error("Journal refers to non-existent event {0}")]
+    InvalidEventIndex(usize),
+
+    #[error("Journal refers to non-existent style {0}")]
+    InvalidStyleIndex(usize),
+
+    #[error("Journal refers to non-existent extradata entry {0:?}")]
+    InvalidExtradataId(ExtradataId),
+}
+
+/// Identifies the state of the subtitle file on disk that a journal applies to. If the file was
+/// modified by something else in the meantime, the journal is not applied.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+struct BaseFile {
+    len: u64,
+    modified_nanos: u64,
+}
+
+impl BaseFile {
+    fn of(path: &Path) -> io::Result<Self> {
+        let metadata = std::fs::metadata(path)?;
+        let modified = metadata
+            .modified()?
+            .duration_since(UNIX_EPOCH)
+            .unwrap_or_default();
+
+        #[allow(clippy::cast_possible_truncation)] // good for a few more centuries
+        let modified_nanos = modified.as_nanos() as u64;
+
+        Ok(Self {
+            len: metadata.len(),
+            modified_nanos,
+        })
+    }
+
+    fn header(self) -> [u8; HEADER_LEN as usize] {
+        let mut header = [0_u8; HEADER_LEN as usize];
+        header[0..8].copy_from_slice(MAGIC);
+        header[8..16].copy_from_slice(&self.len.to_le_bytes());
+        header[16..24].copy_from_slice(&self.modified_nanos.to_le_bytes());
+        header
+    }
+}
+
+/// Returns the path of the journal belonging to the given subtitle file.
+#[must_use]
+pub fn path_for(subtitle_path: &Path) -> PathBuf {
+    let mut file_name = subtitle_path
+        .file_name()
+        .map_or_else(OsString::new, std::ffi::OsStr::to_os_string);
+    file_name.push(".");
+    file_name.push(EXTENSION);
+    subtitle_path.with_file_name(file_name)
+}
+
+/// An open journal, to which edits can be appended.
+pub struct Journal {
+    writer: BufWriter<std::fs::File>,
+
+    /// Number of records written since the last sync.
+    pending: usize,
+    last_sync: Instant,
+
+    /// Filters that were modified since the last sync. Filters can change very frequently (for
+    /// example, with every frame of a running motion track), so instead of recording every
+    /// change, only their latest state is recorded when syncing.
+    dirty_filters: BTreeSet<ExtradataId>,
+
+    /// Sequence number of the next record to be written.
+    next_sequence: u64,
+
+    /// Number of saves that have been started, but have not finished yet.
+    saves_in_progress: usize,
+
+    /// Records written while a save is in progress, together with their sequence numbers. They
+    /// are not part of the file being saved, so they have to be carried over into the new journal
+    /// once saving has finished.
+    unsaved: Vec<(u64, Vec<u8>)>,
+}
+
+/// The point in the journal at which a save was started. Records written after it are not part
+/// of the saved file.
+#[derive(Debug, Clone, Copy)]
+pub struct SaveMark(u64);
+
+impl Journal {
+    /// Opens the journal for the subtitle file at the given path, which has already been loaded
+    /// into `file`. If a journal from an earlier session exists and applies to the file as it is
+    /// on disk, the edits recorded in it are applied to `file`, and new edits will be appended to
+    /// it. Otherwise, a new, empty journal is started. Returns the journal together with the
+    /// number of recovered edits.
+    ///
+    /// # Errors
+    /// Errors if the journal cannot be read or written.
+    pub fn open(subtitle_path: &Path, file: &mut File) -> Result<(Self, usize), Error> {
+        let base = BaseFile::of(subtitle_path)?;
+        let journal_path = path_for(subtitle_path);
+
+        let mut journal_file = match std::fs::OpenOptions::new()
+            .read(true)
+            .write(true)
+            .open(&journal_path)
+        {
+            Ok(journal_file) => journal_file,
+            Err(error) if error.kind() == io::ErrorKind::NotFound => {
+                return Ok((Self::create(subtitle_path)?, 0));
+            }
+            Err(error) => return Err(error.into()),
+        };
+
+        let mut data = vec![];
+        journal_file.read_to_end(&mut data)?;
+
+        if data.len() < HEADER_LEN as usize || data[0..HEADER_LEN as usize] != base.header() {
+            println!(
+                "Ignoring journal {} as it does not match the subtitle file",
+                journal_path.display()
+            );
+            return Ok((Self::create(subtitle_path)?, 0));
+        }
+
+        let (ops, valid_len) = read_records(&data[HEADER_LEN as usize..]);
+        let mut recovered = 0;
+        for op in &ops {
+            if let Err(error) = op.apply(file) {
+                println!("Stopping journal replay: {error}");
+                break;
+            }
+            recovered += 1;
+        }
+
+        // Cut off any torn record at the end, and continue appending after the valid ones
+        journal_file.set_len(HEADER_LEN + valid_len as u64)?;
+        journal_file.seek(io::SeekFrom::End(0))?;
+
+        Ok((Self::from_file(journal_file), recovered))
+    }
+
+    /// Starts a new, empty journal for the subtitle file at the given path, replacing any
+    /// existing one. This should be called after the file has been saved, as the journal's
+    /// previous contents are now part of it.
+    ///
+    /// # Errors
+    /// Errors if the journal cannot be written.
+    pub fn create(subtitle_path: &Path) -> io::Result<Self> {
+        Ok(Self::from_file(create_file(subtitle_path, &[])?))
+    }
+
+    fn from_file(journal_file: std::fs::File) -> Self {
+        Self {
+            writer: BufWriter::new(journal_file),
+            pending: 0,
+            last_sync: Instant::now(),
+            dirty_filters: BTreeSet::new(),
+            next_sequence: 0,
+            saves_in_progress: 0,
+            unsaved: vec![],
+        }
+    }
+
+    /// Removes the journal belonging to the subtitle file at the given path. This should be
+    /// called when samaku exits normally, as the journal is only meant for recovering from
+    /// crashes.
+    ///
+    /// # Errors
+    /// Errors if the journal exists, but cannot be removed.
+    pub fn remove(self, subtitle_path: &Path) -> io::Result<()> {
+        drop(self);
+        Self::remove_for(subtitle_path)
+    }
+
+    /// Removes the journal belonging to the subtitle file at the given path, without it being
+    /// open. This should be called when the subtitles have been saved under another name, as the
+    /// journal still matches the original file, whose edits have not been saved to it.
+    ///
+    /// # Errors
+    /// Errors if the journal exists, but cannot be removed.
+    pub fn remove_for(subtitle_path: &Path) -> io::Result<()> {
+        match std::fs::remove_file(path_for(subtitle_path)) {
+            Err(error) if error.kind() != io::ErrorKind::NotFound => Err(error),
+            _ => Ok(()),
+        }
+    }
+
+    /// Notes that the current state of the subtitles is about to be saved. Pending filter states
+    /// are recorded first, so that everything recorded afterwards is known not to be part of the
+    /// saved file. Once saving has finished, the returned mark needs to be passed to
+    /// [`Journal::finish_save`]; if saving does not happen after all, [`Journal::cancel_save`]
+    /// needs to be called instead.
+    ///
+    /// # Errors
+    /// Errors if the journal cannot be written.
+    pub fn begin_save(&mut self, extradata: &Extradata) -> io::Result<SaveMark> {
+        self.sync(extradata)?;
+        self.saves_in_progress += 1;
+        Ok(SaveMark(self.next_sequence))
+    }
+
+    /// Starts a new journal for the subtitle file that has just been saved to the given path, as
+    /// everything recorded before the save was started is part of it now. Edits recorded while
+    /// saving was in progress are carried over into the new journal.
+    ///
+    /// # Errors
+    /// Errors if the new journal cannot be written.
+    pub fn finish_save(&mut self, subtitle_path: &Path, mark: SaveMark) -> io::Result<()> {
+        let carried_over: Vec<u8> = self
+            .unsaved
+            .iter()
+            .filter(|(sequence, _)| *sequence >= mark.0)
+            .flat_map(|(_, record)| record.iter().copied())
+            .collect();
+        self.end_save();
+
+        self.writer = BufWriter::new(create_file(subtitle_path, &carried_over)?);
+        self.pending = 0;
+        self.last_sync = Instant::now();
+
+        Ok(())
+    }
+
+    /// Notes that a save started with [`Journal::begin_save`] did not happen after all.
+    pub fn cancel_save(&mut self) {
+        self.end_save();
+    }
+
+    fn end_save(&mut self) {
+        self.saves_in_progress = self.saves_in_progress.saturating_sub(1);
+        if self.saves_in_progress == 0 {
+            self.unsaved.clear();
+        }
+    }
+
+    /// Appends an operation to the journal. It will be synced to disk along with other recent
+    /// operations, once enough of them have accumulated or enough time has passed.
+    ///
+    /// # Errors
+    /// Errors if the journal cannot be written.
+    pub fn record(&mut self, op: &Op) -> io::Result<()> {
+        let mut payload = vec![];
+        ciborium::into_writer(op, &mut payload)
+            .map_err(|error| io::Error::new(io::ErrorKind::InvalidData, error.to_string()))?;
+
+        let len = u32::try_from(payload.len())
+            .ok()
+            .filter(|len| *len <= MAX_RECORD_LEN)
+            .ok_or_else(|| io::Error::new(io::ErrorKind::InvalidData, "record too large"))?;
+
+        let mut record = Vec::with_capacity(8 + payload.len());
+        record.extend_from_slice(&len.to_le_bytes());
+        record.extend_from_slice(&checksum(&payload).to_le_bytes());
+        record.extend_from_slice(&payload);
+
+        self.writer.write_all(&record)?;
+        self.pending += 1;
+
+        if self.saves_in_progress > 0 {
+            self.unsaved.push((self.next_sequence, record));
+        }
+        self.next_sequence += 1;
+
+        Ok(())
+    }
+
+    /// Marks the NDE filter with the given ID as modified. Its state will be recorded on the next
+    /// sync.
+    pub fn mark_filter_dirty(&mut self, id: ExtradataId) {
+        self.dirty_filters.insert(id);
+    }
+
+    /// Syncs the journal to disk if enough records are pending, or if some are pending and the
+    /// sync interval has elapsed.
+    ///
+    /// # Errors
+    /// Errors if the journal cannot be written.
+    pub fn sync_if_due(&mut self, extradata: &Extradata) -> io::Result<()> {
+        let pending = self.pending + self.dirty_filters.len();
+        if pending >= SYNC_MAX_PENDING || (pending > 0 && self.last_sync.elapsed() >= SYNC_INTERVAL)
+        {
+            self.sync(extradata)?;
+        }
+
+        Ok(())
+    }
+
+    /// Records the state of modified filters, and syncs all pending records to disk.
+    ///
+    /// # Errors
+    /// Errors if the journal cannot be written.
+    pub fn sync(&mut self, extradata: &Extradata) -> io::Result<()> {
+        for id in std::mem::take(&mut self.dirty_filters) {
+            if let Some(op) = Op::set_filter(extradata, id) {
+                self.record(&op)?;
+            }
+        }
+
+        self.writer.flush()?;
+        self.writer.get_ref().sync_data()?;
+        self.pending = 0;
+        self.last_sync = Instant::now();
+
+        Ok(())
+    }
+}
+
+/// Creates a new journal file for the subtitle file at the given path, containing the header and
+/// the given records.
+fn create_file(subtitle_path: &Path, records: &[u8]) -> io::Result<std::fs::File> {
+    let base = BaseFile::of(subtitle_path)?;
+    let mut journal_file = std::fs::File::create(path_for(subtitle_path))?;
+    journal_file.write_all(&base.header())?;
+    journal_file.write_all(records)?;
+    journal_file.sync_data()?;
+    Ok(journal_file)
+}
+
+/// Reads as many valid records as possible from the given journal data (excluding the header).
+/// Returns the decoded operations and the number of bytes they take up.
+fn read_records(mut data: &[u8]) -> (Vec<Op>, usize) {
+    let mut ops = vec![];
+    let mut valid_len = 0;
+
+    while data.len() >= 8 {
+        let len = u32::from_le_bytes(data[0..4].try_into().unwrap());
+        let expected_checksum = u32::from_le_bytes(data[4..8].try_into().unwrap());
+        let record_len = 8 + len as usize;
+
+        if len > MAX_RECORD_LEN || data.len() < record_len {
+            break;
+        }
+
+        let payload = &data[8..record_len];
+        if checksum(payload) != expected_checksum {
+            break;
+        }
+
+        match ciborium::from_reader::<Op, _>(payload) {
+            Ok(op) => ops.push(op),
+            Err(_) => break,
+        }
+
+        valid_len += record_len;
+        data = &data[record_len..];
+    }
+
+    (ops, valid_len)
+}
+
+/// 32-bit FNV-1a hash, to detect corrupted records.
+fn checksum(data: &[u8]) -> u32 {
+    let mut hash: u32 = 0x811c_9dc5;
+    for byte in data {
+        hash ^= u32::from(*byte);
+        hash = hash.wrapping_mul(0x0100_0193);
+    }
+    hash
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn replay() {
+        let subtitle_path = std::env::temp_dir().join("samaku_journal_test.ass");
+        let mut emitted = String::new();
+        emit::emit(&mut emitted, &File::default(), None).unwrap();
+        std::fs::write(&subtitle_path, emitted).unwrap();
+
+        let mut file = File::default();
+        let (mut journal, recovered) = Journal::open(&subtitle_path, &mut file).unwrap();
+        assert_eq!(recovered, 0);
+
+        for op in [
+            Op::AddEvent,
+            Op::AddEvent,
+            Op::SetEventText(1, "recovered".to_owned()),
+            Op::CreateStyle("Sign".to_owned()),
+            Op::SetEventStyleIndex(1, 1),
+            Op::DeleteEvents(vec![0]),
+        ] {
+            op.apply(&mut file).unwrap();
+            journal.record(&op).unwrap();
+        }
+        journal.sync(&file.extradata).unwrap();
+        drop(journal);
+
+        // Simulate a crash in the middle of writing a record
+        let journal_path = path_for(&subtitle_path);
+        let mut journal_file = std::fs::OpenOptions::new()
+            .append(true)
+            .open(&journal_path)
+            .unwrap();
+        journal_file.write_all(&[200, 0, 0, 0, 1, 2]).unwrap();
+        drop(journal_file);
+
+        let mut recovered_file = File::default();
+        let (_journal, recovered) = Journal::open(&subtitle_path, &mut recovered_file).unwrap();
+        assert_eq!(recovered, 6);
+        assert_eq!(recovered_file.events.len(), 1);
+        assert_eq!(recovered_file.events[EventIndex(0)].text, "recovered");
+        assert_eq!(recovered_file.events[EventIndex(0)].style_index, 1);
+        assert_eq!(recovered_file.styles[1].name, "Sign");
+
+        // Once the file is saved, the journal no longer applies
+        std::fs::write(&subtitle_path, "[Script Info]\n").unwrap();
+        let (_journal, recovered) = Journal::open(&subtitle_path, &mut File::default()).unwrap();
+        assert_eq!(recovered, 0);
+
+        std::fs::remove_file(&subtitle_path).unwrap();
+        std::fs::remove_file(&journal_path).unwrap();
+    }
+
+    #[test]
+    fn edits_during_save() {
+        let subtitle_path = std::env::temp_dir().join("samaku_journal_save_test.ass");
+        let mut emitted = String::new();
+        emit::emit(&mut emitted, &File::default(), None).unwrap();
+        std::fs::write(&subtitle_path, &emitted).unwrap();
+
+        let mut file = File::default();
+        let (mut journal, _) = Journal::open(&subtitle_path, &mut file).unwrap();
+        journal.record(&Op::AddEvent).unwrap();
+        let save_mark = journal.begin_save(&file.extradata).unwrap();
+
+        // Saved file contains one event, then another edit is made before saving finishes
+        let mut saved_file = File::default();
+        Op::AddEvent.apply(&mut saved_file).unwrap();
+        journal
+            .record(&Op::SetEventText(0, "while saving".to_owned()))
+            .unwrap();
+
+        let mut emitted = String::new();
+        emit::emit(&mut emitted, &saved_file, None).unwrap();
+        std::fs::write(&subtitle_path, &emitted).unwrap();
+        journal.finish_save(&subtitle_path, save_mark).unwrap();
+        journal.sync(&file.extradata).unwrap();
+        drop(journal);
+
+        let (journal, recovered) = Journal::open(&subtitle_path, &mut saved_file).unwrap();
+        assert_eq!(recovered, 1);
+        assert_eq!(saved_file.events.len(), 1);
+        assert_eq!(saved_file.events[EventIndex(0)].text, "while saving");
+
+        journal.remove(&subtitle_path).unwrap();
+        assert!(!path_for(&subtitle_path).exists());
+        std::fs::remove_file(&subtitle_path).unwrap();
+    }
+
+    #[test]
+    fn invalid_extradata_id() {
+        let mut file = File::default();
+        Op::AddEvent.apply(&mut file).unwrap();
+
+        let id = file.extradata.push_filter(crate::nde::Filter {
+            name: String::new(),
+            graph: crate::nde::graph::Graph::identity(),
+        });
+        let missing_id = ExtradataId(id.0 + 1);
+
+        assert!(Op::SetEventExtradataIds(0, vec![id])
+            .apply(&mut file)
+            .is_ok());
+        assert!(matches!(
+            Op::SetEventExtradataIds(0, vec![missing_id]).apply(&mut file),
+            Err(Error::InvalidExtradataId(_))
+        ));
+        assert_eq!(file.events[EventIndex(0)].extradata_ids, vec![id]);
+    }
+}
@@ -3,20 +3,24 @@
 //! ones.
 
 use std::borrow::Cow;
+use std::cell::Cell;
 use std::collections::{BTreeMap, HashMap, HashSet};
 use std::ops::{Index, IndexMut};
+use std::rc::Rc;
 
-pub use emit::emit;
+pub use emit::{emit, emit_chunks, write_atomically};
 
 use crate::nde::tags::{
     Alignment, Colour, HorizontalAlignment, Transparency, VerticalAlignment, WrapStyle,
 };
 use crate::{message, model, nde, style};
 
+pub mod cache;
 pub mod compile;
 mod emit;
+pub mod journal;
 pub mod parse;
-mod uu;
+pub mod uu;
 
 /// “Event” is the unambiguous term for a subtitle line, or a typeset sign, or a frame-by-frame
 /// or clipped part of a sign. It is shown from a specific start time on for a specific duration,
@@ -94,7 +98,7 @@ impl<'a> Event<'a> {
     }
 }
 
-#[derive(Debug, Clone, Copy, Default)]
+#[derive(Debug, Clone, Copy, Default, serde::Serialize, serde::Deserialize)]
 pub enum EventType {
     #[default]
     Dialogue,
@@ -548,7 +552,8 @@ impl EventTrack {
 
     /// If exactly one event is selected, this method returns the index of that element. Otherwise,
     /// it returns `None`.
-    fn active_event_index(selected_event_indices: &HashSet<EventIndex>) -> Option<EventIndex> {
+    #[must_use]
+    pub fn active_event_index(selected_event_indices: &HashSet<EventIndex>) -> Option<EventIndex> {
         (selected_event_indices.len() == 1).then(|| *selected_event_indices.iter().next().unwrap())
     }
 
@@ -621,17 +626,19 @@ impl EventTrack {
             }
 
             // Run the complex `nde` compilation method if the event has a filter assigned,
-            // and the trivial one otherwise
-            match extradata.nde_filter_for_event(event) {
-                Some(filter) => match compile::nde(event, &filter.graph, context) {
-                    Ok(mut nde_result) => match &mut nde_result.events {
+            // and the trivial one otherwise. Events sharing a filter also share its plan
+            match extradata.nde_filter_with_plan_for_event(event) {
+                Some((filter, Ok(plan))) => {
+                    let mut nde_result =
+                        compile::nde_with_plan(event, &filter.graph, plan, context);
+                    match &mut nde_result.events {
                         Some(events) => compiled.append(events),
                         None => println!("No output from NDE filter"),
-                    },
-                    Err(error) => {
-                        println!("Got NdeError while running NDE filter: {error:?}");
                     }
-                },
+                }
+                Some((_, Err(error))) => {
+                    println!("Got NdeError while running NDE filter: {error:?}");
+                }
                 None => compiled.push(compile::trivial(event)),
             }
         }
@@ -745,7 +752,18 @@ impl File {
     pub async fn parse<R: smol::io::AsyncBufRead + Unpin>(
         input: smol::io::Lines<R>,
     ) -> Result<(File, Vec<parse::Warning>), parse::Error> {
-        parse::parse(input).await
+        parse::parse(input, false).await
+    }
+
+    /// Like [`File::parse`], but ignores all event lines, leaving the event track empty. Used
+    /// when the events are loaded from a [`cache::Cache`] instead.
+    ///
+    /// # Errors
+    /// Errors under the same conditions as [`File::parse`].
+    pub async fn parse_without_events<R: smol::io::AsyncBufRead + Unpin>(
+        input: smol::io::Lines<R>,
+    ) -> Result<(File, Vec<parse::Warning>), parse::Error> {
+        parse::parse(input, true).await
     }
 }
 
@@ -763,13 +781,29 @@ impl Default for File {
     }
 }
 
-#[derive(Debug, Clone, Copy, Default, PartialEq, Eq, PartialOrd, Ord, Hash)]
+#[derive(
+    Debug,
+    Clone,
+    Copy,
+    Default,
+    PartialEq,
+    Eq,
+    PartialOrd,
+    Ord,
+    Hash,
+    serde::Serialize,
+    serde::Deserialize,
+)]
 pub struct ExtradataId(u32);
 
 #[derive(Debug, Default)]
 pub struct Extradata {
     entries: BTreeMap<ExtradataId, ExtradataEntry>,
     next_id: ExtradataId,
+
+    /// Maps the content hash of encoded NDE filters to an entry containing that filter, to find
+    /// identical filters to share data with. May contain stale IDs, which are ignored on lookup.
+    filters_by_content: HashMap<u64, ExtradataId>,
 }
 
 pub type IterFilters<'a> = std::iter::FilterMap<
@@ -792,9 +826,99 @@ impl Extradata {
         new_id
     }
 
-    /// Append a new filter. Returns the newly created extradata ID.
+    /// Append a new filter. Returns the newly created extradata ID. If an identical filter exists
+    /// already, the new entry will share its data.
     pub fn push_filter(&mut self, filter: nde::Filter) -> ExtradataId {
-        self.push(ExtradataEntry::NdeFilter(filter))
+        // Identical filters are found by their encoded form, so it is needed up front here
+        let lazy_filter = match emit::serialise_nde_filter(&filter) {
+            Ok(encoded) => LazyNdeFilter::with_encoded(filter, encoded.into_bytes()),
+            Err(_) => LazyNdeFilter::new(filter),
+        };
+
+        let new_id = self.next_id;
+        self.insert_filter(new_id, lazy_filter);
+        new_id
+    }
+
+    /// Insert an NDE filter under a specific ID, replacing any previous entry with that ID. If an
+    /// identical filter exists already, the new entry will share its data.
+    pub fn insert_filter(&mut self, id: ExtradataId, filter: LazyNdeFilter) {
+        let filter = match filter.encoded() {
+            Some(encoded) => {
+                let hash = content_hash(encoded);
+                let existing =
+                    self.filters_by_content.get(&hash).and_then(|existing_id| {
+                        match self.entries.get(existing_id) {
+                            Some(ExtradataEntry::NdeFilter(existing))
+                                if existing.encoded() == Some(encoded) =>
+                            {
+                                Some(existing.share())
+                            }
+                            _ => None,
+                        }
+                    });
+
+                existing.unwrap_or_else(|| {
+                    self.filters_by_content.insert(hash, id);
+                    filter
+                })
+            }
+            None => filter,
+        };
+
+        self.entries.insert(id, ExtradataEntry::NdeFilter(filter));
+        self.next_id = self.next_id.max(ExtradataId(id.0 + 1));
+    }
+
+    /// Returns the errors of NDE filters that failed to decode since the last call. Filters are
+    /// decoded lazily, so this needs to be checked after they might have been accessed. Each
+    /// failure is only reported once, even if it is shared between several entries.
+    #[must_use]
+    pub fn take_decode_errors(&self) -> Vec<String> {
+        let mut errors = vec![];
+
+        for entry in self.entries.values() {
+            if let ExtradataEntry::NdeFilter(lazy_filter) = entry {
+                if let Some(error) = lazy_filter.decode_error() {
+                    if !lazy_filter.shared.error_reported.replace(true) {
+                        errors.push(error.to_string());
+                    }
+                }
+            }
+        }
+
+        errors
+    }
+
+    /// Counts NDE filter entries, and how many distinct filters they are backed by.
+    #[must_use]
+    pub fn filter_stats(&self) -> FilterStats {
+        let mut seen: HashSet<*const FilterData> = HashSet::new();
+        let mut stats = FilterStats {
+            entries: 0,
+            unique: 0,
+            decoded: 0,
+        };
+
+        for entry in self.entries.values() {
+            if let ExtradataEntry::NdeFilter(filter) = entry {
+                stats.entries += 1;
+                if seen.insert(Rc::as_ptr(&filter.shared)) {
+                    stats.unique += 1;
+                    if filter.is_decoded() {
+                        stats.decoded += 1;
+                    }
+                }
+            }
+        }
+
+        stats
+    }
+
+    /// Whether an entry with the given ID exists.
+    #[must_use]
+    pub fn contains(&self, id: ExtradataId) -> bool {
+        self.entries.contains_key(&id)
     }
 
     /// Remove an entry. The caller must take care to remove references to it from events!
@@ -802,13 +926,14 @@ impl Extradata {
         self.entries.remove(&id)
     }
 
-    /// Iterate over all existing NDE filters with their indices.
+    /// Iterate over all existing NDE filters with their indices. This decodes all filters that
+    /// have not been decoded yet; filters that fail to decode are skipped.
     pub fn iter_filters(&self) -> IterFilters {
         #[allow(clippy::match_wildcard_for_single_variants)]
         self.entries
             .iter()
             .filter_map(|(index, entry)| match entry {
-                ExtradataEntry::NdeFilter(filter) => Some((*index, filter)),
+                ExtradataEntry::NdeFilter(filter) => filter.get().map(|decoded| (*index, decoded)),
                 _ => None,
             })
     }
@@ -818,13 +943,41 @@ impl Extradata {
     pub fn nde_filter_for_event<'a>(&'a self, event: &Event) -> Option<&'a nde::Filter> {
         for extradata_id in &event.extradata_ids {
             if let ExtradataEntry::NdeFilter(filter) = &self[*extradata_id] {
-                return Some(filter);
+                return filter.get();
             }
         }
 
         None
     }
 
+    /// Like [`Extradata::nde_filter_for_event`], but also returns the filter's compilation plan.
+    #[must_use]
+    pub fn nde_filter_with_plan_for_event<'a>(
+        &'a self,
+        event: &Event,
+    ) -> Option<(
+        &'a nde::Filter,
+        &'a Result<compile::Plan, compile::NdeError>,
+    )> {
+        for extradata_id in &event.extradata_ids {
+            if let ExtradataEntry::NdeFilter(filter) = &self[*extradata_id] {
+                return filter.get_with_plan();
+            }
+        }
+
+        None
+    }
+
+    /// Returns the extradata ID of the NDE filter assigned to the given event, if one exists.
+    #[must_use]
+    pub fn nde_filter_id_for_event(&self, event: &Event) -> Option<ExtradataId> {
+        event
+            .extradata_ids
+            .iter()
+            .copied()
+            .find(|extradata_id| matches!(self[*extradata_id], ExtradataEntry::NdeFilter(_)))
+    }
+
     /// Get a mutable reference to the NDE filter assigned to the given event, if one is assigned.
     ///
     /// # Panics
@@ -834,26 +987,16 @@ impl Extradata {
         &'a mut self,
         event: &Event,
     ) -> Option<&'a mut nde::Filter> {
-        // We have to implement it in this roundabout way because of borrow checker limitations;
-        // if we simply return the filter reference in the loop, the borrow checker cannot prove
-        // that the mutable reference is unique.
-        let mut maybe_filter_id: Option<ExtradataId> = None;
-        for extradata_id in &event.extradata_ids {
-            if let ExtradataEntry::NdeFilter(_) = &self[*extradata_id] {
-                maybe_filter_id = Some(*extradata_id);
-                break;
-            }
-        }
-
-        let Some(filter_id) = maybe_filter_id else {
-            return None;
-        };
+        // We have to look up the ID first because of borrow checker limitations; if we simply
+        // return the filter reference in a loop, the borrow checker cannot prove that the mutable
+        // reference is unique.
+        let filter_id = self.nde_filter_id_for_event(event)?;
 
         let ExtradataEntry::NdeFilter(filter) = &mut self[filter_id] else {
             panic!();
         };
 
-        Some(filter)
+        filter.get_mut()
     }
 }
 
@@ -877,10 +1020,210 @@ impl IndexMut<ExtradataId> for Extradata {
 
 #[derive(Debug)]
 pub enum ExtradataEntry {
-    NdeFilter(nde::Filter),
+    NdeFilter(LazyNdeFilter),
     Opaque { key: String, value: Vec<u8> },
 }
 
+/// An NDE filter stored as extradata. Filters read from a file are kept in their encoded form
+/// (base64 of deflated CBOR), as the raw bytes found in the file, and only decoded the first time
+/// they are actually accessed, so that opening a file with many filters does not require decoding
+/// all of them up front. As long as a filter has not been accessed mutably, its original encoded
+/// form is written back verbatim when saving, even if it cannot be decoded.
+///
+/// Entries with identical encoded content (for example, the same typesetting filter pasted onto
+/// many signs in Aegisub) share their data, including the decoded filter and its compilation
+/// plan. Modifying one of them detaches it from the others first (copy-on-write), so the others
+/// stay unaffected.
+#[derive(Debug)]
+pub struct LazyNdeFilter {
+    shared: Rc<FilterData>,
+}
+
+#[derive(Debug)]
+struct FilterData {
+    /// The encoded filter, without the format identifier. `None` if the filter has been modified
+    /// (or was created within samaku), in which case it needs to be serialised anew on save.
+    /// Shared filter data always has an encoded form, because that is what it is keyed by.
+    /// These are the exact bytes from the file, which are not necessarily valid UTF-8.
+    encoded: Option<Vec<u8>>,
+
+    /// The decoded filter, or the error that occurred while decoding it.
+    decoded: once_cell::unsync::OnceCell<Result<nde::Filter, parse::Error>>,
+
+    /// Whether a decoding error has been passed on to the user already.
+    error_reported: Cell<bool>,
+
+    /// The order in which the filter's nodes are run, made when the filter is first compiled.
+    plan: once_cell::unsync::OnceCell<Result<compile::Plan, compile::NdeError>>,
+}
+
+impl FilterData {
+    fn get(&self) -> Option<&nde::Filter> {
+        self.decoded
+            .get_or_init(|| {
+                let encoded = self
+                    .encoded
+                    .as_ref()
+                    .expect("a filter should be either encoded or decoded");
+
+                parse::decode_nde_filter(encoded)
+            })
+            .as_ref()
+            .ok()
+    }
+
+    fn get_with_plan(&self) -> Option<(&nde::Filter, &Result<compile::Plan, compile::NdeError>)> {
+        let filter = self.get()?;
+        let plan = self.plan.get_or_init(|| compile::Plan::new(&filter.graph));
+        Some((filter, plan))
+    }
+
+    fn new_encoded(encoded: Vec<u8>) -> Self {
+        Self {
+            encoded: Some(encoded),
+            decoded: once_cell::unsync::OnceCell::new(),
+            error_reported: Cell::new(false),
+            plan: once_cell::unsync::OnceCell::new(),
+        }
+    }
+}
+
+impl LazyNdeFilter {
+    /// Wraps an already decoded filter.
+    #[must_use]
+    pub fn new(filter: nde::Filter) -> Self {
+        Self {
+            shared: Rc::new(FilterData {
+                encoded: None,
+                decoded: once_cell::unsync::OnceCell::with_value(Ok(filter)),
+                error_reported: Cell::new(false),
+                plan: once_cell::unsync::OnceCell::new(),
+            }),
+        }
+    }
+
+    /// Wraps an already decoded filter along with its encoded form, which must match it.
+    fn with_encoded(filter: nde::Filter, encoded: Vec<u8>) -> Self {
+        Self {
+            shared: Rc::new(FilterData {
+                encoded: Some(encoded),
+                decoded: once_cell::unsync::OnceCell::with_value(Ok(filter)),
+                error_reported: Cell::new(false),
+                plan: once_cell::unsync::OnceCell::new(),
+            }),
+        }
+    }
+
+    /// Creates a filter from its encoded form, as stored in `_samaku_nde_filter` extradata
+    /// entries after the format identifier. Decoding is deferred until the filter is accessed.
+    #[must_use]
+    pub fn from_encoded(encoded: Vec<u8>) -> Self {
+        Self {
+            shared: Rc::new(FilterData::new_encoded(encoded)),
+        }
+    }
+
+    /// Returns the decoded filter, decoding it if that has not happened yet. Returns `None` if the
+    /// encoded data is invalid.
+    #[must_use]
+    pub fn get(&self) -> Option<&nde::Filter> {
+        self.shared.get()
+    }
+
+    /// Returns a mutable reference to the decoded filter, decoding it if necessary. As the filter
+    /// might be modified through the returned reference, the original encoded form is discarded.
+    /// If the data is shared with other entries, this entry gets its own copy first.
+    #[must_use]
+    pub fn get_mut(&mut self) -> Option<&mut nde::Filter> {
+        if Rc::get_mut(&mut self.shared).is_none() {
+            let encoded = self
+                .shared
+                .encoded
+                .clone()
+                .expect("shared filters should always have an encoded form");
+            self.shared = Rc::new(FilterData::new_encoded(encoded));
+        }
+
+        let data = Rc::get_mut(&mut self.shared).expect("filter data should be unique by now");
+
+        // Make sure the filter is decoded before throwing away the encoded form. The graph might
+        // change as well, so the plan has to be made anew
+        if data.get().is_some() {
+            data.encoded = None;
+        }
+        data.plan.take();
+
+        data.decoded
+            .get_mut()
+            .and_then(|result| result.as_mut().ok())
+    }
+
+    /// Returns the decoded filter together with its compilation plan, making the plan if that has
+    /// not happened yet. Returns `None` if the encoded data is invalid.
+    #[must_use]
+    pub fn get_with_plan(
+        &self,
+    ) -> Option<(&nde::Filter, &Result<compile::Plan, compile::NdeError>)> {
+        self.shared.get_with_plan()
+    }
+
+    /// Returns the original encoded form of this filter, if it has not been modified since it was
+    /// loaded.
+    #[must_use]
+    pub fn encoded(&self) -> Option<&[u8]> {
+        self.shared.encoded.as_deref()
+    }
+
+    /// Whether the filter has been decoded already.
+    #[must_use]
+    pub fn is_decoded(&self) -> bool {
+        self.shared.decoded.get().is_some()
+    }
+
+    /// Returns the error that occurred while decoding this filter, if it has been decoded and
+    /// decoding failed.
+    #[must_use]
+    pub fn decode_error(&self) -> Option<&parse::Error> {
+        self.shared
+            .decoded
+            .get()
+            .and_then(|result| result.as_ref().err())
+    }
+
+    /// Whether this filter shares its data with the given other filter.
+    #[must_use]
+    pub fn shares_data_with(&self, other: &LazyNdeFilter) -> bool {
+        Rc::ptr_eq(&self.shared, &other.shared)
+    }
+
+    fn share(&self) -> Self {
+        Self {
+            shared: Rc::clone(&self.shared),
+        }
+    }
+}
+
+/// Statistics about the NDE filters stored in some [`Extradata`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct FilterStats {
+    /// Number of extradata entries that are NDE filters.
+    pub entries: usize,
+
+    /// Number of distinct filters actually held in memory, after deduplication.
+    pub unique: usize,
+
+    /// Number of distinct filters that have been decoded so far.
+    pub decoded: usize,
+}
+
+fn content_hash(encoded: &[u8]) -> u64 {
+    use std::hash::{Hash, Hasher};
+
+    let mut hasher = std::collections::hash_map::DefaultHasher::new();
+    encoded.hash(&mut hasher);
+    hasher.finish()
+}
+
 #[derive(Debug, Clone)]
 pub struct Attachment {
     attachment_type: AttachmentType,
@@ -896,6 +1239,26 @@ impl Attachment {
     pub fn decode(&self) -> Result<Vec<u8>, data_encoding::DecodeError> {
         uu::decode(&self.uu_data)
     }
+
+    /// Decode the UU-encoded data contained within this attachment into the given buffer, which is
+    /// cleared first. Allows reusing the same buffer for multiple attachments.
+    ///
+    /// # Errors
+    /// Returns a `DecodeError` if the contained data is invalid.
+    pub fn decode_into(&self, buffer: &mut Vec<u8>) -> Result<(), data_encoding::DecodeError> {
+        buffer.clear();
+        uu::decode_into(&self.uu_data, buffer)
+    }
+
+    #[must_use]
+    pub fn attachment_type(&self) -> AttachmentType {
+        self.attachment_type
+    }
+
+    #[must_use]
+    pub fn filename(&self) -> &str {
+        &self.filename
+    }
 }
 
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
@@ -994,6 +1357,7 @@ mod tests {
             extradata: Extradata {
                 entries,
                 next_id: ExtradataId(2),
+                filters_by_content: HashMap::new(),
             },
             ..Default::default()
         };
@@ -1025,6 +1389,161 @@ mod tests {
         assert_eq!(v1, LONG_VALUE);
     }
 
+    #[test]
+    fn lazy_nde_filters() {
+        let path = test_file("test_files/extra_sections.ass");
+        let (mut ass_file, _warnings) = parse::tests::parse_blocking(&path);
+
+        assert_matches!(
+            &ass_file.extradata[ExtradataId(11)],
+            ExtradataEntry::NdeFilter(lazy_filter)
+        );
+        assert!(!lazy_filter.is_decoded());
+        let encoded = std::str::from_utf8(lazy_filter.encoded().unwrap())
+            .unwrap()
+            .to_owned();
+
+        // Unmodified filters should be emitted verbatim, without decoding them
+        let mut emitted = String::new();
+        emit(&mut emitted, &ass_file, None).unwrap();
+        assert!(emitted.contains(&format!("_samaku_nde_filter,e1{encoded}")));
+        assert!(!lazy_filter.is_decoded());
+
+        let event5 = ass_file.events[EventIndex(5)].clone();
+        assert_matches!(ass_file.extradata.nde_filter_for_event(&event5), Some(_));
+        assert_matches!(
+            &ass_file.extradata[ExtradataId(11)],
+            ExtradataEntry::NdeFilter(lazy_filter)
+        );
+        assert!(lazy_filter.is_decoded());
+        assert!(lazy_filter.encoded().is_some());
+
+        // Once it may have been modified, it needs to be serialised again
+        let filter = ass_file
+            .extradata
+            .nde_filter_for_event_mut(&event5)
+            .unwrap();
+        filter.name = "modified".to_owned();
+
+        let mut emitted = String::new();
+        emit(&mut emitted, &ass_file, None).unwrap();
+        assert!(!emitted.contains(&encoded));
+
+        let (parsed, _warnings) = parse::tests::parse_str(&emitted);
+        assert_matches!(parsed.extradata.nde_filter_for_event(&event5), Some(filter));
+        assert_eq!(filter.name, "modified");
+    }
+
+    #[test]
+    fn undecodable_nde_filter() {
+        // Not valid UTF-8, let alone base64
+        let value = b"1not \xFF base64".to_vec();
+        let input = format!(
+            "[Aegisub Extradata]\nData: 1,_samaku_nde_filter,u{}\n",
+            uu::encode(&value)
+        );
+        let (ass_file, _warnings) = parse::tests::parse_str(&input);
+
+        assert_matches!(
+            &ass_file.extradata[ExtradataId(1)],
+            ExtradataEntry::NdeFilter(lazy_filter)
+        );
+        assert!(lazy_filter.get().is_none());
+        assert!(lazy_filter.decode_error().is_some());
+
+        // The error is reported exactly once
+        assert_eq!(ass_file.extradata.take_decode_errors().len(), 1);
+        assert!(ass_file.extradata.take_decode_errors().is_empty());
+
+        // The original bytes are written back unchanged
+        let mut emitted = String::new();
+        emit(&mut emitted, &ass_file, None).unwrap();
+        let (parsed, _warnings) = parse::tests::parse_str(&emitted);
+        assert_matches!(
+            &parsed.extradata[ExtradataId(1)],
+            ExtradataEntry::NdeFilter(reparsed_filter)
+        );
+        assert_eq!(reparsed_filter.encoded(), Some(&value[1..]));
+    }
+
+    #[test]
+    fn deduplicated_nde_filters() {
+        let mut extradata = Extradata::new();
+        let mut events = vec![];
+
+        // Build each graph separately, so their connection maps have different iteration orders
+        for _ in 0..3 {
+            let filter = nde::Filter {
+                name: "sign".to_owned(),
+                graph: nde::Graph::from_single_intermediate(Box::new(nde::node::Italic)),
+            };
+            events.push(Event {
+                extradata_ids: vec![extradata.push_filter(filter)],
+                ..Default::default()
+            });
+        }
+
+        let ass_file = File {
+            events: EventTrack::from_vec(events),
+            extradata,
+            ..Default::default()
+        };
+        // Identical filters are shared as soon as they are added
+        assert_eq!(ass_file.extradata.filter_stats().unique, 1);
+
+        let mut emitted = String::new();
+        emit(&mut emitted, &ass_file, None).unwrap();
+
+        let (mut parsed, _warnings) = parse::tests::parse_str(&emitted);
+        assert_eq!(
+            parsed.extradata.filter_stats(),
+            FilterStats {
+                entries: 3,
+                unique: 1,
+                decoded: 0,
+            }
+        );
+
+        // Modifying one of the filters must not affect the others
+        let event0 = parsed.events[EventIndex(0)].clone();
+        let event1 = parsed.events[EventIndex(1)].clone();
+        parsed
+            .extradata
+            .nde_filter_for_event_mut(&event0)
+            .unwrap()
+            .name = "modified".to_owned();
+
+        assert_eq!(
+            parsed.extradata.nde_filter_for_event(&event0).unwrap().name,
+            "modified"
+        );
+        assert_eq!(
+            parsed.extradata.nde_filter_for_event(&event1).unwrap().name,
+            "sign"
+        );
+        assert_eq!(
+            parsed.extradata.filter_stats(),
+            FilterStats {
+                entries: 3,
+                unique: 2,
+                decoded: 2,
+            }
+        );
+
+        // The unmodified filters also share their plan
+        let event2 = parsed.events[EventIndex(2)].clone();
+        let (_, plan1) = parsed
+            .extradata
+            .nde_filter_with_plan_for_event(&event1)
+            .unwrap();
+        let (_, plan2) = parsed
+            .extradata
+            .nde_filter_with_plan_for_event(&event2)
+            .unwrap();
+        assert!(plan1.is_ok());
+        assert!(std::ptr::eq(plan1, plan2));
+    }
+
     #[test]
     fn opaque_sections_round_trip() {
         let path = test_file("test_files/opaque_sections.ass");
@@ -1074,7 +1593,7 @@ mod tests {
         };
 
         let mut extradata = Extradata::new();
-        extradata.push(ExtradataEntry::NdeFilter(filter));
+        extradata.push_filter(filter);
 
         let event = Event {
             start: StartTime(0),
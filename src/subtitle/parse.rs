@@ -13,13 +13,14 @@ use crate::{model, nde, subtitle};
 
 use super::{
     Angle, Attachment, AttachmentType, BorderStyle, Duration, Event, EventTrack, EventType,
-    Extradata, ExtradataEntry, ExtradataId, File, FontEncoding, JustifyMode, Margins, Scale,
-    ScriptInfo, StartTime, Style, StyleList, YCbCrMatrix,
+    Extradata, ExtradataEntry, ExtradataId, File, FontEncoding, JustifyMode, LazyNdeFilter,
+    Margins, Scale, ScriptInfo, StartTime, Style, StyleList, YCbCrMatrix,
 };
 
 #[allow(clippy::too_many_lines)]
 pub(super) async fn parse<R: smol::io::AsyncBufRead + Unpin>(
     input: smol::io::Lines<R>,
+    skip_events: bool,
 ) -> Result<(File, Vec<Warning>), Error> {
     let mut state = ParseState::ScriptInfo;
 
@@ -115,6 +116,10 @@ pub(super) async fn parse<R: smol::io::AsyncBufRead + Unpin>(
                 }
             }
             ParseState::Events => {
+                if skip_events {
+                    continue;
+                }
+
                 if line.starts_with("Dialogue:") || line.starts_with("Comment:") {
                     match parse_event_line(line) {
                         Ok(event) => raw_events_and_style_names.push(event),
@@ -499,10 +504,14 @@ fn parse_extradata_line(line: &str, extradata: &mut Extradata) -> Result<(), Err
             return Err(Error::InvalidExtradataValueType(value_type.to_owned()));
         };
 
-        extradata.next_id = extradata.next_id.max(ExtradataId(id_num + 1));
-        extradata
-            .entries
-            .insert(ExtradataId(id_num), parse_extradata_entry(key, value)?);
+        let id = ExtradataId(id_num);
+        match parse_extradata_entry(key, value)? {
+            ExtradataEntry::NdeFilter(filter) => extradata.insert_filter(id, filter),
+            entry => {
+                extradata.next_id = extradata.next_id.max(ExtradataId(id_num + 1));
+                extradata.entries.insert(id, entry);
+            }
+        }
     }
 
     Ok(())
@@ -512,17 +521,13 @@ fn parse_extradata_entry(key: String, value: Vec<u8>) -> Result<ExtradataEntry,
     if key == "_samaku_nde_filter" {
         let first_char = value.first().copied();
         if first_char == Some(b'1') {
-            let base64 = &value[1..];
-            let decoded = data_encoding::BASE64
-                .decode(base64)
-                .map_err(Error::NdeFilterBase64DecodeError)?;
-            let decompressed =
-                miniz_oxide::inflate::decompress_to_vec_with_limit(decoded.as_slice(), 1_000_000)
-                    .map_err(Error::NdeFilterDecompressError)?;
-            let filter = ciborium::from_reader::<nde::Filter, _>(decompressed.as_slice())
-                .map_err(|de_error| Error::NdeFilterDeserialiseError(format!("{de_error:?}")))?;
-
-            Ok(ExtradataEntry::NdeFilter(filter))
+            // Decoding is deferred until the filter is first accessed. The bytes are kept as they
+            // are, so that data which fails to decode is still written back unchanged.
+            let mut encoded = value;
+            encoded.remove(0);
+            Ok(ExtradataEntry::NdeFilter(LazyNdeFilter::from_encoded(
+                encoded,
+            )))
         } else {
             Err(Error::InvalidNdeFilterFormat(first_char))
         }
@@ -531,6 +536,22 @@ fn parse_extradata_entry(key: String, value: Vec<u8>) -> Result<ExtradataEntry,
     }
 }
 
+/// Decodes an NDE filter from the format used in `_samaku_nde_filter` extradata entries
+/// (base64-encoded, deflated CBOR), excluding the leading format identifier.
+///
+/// # Errors
+/// Errors if any of the decoding steps fails.
+pub fn decode_nde_filter(encoded: &[u8]) -> Result<nde::Filter, Error> {
+    let decoded = data_encoding::BASE64
+        .decode(encoded)
+        .map_err(Error::NdeFilterBase64DecodeError)?;
+    let decompressed =
+        miniz_oxide::inflate::decompress_to_vec_with_limit(decoded.as_slice(), 1_000_000)
+            .map_err(Error::NdeFilterDecompressError)?;
+    ciborium::from_reader::<nde::Filter, _>(decompressed.as_slice())
+        .map_err(|de_error| Error::NdeFilterDeserialiseError(format!("{de_error:?}")))
+}
+
 fn parse_attachment_header(
     line: &str,
     filename_key: &str,
@@ -1,34 +1,167 @@
-//! Use the `data_encoding` crate to provide an implementation of Aegisub's UUEncode/Decode
+//! Aegisub's variant of UUEncode, used for attachments and binary extradata values. Every 3 bytes
+//! of input are encoded as 4 characters in the range `!` to `` ` ``, each representing 6 bits. A
+//! trailing block of 1 or 2 bytes is encoded as 2 or 3 characters, respectively, without padding.
+//!
+//! Encoding and decoding work on 6 bytes/8 characters at a time, using plain 64-bit integer
+//! arithmetic to validate and (un)pack all characters of a block at once (“SIMD within a
+//! register”). Both append to an existing buffer, so that data arriving in multiple chunks can be
+//! processed without intermediate copies, as long as all chunks but the last have a length
+//! divisible by 3 (when encoding) or 4 (when decoding).
 
-use data_encoding_macro::new_encoding;
+use data_encoding::{DecodeError, DecodeKind};
 
-const UU: data_encoding::Encoding = new_encoding! {
-    symbols: r##"!"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\]^_`"##,
-    padding: None,
-};
+/// Offset of the first symbol, `!`, from zero.
+const OFFSET: u8 = 0x21;
 
+const LANES_8: u64 = 0x0101_0101_0101_0101;
+const HIGH_BITS: u64 = 0x8080_8080_8080_8080;
+
+/// Returns the number of characters `len` bytes will be encoded to.
+#[must_use]
+pub const fn encoded_len(len: usize) -> usize {
+    let trail = len % 3;
+    len / 3 * 4 + if trail == 0 { 0 } else { trail + 1 }
+}
+
+/// Returns the number of bytes `len` characters will be decoded to, if `len` is a valid length
+/// for encoded data.
+#[must_use]
+pub const fn decoded_len(len: usize) -> Option<usize> {
+    match len % 4 {
+        0 => Some(len / 4 * 3),
+        1 => None,
+        trail => Some(len / 4 * 3 + trail - 1),
+    }
+}
+
+#[must_use]
 pub fn encode(input: &[u8]) -> String {
-    // First, pad with zero bytes
-    let mut padded: Vec<u8> = vec![];
-    padded.extend_from_slice(input);
-    let remainder = padded.len() % 3;
-    if remainder != 0 {
-        padded.resize(padded.len() + 3 - remainder, 0);
+    let mut result = String::with_capacity(encoded_len(input.len()));
+    encode_into(input, &mut result);
+    result
+}
+
+/// Encodes `input` and appends the result to `output`.
+pub fn encode_into(input: &[u8], output: &mut String) {
+    output.reserve(encoded_len(input.len()));
+
+    let mut blocks = input.chunks_exact(6);
+    for block in &mut blocks {
+        push_block(output, &encode_block(block).to_le_bytes());
     }
 
-    // Encode
-    let mut result = UU.encode(&padded);
+    // Encode the remainder (at most 5 bytes) using a zero-padded block, then cut off the characters
+    // that only represent padding
+    let remainder = blocks.remainder();
+    if !remainder.is_empty() {
+        let mut padded = [0_u8; 6];
+        padded[..remainder.len()].copy_from_slice(remainder);
+        let chars = encode_block(&padded).to_le_bytes();
+        push_block(output, &chars[..encoded_len(remainder.len())]);
+    }
+}
+
+/// Appends encoded characters to `output`. They are always ASCII, so checking them is cheap.
+fn push_block(output: &mut String, chars: &[u8]) {
+    output.push_str(std::str::from_utf8(chars).expect("UU-encoded data should be ASCII"));
+}
+
+#[allow(clippy::missing_errors_doc)]
+pub fn decode(input: &str) -> Result<Vec<u8>, DecodeError> {
+    let mut result = vec![];
+    decode_into(input, &mut result)?;
+    Ok(result)
+}
 
-    // Remove trailing characters caused by the padding
-    let blocks = input.len() / 3;
-    let trail = input.len() % 3;
-    result.truncate(blocks * 4 + trail + 1);
+/// Decodes `input` and appends the result to `output`. Unlike [`decode`], this allows reusing an
+/// existing buffer.
+///
+/// # Errors
+/// Returns a `DecodeError` if `input` contains invalid characters or has an invalid length. In
+/// this case, `output` may contain partially decoded data.
+pub fn decode_into(input: &str, output: &mut Vec<u8>) -> Result<(), DecodeError> {
+    let input = input.as_bytes();
+    let Some(len) = decoded_len(input.len()) else {
+        return Err(DecodeError {
+            position: input.len(),
+            kind: DecodeKind::Length,
+        });
+    };
+    output.reserve(len);
 
-    result
+    let mut blocks = input.chunks_exact(8);
+    for (index, block) in (&mut blocks).enumerate() {
+        let bytes = decode_block(block).ok_or_else(|| symbol_error(block, index * 8))?;
+        output.extend_from_slice(&bytes);
+    }
+
+    // Decode the remainder using a block padded with the zero symbol
+    let remainder = blocks.remainder();
+    if !remainder.is_empty() {
+        let mut padded = [OFFSET; 8];
+        padded[..remainder.len()].copy_from_slice(remainder);
+        let bytes = decode_block(&padded)
+            .ok_or_else(|| symbol_error(remainder, input.len() - remainder.len()))?;
+        output.extend_from_slice(&bytes[..decoded_len(remainder.len()).unwrap_or(0)]);
+    }
+
+    Ok(())
 }
 
-pub fn decode(input: &str) -> Result<Vec<u8>, data_encoding::DecodeError> {
-    UU.decode(input.as_bytes())
+/// Encodes 6 bytes into 8 characters, returned in little endian order (so that the first
+/// character is in the lowest byte).
+fn encode_block(block: &[u8]) -> u64 {
+    // Two 24-bit groups, each in the lower bits of a 32-bit lane
+    let groups = u64::from(u32::from_be_bytes([0, block[0], block[1], block[2]]))
+        | (u64::from(u32::from_be_bytes([0, block[3], block[4], block[5]])) << 32);
+
+    // Split each group into two 12-bit halves, the first (upper) one in the lower 16-bit lane
+    let halves =
+        ((groups >> 12) & 0x0000_0fff_0000_0fff) | ((groups & 0x0000_0fff_0000_0fff) << 16);
+
+    // Split each half into two 6-bit values, the first (upper) one in the lower 8-bit lane
+    let values = ((halves >> 6) & 0x003f_003f_003f_003f) | ((halves & 0x003f_003f_003f_003f) << 8);
+
+    // No lane can overflow, as every value is less than 64
+    values + LANES_8 * u64::from(OFFSET)
+}
+
+/// Decodes 8 characters into 6 bytes. Returns `None` if any character is not a valid symbol.
+fn decode_block(block: &[u8]) -> Option<[u8; 6]> {
+    let chars = u64::from_le_bytes(block.try_into().unwrap());
+
+    // Each character needs to be at least `!` and at most `` ` ``. For ASCII characters, adding
+    // to them cannot carry into the next lane, so the range checks can be done using the top bit
+    // of each lane.
+    let ascii = chars & HIGH_BITS == 0;
+    let at_least_min =
+        chars.wrapping_add(LANES_8 * u64::from(0x80 - OFFSET)) & HIGH_BITS == HIGH_BITS;
+    let above_max = chars.wrapping_add(LANES_8 * (0x80 - 0x61)) & HIGH_BITS != 0;
+    if !ascii || !at_least_min || above_max {
+        return None;
+    }
+
+    // This is the reverse of `encode_block`
+    let values = chars - LANES_8 * u64::from(OFFSET);
+    let halves = ((values & 0x00ff_00ff_00ff_00ff) << 6) | ((values >> 8) & 0x00ff_00ff_00ff_00ff);
+    let groups =
+        ((halves & 0x0000_ffff_0000_ffff) << 12) | ((halves >> 16) & 0x0000_ffff_0000_ffff);
+
+    let [_, n1_high, n1_mid, n1_low, _, n0_high, n0_mid, n0_low] = groups.to_be_bytes();
+    Some([n0_high, n0_mid, n0_low, n1_high, n1_mid, n1_low])
+}
+
+/// Constructs the error for the first invalid character in `block`, which starts at `position`
+/// within the input.
+fn symbol_error(block: &[u8], position: usize) -> DecodeError {
+    let offset = block
+        .iter()
+        .position(|symbol| !(OFFSET..=0x60).contains(symbol))
+        .unwrap_or(0);
+    DecodeError {
+        position: position + offset,
+        kind: DecodeKind::Symbol,
+    }
 }
 
 #[cfg(test)]
@@ -56,4 +189,53 @@ mod tests {
 
         Ok(())
     }
+
+    #[test]
+    fn round_trip_all_lengths() -> Result<(), data_encoding::DecodeError> {
+        let data: Vec<u8> = (0..=255).chain((0..=255).rev()).collect();
+
+        for len in 0..data.len() {
+            let encoded = encode(&data[..len]);
+            assert_eq!(encoded.len(), encoded_len(len));
+            assert!(encoded
+                .bytes()
+                .all(|symbol| (b'!'..=b'`').contains(&symbol)));
+            assert_eq!(decode(&encoded)?, &data[..len]);
+        }
+
+        Ok(())
+    }
+
+    #[test]
+    fn chunked() -> Result<(), data_encoding::DecodeError> {
+        let data: Vec<u8> = (0..100).collect();
+
+        let mut encoded = String::new();
+        for chunk in data.chunks(60) {
+            encode_into(chunk, &mut encoded);
+        }
+        assert_eq!(encoded, encode(&data));
+
+        let mut decoded = vec![];
+        for line in encoded.as_bytes().chunks(80) {
+            decode_into(std::str::from_utf8(line).unwrap(), &mut decoded)?;
+        }
+        assert_eq!(decoded, data);
+
+        Ok(())
+    }
+
+    #[test]
+    fn invalid() {
+        let error = decode("?(F[?(Fa?(F[").unwrap_err();
+        assert_eq!(error.position, 7);
+        assert_eq!(error.kind, DecodeKind::Symbol);
+
+        let error = decode("?(F[ (").unwrap_err();
+        assert_eq!(error.position, 4);
+        assert_eq!(error.kind, DecodeKind::Symbol);
+
+        let error = decode("?(F[?").unwrap_err();
+        assert_eq!(error.kind, DecodeKind::Length);
+    }
 }
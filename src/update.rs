@@ -1,10 +1,10 @@
 //! Global update logic: update the global state ([`Samaku`] object) based on an incoming message.
 
 use smol::io::AsyncBufReadExt;
-use std::borrow::Cow;
 use std::fmt::Write;
 
 use crate::message::Message;
+use crate::subtitle::journal;
 use crate::{media, message, model, nde, pane, subtitle, view};
 
 macro_rules! active_event {
@@ -15,12 +15,9 @@ macro_rules! active_event {
             .active_event(&$global_state.selected_event_indices)
     };
 }
-macro_rules! active_event_mut {
+macro_rules! active_event_index {
     ($global_state:ident) => {
-        $global_state
-            .subtitles
-            .events
-            .active_event_mut(&$global_state.selected_event_indices)
+        subtitle::EventTrack::active_event_index(&$global_state.selected_event_indices)
     };
 }
 
@@ -35,15 +32,33 @@ macro_rules! iter_panes {
 }
 
 pub fn update(global_state: &mut super::Samaku, message: Message) -> iced::Command<Message> {
+    // The compiled events in the subtitle cache only stay valid until the subtitles are changed.
+    if message.modifies_subtitles() {
+        global_state.project_cache = None;
+        invalidate_grid_rows(global_state);
+    }
+
     // Run the internal update method, which does the actual updating of global state.
     let command = update_internal(global_state, message);
 
+    // NDE filters are only decoded once they are first accessed, which might have happened while
+    // processing the message (or while rendering the view after the previous one).
+    for error in global_state.subtitles.extradata.take_decode_errors() {
+        global_state.toast(view::toast::Toast::new(
+            view::toast::Status::Danger,
+            "Failed to decode NDE filter".to_owned(),
+            format!("{error}. The filter will be saved unchanged."),
+        ));
+    }
+
     // Check whether certain properties have been modified. If they have, we need to notify
     // our panes about this, since some of them contain copies of the data in an iced-specific
     // format, which needs to be kept in sync.
     let styles_modified = global_state.subtitles.styles.check();
     update_style_lists(global_state, styles_modified);
 
+    sync_journal(global_state);
+
     command
 }
 
@@ -138,9 +153,42 @@ fn update_internal(global_state: &mut super::Samaku, message: Message) -> iced::
         Message::VideoFileSelected(path_buf) => {
             global_state.workers.emit_load_video(path_buf);
         }
-        Message::VideoLoaded(metadata) => {
+        Message::VideoLoadProgress(stage) => {
+            if stage.is_none() {
+                global_state.video_preview = None;
+            }
+            global_state.video_load_stage = stage;
+        }
+        Message::VideoPreviewAvailable(handle) => {
+            // The load may have been cancelled in the meantime
+            if global_state.video_load_stage.is_some() {
+                global_state.video_preview = Some(handle);
+            }
+        }
+        Message::CancelVideoLoad => {
+            global_state.video_load_stage = None;
+            global_state.video_preview = None;
+            global_state.workers.emit_cancel_video_load();
+        }
+        Message::VideoLoaded(metadata, path_buf) => {
             global_state.video_metadata = Some(*metadata);
+            global_state.video_load_stage = None;
+            global_state.video_preview = None;
+            global_state.video_path = Some(path_buf.clone());
+
+            // Keyframes detected for the previous video would not match this one
+            global_state.workers.emit_cancel_keyframe_detection();
             global_state.workers.emit_playback_step();
+
+            // Only now that the video has been indexed, so the tracker and the proxy generator
+            // can reuse the index
+            global_state
+                .workers
+                .emit_load_tracking_video(path_buf.clone());
+            global_state.workers.emit_generate_proxy(path_buf);
+        }
+        Message::ProxyAvailable(source_path, proxy_path) => {
+            global_state.workers.emit_use_proxy(source_path, proxy_path);
         }
         Message::SelectAudioFile => {
             return iced::Command::perform(
@@ -189,25 +237,64 @@ fn update_internal(global_state: &mut super::Samaku, message: Message) -> iced::
                 ));
             }
 
+            // The imported subtitles do not belong to any file yet, so edits to them must not end
+            // up in the previous file's journal. Closing it keeps that file's own unsaved edits
+            // recoverable, like opening another file does.
+            global_state.journal = None;
+            global_state.subtitle_path = None;
+            global_state.project_cache = None;
+
             global_state.subtitles = subtitle::File {
                 events: opaque.to_event_track(),
                 styles: model::Trace::new(style_list),
                 script_info: opaque.script_info(),
                 ..Default::default()
-            }
+            };
         }
         Message::OpenSubtitleFile => {
             let future = async {
-                match rfd::AsyncFileDialog::new().pick_file().await {
-                    Some(handle) => match smol::fs::File::open(handle.path()).await {
-                        Ok(file) => {
-                            let lines = smol::io::BufReader::new(file).lines();
-                            subtitle::File::parse(lines).await.map(Box::new)
-                        }
-                        Err(io_err) => Err(subtitle::parse::Error::IoError(io_err)),
-                    },
-                    None => Err(subtitle::parse::Error::NoFileSelected),
-                }
+                let Some(handle) = rfd::AsyncFileDialog::new().pick_file().await else {
+                    return Err(subtitle::parse::Error::NoFileSelected);
+                };
+                let path = handle.path().to_owned();
+                let data = smol::fs::read(&path)
+                    .await
+                    .map_err(subtitle::parse::Error::IoError)?;
+                let source_hash = subtitle::cache::source_hash(&data);
+
+                // If there is a valid cache for this exact file, take the events from it, and
+                // only parse the rest of the file.
+                let cache = match subtitle::cache::Cache::open(&path, source_hash) {
+                    Ok(cache) => Some(cache),
+                    Err(subtitle::cache::Error::Io(io_err))
+                        if io_err.kind() == std::io::ErrorKind::NotFound =>
+                    {
+                        None
+                    }
+                    Err(error) => {
+                        println!("Not using subtitle cache: {error}");
+                        None
+                    }
+                };
+                let cached_events = cache.as_ref().and_then(|cache| {
+                    cache
+                        .events()
+                        .map_err(|error| println!("Not using subtitle cache: {error}"))
+                        .ok()
+                });
+
+                let lines = smol::io::BufReader::new(data.as_slice()).lines();
+                let (mut file, warnings) = match cached_events {
+                    Some(events) => {
+                        let (mut file, warnings) =
+                            subtitle::File::parse_without_events(lines).await?;
+                        file.events = events;
+                        (file, warnings)
+                    }
+                    None => subtitle::File::parse(lines).await?,
+                };
+
+                Ok((path, cache, Box::new((file, warnings))))
             };
 
             // The reason we need to block here, instead of asynchronously executing the future,
@@ -221,9 +308,50 @@ fn update_internal(global_state: &mut super::Samaku, message: Message) -> iced::
             let result = smol::block_on(future);
 
             match result {
-                Ok(file_box) => {
-                    let (ass_file, warnings) = *file_box;
+                Ok((path, cache, file_box)) => {
+                    let (mut ass_file, warnings) = *file_box;
+
+                    // Recover edits that were not saved before samaku last exited
+                    let mut recovered_edits = false;
+                    match journal::Journal::open(&path, &mut ass_file) {
+                        Ok((journal, recovered)) => {
+                            if recovered > 0 {
+                                recovered_edits = true;
+                                global_state.toast(view::toast::Toast::new(
+                                    view::toast::Status::Primary,
+                                    "Recovered unsaved edits".to_owned(),
+                                    format!("Applied {recovered} edits that were not saved in the previous session."),
+                                ));
+                            }
+                            global_state.journal = Some(journal);
+                        }
+                        Err(error) => {
+                            global_state.toast(view::toast::Toast::new(
+                                view::toast::Status::Danger,
+                                "Could not open edit journal".to_owned(),
+                                format!("Unsaved edits will not be recoverable: {error}"),
+                            ));
+                            global_state.journal = None;
+                        }
+                    }
+                    global_state.subtitle_path = Some(path.clone());
+
                     global_state.subtitles = ass_file;
+                    invalidate_grid_rows(global_state);
+
+                    if media::subtitle::add_attached_fonts(&global_state.subtitles.attachments) > 0
+                    {
+                        global_state
+                            .view
+                            .borrow_mut()
+                            .subtitle_renderer
+                            .reload_fonts();
+                    }
+
+                    // Neither the existing cache's compiled events nor a newly built cache would
+                    // match the source file if edits were recovered
+                    let rebuild_cache = cache.is_none() && !recovered_edits;
+                    global_state.project_cache = cache.filter(|_| !recovered_edits);
 
                     for warning in &warnings {
                         global_state.toast(view::toast::Toast::new(
@@ -232,6 +360,20 @@ fn update_internal(global_state: &mut super::Samaku, message: Message) -> iced::
                             format!("{warning}"),
                         ));
                     }
+
+                    if rebuild_cache {
+                        let context = cache_context(global_state);
+                        let future = async move {
+                            smol::unblock(move || subtitle::cache::rebuild(&path, context.as_ref()))
+                                .await
+                        };
+                        return iced::Command::perform(future, |result| {
+                            if let Err(error) = result {
+                                println!("Could not write subtitle cache: {error}");
+                            }
+                            Message::None
+                        });
+                    }
                 }
                 Err(err) => {
                     global_state.toast(view::toast::Toast::new(
@@ -243,21 +385,89 @@ fn update_internal(global_state: &mut super::Samaku, message: Message) -> iced::
             }
         }
         Message::SaveSubtitleFile => {
-            let mut data = String::new();
-            subtitle::emit(&mut data, &global_state.subtitles, None).unwrap();
+            let chunks = subtitle::emit_chunks(&global_state.subtitles, None).unwrap();
+            let context = cache_context(global_state);
+
+            // Edits made from here on are not part of the saved file, so the journal needs to
+            // know where they start
+            let save_mark = match &mut global_state.journal {
+                Some(journal) => match journal.begin_save(&global_state.subtitles.extradata) {
+                    Ok(save_mark) => Some(save_mark),
+                    Err(error) => {
+                        println!("Could not sync edit journal, disabling it: {error}");
+                        global_state.journal = None;
+                        None
+                    }
+                },
+                None => None,
+            };
 
             let future = async {
-                if let Some(handle) = rfd::AsyncFileDialog::new().save_file().await {
-                    smol::fs::write(handle.path(), data).await.unwrap();
+                let handle = rfd::AsyncFileDialog::new().save_file().await?;
+                let path = handle.path().to_owned();
+                let path_clone = path.clone();
+                smol::unblock(move || {
+                    subtitle::write_atomically(&path_clone, &chunks).unwrap();
+                    if let Err(error) = subtitle::cache::rebuild(&path_clone, context.as_ref()) {
+                        println!("Could not write subtitle cache: {error}");
+                    }
+                })
+                .await;
+                Some(path)
+            };
+
+            return iced::Command::perform(future, move |maybe_path| match maybe_path {
+                Some(path) => Message::SubtitleFileSaved(path, save_mark),
+                None => Message::SubtitleSaveCancelled,
+            });
+        }
+        Message::SubtitleFileSaved(path, save_mark) => {
+            // Everything in the journal up to when saving was started is part of the saved file
+            // now, so start a new one, keeping only the edits made while saving was in progress
+            let result = match (global_state.journal.take(), save_mark) {
+                (Some(mut journal), Some(save_mark)) => {
+                    journal.finish_save(&path, save_mark).map(|()| journal)
+                }
+                _ => journal::Journal::create(&path),
+            };
+            global_state.journal = match result {
+                Ok(journal) => Some(journal),
+                Err(error) => {
+                    println!("Could not create edit journal: {error}");
+                    None
                 }
             };
 
-            return iced::Command::perform(future, |()| Message::None);
+            // After saving under a new name, the original file's journal would otherwise still
+            // match it, and its edits would be recovered into it the next time it is opened
+            if let Some(old_path) = global_state.subtitle_path.replace(path.clone()) {
+                if old_path != path {
+                    if let Err(error) = journal::Journal::remove_for(&old_path) {
+                        println!("Could not remove old edit journal: {error}");
+                    }
+                }
+            }
+        }
+        Message::SubtitleSaveCancelled => {
+            if let Some(journal) = &mut global_state.journal {
+                journal.cancel_save();
+            }
+        }
+        Message::SyncJournal => sync_journal(global_state),
+        Message::CloseRequested => {
+            // Exiting normally discards unsaved edits, so there is nothing to recover later
+            if let (Some(journal), Some(path)) =
+                (global_state.journal.take(), &global_state.subtitle_path)
+            {
+                if let Err(error) = journal.remove(path) {
+                    println!("Could not remove edit journal: {error}");
+                }
+            }
+
+            return iced::window::close();
         }
         Message::ExportSubtitleFile => {
-            let mut data = String::new();
-            subtitle::emit(
-                &mut data,
+            let chunks = subtitle::emit_chunks(
                 &global_state.subtitles,
                 Some(global_state.compile_context()),
             )
@@ -273,12 +483,105 @@ fn update_internal(global_state: &mut super::Samaku, message: Message) -> iced::
 
             let future = async {
                 if let Some(handle) = rfd::AsyncFileDialog::new().save_file().await {
-                    smol::fs::write(handle.path(), data).await.unwrap();
+                    let path = handle.path().to_owned();
+                    smol::unblock(move || subtitle::write_atomically(&path, &chunks))
+                        .await
+                        .unwrap();
                 }
             };
 
             return iced::Command::perform(future, |()| Message::None);
         }
+        Message::KeyframesAvailable(keyframes) => {
+            println!("{} keyframes available", keyframes.len());
+            global_state.keyframes = keyframes;
+        }
+        Message::DetectKeyframes => match global_state.video_path {
+            Some(ref path_buf) => {
+                global_state.workers.emit_detect_keyframes(path_buf.clone());
+                global_state.toast(view::toast::Toast::new(
+                    view::toast::Status::Primary,
+                    "Detecting keyframes".to_owned(),
+                    "Scene changes are being detected in the background. This can be cancelled from the Media menu.".to_owned(),
+                ));
+            }
+            None => global_state.toast(view::toast::Toast::new(
+                view::toast::Status::Danger,
+                "No video loaded".to_owned(),
+                "Keyframes can only be detected once a video has been loaded.".to_owned(),
+            )),
+        },
+        Message::CancelKeyframeDetection => {
+            global_state.workers.emit_cancel_keyframe_detection();
+        }
+        Message::SaveKeyframes => {
+            let Some(ref video_path) = global_state.video_path else {
+                global_state.toast(view::toast::Toast::new(
+                    view::toast::Status::Danger,
+                    "No video loaded".to_owned(),
+                    "There are no keyframes to save.".to_owned(),
+                ));
+                return iced::Command::none();
+            };
+
+            // Suggest the file name Aegisub looks for, next to the video
+            let suggested_path = model::keyframes::path_for(video_path);
+            let text = global_state.keyframes.to_v1();
+            let future = async move {
+                let mut dialog = rfd::AsyncFileDialog::new();
+                if let Some(directory) = suggested_path.parent() {
+                    dialog = dialog.set_directory(directory);
+                }
+                if let Some(file_name) = suggested_path.file_name() {
+                    dialog = dialog.set_file_name(file_name.to_string_lossy());
+                }
+
+                match dialog.save_file().await {
+                    Some(handle) => smol::fs::write(handle.path(), text)
+                        .await
+                        .map_err(|error| error.to_string()),
+                    None => Ok(()),
+                }
+            };
+
+            return iced::Command::perform(
+                future,
+                Message::map_result(
+                    |()| Message::None,
+                    |error| message::toast_danger("Failed to save keyframes".to_owned(), error),
+                ),
+            );
+        }
+        Message::SnapSelectedEventsToKeyframes => {
+            if let Some(ref video_metadata) = global_state.video_metadata {
+                let frame_rate = video_metadata.frame_rate;
+                let snap_ms = |ms: i64| {
+                    frame_rate.frame_to_ms(
+                        global_state
+                            .keyframes
+                            .snap(frame_rate.ms_to_frame(ms), model::keyframes::SNAP_DISTANCE),
+                    )
+                };
+
+                let mut ops = vec![];
+                for index in &global_state.selected_event_indices {
+                    let Some(event) = global_state.subtitles.events.as_slice().get(index.0) else {
+                        continue;
+                    };
+
+                    let start = snap_ms(event.start.0);
+                    let end = snap_ms(event.end().0);
+                    if end > start {
+                        ops.push(journal::Op::SetEventStart(index.0, start));
+                        ops.push(journal::Op::SetEventDuration(index.0, end - start));
+                    }
+                }
+
+                for op in &ops {
+                    apply_edit(global_state, op);
+                }
+            }
+        }
         Message::VideoFrameAvailable(new_frame, handle) => {
             global_state.actual_frame = Some((new_frame, handle));
         }
@@ -313,6 +616,32 @@ fn update_internal(global_state: &mut super::Samaku, message: Message) -> iced::
         Message::Playing(playing) => {
             global_state.playing = playing;
         }
+        Message::SetPlaybackSpeed(speed) => set_playback_speed(global_state, speed),
+        Message::StepPlaybackSpeed(steps) => {
+            const PRESETS: [u32; 8] = [250, 375, 500, 750, 1000, 1250, 1500, 2000];
+            let current = global_state.shared.playback_position.speed();
+            let index = PRESETS
+                .iter()
+                .position(|&preset| preset >= current)
+                .unwrap_or(PRESETS.len() - 1);
+            let new_index = index
+                .saturating_add_signed(isize::try_from(steps).unwrap_or(0))
+                .min(PRESETS.len() - 1);
+            set_playback_speed(global_state, PRESETS[new_index]);
+        }
+        Message::PlaySelection => play_selection(global_state, false),
+        Message::LoopSelection => {
+            let playback_position = &global_state.shared.playback_position;
+            if playback_position.range().is_some_and(|range| range.repeat) {
+                playback_position.set_range(None);
+            } else {
+                play_selection(global_state, true);
+            }
+        }
+        Message::PlaybackRangeEnded => {
+            global_state.workers.emit_pause();
+            global_state.shared.playback_position.set_range(None);
+        }
         Message::CreateStyle => {
             let mut counter = 1;
             let mut name = format!("New style {counter}");
@@ -323,53 +652,39 @@ fn update_internal(global_state: &mut super::Samaku, message: Message) -> iced::
                 write!(name, "{counter}").unwrap();
             }
 
-            let new_style = subtitle::Style {
-                name,
-                ..Default::default()
-            };
-            global_state.subtitles.styles.insert(new_style);
+            apply_edit(global_state, &journal::Op::CreateStyle(name));
         }
         Message::DeleteStyle(index) => {
-            global_state.subtitles.styles.remove(index);
-
-            // Update style references in events: assign the default style to all events that had
-            // the removed style assigned, and decrement style indices of applicable events (with
-            // existing style indices > the removed index)
-            for event in &mut global_state.subtitles.events {
-                match event.style_index.cmp(&index) {
-                    std::cmp::Ordering::Less => {}
-                    std::cmp::Ordering::Equal => event.style_index = 0,
-                    std::cmp::Ordering::Greater => event.style_index -= 1,
-                }
-            }
+            // This also updates style references in events
+            apply_edit(global_state, &journal::Op::DeleteStyle(index));
         }
         Message::SetStyleBold(index, value) => {
-            global_state.subtitles.styles[index].bold = value;
+            apply_edit(global_state, &journal::Op::SetStyleBold(index, value));
         }
         Message::AddEvent => {
-            let new_event = subtitle::Event {
-                start: subtitle::StartTime(0),
-                duration: subtitle::Duration(5000),
-                layer_index: 0,
-                style_index: 0,
-                margins: subtitle::Margins {
-                    left: 50,
-                    right: 50,
-                    vertical: 50,
-                },
-                text: Cow::Owned("Sphinx of black quartz, judge my vow".to_owned()),
-                actor: Cow::Owned(String::new()),
-                effect: Cow::Owned(String::new()),
-                event_type: subtitle::EventType::Dialogue,
-                extradata_ids: vec![],
-            };
-            global_state.subtitles.events.push(new_event);
+            apply_edit(global_state, &journal::Op::AddEvent);
+
+            // Show the new event, which is always added at the end
+            let new_index = subtitle::EventIndex(global_state.subtitles.events.len() - 1);
+            let mut commands = vec![];
+            iter_panes!(
+                global_state,
+                pane::State::Grid(grid_state),
+                commands.push(grid_state.scroll_to(new_index))
+            );
+            return iced::Command::batch(commands);
         }
         Message::DeleteSelectedEvents => {
-            global_state
-                .subtitles
-                .events
-                .remove_from_set(&mut global_state.selected_event_indices);
+            let mut indices: Vec<usize> = global_state
+                .selected_event_indices
+                .iter()
+                .map(|index| index.0)
+                .collect();
+            indices.sort_unstable();
+
+            // The selected indices are no longer valid after deletion
+            global_state.selected_event_indices.clear();
+            apply_edit(global_state, &journal::Op::DeleteEvents(indices));
         }
         Message::ToggleEventSelection(index) => {
             if global_state.selected_event_indices.contains(&index) {
@@ -379,62 +694,100 @@ fn update_internal(global_state: &mut super::Samaku, message: Message) -> iced::
             }
         }
         Message::SetActiveEventText(new_text) => {
-            if let Some(event) = active_event_mut!(global_state) {
-                event.text = Cow::Owned(new_text);
+            if let Some(index) = active_event_index!(global_state) {
+                apply_edit(global_state, &journal::Op::SetEventText(index.0, new_text));
             }
         }
         Message::SetActiveEventActor(new_actor) => {
-            if let Some(event) = active_event_mut!(global_state) {
-                event.actor = Cow::Owned(new_actor);
+            if let Some(index) = active_event_index!(global_state) {
+                apply_edit(
+                    global_state,
+                    &journal::Op::SetEventActor(index.0, new_actor),
+                );
             }
         }
         Message::SetActiveEventEffect(new_effect) => {
-            if let Some(event) = active_event_mut!(global_state) {
-                event.effect = Cow::Owned(new_effect);
+            if let Some(index) = active_event_index!(global_state) {
+                apply_edit(
+                    global_state,
+                    &journal::Op::SetEventEffect(index.0, new_effect),
+                );
             }
         }
         Message::SetActiveEventStartTime(new_start_time) => {
-            if let Some(event) = active_event_mut!(global_state) {
-                event.start = new_start_time;
+            if let Some(index) = active_event_index!(global_state) {
+                apply_edit(
+                    global_state,
+                    &journal::Op::SetEventStart(index.0, new_start_time.0),
+                );
             }
         }
         Message::SetActiveEventDuration(new_duration) => {
-            if let Some(event) = active_event_mut!(global_state) {
-                event.duration = new_duration;
+            if let Some(index) = active_event_index!(global_state) {
+                apply_edit(
+                    global_state,
+                    &journal::Op::SetEventDuration(index.0, new_duration.0),
+                );
             }
         }
         Message::SetActiveEventStyleIndex(new_style_index) => {
-            if let Some(event) = active_event_mut!(global_state) {
-                event.style_index = new_style_index;
+            if let Some(index) = active_event_index!(global_state) {
+                apply_edit(
+                    global_state,
+                    &journal::Op::SetEventStyleIndex(index.0, new_style_index),
+                );
             }
         }
         Message::SetActiveEventLayerIndex(new_layer_index) => {
-            if let Some(event) = active_event_mut!(global_state) {
-                event.layer_index = new_layer_index;
+            if let Some(index) = active_event_index!(global_state) {
+                apply_edit(
+                    global_state,
+                    &journal::Op::SetEventLayerIndex(index.0, new_layer_index),
+                );
             }
         }
         Message::SetActiveEventType(new_type) => {
-            if let Some(event) = active_event_mut!(global_state) {
-                event.event_type = new_type;
+            if let Some(index) = active_event_index!(global_state) {
+                apply_edit(global_state, &journal::Op::SetEventType(index.0, new_type));
             }
         }
         Message::CreateEmptyFilter => {
-            global_state.subtitles.extradata.push_filter(nde::Filter {
+            let id = global_state.subtitles.extradata.push_filter(nde::Filter {
                 name: String::new(),
                 graph: nde::graph::Graph::identity(),
             });
+
+            // The filter is recorded right away rather than on the next sync, as events might
+            // have it assigned before then, and the journal must not refer to it before it exists
+            if let Some(op) = journal::Op::set_filter(&global_state.subtitles.extradata, id) {
+                record_edit(&mut global_state.journal, &op);
+            }
             update_filter_lists(global_state);
         }
         Message::AssignFilterToSelectedEvents(filter_index) => {
             for selected_event_index in &global_state.selected_event_indices {
-                global_state.subtitles.events[*selected_event_index]
-                    .assign_nde_filter(filter_index, &global_state.subtitles.extradata);
+                let event = &mut global_state.subtitles.events[*selected_event_index];
+                event.assign_nde_filter(filter_index, &global_state.subtitles.extradata);
+                record_edit(
+                    &mut global_state.journal,
+                    &journal::Op::SetEventExtradataIds(
+                        selected_event_index.0,
+                        event.extradata_ids.clone(),
+                    ),
+                );
             }
         }
         Message::UnassignFilterFromSelectedEvents => {
             for selected_event_index in &global_state.selected_event_indices {
-                global_state.subtitles.events[*selected_event_index]
-                    .unassign_nde_filter(&global_state.subtitles.extradata);
+                let event = &mut global_state.subtitles.events[*selected_event_index];
+                event.unassign_nde_filter(&global_state.subtitles.extradata);
+                record_edit(
+                    &mut global_state.journal,
+                    &journal::Op::SetEventExtradataIds(
+                        selected_event_index.0,
+                        event.extradata_ids.clone(),
+                    ),
+                );
             }
         }
         Message::SetActiveFilterName(new_name) => {
@@ -443,18 +796,14 @@ fn update_internal(global_state: &mut super::Samaku, message: Message) -> iced::
                 &mut global_state.subtitles.extradata,
             ) {
                 filter.name = new_name;
+                mark_active_filter_dirty(global_state);
                 update_filter_lists(global_state);
             }
         }
         Message::DeleteFilter(filter_index) => {
-            // Unassign filters from events that might have it assigned
-            for event in &mut global_state.subtitles.events {
-                event.extradata_ids.retain(|id| *id != filter_index);
-            }
-
-            // Remove the filter itself
-            global_state.subtitles.extradata.remove(filter_index);
-
+            // Unassigns the filter from events that might have it assigned, and removes the
+            // filter itself
+            apply_edit(global_state, &journal::Op::DeleteFilter(filter_index));
             update_filter_lists(global_state);
         }
         Message::AddNode(node_constructor) => {
@@ -468,6 +817,7 @@ fn update_internal(global_state: &mut super::Samaku, message: Message) -> iced::
                 };
                 filter.graph.nodes.push(visual_node);
             }
+            mark_active_filter_dirty(global_state);
         }
         Message::MoveNode(node_index, x, y) => {
             if let Some(filter) = global_state.subtitles.events.active_nde_filter_mut(
@@ -477,6 +827,7 @@ fn update_internal(global_state: &mut super::Samaku, message: Message) -> iced::
                 let node = &mut filter.graph.nodes[node_index];
                 node.position = iced::Point::new(node.position.x + x, node.position.y + y);
             }
+            mark_active_filter_dirty(global_state);
         }
         Message::ConnectNodes(link) => {
             if let Some(filter) = global_state.subtitles.events.active_nde_filter_mut(
@@ -495,6 +846,7 @@ fn update_internal(global_state: &mut super::Samaku, message: Message) -> iced::
                     },
                 );
             }
+            mark_active_filter_dirty(global_state);
         }
         Message::DisconnectNodes(endpoint, new_dangling_end_position, source_pane) => {
             if let Some(filter) = global_state.subtitles.events.active_nde_filter_mut(
@@ -524,6 +876,7 @@ fn update_internal(global_state: &mut super::Samaku, message: Message) -> iced::
                     }
                 }
             }
+            mark_active_filter_dirty(global_state);
         }
         Message::SetReticules(reticules) => {
             global_state.reticules = Some(reticules);
@@ -539,22 +892,23 @@ fn update_internal(global_state: &mut super::Samaku, message: Message) -> iced::
                     }
                 }
             }
+            mark_active_filter_dirty(global_state);
         }
-        Message::TrackMotionForNode(node_index, initial_region) => {
-            if let Some(video_metadata) = global_state.video_metadata {
-                let current_frame = global_state.current_frame().unwrap(); // video is loaded
-
-                // Update the node's cached track to put the marker it requested at the
-                // position of the current frame.
-                // The node can't do this itglobal_state, because it does not know the number of
-                // the current frame.
+        Message::AddMotionTrackKeyframe(node_index, regions) => {
+            // The node can't do this itself, because it does not know the number of the current
+            // frame
+            if let Some(current_frame) = global_state.current_frame() {
                 global_state.subtitles.events.update_node(
                     &global_state.selected_event_indices,
                     &mut global_state.subtitles.extradata,
                     node_index,
-                    message::Node::MotionTrackUpdate(current_frame, initial_region),
+                    message::Node::MotionTrackKeyframe(current_frame, regions),
                 );
-
+            }
+            mark_active_filter_dirty(global_state);
+        }
+        Message::TrackMotionForNode(node_index, keyframes) => {
+            if let Some(ref video_metadata) = global_state.video_metadata {
                 if let Some(event) = global_state
                     .subtitles
                     .events
@@ -562,13 +916,16 @@ fn update_internal(global_state: &mut super::Samaku, message: Message) -> iced::
                 {
                     global_state.workers.emit_track_motion_for_node(
                         node_index,
-                        initial_region,
-                        current_frame,
+                        keyframes,
+                        video_metadata.frame_rate.ms_to_frame(event.start.0),
                         video_metadata.frame_rate.ms_to_frame(event.end().0),
                     );
                 }
             }
         }
+        Message::CancelMotionTracking => {
+            global_state.workers.emit_cancel_motion_tracking();
+        }
         Message::Node(node_index, node_message) => {
             global_state.subtitles.events.update_node(
                 &global_state.selected_event_indices,
@@ -576,12 +933,118 @@ fn update_internal(global_state: &mut super::Samaku, message: Message) -> iced::
                 node_index,
                 node_message,
             );
+            mark_active_filter_dirty(global_state);
         }
     }
 
     iced::Command::none()
 }
 
+fn set_playback_speed(global_state: &super::Samaku, speed: u32) {
+    let playback_position = &global_state.shared.playback_position;
+    playback_position.set_speed(speed);
+    println!("Playback speed: {}%", playback_position.speed() / 10);
+    global_state.workers.emit_playback_step();
+}
+
+/// Restricts playback to the time span covered by the selected events and starts playing it,
+/// while having the video decoder prepare the frames within that span.
+fn play_selection(global_state: &super::Samaku, repeat: bool) {
+    let Some((start, end)) = global_state
+        .selected_event_indices
+        .iter()
+        .map(|index| {
+            let event = &global_state.subtitles.events[*index];
+            (event.start.0, event.end().0)
+        })
+        .reduce(|(start, end), (event_start, event_end)| {
+            (start.min(event_start), end.max(event_end))
+        })
+    else {
+        return;
+    };
+
+    let playback_position = &global_state.shared.playback_position;
+    playback_position.set_range(Some(model::playback::Range {
+        start: playback_position.ticks_from_ms(start),
+        end: playback_position.ticks_from_ms(end),
+        repeat,
+    }));
+
+    if let Some(video_metadata) = &global_state.video_metadata {
+        let frame_rate = video_metadata.frame_rate;
+        global_state
+            .workers
+            .emit_warm_frames(frame_rate.ms_to_frame(start), frame_rate.ms_to_frame(end));
+    }
+
+    global_state.workers.emit_playback_step();
+    if !global_state.playing {
+        global_state.workers.emit_play();
+    }
+}
+
+/// Applies an edit to the subtitles, and records it in the edit journal if one is open.
+fn apply_edit(global_state: &mut super::Samaku, op: &journal::Op) {
+    if let Err(error) = op.apply(&mut global_state.subtitles) {
+        println!("Could not apply edit {op:?}: {error}");
+        return;
+    }
+
+    record_edit(&mut global_state.journal, op);
+}
+
+/// Records an already applied edit in the edit journal, if one is open. If writing to the journal
+/// fails, journalling is stopped (until the file is saved again), as further records would be
+/// meaningless without the failed one.
+fn record_edit(maybe_journal: &mut Option<journal::Journal>, op: &journal::Op) {
+    if let Some(journal) = maybe_journal.as_mut() {
+        if let Err(error) = journal.record(op) {
+            println!("Could not write to edit journal, disabling it: {error}");
+            *maybe_journal = None;
+        }
+    }
+}
+
+/// Marks the NDE filter of the active event as modified in the edit journal, if one is open.
+fn mark_active_filter_dirty(global_state: &mut super::Samaku) {
+    if let Some(journal) = &mut global_state.journal {
+        if let Some(id) = global_state
+            .subtitles
+            .events
+            .active_event(&global_state.selected_event_indices)
+            .and_then(|event| {
+                global_state
+                    .subtitles
+                    .extradata
+                    .nde_filter_id_for_event(event)
+            })
+        {
+            journal.mark_filter_dirty(id);
+        }
+    }
+}
+
+/// Syncs the edit journal to disk, if one is open and syncing is due.
+fn sync_journal(global_state: &mut super::Samaku) {
+    if let Some(journal) = &mut global_state.journal {
+        if let Err(error) = journal.sync_if_due(&global_state.subtitles.extradata) {
+            println!("Could not sync edit journal, disabling it: {error}");
+            global_state.journal = None;
+        }
+    }
+}
+
+/// Returns the context that events should be compiled with for the subtitle cache. Compiled events
+/// are only included if a video is loaded, as otherwise the frame rate they would be compiled for
+/// is merely a guess.
+fn cache_context(global_state: &super::Samaku) -> Option<subtitle::compile::Context> {
+    global_state
+        .video_metadata
+        .is_some()
+        .then(|| global_state.compile_context())
+}
+
 /// Notifies all entities (like node editor panes) that keep some internal copy of the
 /// NDE filter list to update their internal representations
 fn update_filter_lists(global_state: &mut super::Samaku) {
@@ -592,6 +1055,17 @@ fn update_filter_lists(global_state: &mut super::Samaku) {
     );
 }
 
+/// Discards the cell contents cached by all grid panes. Must be called whenever the subtitles
+/// might have changed; messages that report this through [`Message::modifies_subtitles`] are
+/// handled automatically.
+fn invalidate_grid_rows(global_state: &mut super::Samaku) {
+    iter_panes!(
+        global_state,
+        pane::State::Grid(grid_state),
+        grid_state.invalidate_rows()
+    );
+}
+
 /// Notifies all entities (like text editor panes) that keep some internal copy of the
 /// styles list to update their internal representations. If `copy_styles` is false, only the
 /// selected style will be updated.
@@ -27,6 +27,7 @@ where
     R: image::Renderer<Handle = H> + canvas::Renderer,
 {
     images: Vec<StackedImage<H>>,
+    base_size: Option<Size<u32>>,
     width: Length,
     height: Length,
     content_fit: ContentFit,
@@ -44,6 +45,7 @@ where
     pub fn new<T: Into<Vec<StackedImage<H>>>>(images: T, program: P) -> Self {
         ImageStack {
             images: images.into(),
+            base_size: None,
             width: Length::Shrink,
             height: Length::Shrink,
             content_fit: ContentFit::Contain,
@@ -53,6 +55,15 @@ where
         }
     }
 
+    /// Sets the size the first image is displayed at, which otherwise is its own size. The other
+    /// images are positioned relative to this size, so that a lower-resolution first image can
+    /// stand in for a full-size one.
+    #[must_use]
+    pub fn base_size(mut self, size: Size<u32>) -> Self {
+        self.base_size = Some(size);
+        self
+    }
+
     /// Sets the width of the [`ImageStack`] boundaries.
     #[must_use]
     pub fn set_stack_width(mut self, width: impl Into<Length>) -> Self {
@@ -84,6 +95,7 @@ pub fn layout<R, H>(
     renderer: &R,
     limits: &layout::Limits,
     images: &[StackedImage<H>],
+    base_size: Option<Size<u32>>,
     width: Length,
     height: Length,
     content_fit: ContentFit,
@@ -93,7 +105,8 @@ where
 {
     // The raw w/h of the first image
     let image_size = {
-        let Size { width, height } = renderer.dimensions(&images[0].handle);
+        let Size { width, height } =
+            base_size.unwrap_or_else(|| renderer.dimensions(&images[0].handle));
 
         #[allow(clippy::cast_precision_loss)]
         Size::new(width as f32, height as f32)
@@ -125,13 +138,15 @@ pub fn draw<R, H>(
     renderer: &mut R,
     layout: Layout<'_>,
     images: &[StackedImage<H>],
+    base_size: Option<Size<u32>>,
     content_fit: ContentFit,
 ) where
     R: image::Renderer<Handle = H>,
     H: Clone + Hash,
 {
     // Find out maximum size (assuming the first image covers the entire area)
-    let Size { width, height } = renderer.dimensions(&images[0].handle);
+    let Size { width, height } =
+        base_size.unwrap_or_else(|| renderer.dimensions(&images[0].handle));
     #[allow(clippy::cast_precision_loss)]
     let overall_size = Size::new(width as f32, height as f32);
 
@@ -144,8 +159,12 @@ pub fn draw<R, H>(
     // Preprocess images
     let to_draw: Vec<(&StackedImage<H>, Rectangle)> = images
         .iter()
-        .map(|image| {
-            let Size { width, height } = renderer.dimensions(&image.handle);
+        .enumerate()
+        .map(|(index, image)| {
+            let Size { width, height } = match base_size {
+                Some(base_size) if index == 0 => base_size,
+                _ => renderer.dimensions(&image.handle),
+            };
 
             let center_offset = Vector::new(
                 (bounds.width - overall_adjusted_fit.width).max(0.0) / 2.0,
@@ -199,6 +218,7 @@ where
             renderer,
             limits,
             &self.images,
+            self.base_size,
             self.width,
             self.height,
             self.content_fit,
@@ -215,7 +235,13 @@ where
         cursor: mouse::Cursor,
         _viewport: &Rectangle,
     ) {
-        draw(renderer, layout, &self.images, self.content_fit);
+        draw(
+            renderer,
+            layout,
+            &self.images,
+            self.base_size,
+            self.content_fit,
+        );
 
         let bounds = layout.bounds();
 
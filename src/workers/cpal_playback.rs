@@ -1,11 +1,24 @@
 use std::{
-    mem::size_of,
     sync::{atomic, Arc, Mutex},
     thread,
+    time::Duration,
 };
 
 use crate::{media, message, model};
 
+/// Number of frames decoded and converted at a time.
+const DECODE_CHUNK_FRAMES: u64 = 2048;
+
+/// How much converted audio the decode thread tries to keep queued for the callback.
+const QUEUE_MILLIS: u64 = 200;
+
+/// How much audio to decode into memory before and after a playback range, so that the range can
+/// be moved slightly without having to decode it again.
+const LOOP_BUFFER_PADDING_MILLIS: u64 = 500;
+
+/// Playback ranges longer than this are streamed from the source on every repetition.
+const MAX_LOOP_BUFFER_SECONDS: u64 = 120;
+
 #[derive(Debug, Clone)]
 pub enum MessageIn {
     TryRestart,
@@ -13,11 +26,201 @@ pub enum MessageIn {
     Pause,
 }
 
+/// Audio that has been decoded and converted into the output format, on its way from the decode
+/// thread to the audio callback. Interleaved samples are kept in the output channel layout and
+/// sample rate, already stretched according to the playback speed.
+///
+/// This is a single-producer, single-consumer ring buffer that neither side ever has to wait for,
+/// as the callback runs on a real-time thread, where waiting for a lock can cause audible
+/// dropouts. Samples are stored as their bit patterns in atomics, so no `unsafe` is needed.
+///
+/// Audio is written in segments, one for every seek. Starting a new segment makes everything
+/// written before it obsolete; the consumer skips over it once it notices the new segment.
+struct Ring {
+    samples: Box<[atomic::AtomicU32]>,
+
+    /// Total number of samples written so far. Only stored to by the producer.
+    write: atomic::AtomicU64,
+
+    /// Total number of samples read or skipped so far. Only stored to by the consumer.
+    read: atomic::AtomicU64,
+
+    /// The current segment, see [`Segment`].
+    segment: atomic::AtomicU64,
+}
+
+impl Ring {
+    fn new(min_capacity: usize) -> Self {
+        Self {
+            samples: (0..min_capacity.next_power_of_two())
+                .map(|_| atomic::AtomicU32::new(0))
+                .collect(),
+            write: atomic::AtomicU64::new(0),
+            read: atomic::AtomicU64::new(0),
+            segment: atomic::AtomicU64::new(Segment::NONE),
+        }
+    }
+
+    fn slot(&self, index: u64) -> &atomic::AtomicU32 {
+        #[allow(clippy::cast_possible_truncation)] // the length is a power of two
+        let mask = (self.samples.len() - 1) as u64;
+        #[allow(clippy::cast_possible_truncation)]
+        &self.samples[(index & mask) as usize]
+    }
+}
+
+/// A segment of the ring buffer, packed into a `u64` so that it can be published atomically: the
+/// seek epoch its audio was decoded for in the lower 16 bits, a bit that is set for any valid
+/// segment, and the `write` index its first sample was written at in the remaining upper bits.
+struct Segment;
+
+impl Segment {
+    const NONE: u64 = 0;
+
+    fn pack(start: u64, epoch: u16) -> u64 {
+        (start << 17) | (1 << 16) | u64::from(epoch)
+    }
+
+    fn start(packed: u64) -> u64 {
+        packed >> 17
+    }
+
+    fn epoch(packed: u64) -> Option<u16> {
+        #[allow(clippy::cast_possible_truncation)]
+        (packed != Self::NONE).then_some(packed as u16)
+    }
+}
+
+/// The decode thread's end of a [`Ring`].
+struct Producer {
+    ring: Arc<Ring>,
+    write: u64,
+    segment_start: u64,
+}
+
+impl Producer {
+    /// Starts a new segment for audio decoded for the given seek epoch.
+    fn start_segment(&mut self, epoch: u16) {
+        self.segment_start = self.write;
+        self.ring
+            .segment
+            .store(Segment::pack(self.write, epoch), atomic::Ordering::Release);
+    }
+
+    /// Returns the number of samples of the current segment that have not been read yet.
+    fn queued(&self) -> usize {
+        let read = self.ring.read.load(atomic::Ordering::Acquire);
+        usize::try_from(self.write - read.max(self.segment_start)).unwrap_or(usize::MAX)
+    }
+
+    /// Appends as many of the given samples as fit, and returns how many that were.
+    fn push(&mut self, samples: &[f32]) -> usize {
+        let read = self.ring.read.load(atomic::Ordering::Acquire);
+        let free = self.ring.samples.len() - usize::try_from(self.write - read).unwrap_or(0);
+        let count = samples.len().min(free);
+
+        for (index, sample) in (self.write..).zip(&samples[..count]) {
+            self.ring
+                .slot(index)
+                .store(sample.to_bits(), atomic::Ordering::Relaxed);
+        }
+
+        self.write += count as u64;
+        self.ring.write.store(self.write, atomic::Ordering::Release);
+        count
+    }
+}
+
+/// The audio callback's end of a [`Ring`]. Also keeps the state of the callback that has to
+/// persist between calls.
+struct Consumer {
+    ring: Arc<Ring>,
+    read: u64,
+    segment: u64,
+
+    /// Fraction of a tick, in thousandths, that the position has not been advanced by yet
+    /// because of the playback speed.
+    tick_remainder: u64,
+
+    /// The decode thread, to be woken up once it might have something to do.
+    decoder: thread::Thread,
+}
+
+impl Consumer {
+    /// Returns the number of samples that are available for the given seek epoch, skipping
+    /// obsolete segments. Returns `None` if nothing has been decoded for this epoch yet.
+    fn available(&mut self, epoch: u16) -> Option<usize> {
+        // The segment has to be read again after the write index, in case a new one has been
+        // started in between, which the samples up to the write index might belong to
+        let (segment, write) = loop {
+            let segment = self.ring.segment.load(atomic::Ordering::Acquire);
+            let write = self.ring.write.load(atomic::Ordering::Acquire);
+            if self.ring.segment.load(atomic::Ordering::Acquire) == segment {
+                break (segment, write);
+            }
+        };
+
+        if segment != self.segment {
+            self.segment = segment;
+            self.read = self.read.max(Segment::start(segment));
+            self.ring.read.store(self.read, atomic::Ordering::Release);
+            self.tick_remainder = 0;
+        }
+
+        (Segment::epoch(segment) == Some(epoch))
+            .then(|| usize::try_from(write - self.read).unwrap_or(usize::MAX))
+    }
+
+    /// Converts the next `output.len()` samples into `output`. They must be available.
+    fn pop<T: cpal::FromSample<f32>>(&mut self, output: &mut [T]) {
+        for (index, out) in (self.read..).zip(output.iter_mut()) {
+            let bits = self.ring.slot(index).load(atomic::Ordering::Relaxed);
+            *out = T::from_sample(f32::from_bits(bits));
+        }
+
+        self.read += output.len() as u64;
+        self.ring.read.store(self.read, atomic::Ordering::Release);
+    }
+
+    /// Lets the decode thread check whether it needs to decode more audio.
+    fn wake_decoder(&self) {
+        self.decoder.unpark();
+    }
+}
+
+/// Thread that decodes audio ahead of the playback position and converts it, so that the audio
+/// callback only has to copy samples. It sleeps while enough audio is queued, until the callback
+/// has played some of it or [`Decoder::wake`] is called. Stopped and joined when dropped.
+struct Decoder {
+    stop: Arc<atomic::AtomicBool>,
+    handle: Option<thread::JoinHandle<()>>,
+}
+
+impl Decoder {
+    /// Lets the decode thread check whether there has been a seek. The callback does this while
+    /// playing, but seeks while paused would otherwise only be noticed once playback resumes.
+    fn wake(&self) {
+        if let Some(handle) = &self.handle {
+            handle.thread().unpark();
+        }
+    }
+}
+
+impl Drop for Decoder {
+    fn drop(&mut self) {
+        self.stop.store(true, atomic::Ordering::Relaxed);
+        if let Some(handle) = self.handle.take() {
+            handle.thread().unpark();
+            handle.join().expect("audio decode thread panicked");
+        }
+    }
+}
+
 pub fn spawn(
     tx_out: super::GlobalSender,
     shared_state: &crate::SharedState,
 ) -> super::Worker<MessageIn> {
-    use cpal::traits::{DeviceTrait, HostTrait};
+    use cpal::traits::HostTrait;
 
     let (tx_in, rx_in) = std::sync::mpsc::channel::<MessageIn>();
 
@@ -28,6 +231,7 @@ pub fn spawn(
     let handle = thread::Builder::new().name("samaku_cpal_playback".to_owned()).spawn(move || {
         use cpal::traits::StreamTrait;
         let mut stream_opt: Option<cpal::Stream> = None;
+        let mut decoder_opt: Option<Decoder> = None;
 
         loop {
             match rx_in.recv() {
@@ -36,6 +240,8 @@ pub fn spawn(
                         // This drops the existing stream, which is supposedly guaranteed to
                         // close it (https://github.com/RustAudio/cpal/issues/652)
                         stream_opt = None;
+                        decoder_opt = None;
+                        playback_position.mark_idle();
 
                         let audio_properties = {
                             let audio_lock = audio_mutex.lock().unwrap();
@@ -46,49 +252,63 @@ pub fn spawn(
                             }
                         };
 
-                        // Find the cpal sample format that matches the audio properties
-                        let sample_format = sample_format_for_audio_properties(&audio_properties);
+                        let host = cpal::default_host();
+                        let Some(device) = host.default_output_device() else {
+                            println!("No audio output device available");
+                            continue;
+                        };
+                        let Some(config) = choose_config(&device, &audio_properties) else {
+                            continue;
+                        };
 
-                        let mut config_opt: Option<cpal::SupportedStreamConfig> = None;
+                        let Some(converter) = media::dsp::Converter::new(
+                            &audio_properties,
+                            config.channels(),
+                            config.sample_rate().0,
+                        ) else {
+                            println!("Unsupported audio sample format: {audio_properties:?}");
+                            continue;
+                        };
 
-                        let host = cpal::default_host();
-                        let device = host
-                            .default_output_device()
-                            .expect("No audio output device available");
-
-                        // Try to find a cpal playback config that matches the audio_properties
-                        for supported_config in device
-                            .supported_output_configs()
-                            .expect("Error while querying audio output configurations")
+                        if audio_properties.sample_rate != config.sample_rate().0
+                            || audio_properties.channels != u32::from(config.channels())
                         {
-                            if audio_properties.channels == u32::from(supported_config.channels())
-                                && audio_properties.sample_rate
-                                >= supported_config.min_sample_rate().0
-                                && audio_properties.sample_rate
-                                <= supported_config.max_sample_rate().0
-                                && sample_format == supported_config.sample_format()
-                            {
-                                config_opt =
-                                    Some(supported_config.with_sample_rate(cpal::SampleRate(
-                                        audio_properties.sample_rate,
-                                    )));
-                            }
+                            println!(
+                                "Converting audio from {} Hz/{} channels to {} Hz/{} channels for playback",
+                                audio_properties.sample_rate,
+                                audio_properties.channels,
+                                config.sample_rate().0,
+                                config.channels()
+                            );
                         }
 
-                        let config = config_opt.expect(
-                            "Could not find a suitable system audio configuration that matches the loaded audio file",
-                        );
+                        // The playback position counts frames at the output rate, which is what
+                        // the audio callback advances it by. Any playback range would refer to
+                        // the old rate, so it is lifted.
+                        playback_position.set_range(None);
+                        let seconds = playback_position.seconds();
+                        playback_position.set_rate(config.sample_rate().0);
+                        playback_position.add_seconds(seconds - playback_position.seconds());
 
-                        playback_position
-                            .rate
-                            .store(audio_properties.sample_rate, atomic::Ordering::Relaxed);
+                        let (decoder, consumer) = spawn_decoder(
+                            converter,
+                            audio_properties,
+                            config.channels(),
+                            config.sample_rate().0,
+                            Arc::clone(&audio_mutex),
+                            Arc::clone(&playback_position),
+                        );
+                        decoder_opt = Some(decoder);
 
-                        if let Some(stream) = try_build_stream(sample_format, &device, config, Arc::clone(&audio_mutex), Arc::clone(&playing), Arc::clone(&playback_position), tx_out.clone()) {
+                        if let Some(stream) = try_build_stream(&device, &config, consumer, &playing, &playback_position, &tx_out) {
                             stream_opt = Some(stream);
                         }
                     }
                     self::MessageIn::Play => {
                         if let Some(ref stream) = stream_opt {
+                            if let Some(ref decoder) = decoder_opt {
+                                decoder.wake();
+                            }
                             playing.store(true, atomic::Ordering::Relaxed);
                             tx_out.unbounded_send(message::Message::Playing(true)).expect("Failed to send playing message");
                             stream.play().expect("Failed to play audio stream");
@@ -97,6 +317,7 @@ pub fn spawn(
                     self::MessageIn::Pause => {
                         if let Some(ref stream) = stream_opt {
                             playing.store(false, atomic::Ordering::Relaxed);
+                            playback_position.mark_idle();
                             tx_out.unbounded_send(message::Message::Playing(false)).expect("Failed to send pausing message");
                             stream.pause().expect("Failed to pause audio stream");
                         }
@@ -114,82 +335,352 @@ pub fn spawn(
     }
 }
 
-fn sample_format_for_audio_properties(
+/// Picks the output configuration to play the given audio with. A configuration matching the
+/// audio's channel count and sample rate is preferred, so that no conversion is necessary;
+/// otherwise, the device's default configuration is used and the audio converted to it.
+fn choose_config(
+    device: &cpal::Device,
     audio_properties: &media::AudioProperties,
-) -> cpal::SampleFormat {
-    let sample_format_opt: Option<cpal::SampleFormat> = if audio_properties.is_float {
-        const F32_SIZE: usize = size_of::<f32>();
-        const F64_SIZE: usize = size_of::<f64>();
-        match audio_properties.bytes_per_sample {
-            F32_SIZE => Some(cpal::SampleFormat::F32),
-            F64_SIZE => Some(cpal::SampleFormat::F64),
-            _ => None,
+) -> Option<cpal::SupportedStreamConfig> {
+    use cpal::traits::DeviceTrait;
+
+    let matching = device
+        .supported_output_configs()
+        .map_err(|err| println!("Error while querying audio output configurations: {err}"))
+        .ok()
+        .and_then(|mut configs| {
+            configs.find(|supported_config| {
+                audio_properties.channels == u32::from(supported_config.channels())
+                    && audio_properties.sample_rate >= supported_config.min_sample_rate().0
+                    && audio_properties.sample_rate <= supported_config.max_sample_rate().0
+                    && supported_config.sample_format() == cpal::SampleFormat::F32
+            })
+        })
+        .map(|supported_config| {
+            supported_config.with_sample_rate(cpal::SampleRate(audio_properties.sample_rate))
+        });
+
+    matching.or_else(|| {
+        device
+            .default_output_config()
+            .map_err(|err| {
+                println!("Could not determine default audio output configuration: {err}")
+            })
+            .ok()
+    })
+}
+
+fn spawn_decoder(
+    converter: media::dsp::Converter,
+    audio_properties: media::AudioProperties,
+    output_channels: u16,
+    output_rate: u32,
+    audio_mutex: Arc<Mutex<Option<media::Audio>>>,
+    playback_position: Arc<model::playback::Position>,
+) -> (Decoder, Consumer) {
+    let stop = Arc::new(atomic::AtomicBool::new(false));
+    let stop_clone = Arc::clone(&stop);
+
+    let channels = usize::from(output_channels);
+    let target_len = usize::try_from(u64::from(output_rate) * QUEUE_MILLIS / 1000)
+        .unwrap_or(usize::MAX)
+        * channels;
+
+    // Besides the queued audio, there needs to be room for a whole chunk (stretched to the slowest
+    // speed), and for obsolete audio that the callback has not skipped yet after a seek
+    let max_chunk_len = usize::try_from(
+        DECODE_CHUNK_FRAMES * u64::from(media::dsp::UNITY_SPEED)
+            / u64::from(model::playback::MIN_SPEED),
+    )
+    .unwrap_or(usize::MAX)
+        * channels;
+    let ring = Arc::new(Ring::new(2 * (target_len + max_chunk_len)));
+    let mut producer = Producer {
+        ring: Arc::clone(&ring),
+        write: 0,
+        segment_start: 0,
+    };
+
+    let handle = thread::Builder::new()
+        .name("samaku_audio_decoder".to_owned())
+        .spawn(move || {
+            let loop_buffer_padding = u64::from(output_rate) * LOOP_BUFFER_PADDING_MILLIS / 1000;
+            let max_loop_buffer_len = u64::from(output_rate) * MAX_LOOP_BUFFER_SECONDS;
+
+            let mut source = Source::new(converter, audio_properties, audio_mutex, channels);
+            let mut stretcher = media::dsp::Stretcher::new(channels, output_rate);
+            let mut loop_buffer: Option<LoopBuffer> = None;
+            let mut chunk: Vec<f32> = vec![];
+            let mut stretched: Vec<f32> = vec![];
+
+            // Number of samples at the start of `stretched` that have been queued already
+            let mut pushed: usize = 0;
+
+            let mut epoch: Option<u16> = None;
+            let mut range: Option<model::playback::Range> = None;
+            let mut position: u64 = 0;
+            let mut finished = false;
+
+            while !stop.load(atomic::Ordering::Relaxed) {
+                // Restart from the current position after a seek, discarding everything that was
+                // decoded for the previous one
+                let snapshot = playback_position.snapshot();
+                if epoch != Some(snapshot.epoch) {
+                    epoch = Some(snapshot.epoch);
+                    producer.start_segment(snapshot.epoch);
+                    position = snapshot.position;
+                    range = playback_position.range();
+                    stretcher.reset(playback_position.speed());
+                    stretched.clear();
+                    pushed = 0;
+                    finished = false;
+                }
+
+                // Queue what is left of the previous chunk first, once there is room for it
+                if pushed < stretched.len() {
+                    pushed += producer.push(&stretched[pushed..]);
+                    if pushed < stretched.len() {
+                        thread::park();
+                    }
+                    continue;
+                }
+
+                // Decode a looped range into memory once, so that every repetition can be played
+                // from there without having to seek in the source
+                if let Some(range) = range.filter(|range| {
+                    range.end - range.start <= max_loop_buffer_len
+                        && !loop_buffer
+                            .as_ref()
+                            .is_some_and(|buffer| buffer.covers(range.start, range.end, channels))
+                }) {
+                    let start = range.start.saturating_sub(loop_buffer_padding);
+                    let end = range.end + loop_buffer_padding;
+                    match LoopBuffer::decode(&mut source, start, end) {
+                        Some(buffer) => loop_buffer = Some(buffer),
+                        None => return,
+                    }
+                }
+
+                // Wait until the callback has played some audio, or there has been a seek
+                if producer.queued() >= target_len || finished {
+                    thread::park();
+                    continue;
+                }
+
+                // Positions refer to the unstretched audio. Never decode across the boundaries
+                // of the range, so that wrapping around
+                // happens exactly at its end
+                let limit = match range {
+                    Some(range) if position < range.start => range.start,
+                    Some(range) if position < range.end => range.end,
+                    _ => u64::MAX,
+                };
+                let max_frames = (limit - position).min(DECODE_CHUNK_FRAMES);
+
+                chunk.clear();
+                let frames = match loop_buffer
+                    .as_ref()
+                    .and_then(|buffer| buffer.read(position, max_frames, channels, &mut chunk))
+                {
+                    Some(frames) => frames,
+                    None => match source.decode(position, max_frames, &mut chunk) {
+                        Some(frames) => frames,
+                        None => return,
+                    },
+                };
+
+                position += frames;
+                if let Some(range) = range.filter(|range| position == range.end) {
+                    if range.repeat {
+                        position = range.start;
+                    } else {
+                        finished = true;
+                    }
+                }
+
+                stretched.clear();
+                stretcher.process(&chunk, &mut stretched);
+                pushed = producer.push(&stretched);
+            }
+        })
+        .unwrap();
+
+    let consumer = Consumer {
+        ring,
+        read: 0,
+        segment: Segment::NONE,
+        tick_remainder: 0,
+        decoder: handle.thread().clone(),
+    };
+    let decoder = Decoder {
+        stop: stop_clone,
+        handle: Some(handle),
+    };
+
+    (decoder, consumer)
+}
+
+/// Decodes audio from the shared `Audio` and converts it, continuing seamlessly from where the
+/// previous call left off where possible.
+struct Source {
+    converter: media::dsp::Converter,
+    audio_properties: media::AudioProperties,
+    audio_mutex: Arc<Mutex<Option<media::Audio>>>,
+    channels: usize,
+
+    raw: Vec<u8>,
+    converted: Vec<f32>,
+
+    /// Output position the converter will produce next, if it is in a continuous state.
+    next_position: Option<u64>,
+    source_frame: u64,
+}
+
+impl Source {
+    fn new(
+        converter: media::dsp::Converter,
+        audio_properties: media::AudioProperties,
+        audio_mutex: Arc<Mutex<Option<media::Audio>>>,
+        channels: usize,
+    ) -> Self {
+        let chunk_bytes = usize::try_from(DECODE_CHUNK_FRAMES).unwrap_or(usize::MAX)
+            * converter.input_frame_size();
+
+        Self {
+            converter,
+            audio_properties,
+            audio_mutex,
+            channels,
+            raw: vec![0; chunk_bytes],
+            converted: vec![],
+            next_position: None,
+            source_frame: 0,
         }
-    } else {
-        const U8_SIZE: usize = size_of::<u8>();
-        const I16_SIZE: usize = size_of::<i16>();
-        const I32_SIZE: usize = size_of::<i32>();
-        match audio_properties.bytes_per_sample {
-            U8_SIZE => Some(cpal::SampleFormat::U8),
-            I16_SIZE => Some(cpal::SampleFormat::I16),
-            I32_SIZE => Some(cpal::SampleFormat::I32),
-            _ => None,
+    }
+
+    /// Appends at most `max_frames` frames of converted audio starting at output position
+    /// `position` to `output`, and returns how many were appended. Returns `None` if the audio
+    /// has been unloaded or replaced in the meantime.
+    fn decode(&mut self, position: u64, max_frames: u64, output: &mut Vec<f32>) -> Option<u64> {
+        if self.next_position != Some(position) {
+            self.source_frame = self.converter.seek(position);
         }
-    };
 
-    sample_format_opt.expect("Audio sample format not representable by cpal")
+        // The resampler holds back some input, so the first chunk after a seek may not produce
+        // any output on its own
+        self.converted.clear();
+        while self.converted.is_empty() {
+            {
+                let mut audio_lock = self.audio_mutex.lock().unwrap();
+                match audio_lock.as_mut() {
+                    // If different audio has been loaded, the playback worker will be restarted
+                    // shortly, and the buffer size might no longer match
+                    Some(audio)
+                        if audio.properties.channels == self.audio_properties.channels
+                            && audio.properties.bytes_per_sample
+                                == self.audio_properties.bytes_per_sample =>
+                    {
+                        audio.fill_buffer_packed(
+                            &mut self.raw,
+                            self.source_frame,
+                            DECODE_CHUNK_FRAMES,
+                        );
+                    }
+                    _ => return None,
+                }
+            }
+            self.source_frame += DECODE_CHUNK_FRAMES;
+            self.converter.process(&self.raw, &mut self.converted);
+        }
+
+        let frames = (self.converted.len() / self.channels) as u64;
+        let taken = frames.min(max_frames);
+        output.extend_from_slice(
+            &self.converted[..usize::try_from(taken).unwrap_or(usize::MAX) * self.channels],
+        );
+
+        // Anything that was cut off is lost, so the next call will have to seek
+        self.next_position = (taken == frames).then_some(position + frames);
+        Some(taken)
+    }
+}
+
+/// Converted audio for a fixed span of output positions, kept in memory.
+struct LoopBuffer {
+    start: u64,
+    samples: Vec<f32>,
+}
+
+impl LoopBuffer {
+    fn decode(source: &mut Source, start: u64, end: u64) -> Option<Self> {
+        let capacity = usize::try_from(end - start).unwrap_or(0) * source.channels;
+        let mut samples = Vec::with_capacity(capacity);
+        let mut position = start;
+        while position < end {
+            position += source.decode(position, end - position, &mut samples)?;
+        }
+        Some(Self { start, samples })
+    }
+
+    fn end(&self, channels: usize) -> u64 {
+        self.start + (self.samples.len() / channels) as u64
+    }
+
+    fn covers(&self, start: u64, end: u64, channels: usize) -> bool {
+        self.start <= start && end <= self.end(channels)
+    }
+
+    /// Appends at most `max_frames` frames starting at `position` to `output`, and returns how
+    /// many were appended, or `None` if `position` is not within the buffer.
+    fn read(
+        &self,
+        position: u64,
+        max_frames: u64,
+        channels: usize,
+        output: &mut Vec<f32>,
+    ) -> Option<u64> {
+        if !(self.start..self.end(channels)).contains(&position) {
+            return None;
+        }
+
+        let frames = max_frames.min(self.end(channels) - position);
+        let offset = usize::try_from(position - self.start).ok()? * channels;
+        let len = usize::try_from(frames).ok()? * channels;
+        output.extend_from_slice(&self.samples[offset..offset + len]);
+        Some(frames)
+    }
 }
 
 fn try_build_stream(
-    sample_format: cpal::SampleFormat,
     device: &cpal::Device,
-    config: cpal::SupportedStreamConfig,
-    audio_mutex: Arc<Mutex<Option<media::Audio>>>,
-    playing: Arc<atomic::AtomicBool>,
-    playback_position: Arc<model::playback::Position>,
-    tx_out: super::GlobalSender,
+    config: &cpal::SupportedStreamConfig,
+    consumer: Consumer,
+    playing: &Arc<atomic::AtomicBool>,
+    playback_position: &Arc<model::playback::Position>,
+    tx_out: &super::GlobalSender,
 ) -> Option<cpal::Stream> {
-    match sample_format {
-        cpal::SampleFormat::F32 => Some(build_stream::<f32>(
-            device,
-            &config.into(),
-            audio_mutex,
-            playing,
-            playback_position,
-            tx_out,
-        )),
-        cpal::SampleFormat::F64 => Some(build_stream::<f64>(
-            device,
-            &config.into(),
-            audio_mutex,
-            playing,
-            playback_position,
-            tx_out,
-        )),
-        cpal::SampleFormat::U8 => Some(build_stream::<u8>(
-            device,
-            &config.into(),
-            audio_mutex,
-            playing,
-            playback_position,
-            tx_out,
-        )),
-        cpal::SampleFormat::I16 => Some(build_stream::<i16>(
-            device,
-            &config.into(),
-            audio_mutex,
-            playing,
-            playback_position,
-            tx_out,
-        )),
-        cpal::SampleFormat::I32 => Some(build_stream::<i32>(
-            device,
-            &config.into(),
-            audio_mutex,
-            playing,
-            playback_position,
-            tx_out,
-        )),
+    macro_rules! build {
+        ($sample:ty) => {
+            Some(build_stream::<$sample>(
+                device,
+                &config.config(),
+                consumer,
+                Arc::clone(playing),
+                Arc::clone(playback_position),
+                tx_out.clone(),
+            ))
+        };
+    }
+
+    match config.sample_format() {
+        cpal::SampleFormat::F32 => build!(f32),
+        cpal::SampleFormat::F64 => build!(f64),
+        cpal::SampleFormat::U8 => build!(u8),
+        cpal::SampleFormat::I8 => build!(i8),
+        cpal::SampleFormat::U16 => build!(u16),
+        cpal::SampleFormat::I16 => build!(i16),
+        cpal::SampleFormat::U32 => build!(u32),
+        cpal::SampleFormat::I32 => build!(i32),
         other => {
             println!("Unsupported sample format for playback: {other}");
             None
@@ -200,21 +691,32 @@ fn try_build_stream(
 fn build_stream<T>(
     device: &cpal::Device,
     config: &cpal::StreamConfig,
-    audio_mutex: Arc<Mutex<Option<media::Audio>>>,
+    mut consumer: Consumer,
     playing: Arc<atomic::AtomicBool>,
     playback_position: Arc<model::playback::Position>,
     tx_out: super::GlobalSender,
 ) -> cpal::Stream
 where
-    T: cpal::SizedSample + Default,
+    T: cpal::SizedSample + cpal::FromSample<f32>,
 {
     use cpal::traits::DeviceTrait;
 
+    let channels = usize::from(config.channels);
+
     device
         .build_output_stream(
             config,
-            move |data: &mut [T], _| {
-                data_callback::<T>(data, &audio_mutex, &playing, &playback_position, &tx_out);
+            move |data: &mut [T], info: &cpal::OutputCallbackInfo| {
+                let timing = callback_timing(info);
+                data_callback::<T>(
+                    data,
+                    channels,
+                    timing,
+                    &mut consumer,
+                    &playing,
+                    &playback_position,
+                    &tx_out,
+                );
             },
             move |err| println!("Audio stream error: {err}"),
             None,
@@ -222,51 +724,224 @@ where
         .expect("Failed to build audio stream")
 }
 
+/// Determines when the audio provided in a callback will start to be heard, using the timestamps
+/// cpal provides.
+fn callback_timing(info: &cpal::OutputCallbackInfo) -> model::playback::CallbackTiming {
+    let timestamp = info.timestamp();
+    model::playback::CallbackTiming {
+        time: std::time::Instant::now(),
+        // Some backends do not provide meaningful timestamps, in which case we can only assume
+        // the audio will be heard immediately
+        latency: timestamp
+            .playback
+            .duration_since(&timestamp.callback)
+            .unwrap_or_default(),
+    }
+}
+
+/// Fills `data` with queued audio and advances the playback position accordingly. Returns the
+/// number of frames that were filled with audio; the rest of the buffer is silent.
 fn data_callback<T>(
     data: &mut [T],
-    audio_mutex: &Arc<Mutex<Option<media::Audio>>>,
-    playing: &Arc<atomic::AtomicBool>,
-    playback_position: &Arc<model::playback::Position>,
+    channels: usize,
+    timing: model::playback::CallbackTiming,
+    consumer: &mut Consumer,
+    playing: &atomic::AtomicBool,
+    playback_position: &model::playback::Position,
     tx_out: &super::GlobalSender,
-) where
-    T: Default,
+) -> usize
+where
+    T: cpal::Sample + cpal::FromSample<f32>,
 {
-    // Lock the audio mutex, so nothing else tries to access the audio data at the moment.
-    let mut audio_lock = audio_mutex.lock().unwrap();
-
-    // If playback is paused, zero the array and return
+    // If playback is paused, output silence and return
     if !playing.load(atomic::Ordering::Relaxed) {
-        for i in &mut *data {
-            *i = Default::default();
-        }
-        return;
+        data.fill(T::EQUILIBRIUM);
+        return 0;
     }
 
-    if let Some(audio) = audio_lock.as_mut() {
-        // Lock the position mutex, so nothing tries to change the position
-        // between now and when we get the audio.
-        let mut auth_pos = playback_position.authoritative_position.lock().unwrap();
+    // Take a snapshot of the position to fill the buffer from. If it is changed by a seek in the
+    // meantime, the seek takes precedence, and the next callback will play from the new position.
+    let start = playback_position.snapshot();
+
+    // Either the decode thread can top up the queue now, or it needs to notice a seek
+    consumer.wake_decoder();
+
+    // Nothing has been decoded for the current position yet, e.g. right after a seek
+    let Some(available) = consumer.available(start.epoch) else {
+        data.fill(T::EQUILIBRIUM);
+        return 0;
+    };
 
-        // cpal expects packed audio. The buffer length refers to the
-        // number of samples (so frames * channels)
-        let num_samples = data.len() as u64;
+    // cpal expects packed audio. The buffer length refers to the number of samples (so frames *
+    // channels)
+    let num_frames = (data.len() / channels).min(available / channels);
+    let num_samples = num_frames * channels;
+    consumer.pop(&mut data[..num_samples]);
+    data[num_samples..].fill(T::EQUILIBRIUM);
 
-        // BS' parameters refer to the number of frames, so we
-        // need to divide by the number of channels
-        let num_frames = num_samples / u64::from(audio.properties.channels);
+    // When playing at a different speed, the frames handed to the device correspond to a
+    // different number of ticks
+    let scaled = num_frames as u64 * u64::from(playback_position.speed()) + consumer.tick_remainder;
+    let ticks = scaled / u64::from(media::dsp::UNITY_SPEED);
+    consumer.tick_remainder = scaled % u64::from(media::dsp::UNITY_SPEED);
+    let end = playback_position.advanced_position(start.position, ticks);
 
-        // Get the actual data
-        audio.fill_buffer_packed(data, *auth_pos, num_frames);
+    if num_frames == 0 {
+        return 0;
+    }
 
-        *auth_pos += num_frames;
-        playback_position
-            .position
-            .store(*auth_pos, atomic::Ordering::Relaxed);
+    if !playback_position.advance(
+        start,
+        u32::try_from(ticks).expect("audio buffer too large"),
+        timing,
+    ) {
+        return num_frames;
+    }
 
-        drop(auth_pos);
+    tx_out
+        .unbounded_send(message::Message::PlaybackStep)
+        .expect("Error while emitting PlaybackStep");
 
+    // Let the UI stop playback once the end of a non-repeating range has been reached
+    if playback_position
+        .range()
+        .is_some_and(|range| !range.repeat && start.position < range.end && end == range.end)
+    {
         tx_out
-            .unbounded_send(message::Message::PlaybackStep)
-            .expect("Error while emitting PlaybackStep");
+            .unbounded_send(message::Message::PlaybackRangeEnded)
+            .expect("Error while emitting PlaybackRangeEnded");
+    }
+
+    num_frames
+}
+
+/// An audio output that is driven by the caller instead of an audio device, and that writes into
+/// memory. Runs the same decode thread and callback as real playback, so that its performance can
+/// be measured without audio hardware.
+pub struct VirtualSink {
+    consumer: Consumer,
+    playing: atomic::AtomicBool,
+    playback_position: Arc<model::playback::Position>,
+    tx_out: super::GlobalSender,
+    rx_out: super::GlobalReceiver,
+    channels: usize,
+    latency: Duration,
+    _decoder: Decoder,
+}
+
+impl VirtualSink {
+    /// Starts decoding the given audio for a virtual device with the given channel count, sample
+    /// rate and output latency. Returns `None` if no audio is loaded or its format is not
+    /// supported.
+    ///
+    /// # Panics
+    /// Panics if the audio mutex is poisoned.
+    #[must_use]
+    pub fn new(
+        audio_mutex: &Arc<Mutex<Option<media::Audio>>>,
+        playback_position: &Arc<model::playback::Position>,
+        channels: u16,
+        rate: u32,
+        latency: Duration,
+    ) -> Option<Self> {
+        let audio_properties = audio_mutex.lock().unwrap().as_ref()?.properties;
+        let converter = media::dsp::Converter::new(&audio_properties, channels, rate)?;
+        playback_position.set_rate(rate);
+
+        let (decoder, consumer) = spawn_decoder(
+            converter,
+            audio_properties,
+            channels,
+            rate,
+            Arc::clone(audio_mutex),
+            Arc::clone(playback_position),
+        );
+        let (tx_out, rx_out) = iced::futures::channel::mpsc::unbounded();
+
+        Some(Self {
+            consumer,
+            playing: atomic::AtomicBool::new(true),
+            playback_position: Arc::clone(playback_position),
+            tx_out,
+            rx_out,
+            channels: usize::from(channels),
+            latency,
+            _decoder: decoder,
+        })
+    }
+
+    /// Runs the audio callback for the interleaved buffer `data`, as a device would at time
+    /// `time`. Returns the number of frames that were filled with audio.
+    pub fn render(&mut self, data: &mut [f32], time: std::time::Instant) -> usize {
+        let frames = data_callback(
+            data,
+            self.channels,
+            model::playback::CallbackTiming {
+                time,
+                latency: self.latency,
+            },
+            &mut self.consumer,
+            &self.playing,
+            &self.playback_position,
+            &self.tx_out,
+        );
+
+        // Discard the messages meant for the UI
+        while let Ok(Some(_)) = self.rx_out.try_next() {}
+
+        frames
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn ring_segments() {
+        let ring = Arc::new(Ring::new(6));
+        let mut producer = Producer {
+            ring: Arc::clone(&ring),
+            write: 0,
+            segment_start: 0,
+        };
+        let mut consumer = Consumer {
+            ring,
+            read: 0,
+            segment: Segment::NONE,
+            tick_remainder: 0,
+            decoder: thread::current(),
+        };
+        assert_eq!(consumer.available(0), None);
+
+        producer.start_segment(0);
+        assert_eq!(producer.push(&[1.0, 2.0, 3.0, 4.0, 5.0, 6.0]), 6);
+        assert_eq!(producer.push(&[7.0, 8.0, 9.0, 10.0]), 2);
+        assert_eq!(producer.queued(), 8);
+        assert_eq!(consumer.available(1), None);
+        assert_eq!(consumer.available(0), Some(8));
+
+        let mut output = [0.0_f32; 3];
+        consumer.pop(&mut output);
+        assert_eq!(output, [1.0, 2.0, 3.0]);
+        assert_eq!(producer.queued(), 5);
+
+        // Wraps around
+        assert_eq!(producer.push(&[9.0, 10.0, 11.0, 12.0]), 3);
+        assert_eq!(consumer.available(0), Some(8));
+        let mut output = [0.0_f32; 8];
+        consumer.pop(&mut output);
+        assert_eq!(output, [4.0, 5.0, 6.0, 7.0, 8.0, 9.0, 10.0, 11.0]);
+
+        // Audio from before a seek is skipped
+        assert_eq!(producer.push(&[0.0, 0.0]), 2);
+        producer.start_segment(1);
+        assert_eq!(producer.queued(), 0);
+        assert_eq!(producer.push(&[13.0]), 1);
+        assert_eq!(consumer.available(0), None);
+        assert_eq!(consumer.available(1), Some(1));
+        let mut output = [0.0_f32; 1];
+        consumer.pop(&mut output);
+        assert_eq!(output, [13.0]);
     }
 }
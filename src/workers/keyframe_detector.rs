@@ -0,0 +1,132 @@
+use std::{
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        Arc,
+    },
+    thread,
+    time::Instant,
+};
+
+use crate::{media, message, model, view};
+
+#[derive(Debug, Clone)]
+pub enum MessageIn {
+    Detect(std::path::PathBuf),
+    Cancel,
+}
+
+/// Memory budget for the frame cache of the detector's own video. Every frame is only read once.
+const CACHE_MEMORY: i64 = 128 << 20;
+
+/// Detects scene changes in videos, to be used as keyframes. Each detection runs on a thread of
+/// its own, with its own instance of the video, so that neither motion tracking nor any other
+/// worker has to wait for it. A detection can be cancelled at any time, and starting another one
+/// cancels the previous one.
+pub fn spawn(
+    tx_out: super::GlobalSender,
+    _shared_state: &crate::SharedState,
+) -> super::Worker<MessageIn> {
+    let (tx_in, rx_in) = std::sync::mpsc::channel::<MessageIn>();
+
+    let handle = thread::Builder::new()
+        .name("samaku_keyframe_detector".to_owned())
+        .spawn(move || {
+            let mut running: Option<Arc<AtomicBool>> = None;
+
+            while let Ok(message) = rx_in.recv() {
+                if let Some(cancelled) = running.take() {
+                    cancelled.store(true, Ordering::Relaxed);
+                }
+
+                match message {
+                    self::MessageIn::Detect(path_buf) => {
+                        running = Some(spawn_detection(path_buf, tx_out.clone()));
+                    }
+                    self::MessageIn::Cancel => {}
+                }
+            }
+        })
+        .unwrap();
+
+    super::Worker {
+        worker_type: super::Type::KeyframeDetector,
+        _handle: handle,
+        message_in: tx_in,
+    }
+}
+
+/// Starts detecting keyframes in the given video on a new thread, which sends them to the UI once
+/// it is done. Returns the flag that cancels the detection when set.
+fn spawn_detection(path_buf: std::path::PathBuf, tx_out: super::GlobalSender) -> Arc<AtomicBool> {
+    let cancelled = Arc::new(AtomicBool::new(false));
+    let thread_cancelled = Arc::clone(&cancelled);
+
+    thread::Builder::new()
+        .name("samaku_keyframe_detection".to_owned())
+        .spawn(move || {
+            // The threads analysing the segments inherit the lowered priority
+            super::lower_priority(&super::Type::KeyframeDetector);
+
+            let messages = match detect(&path_buf, &thread_cancelled) {
+                Ok(Some(keyframes)) => vec![
+                    message::Message::Toast(view::toast::Toast::new(
+                        view::toast::Status::Success,
+                        "Keyframes detected".to_owned(),
+                        format!("Found {} keyframes.", keyframes.len()),
+                    )),
+                    message::Message::KeyframesAvailable(keyframes),
+                ],
+                Ok(None) => {
+                    println!("Keyframe detection cancelled");
+                    return;
+                }
+                Err(err) => vec![message::toast_danger(
+                    "Failed to detect keyframes".to_owned(),
+                    err.to_string(),
+                )],
+            };
+
+            for message in messages {
+                if tx_out.unbounded_send(message).is_err() {
+                    return;
+                }
+            }
+        })
+        .unwrap();
+
+    cancelled
+}
+
+/// Detects scene changes over the whole video, using all available threads. Returns `None` if
+/// detection was cancelled.
+fn detect(
+    path: &std::path::Path,
+    cancelled: &AtomicBool,
+) -> Result<Option<model::keyframes::Keyframes>, media::VideoLoadError> {
+    let video = media::Video::load(path)?;
+    video.set_core_budget(media::VideoCoreBudget::for_system(
+        CACHE_MEMORY,
+        &video.metadata,
+    ));
+
+    let instant = Instant::now();
+    let threads = thread::available_parallelism().map_or(1, usize::from);
+    let keyframes = media::scene_change::detect(
+        &video,
+        media::Video::get_luma_thumbnail,
+        0..video.metadata.num_frames,
+        threads,
+        cancelled,
+    );
+
+    if let Some(ref keyframes) = keyframes {
+        println!(
+            "Detected {} keyframes in {} frames in {:.2?}",
+            keyframes.len(),
+            video.metadata.num_frames,
+            instant.elapsed()
+        );
+    }
+
+    Ok(keyframes)
+}
@@ -2,14 +2,22 @@ use std::{cell::RefCell, thread};
 
 use crate::{media, message, model};
 
+pub use cpal_playback::VirtualSink;
+
 mod cpal_playback;
+mod keyframe_detector;
 mod log_toasts;
+mod motion_tracker;
+mod proxy_generator;
 mod video_decoder;
 
 #[derive(Debug, Clone)]
 pub enum Type {
     VideoDecoder,
     CpalPlayback,
+    MotionTracker,
+    ProxyGenerator,
+    KeyframeDetector,
     LogToasts,
 }
 
@@ -39,6 +47,9 @@ pub struct Workers {
 
     video_decoder: Worker<video_decoder::MessageIn>,
     cpal_playback: Worker<cpal_playback::MessageIn>,
+    motion_tracker: Worker<motion_tracker::MessageIn>,
+    proxy_generator: Worker<proxy_generator::MessageIn>,
+    keyframe_detector: Worker<keyframe_detector::MessageIn>,
     _log_toasts: Worker<log_toasts::MessageIn>,
 }
 
@@ -51,6 +62,9 @@ impl Workers {
         Self {
             video_decoder: video_decoder::spawn(sender.clone(), shared_state),
             cpal_playback: cpal_playback::spawn(sender.clone(), shared_state),
+            motion_tracker: motion_tracker::spawn(sender.clone(), shared_state),
+            proxy_generator: proxy_generator::spawn(sender.clone(), shared_state),
+            keyframe_detector: keyframe_detector::spawn(sender.clone(), shared_state),
             _log_toasts: log_toasts::spawn(sender.clone(), shared_state),
 
             _sender: sender,
@@ -71,29 +85,125 @@ impl Workers {
             .dispatch(video_decoder::MessageIn::PlaybackStep);
     }
 
+    /// Starts loading the given video on the video decoder, in the background. The decoder keeps
+    /// showing the previous video, if any, until loading has finished.
     pub fn emit_load_video(&self, path_buf: std::path::PathBuf) {
         self.video_decoder
             .dispatch(video_decoder::MessageIn::LoadVideo(path_buf));
     }
 
+    pub fn emit_cancel_video_load(&self) {
+        self.video_decoder
+            .dispatch(video_decoder::MessageIn::CancelLoad);
+    }
+
+    /// Starts detecting scene changes in the given video in the background, to use them as
+    /// keyframes. Should only be called once the video decoder has loaded the video, so that its
+    /// index already exists.
+    pub fn emit_detect_keyframes(&self, path_buf: std::path::PathBuf) {
+        self.keyframe_detector
+            .dispatch(keyframe_detector::MessageIn::Detect(path_buf));
+    }
+
+    pub fn emit_cancel_keyframe_detection(&self) {
+        self.keyframe_detector
+            .dispatch(keyframe_detector::MessageIn::Cancel);
+    }
+
+    /// Loads the given video for motion tracking. Should only be called once the video decoder has
+    /// loaded the video, so that its index already exists.
+    pub fn emit_load_tracking_video(&self, path_buf: std::path::PathBuf) {
+        self.motion_tracker
+            .dispatch(motion_tracker::MessageIn::LoadVideo(path_buf));
+    }
+
+    /// Starts generating a low-resolution proxy of the given video in the background, if it is
+    /// heavy enough to need one and no complete proxy exists yet. Should only be called once the
+    /// video decoder has loaded the video, so that its index already exists.
+    pub fn emit_generate_proxy(&self, path_buf: std::path::PathBuf) {
+        self.proxy_generator
+            .dispatch(proxy_generator::MessageIn::LoadVideo(path_buf));
+    }
+
+    /// Lets the video decoder show frames from the given proxy while the given video is loaded.
+    pub fn emit_use_proxy(&self, source_path: std::path::PathBuf, proxy_path: std::path::PathBuf) {
+        self.video_decoder
+            .dispatch(video_decoder::MessageIn::UseProxy(source_path, proxy_path));
+    }
+
     pub fn emit_restart_audio(&self) {
         self.cpal_playback
             .dispatch(cpal_playback::MessageIn::TryRestart);
     }
 
+    /// Asks the video decoder to decode the frames in the given range ahead of time, so that they
+    /// can be displayed without delay when playback reaches them.
+    pub fn emit_warm_frames(&self, start_frame: model::FrameNumber, end_frame: model::FrameNumber) {
+        self.video_decoder
+            .dispatch(video_decoder::MessageIn::WarmFrames(start_frame, end_frame));
+    }
+
+    /// Starts motion tracking on the motion tracker worker, replacing any track that is still
+    /// running. The markers are tracked forward and backward from each keyframe, covering the
+    /// frames from `start_frame` to `end_frame`.
     pub fn emit_track_motion_for_node(
         &self,
         node_index: usize,
-        initial_region: media::motion::Region,
+        keyframes: Vec<(model::FrameNumber, Vec<media::motion::Region>)>,
         start_frame: model::FrameNumber,
         end_frame: model::FrameNumber,
     ) {
-        self.video_decoder
-            .dispatch(video_decoder::MessageIn::TrackMotionForNode(
+        self.motion_tracker
+            .dispatch(motion_tracker::MessageIn::TrackMotionForNode(
                 node_index,
-                initial_region,
+                keyframes,
                 start_frame,
                 end_frame,
             ));
     }
+
+    pub fn emit_cancel_motion_tracking(&self) {
+        self.motion_tracker
+            .dispatch(motion_tracker::MessageIn::Cancel);
+    }
 }
+
+/// Niceness of threads that run long background tasks, like motion tracking. The scheduler should
+/// always prefer the threads involved in playback (video decoding, audio callbacks, the UI) when
+/// they compete for CPU time.
+#[cfg(target_os = "linux")]
+const BACKGROUND_NICENESS: libc::c_int = 10;
+
+/// Lowers the scheduling priority of the calling thread. On Linux, the nice value is a per-thread
+/// attribute, and `setpriority` with an ID of zero only affects the calling thread.
+#[cfg(target_os = "linux")]
+fn lower_priority(worker_type: &Type) {
+    // SAFETY: `setpriority` has no memory safety preconditions. Failure is harmless, as the
+    // thread simply keeps running at the default priority.
+    let result = unsafe { libc::setpriority(libc::PRIO_PROCESS, 0, BACKGROUND_NICENESS) };
+    if result != 0 {
+        println!(
+            "Failed to lower {worker_type:?} worker priority: {}",
+            std::io::Error::last_os_error()
+        );
+    }
+}
+
+/// Lowers the scheduling priority of the calling thread. On macOS, `setpriority` would affect the
+/// whole process, so the thread's quality of service class is lowered instead.
+#[cfg(target_os = "macos")]
+fn lower_priority(worker_type: &Type) {
+    // SAFETY: `pthread_set_qos_class_self_np` has no memory safety preconditions. Failure is
+    // harmless, as the thread simply keeps running at the default priority.
+    let result =
+        unsafe { libc::pthread_set_qos_class_self_np(libc::qos_class_t::QOS_CLASS_UTILITY, 0) };
+    if result != 0 {
+        println!(
+            "Failed to lower {worker_type:?} worker priority: {}",
+            std::io::Error::from_raw_os_error(result)
+        );
+    }
+}
+
+#[cfg(not(any(target_os = "linux", target_os = "macos")))]
+const fn lower_priority(_worker_type: &Type) {}
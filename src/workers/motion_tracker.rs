@@ -0,0 +1,197 @@
+use std::{
+    thread,
+    time::{Duration, Instant},
+};
+
+use crate::{media, message, model};
+
+#[derive(Debug, Clone)]
+pub enum MessageIn {
+    LoadVideo(std::path::PathBuf),
+    TrackMotionForNode(
+        usize,
+        Vec<(model::FrameNumber, Vec<media::motion::Region>)>,
+        model::FrameNumber,
+        model::FrameNumber,
+    ),
+    Cancel,
+}
+
+/// Memory budget for the frame cache of the tracker's own video. Frames are tracked in order, so
+/// only the few frames around the current ones are ever requested again.
+const CACHE_MEMORY: i64 = 128 << 20;
+
+/// Runs motion tracking on its own thread, with its own instance of the video, so that a long
+/// track never delays decoding the frames to display. Each tracking step is a full libmv solve
+/// for every segment, but incoming messages are checked between steps, so a running track can be
+/// cancelled or replaced by a new one at any time. Segments and markers are tracked in parallel
+/// on a thread pool that is created once, with the same lowered priority as the worker itself.
+pub fn spawn(
+    tx_out: super::GlobalSender,
+    _shared_state: &crate::SharedState,
+) -> super::Worker<MessageIn> {
+    let (tx_in, rx_in) = std::sync::mpsc::channel::<MessageIn>();
+
+    let handle = thread::Builder::new()
+        .name("samaku_motion_tracker".to_owned())
+        .spawn(move || {
+            super::lower_priority(&super::Type::MotionTracker);
+
+            let pool = rayon::ThreadPoolBuilder::new()
+                .thread_name(|index| format!("samaku_motion_tracker_{index}"))
+                .start_handler(|_| super::lower_priority(&super::Type::MotionTracker))
+                .build()
+                .expect("failed to create motion tracking thread pool");
+
+            let mut video_opt: Option<media::Video> = None;
+
+            let mut batch = Batch::new(0);
+            let mut tracker_opt: Option<media::motion::SegmentTracker<media::Video>> = None;
+
+            loop {
+                // While tracking, only check for messages between steps, so that cancellation
+                // takes effect after at most one step. Otherwise, wait for the next message.
+                let maybe_message = if let Some(ref mut tracker) = tracker_opt {
+                    match rx_in.try_recv() {
+                        Ok(message) => Some(message),
+                        Err(std::sync::mpsc::TryRecvError::Empty) => {
+                            if let Some(updates) =
+                                pool.install(|| tracker.update(media::motion::Model::Translation))
+                            {
+                                batch.frames.extend(updates);
+                                if batch.is_due() && !batch.flush(&tx_out) {
+                                    return;
+                                }
+                            } else {
+                                println!("Motion tracking finished");
+                                tracker_opt = None;
+                                if !batch.flush(&tx_out) {
+                                    return;
+                                }
+                            }
+
+                            None
+                        }
+                        Err(_) => return,
+                    }
+                } else {
+                    match rx_in.recv() {
+                        Ok(message) => Some(message),
+                        Err(_) => return,
+                    }
+                };
+
+                if let Some(message) = maybe_message {
+                    match message {
+                        self::MessageIn::LoadVideo(path_buf) => {
+                            // Results for the previous video are of no use anymore
+                            tracker_opt = None;
+                            batch.frames.clear();
+                            video_opt = None;
+
+                            // Errors are already reported to the user by the video decoder, which
+                            // loads the same file
+                            match media::Video::load(&path_buf) {
+                                Ok(video) => {
+                                    video.set_core_budget(media::VideoCoreBudget::for_system(
+                                        CACHE_MEMORY,
+                                        &video.metadata,
+                                    ));
+                                    video_opt = Some(video);
+                                }
+                                Err(err) => println!("Motion tracker failed to load video: {err}"),
+                            }
+                        }
+                        self::MessageIn::TrackMotionForNode(
+                            new_node_index,
+                            keyframes,
+                            start_frame,
+                            end_frame,
+                        ) => {
+                            let markers_per_keyframe =
+                                keyframes.first().map(|(_, markers)| markers.len());
+                            let valid = markers_per_keyframe.is_some_and(|count| count > 0)
+                                && keyframes.iter().all(|(_, markers)| {
+                                    Some(markers.len()) == markers_per_keyframe
+                                });
+
+                            if let Some(video) = video_opt.as_ref().filter(|_| valid) {
+                                if !batch.flush(&tx_out) {
+                                    return;
+                                }
+                                batch = Batch::new(new_node_index);
+                                tracker_opt = Some(media::motion::SegmentTracker::new(
+                                    video,
+                                    media::Video::get_libmv_patch,
+                                    keyframes,
+                                    60.0,
+                                    start_frame,
+                                    end_frame,
+                                ));
+                            }
+                        }
+                        self::MessageIn::Cancel => {
+                            if tracker_opt.take().is_some() {
+                                println!("Motion tracking cancelled");
+                                if !batch.flush(&tx_out) {
+                                    return;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        })
+        .unwrap();
+
+    super::Worker {
+        worker_type: super::Type::MotionTracker,
+        _handle: handle,
+        message_in: tx_in,
+    }
+}
+
+/// Tracked frames that have not been sent to the UI yet. Every message to the UI updates the node
+/// and rebuilds the view, which can take much longer than tracking a frame, so results are sent in
+/// batches instead of one frame at a time.
+struct Batch {
+    node_index: usize,
+    frames: Vec<(model::FrameNumber, Vec<media::motion::Region>)>,
+    last_flush: Instant,
+}
+
+impl Batch {
+    /// Longest time results are held back before being sent.
+    const FLUSH_INTERVAL: Duration = Duration::from_millis(100);
+
+    /// Most frames sent at once.
+    const FLUSH_FRAMES: usize = 48;
+
+    fn new(node_index: usize) -> Self {
+        Self {
+            node_index,
+            frames: vec![],
+            last_flush: Instant::now(),
+        }
+    }
+
+    fn is_due(&self) -> bool {
+        self.frames.len() >= Self::FLUSH_FRAMES
+            || (!self.frames.is_empty() && self.last_flush.elapsed() >= Self::FLUSH_INTERVAL)
+    }
+
+    /// Sends all pending frames to the node. Returns `false` if the UI has gone away.
+    fn flush(&mut self, tx_out: &super::GlobalSender) -> bool {
+        self.last_flush = Instant::now();
+        if self.frames.is_empty() {
+            return true;
+        }
+
+        tx_out
+            .unbounded_send(message::Message::Node(
+                self.node_index,
+                message::Node::MotionTrackUpdate(std::mem::take(&mut self.frames)),
+            ))
+            .is_ok()
+    }
+}
@@ -0,0 +1,212 @@
+use std::{
+    sync::Arc,
+    thread,
+    time::{Duration, Instant},
+};
+
+use crate::{media, message, model};
+
+#[derive(Debug, Clone)]
+pub enum MessageIn {
+    LoadVideo(std::path::PathBuf),
+}
+
+/// Memory budget for the frame cache of the generator's own video. Frames are generated mostly in
+/// order, so few of them are ever requested again.
+const CACHE_MEMORY: i64 = 128 << 20;
+
+/// How many frames to generate between progress reports on the console.
+const REPORT_INTERVAL: u32 = 1000;
+
+/// How many consecutive frames to decode when measuring how expensive a video is. The first one
+/// includes seeking and is not counted.
+const SAMPLE_FRAMES: i32 = 6;
+
+/// Generates low-resolution proxies of heavy videos on its own thread, with its own instance of
+/// the video. One frame is generated at a time, and incoming messages are checked in between, so
+/// loading another video stops generation right away. Generation starts at the current playback
+/// position, so that the frames around it become available first.
+pub fn spawn(
+    tx_out: super::GlobalSender,
+    shared_state: &crate::SharedState,
+) -> super::Worker<MessageIn> {
+    let (tx_in, rx_in) = std::sync::mpsc::channel::<MessageIn>();
+
+    let playback_position = Arc::clone(&shared_state.playback_position);
+
+    let handle = thread::Builder::new()
+        .name("samaku_proxy_generator".to_owned())
+        .spawn(move || {
+            super::lower_priority(&super::Type::ProxyGenerator);
+
+            let mut generation_opt: Option<Generation> = None;
+
+            loop {
+                let maybe_message = if let Some(ref mut generation) = generation_opt {
+                    match rx_in.try_recv() {
+                        Ok(message) => Some(message),
+                        Err(std::sync::mpsc::TryRecvError::Empty) => {
+                            let from = playback_position
+                                .current_frame(generation.video.metadata.frame_rate);
+                            if !generation.step(from) {
+                                generation_opt = None;
+                            }
+                            None
+                        }
+                        Err(_) => return,
+                    }
+                } else {
+                    match rx_in.recv() {
+                        Ok(message) => Some(message),
+                        Err(_) => return,
+                    }
+                };
+
+                if let Some(message) = maybe_message {
+                    match message {
+                        self::MessageIn::LoadVideo(path_buf) => {
+                            generation_opt = None;
+                            match Generation::start(&path_buf) {
+                                Ok(Some(generation)) => {
+                                    if tx_out
+                                        .unbounded_send(message::Message::ProxyAvailable(
+                                            path_buf,
+                                            generation.proxy_path.clone(),
+                                        ))
+                                        .is_err()
+                                    {
+                                        return;
+                                    }
+                                    generation_opt = Some(generation);
+                                }
+                                Ok(None) => {}
+                                Err(err) => println!("Not generating a proxy: {err}"),
+                            }
+                        }
+                    }
+                }
+            }
+        })
+        .unwrap();
+
+    super::Worker {
+        worker_type: super::Type::ProxyGenerator,
+        _handle: handle,
+        message_in: tx_in,
+    }
+}
+
+/// The proxy of a video that is being generated.
+struct Generation {
+    video: media::Video,
+    writer: media::proxy::Writer,
+    cache: media::proxy::Cache,
+    proxy_path: std::path::PathBuf,
+    generated: u32,
+    instant: Instant,
+}
+
+impl Generation {
+    /// Loads the video and opens its proxy. Returns `None` if the video is cheap enough to be
+    /// decoded directly.
+    fn start(path: &std::path::Path) -> Result<Option<Self>, String> {
+        let mut video = media::Video::load(path).map_err(|err| err.to_string())?;
+        let Some(dimensions) = media::proxy::Dimensions::for_video(&video.metadata) else {
+            return Ok(None);
+        };
+        video.set_core_budget(media::VideoCoreBudget::for_system(
+            CACHE_MEMORY,
+            &video.metadata,
+        ));
+
+        if !media::proxy::needs_proxy(&video.metadata, || measure_decode_time(&video)) {
+            println!("Not generating a proxy, the video is cheap enough to decode directly");
+            return Ok(None);
+        }
+        video
+            .prepare_proxy(dimensions)
+            .map_err(|err| err.to_string())?;
+
+        let cache = media::proxy::Cache::for_user();
+        let proxy_path = cache.path_for(path).map_err(|err| err.to_string())?;
+        let writer =
+            media::proxy::Writer::open(&proxy_path, dimensions).map_err(|err| err.to_string())?;
+        if let Err(err) = cache.evict(&proxy_path) {
+            println!("Failed to evict old proxies: {err}");
+        }
+
+        println!(
+            "Generating {}x{} proxy at {}",
+            dimensions.width,
+            dimensions.height,
+            proxy_path.display()
+        );
+
+        Ok(Some(Self {
+            video,
+            writer,
+            cache,
+            proxy_path,
+            generated: 0,
+            instant: Instant::now(),
+        }))
+    }
+
+    /// Adds the first missing frame at or after `from` to the proxy. Returns `false` once there is
+    /// nothing left to do, because the proxy is complete or generation failed.
+    fn step(&mut self, from: model::FrameNumber) -> bool {
+        let Some(frame) = self.writer.next_missing(from) else {
+            println!(
+                "Proxy complete, generated {} frames in {:.2?}",
+                self.generated,
+                self.instant.elapsed()
+            );
+
+            // The proxy has reached its full size now
+            if let Err(err) = self.cache.evict(&self.proxy_path) {
+                println!("Failed to evict old proxies: {err}");
+            }
+            return false;
+        };
+
+        let rgb = self.video.get_proxy_rgb(frame);
+        if let Err(err) = self.writer.add_frame(frame, &rgb) {
+            println!("Proxy generation failed at frame {}: {err}", frame.0);
+            return false;
+        }
+
+        self.generated += 1;
+        if self.generated % REPORT_INTERVAL == 0 {
+            let frames_per_second =
+                f64::from(self.generated) / self.instant.elapsed().as_secs_f64();
+            println!(
+                "Proxy generation: {} of {} frames, {frames_per_second:.1} frames/s",
+                self.generated,
+                self.writer.dimensions().num_frames
+            );
+        }
+
+        true
+    }
+}
+
+/// Measures how long decoding one frame of the video at full size takes during playback, by
+/// decoding a few consecutive frames from its middle.
+fn measure_decode_time(video: &media::Video) -> Duration {
+    let first = (video.metadata.num_frames / 2)
+        .min(video.metadata.num_frames - SAMPLE_FRAMES)
+        .max(0);
+    let last = (first + SAMPLE_FRAMES).min(video.metadata.num_frames);
+
+    // Seeking to the first frame is not representative of playback
+    let _ = video.get_iced_frame(model::FrameNumber(first));
+
+    let instant = Instant::now();
+    for frame in (first + 1)..last {
+        let _ = video.get_iced_frame(model::FrameNumber(frame));
+    }
+    let decode_time = instant.elapsed() / u32::try_from(last - first - 1).unwrap_or(1).max(1);
+
+    println!("Decoding a frame at full size takes {decode_time:.2?}");
+    decode_time
+}
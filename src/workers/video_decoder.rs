@@ -1,4 +1,11 @@
-use std::{sync::Arc, thread};
+use std::{
+    collections::{HashMap, VecDeque},
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        Arc,
+    },
+    thread,
+};
 
 use crate::{media, message, model};
 
@@ -6,14 +13,23 @@ use crate::{media, message, model};
 pub enum MessageIn {
     PlaybackStep,
     LoadVideo(std::path::PathBuf),
-    TrackMotionForNode(
-        usize,
-        media::motion::Region,
-        model::FrameNumber,
-        model::FrameNumber,
-    ),
+    CancelLoad,
+    WarmFrames(model::FrameNumber, model::FrameNumber),
+    UseProxy(std::path::PathBuf, std::path::PathBuf),
 }
 
+/// Lower bound for how long to wait for the next frame during playback, to avoid spinning when
+/// the audio clock stalls.
+const MIN_FRAME_WAIT: std::time::Duration = std::time::Duration::from_millis(1);
+
+/// How often to check whether a video that is being loaded in the background has finished.
+const LOAD_POLL_INTERVAL: std::time::Duration = std::time::Duration::from_millis(20);
+
+/// How long the position has to stay the same while paused before a frame shown from the proxy is
+/// replaced by the full-resolution one. While scrubbing, the position changes faster than this, so
+/// only proxy frames are shown.
+const SETTLE_DELAY: std::time::Duration = std::time::Duration::from_millis(120);
+
 #[allow(clippy::too_many_lines)]
 pub fn spawn(
     tx_out: super::GlobalSender,
@@ -28,46 +44,151 @@ pub fn spawn(
         .spawn(move || {
             let mut video_opt: Option<media::Video> = None;
             let mut last_frame = model::FrameNumber(-1);
+            let mut frame_cache = FrameCache::default();
+            let mut pending_load: Option<PendingLoad> = None;
+            let mut video_path: Option<std::path::PathBuf> = None;
+            let mut proxy: Option<media::proxy::Reader> = None;
 
-            let mut node_index = 0;
-            let mut tracker_opt: Option<media::motion::Tracker<media::Video>> = None;
+            // When the frame currently shown was read from the proxy, if it was
+            let mut proxy_shown_at: Option<std::time::Instant> = None;
 
             loop {
-                // Check if there's something to motion track. If it is, try to get a message to
-                // see if there's something more important to do.
-                let maybe_message = if let Some(ref mut tracker) = tracker_opt {
-                    match rx_in.try_recv() {
-                        Ok(message) => Some(message),
-                        Err(std::sync::mpsc::TryRecvError::Empty) => {
-                            // No message was received — motion tracking time!
-                            let result = tracker.update(media::motion::Model::Translation);
-                            println!("{result:?}");
+                if let Some(load) = &pending_load {
+                    match load.result.try_recv() {
+                        Ok(Ok(mut video)) => {
+                            let path_buf = pending_load.take().unwrap().path_buf;
+                            let keyframes = load_keyframes(&path_buf, &video);
+                            video_path = Some(path_buf.clone());
+                            proxy = None;
+                            proxy_shown_at = None;
+                            let metadata_box = Box::new(video.metadata);
+                            if tx_out
+                                .unbounded_send(message::Message::VideoLoaded(
+                                    metadata_box,
+                                    path_buf,
+                                ))
+                                .is_err()
+                                || tx_out
+                                    .unbounded_send(message::Message::KeyframesAvailable(keyframes))
+                                    .is_err()
+                            {
+                                return;
+                            }
 
-                            match result {
-                                media::motion::TrackResult::Success => {
+                            // Show the first frame right away if that is where playback is,
+                            // without decoding it a second time
+                            frame_cache = FrameCache::default();
+                            last_frame = model::FrameNumber(-1);
+                            let first_frame = model::FrameNumber(0);
+                            if playback_position.current_frame(video.metadata.frame_rate)
+                                == first_frame
+                            {
+                                if let Some(handle) = video.take_poster() {
+                                    last_frame = first_frame;
                                     if tx_out
-                                        .unbounded_send(message::Message::Node(
-                                            node_index,
-                                            message::Node::MotionTrackUpdate(
-                                                tracker.last_tracked_frame(),
-                                                *tracker.track().last().unwrap(),
-                                            ),
+                                        .unbounded_send(message::Message::VideoFrameAvailable(
+                                            first_frame,
+                                            handle,
                                         ))
                                         .is_err()
                                     {
                                         return;
                                     }
                                 }
-                                media::motion::TrackResult::Failure
-                                | media::motion::TrackResult::Termination => tracker_opt = None,
                             }
+                            video_opt = Some(video);
+                        }
+                        Ok(Err(err)) => {
+                            pending_load = None;
 
-                            None
+                            // Display the error to the user as a toast
+                            if tx_out
+                                .unbounded_send(message::Message::VideoLoadProgress(None))
+                                .is_err()
+                                || tx_out
+                                    .unbounded_send(message::toast_danger(
+                                        "Failed to load video".to_owned(),
+                                        err.to_string(),
+                                    ))
+                                    .is_err()
+                            {
+                                return;
+                            }
+                        }
+                        Err(std::sync::mpsc::TryRecvError::Empty) => {}
+                        Err(std::sync::mpsc::TryRecvError::Disconnected) => {
+                            // The loader thread panicked
+                            pending_load = None;
+                            if tx_out
+                                .unbounded_send(message::Message::VideoLoadProgress(None))
+                                .is_err()
+                            {
+                                return;
+                            }
+                        }
+                    }
+                }
+
+                // Replace the proxy frame by the full-resolution one once the position has settled
+                if let Some(ref video) = video_opt {
+                    if proxy_shown_at.is_some_and(|shown_at| shown_at.elapsed() >= SETTLE_DELAY)
+                        && !playback_position.is_running()
+                    {
+                        proxy_shown_at = None;
+                        if tx_out
+                            .unbounded_send(message::Message::VideoFrameAvailable(
+                                last_frame,
+                                video.get_iced_frame(last_frame),
+                            ))
+                            .is_err()
+                        {
+                            return;
+                        }
+                    }
+                }
+
+                let maybe_message = if let Some(video) =
+                    video_opt.as_ref().filter(|_| frame_cache.is_warming())
+                {
+                    // Frames for a playback range are waiting to be decoded ahead of time. Do so
+                    // one at a time, as long as nothing else is to be done.
+                    match rx_in.try_recv() {
+                        Ok(message) => Some(message),
+                        Err(std::sync::mpsc::TryRecvError::Empty) => {
+                            frame_cache.warm_next(video);
+                            Some(MessageIn::PlaybackStep)
                         }
                         Err(_) => return,
                     }
+                } else if let Some(timeout) = video_opt.as_ref().and_then(|video| {
+                    playback_position.duration_until_next_frame(video.metadata.frame_rate)
+                }) {
+                    // Playback is running. Audio callbacks do not necessarily coincide with
+                    // frame boundaries, so wake up by ourselves once the next frame is due.
+                    match rx_in.recv_timeout(timeout.max(MIN_FRAME_WAIT)) {
+                        Ok(message) => Some(message),
+                        Err(std::sync::mpsc::RecvTimeoutError::Timeout) => {
+                            Some(MessageIn::PlaybackStep)
+                        }
+                        Err(std::sync::mpsc::RecvTimeoutError::Disconnected) => return,
+                    }
+                } else if let Some(timeout) = [
+                    proxy_shown_at.map(|shown_at| SETTLE_DELAY.saturating_sub(shown_at.elapsed())),
+                    pending_load.as_ref().map(|_| LOAD_POLL_INTERVAL),
+                ]
+                .into_iter()
+                .flatten()
+                .min()
+                {
+                    // A proxy frame is to be replaced soon, or a video is being loaded in the
+                    // background, so check back in time
+                    match rx_in.recv_timeout(timeout) {
+                        Ok(message) => Some(message),
+                        Err(std::sync::mpsc::RecvTimeoutError::Timeout) => None,
+                        Err(std::sync::mpsc::RecvTimeoutError::Disconnected) => return,
+                    }
                 } else {
-                    // There's nothing to motion track, so wait for the next message
+                    // There's nothing to do ahead of time, so wait for the next message
                     match rx_in.recv() {
                         Ok(message) => Some(message),
                         Err(_) => return,
@@ -87,7 +208,22 @@ pub fn spawn(
                                     playback_position.current_frame(video.metadata.frame_rate);
                                 if new_frame != last_frame {
                                     last_frame = new_frame;
-                                    let handle = video.get_iced_frame(new_frame);
+
+                                    // Frames decoded ahead of time are best. Otherwise, the
+                                    // proxy is much faster to seek in than the video itself
+                                    let cached = frame_cache.get(new_frame);
+                                    let proxy_handle = if cached.is_none() {
+                                        proxy
+                                            .as_mut()
+                                            .and_then(|reader| read_proxy(reader, new_frame))
+                                    } else {
+                                        None
+                                    };
+                                    proxy_shown_at =
+                                        proxy_handle.is_some().then(std::time::Instant::now);
+                                    let handle = cached
+                                        .or(proxy_handle)
+                                        .unwrap_or_else(|| video.get_iced_frame(new_frame));
                                     if tx_out
                                         .unbounded_send(message::Message::VideoFrameAvailable(
                                             new_frame, handle,
@@ -100,49 +236,31 @@ pub fn spawn(
                             }
                         }
                         self::MessageIn::LoadVideo(path_buf) => {
-                            // Load new video
-                            match media::Video::load(path_buf) {
-                                Ok(video) => {
-                                    let metadata_box = Box::new(video.metadata);
-                                    if tx_out
-                                        .unbounded_send(message::Message::VideoLoaded(metadata_box))
-                                        .is_err()
-                                    {
-                                        return;
-                                    }
-                                    tracker_opt = None;
-                                    video_opt = Some(video);
-                                }
-                                Err(err) => {
-                                    // Display the error to the user as a toast
-                                    if tx_out
-                                        .unbounded_send(message::toast_danger(
-                                            "Failed to load video".to_owned(),
-                                            err.to_string(),
-                                        ))
-                                        .is_err()
-                                    {
-                                        return;
-                                    }
+                            // Load the new video on its own thread, so that the current one can
+                            // still be played while the new one is being indexed. A load that
+                            // is still running is superseded by the new one
+                            if let Some(load) = pending_load.take() {
+                                load.cancel();
+                            }
+                            pending_load = Some(PendingLoad::spawn(path_buf, tx_out.clone()));
+                        }
+                        self::MessageIn::CancelLoad => {
+                            if let Some(load) = pending_load.take() {
+                                load.cancel();
+                            }
+                        }
+                        self::MessageIn::UseProxy(source_path, proxy_path) => {
+                            // The proxy might be for a video that has been replaced since
+                            if video_path.as_ref() == Some(&source_path) {
+                                match media::proxy::Reader::open(&proxy_path) {
+                                    Ok(reader) => proxy = Some(reader),
+                                    Err(err) => println!("Failed to open proxy: {err}"),
                                 }
                             }
                         }
-                        self::MessageIn::TrackMotionForNode(
-                            new_node_index,
-                            initial_region,
-                            start_frame,
-                            end_frame,
-                        ) => {
+                        self::MessageIn::WarmFrames(start_frame, end_frame) => {
                             if let Some(ref video) = video_opt {
-                                node_index = new_node_index;
-                                tracker_opt = Some(media::motion::Tracker::new(
-                                    video,
-                                    media::Video::get_libmv_patch,
-                                    initial_region,
-                                    60.0,
-                                    start_frame,
-                                    end_frame,
-                                ));
+                                frame_cache.warm(start_frame, end_frame, &video.metadata);
                             }
                         }
                     }
@@ -157,3 +275,159 @@ pub fn spawn(
         message_in: tx_in,
     }
 }
+
+/// Reads the keyframes from the video's keyframe file, if there is one, and otherwise takes the
+/// codec keyframes from the index.
+fn load_keyframes(path: &std::path::Path, video: &media::Video) -> model::keyframes::Keyframes {
+    let keyframes_path = model::keyframes::path_for(path);
+    let Ok(text) = std::fs::read_to_string(&keyframes_path) else {
+        return video.keyframes.clone();
+    };
+
+    match model::keyframes::Keyframes::parse_v1(&text) {
+        Ok(keyframes) => keyframes,
+        Err(err) => {
+            println!("Ignoring {}: {err}", keyframes_path.display());
+            video.keyframes.clone()
+        }
+    }
+}
+
+/// Reads a frame from the proxy. Returns `None` if it has not been generated yet, or cannot be
+/// read, in which case it is decoded from the video instead.
+fn read_proxy(
+    reader: &mut media::proxy::Reader,
+    frame: model::FrameNumber,
+) -> Option<iced::widget::image::Handle> {
+    let instant = std::time::Instant::now();
+    match reader.read_iced_frame(frame) {
+        Ok(handle) => {
+            if handle.is_some() {
+                println!(
+                    "Frame profiling [proxy]: reading frame {frame:?} took {:.2?}",
+                    instant.elapsed()
+                );
+            }
+            handle
+        }
+        Err(err) => {
+            println!("Failed to read frame {frame:?} from proxy: {err}");
+            None
+        }
+    }
+}
+
+/// A video being loaded on a thread of its own.
+struct PendingLoad {
+    path_buf: std::path::PathBuf,
+    result: std::sync::mpsc::Receiver<Result<media::Video, media::VideoLoadError>>,
+    cancelled: Arc<AtomicBool>,
+}
+
+impl PendingLoad {
+    fn spawn(path_buf: std::path::PathBuf, tx_out: super::GlobalSender) -> Self {
+        let (tx_result, rx_result) = std::sync::mpsc::channel();
+        let cancelled = Arc::new(AtomicBool::new(false));
+
+        let thread_path_buf = path_buf.clone();
+        let preview_path_buf = path_buf.clone();
+        let thread_cancelled = Arc::clone(&cancelled);
+        thread::Builder::new()
+            .name("samaku_video_loader".to_owned())
+            .spawn(move || {
+                let result = media::Video::load_with_progress(
+                    thread_path_buf,
+                    &media::IndexCache::for_user(),
+                    |stage| {
+                        // Indexing itself cannot be interrupted, so a cancelled load only stops
+                        // once it reaches the next stage. The index is kept for next time.
+                        if thread_cancelled.load(Ordering::Relaxed)
+                            || tx_out
+                                .unbounded_send(message::Message::VideoLoadProgress(Some(stage)))
+                                .is_err()
+                        {
+                            return false;
+                        }
+
+                        // Some containers can be decoded without an index, so their first frame
+                        // can be shown while indexing is still going on
+                        if stage == media::VideoLoadStage::Indexing {
+                            if let Some(handle) = media::Video::preview(&preview_path_buf) {
+                                return tx_out
+                                    .unbounded_send(message::Message::VideoPreviewAvailable(handle))
+                                    .is_ok();
+                            }
+                        }
+
+                        true
+                    },
+                );
+
+                // Nobody is waiting for the result anymore if the load was cancelled
+                let _ = tx_result.send(result);
+            })
+            .unwrap();
+
+        Self {
+            path_buf,
+            result: rx_result,
+            cancelled,
+        }
+    }
+
+    fn cancel(self) {
+        self.cancelled.store(true, Ordering::Relaxed);
+    }
+}
+
+/// Frames of a playback range that have been decoded ahead of time, so that looping over the range
+/// does not require decoding them again on every repetition.
+#[derive(Default)]
+struct FrameCache {
+    frames: HashMap<model::FrameNumber, iced::widget::image::Handle>,
+    pending: VecDeque<model::FrameNumber>,
+}
+
+impl FrameCache {
+    /// Upper bound for the memory used by cached frames. Frames after the range's first ones that
+    /// do not fit are decoded on demand as usual.
+    const BUDGET_BYTES: usize = 512 * 1024 * 1024;
+
+    /// Discards cached frames outside the given range, and schedules the ones within it that
+    /// have not been decoded yet.
+    fn warm(
+        &mut self,
+        start_frame: model::FrameNumber,
+        end_frame: model::FrameNumber,
+        metadata: &media::VideoMetadata,
+    ) {
+        let frame_bytes = usize::try_from(metadata.width).unwrap_or(0)
+            * usize::try_from(metadata.height).unwrap_or(0)
+            * 4;
+        let max_frames = i32::try_from(Self::BUDGET_BYTES / frame_bytes.max(1)).unwrap_or(i32::MAX);
+        let range = start_frame.0.max(0)
+            ..=end_frame
+                .0
+                .min(start_frame.0.saturating_add(max_frames - 1));
+
+        self.frames.retain(|frame, _| range.contains(&frame.0));
+        self.pending = range
+            .map(model::FrameNumber)
+            .filter(|frame| !self.frames.contains_key(frame))
+            .collect();
+    }
+
+    fn is_warming(&self) -> bool {
+        !self.pending.is_empty()
+    }
+
+    fn warm_next(&mut self, video: &media::Video) {
+        if let Some(frame) = self.pending.pop_front() {
+            self.frames.insert(frame, video.get_iced_frame(frame));
+        }
+    }
+
+    fn get(&self, frame: model::FrameNumber) -> Option<iced::widget::image::Handle> {
+        self.frames.get(&frame).cloned()
+    }
+}
@@ -0,0 +1,274 @@
+//! Measures how well the audio playback path keeps up, by running the playback callback from a
+//! simulated audio device in real time, without needing any audio hardware. Seeks are injected at
+//! regular intervals. For each device configuration, the distribution of callback execution
+//! times, the number of underruns, and the time from a seek to the new position becoming audible
+//! are reported.
+//!
+//! A/V sync is measured as well: twice per buffer, the frame that the video decoder would present
+//! according to the playback clock is compared with the audio that the simulated device is
+//! actually outputting at that time. A frame is in sync if the audio being heard lies within it.
+//!
+//! As the measurement takes a while and its results depend on the machine, it is ignored by default
+//! and has to be run using `cargo test --release --test playback_latency -- --ignored`. The buffer
+//! sizes to test can be overridden by setting `SAMAKU_PLAYBACK_BUFFER_SIZES` to a comma-separated
+//! list of frame counts. Only the deterministic behaviour of a seek is checked by default.
+
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant};
+
+use samaku::{media, model, workers};
+
+const MUSIC_FILE: &str = concat!(env!("CARGO_MANIFEST_DIR"), "/test_files/music.mp3");
+
+/// How long to play for each configuration.
+const RUN_DURATION: Duration = Duration::from_secs(3);
+
+const SEEK_INTERVAL: Duration = Duration::from_millis(500);
+
+/// Positions to seek to in turn, in milliseconds.
+const SEEK_TARGETS: [i64; 3] = [2000, 6000, 4000];
+
+/// Output latency reported by the simulated device.
+const LATENCY: Duration = Duration::from_millis(20);
+
+/// Upper bound for the time from a seek to the new position being heard.
+const MAX_SEEK_LATENCY: Duration = Duration::from_millis(250);
+
+/// How long to wait for audio to be decoded before giving up.
+const DECODE_TIMEOUT: Duration = Duration::from_secs(10);
+
+/// Frame rate of the simulated video, for measuring A/V sync.
+const FRAME_RATE: media::FrameRate = media::FrameRate {
+    numerator: 24000,
+    denominator: 1001,
+};
+
+struct Report {
+    callback_times: Vec<Duration>,
+    underruns: usize,
+    seek_latencies: Vec<Duration>,
+
+    /// Offsets between the audio being heard and the start of the frame presented at that time,
+    /// in seconds.
+    av_offsets: Vec<f64>,
+}
+
+/// A buffer of audio that the simulated device outputs, starting at `start`.
+struct Output {
+    start: Instant,
+    position: u64,
+    frames: usize,
+}
+
+/// Returns the position that the simulated device outputs at the given time, based on the buffers
+/// it has been handed, or `None` if it outputs silence.
+#[allow(clippy::cast_possible_truncation, clippy::cast_sign_loss)]
+fn heard_position(outputs: &[Output], time: Instant, rate: u32) -> Option<u64> {
+    let output = outputs.iter().rev().find(|output| output.start <= time)?;
+    let elapsed = (time - output.start).as_secs_f64() * f64::from(rate);
+    ((elapsed as usize) < output.frames).then(|| output.position + elapsed as u64)
+}
+
+/// Returns the offset between the audio heard at `time` and the start of the frame that the video
+/// decoder would present at that time.
+#[allow(clippy::cast_precision_loss)]
+fn av_offset(
+    playback_position: &model::playback::Position,
+    outputs: &[Output],
+    time: Instant,
+    rate: u32,
+) -> Option<f64> {
+    let heard = heard_position(outputs, time, rate)?;
+    let presented = u128::from(playback_position.extrapolated_position_at(time))
+        * u128::from(FRAME_RATE.numerator)
+        / (u128::from(FRAME_RATE.denominator) * u128::from(rate));
+    let frame_start = presented as f64 / f64::from(FRAME_RATE);
+
+    Some(heard as f64 / f64::from(rate) - frame_start)
+}
+
+fn run(buffer_frames: usize, rate: u32) -> Report {
+    let audio = Arc::new(Mutex::new(Some(media::Audio::load(MUSIC_FILE))));
+    let playback_position = Arc::new(model::playback::Position::default());
+    let mut sink = workers::VirtualSink::new(&audio, &playback_position, 2, rate, LATENCY).unwrap();
+
+    let buffer_duration =
+        Duration::from_nanos(buffer_frames as u64 * 1_000_000_000 / u64::from(rate));
+    let mut data = vec![0.0; buffer_frames * 2];
+
+    let mut report = Report {
+        callback_times: vec![],
+        underruns: 0,
+        seek_latencies: vec![],
+        av_offsets: vec![],
+    };
+    let mut outputs: Vec<Output> = vec![];
+
+    let start = Instant::now();
+    let mut deadline = start;
+    let mut next_seek = start + SEEK_INTERVAL;
+    let mut seeks = SEEK_TARGETS.iter().cycle();
+    let mut pending_seek: Option<Instant> = None;
+    let mut started = false;
+
+    while deadline < start + RUN_DURATION {
+        // Wait until the simulated device asks for the next buffer
+        std::thread::sleep(deadline.saturating_duration_since(Instant::now()));
+
+        if Instant::now() >= next_seek {
+            let target = playback_position.ticks_from_ms(*seeks.next().unwrap());
+            playback_position.seek_to(target);
+            pending_seek = Some(Instant::now());
+            next_seek += SEEK_INTERVAL;
+        }
+
+        let time = Instant::now();
+        let position = playback_position.position();
+        let frames = sink.render(&mut data, time);
+        report.callback_times.push(time.elapsed());
+        outputs.push(Output {
+            start: time + LATENCY,
+            position,
+            frames,
+        });
+
+        if let Some(seek_time) = pending_seek {
+            if frames > 0 {
+                report.seek_latencies.push(time + LATENCY - seek_time);
+                pending_seek = None;
+            }
+        } else if started && frames < buffer_frames {
+            report.underruns += 1;
+        }
+        started |= frames > 0;
+
+        // Right after a seek, the old position is still being heard on purpose
+        if pending_seek.is_none() {
+            for sample_time in [time, time + buffer_duration / 2] {
+                report.av_offsets.extend(av_offset(
+                    &playback_position,
+                    &outputs,
+                    sample_time,
+                    rate,
+                ));
+            }
+        }
+
+        deadline += buffer_duration;
+    }
+
+    report
+}
+
+fn percentile(sorted: &[Duration], percent: usize) -> Duration {
+    sorted
+        .get((sorted.len() * percent / 100).min(sorted.len().saturating_sub(1)))
+        .copied()
+        .unwrap_or_default()
+}
+
+fn buffer_sizes() -> Vec<usize> {
+    std::env::var("SAMAKU_PLAYBACK_BUFFER_SIZES").map_or_else(
+        |_| vec![256, 1024, 4096],
+        |sizes| {
+            sizes
+                .split(',')
+                .map(|size| size.trim().parse().unwrap())
+                .collect()
+        },
+    )
+}
+
+#[test]
+fn seek_becomes_audible() {
+    const RATE: u32 = 44100;
+    const BUFFER_FRAMES: usize = 1024;
+
+    let audio = Arc::new(Mutex::new(Some(media::Audio::load(MUSIC_FILE))));
+    let playback_position = Arc::new(model::playback::Position::default());
+    let mut sink = workers::VirtualSink::new(&audio, &playback_position, 2, RATE, LATENCY).unwrap();
+    let mut data = vec![0.0; BUFFER_FRAMES * 2];
+
+    let target = playback_position.ticks_from_ms(SEEK_TARGETS[0]);
+    playback_position.seek_to(target);
+
+    // Until the audio at the new position has been decoded, the device outputs silence and the
+    // position stays where it is
+    let start = Instant::now();
+    let frames = loop {
+        let frames = sink.render(&mut data, Instant::now());
+        if frames > 0 {
+            break frames;
+        }
+        assert_eq!(playback_position.position(), target);
+        assert!(data.iter().all(|sample| *sample == 0.0));
+        assert!(
+            start.elapsed() < DECODE_TIMEOUT,
+            "seek never became audible"
+        );
+        std::thread::sleep(Duration::from_millis(1));
+    };
+
+    assert!(frames <= BUFFER_FRAMES);
+    assert_eq!(playback_position.position(), target + frames as u64);
+    assert!(data[..frames * 2].iter().any(|sample| *sample != 0.0));
+}
+
+#[test]
+#[ignore = "runs in real time for several seconds, see the module documentation"]
+fn playback_latency() {
+    // The test file is 44.1 kHz, so the second rate exercises resampling
+    for rate in [44100, 48000] {
+        for buffer_frames in buffer_sizes() {
+            let mut report = run(buffer_frames, rate);
+            report.callback_times.sort();
+            report.seek_latencies.sort();
+
+            let frame_duration = 1.0 / f64::from(FRAME_RATE);
+            let out_of_sync = report
+                .av_offsets
+                .iter()
+                .filter(|offset| !(0.0..frame_duration).contains(*offset))
+                .count();
+            let max_offset = report
+                .av_offsets
+                .iter()
+                .fold(0.0_f64, |max, offset| max.max(offset.abs()));
+
+            println!(
+                "{rate} Hz, {buffer_frames} frames: {} callbacks, execution time p50 {:.1?} / p99 {:.1?} / max {:.1?}, {} underruns, seek latency p50 {:.1?} / max {:.1?}",
+                report.callback_times.len(),
+                percentile(&report.callback_times, 50),
+                percentile(&report.callback_times, 99),
+                report.callback_times.last().copied().unwrap_or_default(),
+                report.underruns,
+                percentile(&report.seek_latencies, 50),
+                report.seek_latencies.last().copied().unwrap_or_default(),
+            );
+            println!(
+                "    A/V sync: {} of {} presented frames out of sync, max offset {:.1} ms",
+                out_of_sync,
+                report.av_offsets.len(),
+                max_offset * 1000.0
+            );
+
+            assert!(
+                !report.seek_latencies.is_empty(),
+                "no seek ever became audible"
+            );
+
+            // Unoptimised builds are too slow to convert audio in real time reliably, so only
+            // report there
+            if !cfg!(debug_assertions) {
+                assert_eq!(report.underruns, 0, "playback underran");
+                assert!(
+                    report
+                        .seek_latencies
+                        .iter()
+                        .all(|latency| *latency <= MAX_SEEK_LATENCY),
+                    "seeking took too long to become audible"
+                );
+            }
+        }
+    }
+}
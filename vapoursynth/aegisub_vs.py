@@ -141,21 +141,23 @@ def info_from_lwindex(indexfile: str) -> Dict[str, List[int]]:
     }
 
 
-def wrap_lwlibavsource(filename: str, cachedir: str | None = None, **kwargs: Any) -> Tuple[vs.VideoNode, Dict[str, List[int]]]:
+def wrap_lwlibavsource(filename: str, cachedir: str | None = None, cachefile: str | None = None, **kwargs: Any) -> Tuple[vs.VideoNode, Dict[str, List[int]]]:
     """
     Given a path to a video file and a directory to store index files in
     (usually __aegi_vscache), will open the video with LWLibavSource and read
     the generated .lwi file to obtain the timecodes and keyframes.
+    If `cachefile` is given, the index is stored in that file instead.
     Additional keyword arguments are passed on to LWLibavSource.
     """
-    if cachedir is None:
-        cachedir = aegi_vscache
+    if cachefile is None:
+        if cachedir is None:
+            cachedir = aegi_vscache
 
-    try:
-        os.mkdir(cachedir)
-    except FileExistsError:
-        pass
-    cachefile = os.path.join(cachedir, make_lwi_cache_filename(filename))
+        try:
+            os.mkdir(cachedir)
+        except FileExistsError:
+            pass
+        cachefile = os.path.join(cachedir, make_lwi_cache_filename(filename))
 
     ensure_plugin("lsmas", "libvslsmashsource", "To use Aegisub's LWLibavSource wrapper, the `lsmas` plugin for VapourSynth must be installed")
 